@@ -763,10 +763,10 @@ Arch_UpdateMTime(GNode *gn)
 void
 Arch_UpdateMemberMTime(GNode *gn)
 {
-	GNodeListNode *ln;
+	size_t i;
 
-	for (ln = gn->parents.first; ln != NULL; ln = ln->next) {
-		GNode *pgn = ln->datum;
+	for (i = 0; i < gn->parents.len; i++) {
+		GNode *pgn = GNodeVec_Get(&gn->parents, i);
 
 		if (pgn->type & OP_ARCHV) {
 			/*
@@ -853,9 +853,9 @@ Arch_LibOODate(GNode *gn)
 
 	if (gn->type & OP_PHONY)
 		return true;
-	if (!GNode_IsTarget(gn) && Lst_IsEmpty(&gn->children))
+	if (!GNode_IsTarget(gn) && GNodeVec_IsEmpty(&gn->children))
 		return false;
-	if ((!Lst_IsEmpty(&gn->children) && gn->youngestChild == NULL) ||
+	if ((!GNodeVec_IsEmpty(&gn->children) && gn->youngestChild == NULL) ||
 		   (gn->mtime > now) ||
 		   (gn->youngestChild != NULL &&
 			gn->mtime < gn->youngestChild->mtime))
@@ -0,0 +1,55 @@
+/* Generator for a makefile with a large dependency graph */
+
+/*
+ * Usage: graph-gen [edges [fanout]]
+ *
+ * Writes a makefile to stdout with the given number of dependencies,
+ * 1000000 by default.  Each target depends on the previous target and on
+ * fanout - 1 other targets that come before it, 10 by default.  The
+ * targets have no commands, so running make on the result measures how
+ * fast the dependency graph is built and walked:
+ *
+ *	graph-gen 1000000 >graph.mk
+ *	bmake -f graph.mk -du
+ *
+ * The same seed is used every time, so the output only depends on the
+ * arguments.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static unsigned long seed = 1;
+
+/* Return a pseudo-random number below n. */
+static unsigned long
+Random(unsigned long n)
+{
+	seed = seed * 1103515245UL + 12345UL;
+	return (seed / 65536UL) % n;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned long edges = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	unsigned long fanout = argc > 2 ? strtoul(argv[2], NULL, 10) : 10;
+	unsigned long targets, i, j;
+
+	if (fanout == 0 || edges < fanout) {
+		fprintf(stderr, "usage: graph-gen [edges [fanout]]\n");
+		return 2;
+	}
+	targets = edges / fanout + 1;
+
+	printf("# %lu targets, %lu dependencies\n\n", targets, edges);
+	printf("all: t%lu\n\n", targets - 1);
+	printf("t0:\n");
+	for (i = 1; i < targets; i++) {
+		printf("t%lu: t%lu", i, i - 1);
+		for (j = 1; j < fanout; j++)
+			printf(" t%lu", Random(i));
+		printf("\n");
+	}
+	return 0;
+}
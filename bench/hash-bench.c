@@ -0,0 +1,138 @@
+/* Micro-benchmark for the hash tables in hash.c */
+
+/*
+ * Measures inserting, finding, not finding and iterating over tables of
+ * 1e3 to 1e6 entries, with keys that look like the paths and variable
+ * names that make uses.  Build it once as is and once with HASH_CHAINED
+ * to compare the two implementations, see the Makefile.
+ *
+ * With -v, the statistics of each table are printed as with -dh.
+ */
+
+#include <time.h>
+
+#include "make.h"
+
+/* Normally provided by main.c and make.c. */
+CmdOpts opts;
+const char *progname = "hash-bench";
+
+void
+debug_printf(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(opts.debug_file, fmt, ap);
+	va_end(ap);
+}
+
+/* Each measurement covers at least this many operations. */
+#define MIN_OPS 2000000
+
+static char **
+MakeKeys(unsigned int n, const char *prefix)
+{
+	char **keys = bmake_malloc(sizeof *keys * n);
+	char buf[64];
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		snprintf(buf, sizeof buf, "%s/dir%u/file%u.c",
+		    prefix, i % 97, i);
+		keys[i] = bmake_strdup(buf);
+	}
+	return keys;
+}
+
+static void
+FreeKeys(char **keys, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		free(keys[i]);
+	free(keys);
+}
+
+static double
+NsPerOp(clock_t start, unsigned long ops)
+{
+	return (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / (double)ops;
+}
+
+static void
+Bench(unsigned int n)
+{
+	char **keys = MakeKeys(n, "src");
+	char **missing = MakeKeys(n, "obj");
+	unsigned int rounds = n >= MIN_OPS ? 1 : MIN_OPS / n;
+	unsigned int i, r;
+	unsigned long found = 0;
+	double insert, find, miss, iter;
+	HashTable t;
+	HashIter hi;
+	clock_t start;
+
+	start = clock();
+	for (r = 0; r < rounds; r++) {
+		HashTable_Init(&t);
+		for (i = 0; i < n; i++)
+			HashTable_Set(&t, keys[i], keys[i]);
+		if (r + 1 < rounds)
+			HashTable_Done(&t);
+	}
+	insert = NsPerOp(start, (unsigned long)rounds * n);
+
+	start = clock();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < n; i++)
+			if (HashTable_FindValue(&t, keys[i]) == keys[i])
+				found++;
+	find = NsPerOp(start, (unsigned long)rounds * n);
+
+	start = clock();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < n; i++)
+			if (HashTable_FindValue(&t, missing[i]) != NULL)
+				found++;
+	miss = NsPerOp(start, (unsigned long)rounds * n);
+
+	start = clock();
+	for (r = 0; r < rounds; r++) {
+		HashIter_Init(&hi, &t);
+		while (HashIter_Next(&hi))
+			found++;
+	}
+	iter = NsPerOp(start, (unsigned long)rounds * n);
+
+	if (found != 2UL * rounds * n) {
+		fprintf(stderr, "%s: wrong results for %u entries\n",
+		    progname, n);
+		exit(1);
+	}
+
+	printf("%8u %10.1f %10.1f %10.1f %10.1f\n",
+	    n, insert, find, miss, iter);
+	HashTable_DebugStats(&t, "bench");
+
+	HashTable_Done(&t);
+	FreeKeys(keys, n);
+	FreeKeys(missing, n);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int n;
+
+	opts.debug_file = stdout;
+	if (argc > 1 && strcmp(argv[1], "-v") == 0)
+		opts.debug.DEBUG_HASH = true;
+
+	printf("%8s %10s %10s %10s %10s   (ns per entry)\n",
+	    "entries", "insert", "find", "find-miss", "iterate");
+	for (n = 1000; n <= 1000000; n *= 10)
+		Bench(n);
+	return 0;
+}
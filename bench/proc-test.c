@@ -0,0 +1,256 @@
+/* Smoke test for the POSIX process backend in proc_posix.c */
+
+/*
+ * Runs children through the Proc interface the way the job module does:
+ * with and without the shell, with an environment block, with more output
+ * than fits in a pipe, and many at the same time, all collected through
+ * Proc_WaitForEvent.  It also passes a token through the token pipe, and
+ * checks that PROC_SUSPENDED, which proc_posix.c does not support, fails.
+ *
+ * proc_posix.c depends only on proc.h and the C library, so this builds
+ * on any POSIX system without the rest of make:
+ *
+ *	cc -I.. -o proc-test proc-test.c ../proc_posix.c
+ *	./proc-test
+ *
+ * Each check prints a line; the exit status is 1 if any check failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "proc.h"
+
+#define NUM_PARALLEL 64
+
+/* A child whose output is collected into a growing buffer. */
+typedef struct Child {
+	Proc proc;
+	ProcPipe pipe;
+	bool exited;
+	bool eof;
+	ProcStatus status;
+	char chunk[4096];
+	char *out;
+	size_t outLen;
+} Child;
+
+static int failures = 0;
+
+static void
+Check(bool ok, const char *what)
+{
+	printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+	if (!ok)
+		failures++;
+}
+
+static void
+Child_Read(Child *ch, bool finish)
+{
+	size_t nr;
+	ProcResult res;
+
+	while (!ch->eof &&
+	       (res = ProcPipe_ReadResult(&ch->pipe, finish, &nr)) != PROC_AGAIN) {
+		if (res == PROC_ERROR || nr == 0) {
+			ch->eof = true;
+			break;
+		}
+		ch->out = realloc(ch->out, ch->outLen + nr + 1);
+		memcpy(ch->out + ch->outLen, ch->chunk, nr);
+		ch->outLen += nr;
+		ch->out[ch->outLen] = '\0';
+		if (!ProcPipe_StartRead(&ch->pipe, ch->chunk, sizeof ch->chunk))
+			ch->eof = true;
+	}
+}
+
+/* Collect what the child has done so far; return whether it is done. */
+static bool
+Child_Poll(Child *ch)
+{
+	if (ch->exited)
+		return true;
+
+	Child_Read(ch, false);
+	if (Proc_Wait(&ch->proc, false, &ch->status) != PROC_DONE)
+		return false;
+
+	ch->exited = true;
+	Child_Read(ch, true);
+	Proc_Close(&ch->proc);
+	ProcPipe_Close(&ch->pipe);
+	return true;
+}
+
+static bool
+Child_Start(Child *ch, const char *program, const char *cmd, const char *env,
+	    bool direct)
+{
+	bool ok;
+
+	memset(ch, 0, sizeof *ch);
+	if (!ProcPipe_Open(&ch->pipe))
+		return false;
+	if (direct)
+		ok = Proc_SpawnDirect(&ch->proc, program, cmd, env, &ch->pipe,
+		    PROC_STDOUT);
+	else
+		ok = Proc_Spawn(&ch->proc, program, "-c", cmd, env, &ch->pipe,
+		    PROC_STDOUT);
+	if (!ok) {
+		ProcPipe_Close(&ch->pipe);
+		return false;
+	}
+	return ProcPipe_StartRead(&ch->pipe, ch->chunk, sizeof ch->chunk);
+}
+
+/* Wait until all children are done, looking at them before each wait. */
+static void
+Children_Finish(Child *children, size_t n)
+{
+	size_t i;
+	bool running;
+
+	for (;;) {
+		running = false;
+		for (i = 0; i < n; i++)
+			if (!Child_Poll(children + i))
+				running = true;
+		if (!running)
+			break;
+		if (Proc_WaitForEvent(-1) == PROC_ERROR) {
+			printf("Proc_WaitForEvent: %s\n", Proc_Error());
+			exit(1);
+		}
+	}
+}
+
+/* Run a single command and check its output and exit status. */
+static void
+TestRun(const char *what, const char *program, const char *cmd,
+	const char *env, bool direct, const char *expOut, ProcStatus expStatus)
+{
+	Child ch;
+
+	if (!Child_Start(&ch, program, cmd, env, direct)) {
+		printf("%s: %s\n", what, Proc_Error());
+		Check(false, what);
+		return;
+	}
+	Children_Finish(&ch, 1);
+	Check(ch.status == expStatus &&
+	      strcmp(ch.out != NULL ? ch.out : "", expOut) == 0, what);
+	free(ch.out);
+}
+
+/* Starting a child suspended is not supported and must fail. */
+static void
+TestSuspended(void)
+{
+	ProcPipe pp;
+	Proc proc;
+	bool ok;
+
+	if (!ProcPipe_Open(&pp)) {
+		Check(false, "suspended");
+		return;
+	}
+	ok = !Proc_Spawn(&proc, "/bin/sh", "-c", "echo unexpected", NULL, &pp,
+	    PROC_STDOUT | PROC_SUSPENDED);
+	ProcPipe_Close(&pp);
+	Check(ok, "suspended is refused");
+}
+
+static void
+TestLargeOutput(void)
+{
+	Child ch;
+	size_t i;
+	bool ok;
+
+	/* Far more than fits in a pipe, so the child blocks until read. */
+	ok = Child_Start(&ch, "/bin/sh",
+	    "i=0; while [ $i -lt 20000 ]; do echo 0123456789; i=$((i+1)); done",
+	    NULL, false);
+	if (ok)
+		Children_Finish(&ch, 1);
+	ok = ok && ch.status == 0 && ch.outLen == 20000 * 11;
+	for (i = 0; ok && i < ch.outLen; i += 11)
+		ok = memcmp(ch.out + i, "0123456789\n", 11) == 0;
+	Check(ok, "large output");
+	free(ch.out);
+}
+
+static void
+TestParallel(void)
+{
+	static Child children[NUM_PARALLEL];
+	char cmd[64], exp[16];
+	size_t i;
+	bool ok = true;
+
+	for (i = 0; i < NUM_PARALLEL; i++) {
+		snprintf(cmd, sizeof cmd, "sleep 0.%02u; echo %u; exit %u",
+		    (unsigned)(i % 7), (unsigned)i, (unsigned)(i % 3));
+		if (!Child_Start(children + i, "/bin/sh", cmd, NULL, false)) {
+			printf("parallel: %s\n", Proc_Error());
+			exit(1);
+		}
+	}
+	Children_Finish(children, NUM_PARALLEL);
+
+	for (i = 0; i < NUM_PARALLEL; i++) {
+		snprintf(exp, sizeof exp, "%u\n", (unsigned)i);
+		if (children[i].status != i % 3 || children[i].out == NULL ||
+		    strcmp(children[i].out, exp) != 0)
+			ok = false;
+		free(children[i].out);
+	}
+	Check(ok, "parallel children");
+}
+
+static void
+TestTokens(void)
+{
+	ProcPipe tokens, parsed;
+	char buf[64], tok = '\0';
+	bool ok;
+
+	ok = ProcPipe_OpenTokens(&tokens) &&
+	     ProcPipe_TryReadToken(&tokens, &tok) == PROC_AGAIN &&
+	     ProcPipe_WriteToken(&tokens, '+');
+	ProcPipe_Format(&tokens, buf, sizeof buf);
+	ok = ok && ProcPipe_Parse(&parsed, buf) &&
+	     ProcPipe_TryReadToken(&parsed, &tok) == PROC_DONE && tok == '+' &&
+	     ProcPipe_TryReadToken(&parsed, &tok) == PROC_AGAIN &&
+	     !ProcPipe_Parse(&parsed, "12345,12346");
+	Check(ok, "token pipe");
+}
+
+int
+main(void)
+{
+	if (!Proc_Init()) {
+		printf("Proc_Init: %s\n", Proc_Error());
+		return 1;
+	}
+
+	TestRun("shell", "/bin/sh", "echo hello; exit 3", NULL, false,
+	    "hello\n", 3);
+	TestRun("environment block", "/bin/sh", "echo \"$A,$B\"",
+	    "A=1\0B=two\0", false, "1,two\n", 0);
+	TestRun("without the shell", "/bin/echo", "echo  a\tb c", NULL, true,
+	    "a b c\n", 0);
+	TestRun("killed by a signal", "/bin/sh", "kill -9 $$", NULL, false,
+	    "", 128 + 9);
+	TestSuspended();
+	TestLargeOutput();
+	TestParallel();
+	TestTokens();
+
+	Proc_End();
+	return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+/* Micro-benchmark for the :C modifier, using the regular expressions of TRE */
+
+/*
+ * Usage: regex-bench [words]
+ *
+ * Matches each pattern against a list of words, 100000 by default, the way
+ * ModifyWord_SubstRegex in var.c does for ${WORDS:C/pattern/.../}: with
+ * REG_EXTENDED and up to 10 submatches.  The words look like the file
+ * names that makefiles typically apply :C to, and most of them do not
+ * match, as is usual.
+ *
+ * For each pattern, the time per 100000 words and the number of matching
+ * words is printed.  The same seed is used every time, so the number of
+ * matches only depends on the number of words.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tre/tre.h"
+
+/* Each measurement covers at least this many words. */
+#define MIN_WORDS 2000000
+
+static const char *const patterns[] = {
+	"\\.c$",
+	"^src/(.*)\\.o$",
+	"foo|bar",
+	"[0-9]+x",
+	"lib[a-z]*\\.a",
+	"(x|y)z+w",
+	"^([a-z]+)/([a-z]+)([0-9]{2,3})\\.h$",
+	"((a{2}b)+c)+",
+};
+
+static const char *const dirs[] = {
+	"src", "obj", "include", "lib", "tools", "tests"
+};
+
+static const char *const exts[] = {
+	"c", "h", "o", "obj", "a", "lib", "mk", "txt"
+};
+
+static unsigned long seed = 1;
+
+/* Return a pseudo-random number below n. */
+static unsigned long
+Random(unsigned long n)
+{
+	seed = seed * 1103515245UL + 12345UL;
+	return (seed / 65536UL) % n;
+}
+
+static char **
+MakeWords(unsigned long n)
+{
+	char **words = malloc(sizeof *words * n);
+	char buf[64];
+	unsigned long i;
+
+	if (words == NULL)
+		exit(1);
+	for (i = 0; i < n; i++) {
+		snprintf(buf, sizeof buf, "%s/%s%lu.%s",
+		    dirs[Random(sizeof dirs / sizeof dirs[0])],
+		    Random(4) == 0 ? "libfile" : "file", Random(100000),
+		    exts[Random(sizeof exts / sizeof exts[0])]);
+		if ((words[i] = strdup(buf)) == NULL)
+			exit(1);
+	}
+	return words;
+}
+
+static void
+Bench(const char *pattern, char **words, unsigned long n)
+{
+	unsigned long rounds = n >= MIN_WORDS ? 1 : MIN_WORDS / n;
+	unsigned long i, r, matches = 0;
+	regmatch_t m[10];
+	size_t nsub;
+	regex_t re;
+	clock_t start;
+	double ms;
+	int error;
+
+	if ((error = tre_regcomp(&re, pattern, REG_EXTENDED)) != 0) {
+		char msg[256];
+
+		tre_regerror(error, &re, msg, sizeof msg);
+		fprintf(stderr, "regex-bench: %s: %s\n", pattern, msg);
+		exit(1);
+	}
+	nsub = re.re_nsub + 1;
+	if (nsub > 10)
+		nsub = 10;
+
+	start = clock();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < n; i++)
+			if (tre_regexec(&re, words[i], nsub, m, 0) == 0)
+				matches++;
+	ms = (double)(clock() - start) * 1e3 / CLOCKS_PER_SEC /
+	    (double)rounds * 100000.0 / (double)n;
+
+	printf("%10.1f %8lu   %s\n", ms, matches / rounds, pattern);
+	tre_regfree(&re);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned long n = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+	char **words;
+	size_t i;
+
+	if (n == 0) {
+		fprintf(stderr, "usage: regex-bench [words]\n");
+		return 2;
+	}
+	words = MakeWords(n);
+
+	printf("%10s %8s   %s\n", "ms/100k", "matches", "pattern");
+	for (i = 0; i < sizeof patterns / sizeof patterns[0]; i++)
+		Bench(patterns[i], words, n);
+
+	for (i = 0; i < n; i++)
+		free(words[i]);
+	free(words);
+	return 0;
+}
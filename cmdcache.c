@@ -0,0 +1,485 @@
+/* The output of shell commands from earlier runs, see .MAKE.CMDCACHE */
+
+/*
+ * Interface:
+ *	CmdCache_Load	Use the file named by .MAKE.CMDCACHE for the
+ *			cache.  Called when the variable is assigned to.
+ *
+ *	CmdCache_End	Write the cache back if anything changed.
+ *
+ *	CmdCache_Find	Return the output of a command from the cache, if
+ *			it is still valid, or else the key for
+ *			CmdCache_Add.
+ *
+ *	CmdCache_Add	Remember the output of a command that succeeded.
+ *
+ * Makefiles often run the same probes, such as 'cc --version' or
+ * 'git rev-parse HEAD', in each sub-make, using '!=' or ':sh'.  While
+ * .MAKE.CMDCACHE names a file, the output of each such command that
+ * succeeds is kept there, and later runs of the same command take it from
+ * there instead of starting a shell.  Setting .MAKE.CMDCACHE to an empty
+ * value stops caching the commands that follow.
+ *
+ * An entry is only used for the same command in the same directory with
+ * the same environment, apart from MAKEFLAGS and the make level, which are
+ * different in each sub-make.  The files listed in .MAKE.CMDCACHE.DEPS
+ * when the command ran are recorded with their modification times, and
+ * the entry is only used while none of them changed:
+ *
+ *	.MAKE.CMDCACHE=		.cmdcache
+ *	.MAKE.CMDCACHE.DEPS=	${.CURDIR}/.git/HEAD ${.CURDIR}/.git/index
+ *	GIT_REV!=		git rev-parse HEAD
+ *
+ * The file is relative to .OBJDIR.  It starts with CMDCACHE_MAGIC,
+ * followed by one record per command:
+ *
+ *	4 bytes		the length of the key, little-endian
+ *	<length> bytes	the key: the hash of the directory, environment and
+ *			dependencies in hex, a space and the command
+ *	4 bytes		the length of the output, little-endian
+ *	<length> bytes	the output
+ *	2 bytes		the number of dependencies, little-endian
+ *
+ * and for each dependency:
+ *
+ *	8 bytes		the modification time, -1 if the file is missing
+ *	2 bytes		the length of the path, little-endian
+ *	<length> bytes	the path
+ *
+ * Sub-makes that share the file each replace it in a single step, the last
+ * one to finish wins.
+ */
+
+#include <sys/stat.h>
+
+#include "make.h"
+
+#define CMDCACHE_MAGIC "bmake cmdcache 1\n"
+
+/*
+ * If the cache has more entries than this, the entries that were not used
+ * in this run are dropped when it is written.
+ */
+#define CMDCACHE_MAX 1024
+
+typedef struct CmdCacheDep {
+	char *path;
+	time_t mtime;		/* -1 if the file does not exist */
+} CmdCacheDep;
+
+typedef struct CmdCacheEntry {
+	char *output;
+	size_t outputLen;
+	CmdCacheDep *deps;
+	size_t numDeps;
+	bool used;		/* in this run */
+} CmdCacheEntry;
+
+/*
+ * The key of a command, computed when the command is started, since the
+ * directory, the environment and the dependencies may change until it
+ * finishes.
+ */
+struct CmdCacheKey {
+	char *key;
+	char *deps;
+};
+
+static char *cacheName = NULL;	/* as given in .MAKE.CMDCACHE */
+static char *cacheFile = NULL;	/* absolute; NULL until it is read */
+static bool cacheEnabled = false; /* .MAKE.CMDCACHE is not empty */
+static bool cacheDirty = false;
+static HashTable cache;		/* the CmdCacheEntry of each key */
+
+/* Statistics for -dv */
+static unsigned int numHits;
+static unsigned int numMisses;
+
+static time_t
+CmdCache_MTime(const char *path)
+{
+	struct stat st;
+
+	return stat(path, &st) == 0 ? st.st_mtime : (time_t)-1;
+}
+
+static void
+CmdCacheEntry_Free(CmdCacheEntry *ent)
+{
+	size_t i;
+
+	for (i = 0; i < ent->numDeps; i++)
+		free(ent->deps[i].path);
+	free(ent->deps);
+	free(ent->output);
+	free(ent);
+}
+
+static ULONGLONG
+CmdCache_Hash(ULONGLONG h, const char *str, size_t len)
+{
+	while (len-- > 0)
+		h = (h ^ (unsigned char)*str++) * 0x100000001b3ULL;
+	return h;
+}
+
+static bool
+IsVolatileEnv(const char *env)
+{
+	size_t len = strlen(MAKE_LEVEL_ENV);
+
+	return strncmp(env, "MAKEFLAGS=", 10) == 0 ||
+	    (strncmp(env, MAKE_LEVEL_ENV, len) == 0 && env[len] == '=');
+}
+
+/*
+ * Build the key for the command, from the current directory, the
+ * environment that the command will get, including the exported variables,
+ * the dependencies and the command itself.  The variables in the
+ * environment are hashed independently of their order.
+ */
+static char *
+CmdCache_Key(const char *cmd, const char *deps)
+{
+	const ULONGLONG basis = 0xcbf29ce484222325ULL;
+	char cwd[MAXPATHLEN + 1];
+	char hex[17];
+	ULONGLONG h = basis, envSum = 0;
+	const char *p;
+
+	if (getcwd(cwd, sizeof cwd) == NULL)
+		cwd[0] = '\0';
+	h = CmdCache_Hash(h, cwd, strlen(cwd) + 1);
+	h = CmdCache_Hash(h, deps, strlen(deps) + 1);
+
+	for (p = Var_Environment(SCOPE_GLOBAL, NULL); *p != '\0';
+	     p += strlen(p) + 1)
+		if (!IsVolatileEnv(p))
+			envSum += CmdCache_Hash(basis, p, strlen(p));
+	h = CmdCache_Hash(h, (const char *)&envSum, sizeof envSum);
+
+	snprintf(hex, sizeof hex, "%016llx", h);
+	return str_concat3(hex, " ", cmd);
+}
+
+static void
+CmdCache_WriteInt(FILE *f, ULONGLONG x, size_t len)
+{
+	unsigned char b[8];
+	size_t i;
+
+	for (i = 0; i < len; i++, x >>= 8)
+		b[i] = (unsigned char)x;
+	fwrite(b, 1, len, f);
+}
+
+static bool
+CmdCache_ReadInt(FILE *f, size_t len, ULONGLONG *out_x)
+{
+	unsigned char b[8];
+	ULONGLONG x = 0;
+
+	if (fread(b, 1, len, f) != len)
+		return false;
+	while (len-- > 0)
+		x = x << 8 | b[len];
+	*out_x = x;
+	return true;
+}
+
+/* Read a string of the given length, or return NULL at the end. */
+static char *
+CmdCache_ReadStr(FILE *f, ULONGLONG len)
+{
+	char *str;
+
+	if (len >= 0x40000000)
+		return NULL;
+	str = bmake_malloc((size_t)len + 1);
+	if (fread(str, 1, (size_t)len, f) != (size_t)len) {
+		free(str);
+		return NULL;
+	}
+	str[len] = '\0';
+	return str;
+}
+
+/*
+ * Read the next record.  A truncated record at the end, from a make that
+ * was killed, is ignored.
+ */
+static bool
+CmdCache_ReadRecord(FILE *f)
+{
+	ULONGLONG len, numDeps, mtime;
+	CmdCacheEntry *ent;
+	HashEntry *he;
+	bool isNew;
+	char *key;
+	size_t i;
+
+	if (!CmdCache_ReadInt(f, 4, &len) ||
+	    (key = CmdCache_ReadStr(f, len)) == NULL)
+		return false;
+
+	ent = bmake_malloc(sizeof *ent);
+	ent->deps = NULL;
+	ent->numDeps = 0;
+	ent->used = false;
+	if (!CmdCache_ReadInt(f, 4, &len) ||
+	    (ent->output = CmdCache_ReadStr(f, len)) == NULL) {
+		free(ent);
+		goto bad;
+	}
+	ent->outputLen = (size_t)len;
+	if (!CmdCache_ReadInt(f, 2, &numDeps))
+		goto bad_entry;
+	ent->deps = bmake_malloc(
+	    ((size_t)numDeps + 1) * sizeof ent->deps[0]);
+	for (i = 0; i < numDeps; i++) {
+		if (!CmdCache_ReadInt(f, 8, &mtime) ||
+		    !CmdCache_ReadInt(f, 2, &len) ||
+		    (ent->deps[i].path = CmdCache_ReadStr(f, len)) == NULL)
+			goto bad_entry;
+		ent->deps[i].mtime = (time_t)mtime;
+		ent->numDeps++;
+	}
+
+	he = HashTable_CreateEntry(&cache, key, &isNew);
+	if (!isNew)
+		CmdCacheEntry_Free(he->value);
+	he->value = ent;
+	free(key);
+	return true;
+
+bad_entry:
+	CmdCacheEntry_Free(ent);
+bad:
+	free(key);
+	return false;
+}
+
+/*
+ * Use the file named by .MAKE.CMDCACHE as the cache, until the variable is
+ * set to an empty value.  Only the first file counts.  The file is read
+ * when the first command runs, since .OBJDIR may not be known yet, for
+ * example when .MAKE.CMDCACHE is given on the command line.
+ */
+void
+CmdCache_Load(void)
+{
+	char *file = Var_Subst("${.MAKE.CMDCACHE:U}", SCOPE_GLOBAL, VARE_EVAL);
+	/* TODO: handle errors */
+
+	cacheEnabled = file[0] != '\0';
+	if (cacheEnabled && cacheName == NULL)
+		cacheName = file;
+	else
+		free(file);
+}
+
+static void
+CmdCache_Open(void)
+{
+	char magic[sizeof CMDCACHE_MAGIC - 1];
+	FILE *f;
+
+	if (isAbs(cacheName))
+		cacheFile = bmake_strdup(cacheName);
+	else {
+		FStr objdir = Var_Value(SCOPE_GLOBAL, ".OBJDIR");
+		cacheFile = str_concat3(objdir.str != NULL ? objdir.str : curdir,
+		    "\\", cacheName);
+		FStr_Done(&objdir);
+	}
+	HashTable_Init(&cache);
+
+	if ((f = fopen(cacheFile, "rb")) == NULL) {
+		DEBUG1(VAR, "Command cache %s does not exist yet\n",
+		    cacheFile);
+		return;
+	}
+	if (fread(magic, 1, sizeof magic, f) == sizeof magic &&
+	    memcmp(magic, CMDCACHE_MAGIC, sizeof magic) == 0)
+		while (CmdCache_ReadRecord(f))
+			continue;
+	fclose(f);
+	DEBUG2(VAR, "Command cache %s has %u commands\n",
+	    cacheFile, cache.numEntries);
+}
+
+static void
+CmdCache_Write(void)
+{
+	char tmp[MAXPATHLEN + 1];
+	bool dropUnused = cache.numEntries > CMDCACHE_MAX;
+	HashIter hi;
+	FILE *f;
+	bool ok;
+	size_t i;
+
+	snprintf(tmp, sizeof tmp, "%s.%lu", cacheFile, myPid);
+	if ((f = fopen(tmp, "wb")) == NULL) {
+		DEBUG2(VAR, "Cannot write command cache %s: %s\n",
+		    tmp, strerror(errno));
+		return;
+	}
+
+	fputs(CMDCACHE_MAGIC, f);
+	HashIter_Init(&hi, &cache);
+	while (HashIter_Next(&hi)) {
+		const char *key = hi.entry->key;
+		CmdCacheEntry *ent = hi.entry->value;
+
+		if (dropUnused && !ent->used)
+			continue;
+		CmdCache_WriteInt(f, strlen(key), 4);
+		fputs(key, f);
+		CmdCache_WriteInt(f, ent->outputLen, 4);
+		fwrite(ent->output, 1, ent->outputLen, f);
+		CmdCache_WriteInt(f, ent->numDeps, 2);
+		for (i = 0; i < ent->numDeps; i++) {
+			CmdCache_WriteInt(f, (ULONGLONG)ent->deps[i].mtime, 8);
+			CmdCache_WriteInt(f, strlen(ent->deps[i].path), 2);
+			fputs(ent->deps[i].path, f);
+		}
+	}
+
+	ok = fflush(f) == 0 && !ferror(f);
+	ok = fclose(f) == 0 && ok;
+	if (!ok || MoveFileExA(tmp, cacheFile,
+	    MOVEFILE_REPLACE_EXISTING) == 0) {
+		DEBUG1(VAR, "Cannot replace command cache %s\n", cacheFile);
+		(void)unlink(tmp);
+	}
+}
+
+void
+CmdCache_End(void)
+{
+#ifdef CLEANUP
+	HashIter hi;
+#endif
+
+	if (cacheFile == NULL)
+		return;
+	DEBUG3(VAR, "Command cache: %u hits, %u misses, %u commands\n",
+	    numHits, numMisses, cache.numEntries);
+	if (cacheDirty)
+		CmdCache_Write();
+#ifdef CLEANUP
+	HashIter_Init(&hi, &cache);
+	while (HashIter_Next(&hi))
+		CmdCacheEntry_Free(hi.entry->value);
+	HashTable_Done(&cache);
+	free(cacheFile);
+	cacheFile = NULL;
+	free(cacheName);
+	cacheName = NULL;
+#endif
+}
+
+static char *
+CmdCache_Deps(void)
+{
+	char *deps = Var_Subst("${.MAKE.CMDCACHE.DEPS:U}", SCOPE_GLOBAL,
+	    VARE_EVAL);
+	/* TODO: handle errors */
+	return deps;
+}
+
+/*
+ * Return the output of the command from an earlier run, or NULL.  The
+ * environment of make must already be the one that the command would get.
+ *
+ * If the command is not in the cache, store its key in out_key, to be
+ * passed to CmdCache_Add once the command has finished.
+ */
+char *
+CmdCache_Find(const char *cmd, CmdCacheKey **out_key)
+{
+	CmdCacheKey *ck;
+	CmdCacheEntry *ent;
+	size_t i;
+
+	*out_key = NULL;
+	if (!cacheEnabled)
+		return NULL;
+	if (cacheFile == NULL)
+		CmdCache_Open();
+
+	ck = bmake_malloc(sizeof *ck);
+	ck->deps = CmdCache_Deps();
+	ck->key = CmdCache_Key(cmd, ck->deps);
+	ent = HashTable_FindValue(&cache, ck->key);
+
+	if (ent == NULL)
+		goto miss;
+	for (i = 0; i < ent->numDeps; i++) {
+		if (CmdCache_MTime(ent->deps[i].path) != ent->deps[i].mtime) {
+			DEBUG2(VAR, "Command cache: %s changed for \"%s\"\n",
+			    ent->deps[i].path, cmd);
+			goto miss;
+		}
+	}
+
+	numHits++;
+	ent->used = true;
+	DEBUG1(VAR, "Taking the output of command \"%s\" from the cache\n",
+	    cmd);
+	CmdCache_Add(ck, NULL);
+	return bmake_strdup(ent->output);
+
+miss:
+	numMisses++;
+	*out_key = ck;
+	return NULL;
+}
+
+/*
+ * Remember the output of a command that succeeded, under the key from
+ * CmdCache_Find, which is freed.  For a command that failed, the output is
+ * NULL, and only the key is freed.
+ */
+void
+CmdCache_Add(CmdCacheKey *ck, const char *output)
+{
+	Words words;
+	CmdCacheEntry *ent;
+	HashEntry *he;
+	bool isNew;
+	size_t i;
+
+	if (ck == NULL)
+		return;
+	if (output == NULL || !cacheEnabled)
+		goto done;
+
+	he = HashTable_CreateEntry(&cache, ck->key, &isNew);
+	if (!isNew)
+		CmdCacheEntry_Free(he->value);
+
+	ent = bmake_malloc(sizeof *ent);
+	ent->output = bmake_strdup(output);
+	ent->outputLen = strlen(output);
+	ent->used = true;
+	words = Str_Words(ck->deps, false);
+	ent->deps = bmake_malloc((words.len + 1) * sizeof ent->deps[0]);
+	ent->numDeps = 0;
+	for (i = 0; i < words.len && i < 0xffff; i++) {
+		if (strlen(words.words[i]) > 0xffff)
+			continue;
+		ent->deps[ent->numDeps].path = bmake_strdup(words.words[i]);
+		ent->deps[ent->numDeps].mtime = CmdCache_MTime(words.words[i]);
+		ent->numDeps++;
+	}
+	Words_Free(words);
+
+	he->value = ent;
+	cacheDirty = true;
+
+done:
+	free(ck->deps);
+	free(ck->key);
+	free(ck);
+}
@@ -77,15 +77,14 @@
  *	Compat_MakeAll	Initialize this module and make the given targets.
  */
 
-#include <malloc.h>
-
 #include "make.h"
+#include "dir.h"
 #include "job.h"
 
 /*	"@(#)compat.c	8.2 (Berkeley) 3/19/94"	*/
 
 static GNode *curTarg = NULL;
-static HANDLE compatChild = NULL;
+static Proc *compatChild = NULL;
 static bool signaled = false;
 
 /*
@@ -119,7 +118,7 @@ CompatInterrupt_int(void)
 	 * if Compat_Make is run, compatChild
 	 * loses its value
 	 */
-	HANDLE savedChild = compatChild;
+	Proc *savedChild = compatChild;
 
 	CompatDeleteTarget(curTarg);
 
@@ -135,7 +134,7 @@ CompatInterrupt_int(void)
 
 	signaled = true;
 	if (savedChild != NULL)
-		(void)TerminateProcess(savedChild, 0);
+		Proc_Kill(savedChild);
 	else
 		exit(2);
 }
@@ -147,7 +146,7 @@ CompatInterrupt_term(void)
 
 	signaled = true;
 	if (compatChild != NULL)
-		(void)TerminateProcess(compatChild, 0);
+		Proc_Kill(compatChild);
 	else
 		exit(2);
 }
@@ -194,8 +193,14 @@ Compat_RunCommand(const char *cmdp, GNode *gn, StringListNode *ln)
 	bool silent;		/* Don't print command */
 	bool doIt;		/* Execute even if -n */
 	bool errCheck;	/* Check errors */
-	DWORD status;		/* Child's exit code */
-	PROCESS_INFORMATION pi;	/* Process information for the shell we start */
+	ProcStatus status;	/* Child's exit code */
+	Proc proc;		/* The shell we start */
+	ProcPipe *pp = NULL;	/* Where its output goes, if anywhere */
+	ProcRedirect redirect;	/* Which of its handles are redirected */
+	const char *filemonEnv = NULL;
+	const char *env;	/* The environment of the child */
+	char *program;		/* The program to run without the shell */
+	bool started = false;
 
 	const char *cmd = cmdp;
 
@@ -265,43 +270,51 @@ Compat_RunCommand(const char *cmdp, GNode *gn, StringListNode *ln)
 	if (!doIt && !GNode_ShouldExecute(gn))
 		goto register_command;
 
-	DEBUG1(JOB, "Execute: '%s'\n", cmd);
-
 	if (shellPath == NULL)
 		Shell_Init();		/* we need shellPath */
 
-	{
-		const char *args = Shell_GetArgs();
-		char *tmp = _alloca((size_t)
-			snprintf(NULL, 0, cmdFmt, shellPath, args, cmd) + 1);
-
-		sprintf(tmp, cmdFmt, shellPath, args, cmd);
-		cmd = tmp;
-	}
-
 #ifdef USE_META
-	if (useMeta)
+	if (useMeta) {
 		meta_compat_start();
+		pp = meta_compat_pipe();
+	}
 #endif
 
-	Var_ReexportVars(gn);
+	if (gn->type & (OP_MAKE | OP_SUBMAKE))
+		Dir_SaveStatCache();
+	else
+		Dir_ExpireStatCache();
 
+	redirect = pp != NULL ? PROC_STDOUT | PROC_STDERR : PROC_INHERIT;
 #ifdef USE_META
-	if (useMeta) {
-		STARTUPINFOA si = {sizeof si, 0};
-		si.dwFlags = STARTF_USESTDHANDLES;
-		si.hStdOutput = si.hStdError = meta_compat_pipe()[1];
-		si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+	if (useMeta && (filemonEnv = meta_job_child(NULL)) != NULL)
+		redirect |= PROC_SUSPENDED;
+#endif
+	env = Var_Environment(gn, filemonEnv);
+	program = Shell_FindProgram(cmd, env);
+
+	if (program != NULL) {
+		DEBUG1(JOB, "Execute without the shell: '%s'\n", cmd);
+		started = Proc_SpawnDirect(&proc, program, cmd, env, pp,
+		    redirect);
+		if (!started)
+			DEBUG2(JOB, "Cannot run %s without the shell: %s\n",
+			    program, Proc_Error());
+	}
+	free(program);
+	if (!started) {
+		DEBUG1(JOB, "Execute: '%s'\n", cmd);
+		if (!Proc_Spawn(&proc, shellPath, Shell_GetArgs(), cmd,
+		    env, pp, redirect))
+			Punt("could not create process: %s", Proc_Error());
+	}
 
-		if (CreateProcessA(shellPath, (LPSTR)cmd, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi) == 0)
-			Punt("could not create process: %s", strerr(GetLastError()));
-	} else
+#ifdef USE_META
+	if (useMeta)
+		meta_job_parent(NULL, &proc);
 #endif
-	if (CreateProcessA(shellPath, (LPSTR)cmd, NULL, NULL, FALSE, 0, NULL, NULL,
-			&(STARTUPINFOA){sizeof (STARTUPINFOA), 0}, &pi) == 0)
-		Punt("could not create process: %s", strerr(GetLastError()));
 
-	compatChild = pi.hProcess;
+	compatChild = &proc;
 
 	/* XXX: Memory management looks suspicious here. */
 	/* XXX: Setting a list item to NULL is unexpected. */
@@ -310,29 +323,22 @@ Compat_RunCommand(const char *cmdp, GNode *gn, StringListNode *ln)
 	/* The child is off and running. Now all we can do is wait... */
 #ifdef USE_META
 	if (useMeta) {
-		while ((status = WaitForSingleObject(pi.hProcess, PROCESSWAIT)) == WAIT_TIMEOUT) {
-			DWORD avail;
-
-			if (PeekNamedPipe(meta_compat_pipe()[0], NULL, 0, NULL, &avail, NULL) == 0)
-				Punt("failed to peek pipe: %s", strerr(GetLastError()));
-
-			if (avail >= PIPESZ)
-				meta_compat_catch(cmdStart, false);
+		ProcResult res;
+
+		/* Pass the output on as it arrives, until the child exits. */
+		while ((res = Proc_Wait(&proc, false, &status)) == PROC_AGAIN) {
+			meta_compat_catch(cmdStart, false);
+			if (Proc_WaitForEvent(-1) == PROC_ERROR)
+				Punt("failed to wait for process: %s",
+					Proc_Error());
 		}
-
-		if (status == WAIT_FAILED)
-			Punt("failed to wait for process: %s", strerr(GetLastError()));
-	} else
-#endif
-	if (WaitForSingleObject(pi.hProcess, INFINITE) == WAIT_FAILED)
-		Punt("failed to wait for process: %s", strerr(GetLastError()));
-
-	(void)GetExitCodeProcess(pi.hProcess, &status);
-
-#ifdef USE_META
-	if (useMeta)
+		if (res == PROC_ERROR)
+			Punt("failed to wait for process: %s", Proc_Error());
 		meta_compat_catch(cmdStart, true);
+	} else
 #endif
+	if (Proc_Wait(&proc, true, &status) != PROC_DONE)
+		Punt("failed to wait for process: %s", Proc_Error());
 
 	if (status != 0) {
 		if (DEBUG(ERROR))
@@ -370,8 +376,7 @@ Compat_RunCommand(const char *cmdp, GNode *gn, StringListNode *ln)
 
 	free(cmdStart);
 	compatChild = NULL;
-	CloseHandle(pi.hProcess);
-	CloseHandle(pi.hThread);
+	Proc_Close(&proc);
 
 	if (signaled)
 		exit(2);
@@ -410,16 +415,20 @@ MakeInRandomOrder(GNode **gnodes, GNode **end, GNode *pgn)
 }
 
 static void
-MakeWaitGroupsInRandomOrder(GNodeList *gnodes, GNode *pgn)
+MakeWaitGroupsInRandomOrder(GNodeVec *gnodes, GNode *pgn)
 {
 	Vector vec;
-	GNodeListNode *ln;
 	GNode **nodes;
 	size_t i, n, start;
 
+	/* An empty vector has no items to do pointer arithmetic on. */
+	if (GNodeVec_IsEmpty(gnodes))
+		return;
+
+	/* Shuffle a copy, the order of the graph edges stays as it is. */
 	Vector_Init(&vec, sizeof(GNode *));
-	for (ln = gnodes->first; ln != NULL; ln = ln->next)
-		*(GNode **)Vector_Push(&vec) = ln->datum;
+	for (i = 0; i < gnodes->len; i++)
+		*(GNode **)Vector_Push(&vec) = GNodeVec_Get(gnodes, i);
 	nodes = vec.items;
 	n = vec.len;
 
@@ -437,21 +446,19 @@ MakeWaitGroupsInRandomOrder(GNodeList *gnodes, GNode *pgn)
 }
 
 static void
-MakeNodes(GNodeList *gnodes, GNode *pgn)
+MakeNodes(GNodeVec *gnodes, GNode *pgn)
 {
-	GNodeListNode *ln;
+	size_t i;
 
-	if (Lst_IsEmpty(gnodes))
+	if (GNodeVec_IsEmpty(gnodes))
 		return;
 	if (opts.randomizeTargets) {
 		MakeWaitGroupsInRandomOrder(gnodes, pgn);
 		return;
 	}
 
-	for (ln = gnodes->first; ln != NULL; ln = ln->next) {
-		GNode *cgn = ln->datum;
-		Compat_Make(cgn, pgn);
-	}
+	for (i = 0; i < gnodes->len; i++)
+		Compat_Make(GNodeVec_Get(gnodes, i), pgn);
 }
 
 static bool
@@ -482,7 +489,7 @@ MakeUnmade(GNode *gn, GNode *pgn)
 		return false;
 	}
 
-	if (Lst_FindDatum(&gn->implicitParents, pgn) != NULL)
+	if (GNodeVec_Contains(&gn->implicitParents, pgn))
 		Var_Set(pgn, IMPSRC, GNode_VarTarget(gn));
 
 	/*
@@ -569,7 +576,7 @@ static void
 MakeOther(GNode *gn, GNode *pgn)
 {
 
-	if (Lst_FindDatum(&gn->implicitParents, pgn) != NULL) {
+	if (GNodeVec_Contains(&gn->implicitParents, pgn)) {
 		const char *target = GNode_VarTarget(gn);
 		Var_Set(pgn, IMPSRC, target != NULL ? target : "");
 	}
@@ -288,19 +288,25 @@ FuncMake(const char *targetPattern)
 {
 	StringListNode *ln;
 	bool warned = false;
+	StrPattern sp;
+	bool matched = false;
 
+	StrPattern_Init(&sp, targetPattern);
 	for (ln = opts.create.first; ln != NULL; ln = ln->next) {
-		StrMatchResult res = Str_Match(ln->datum, targetPattern);
+		StrMatchResult res = StrPattern_Match(&sp, ln->datum);
 		if (res.error != NULL && !warned) {
 			warned = true;
 			Parse_Error(PARSE_WARNING,
 			    "%s in pattern argument '%s' to function 'make'",
 			    res.error, targetPattern);
 		}
-		if (res.matched)
-			return true;
+		if (res.matched) {
+			matched = true;
+			break;
+		}
 	}
-	return false;
+	StrPattern_Done(&sp);
+	return matched;
 }
 
 /* See if the given file exists. */
@@ -116,6 +116,12 @@
  *	SearchPath_Clear
  *			Resets a search path to the empty list.
  *
+ *	Dir_Prefetch	Read several directories in parallel before they
+ *			are added to search paths.
+ *
+ *	Dir_LoadCache	Take the directory contents from the persistent
+ *			cache file, see .MAKE.DIRCACHE.
+ *
  * For debugging:
  *	Dir_PrintDirectories
  *			Print stats about the directory cache.
@@ -216,6 +222,12 @@ struct CachedDir {
 	/* The number of times a file in this directory has been found. */
 	int hits;
 
+	/*
+	 * The modification time of the directory when it was read, for the
+	 * persistent cache, or 0 if unknown.
+	 */
+	time_t mtime;
+
 	/* The names of the directory entries. */
 	HashSet files;
 };
@@ -260,6 +272,95 @@ static CachedDir *dotLast = NULL;
  */
 static HashTable mtimes;
 
+/*
+ * The persistent directory cache, see .MAKE.DIRCACHE.
+ *
+ * The cache file lists the names in each cached directory, together with
+ * the modification time of the directory.  On the next run, a directory
+ * whose modification time is unchanged is taken from the cache file
+ * instead of being read again, which saves a lot of time for search paths
+ * with thousands of directories.
+ *
+ * The file is mapped into memory and has the following format:
+ *
+ *	bmake dircache 2
+ *	D <mtime> <count> <size> <directory>
+ *	<file>
+ *	...
+ *
+ * where <size> is the number of bytes taken by the <count> lines that
+ * follow, so that the directories can be indexed without looking at the
+ * files.  The <directory> is absolute, since sub-makes in other
+ * directories share the file, and "." or "../src" means a different
+ * directory to each of them.
+ */
+typedef struct DirCacheEntry {
+	time_t mtime;
+	unsigned int numFiles;
+	const char *files;	/* newline-separated, in the mapped file */
+	size_t filesLen;
+} DirCacheEntry;
+
+#define DIRCACHE_MAGIC "bmake dircache 2\n"
+
+static char *dirCacheFile = NULL; /* absolute; NULL if there is no cache */
+static HANDLE dirCacheMap = NULL;
+static const char *dirCacheData = NULL;
+static HashTable dirCache;	/* the DirCacheEntry for each directory */
+static bool dirCacheDirty = false; /* whether to write the file at the end */
+static int dirCacheHits;	/* directories taken from the cache file */
+static int dirCacheMisses;	/* directories read despite the cache file */
+static Buffer dirCacheNew;	/* the records of the directories just read */
+static HashSet dirCacheUpdated;	/* the directories in dirCacheNew */
+
+/*
+ * The stat cache, see .MAKE.STATCACHE.
+ *
+ * The top-level make creates a temporary file, which it passes on to the
+ * sub-makes in .MAKE.STATCACHE via MAKEFLAGS.  Before starting a sub-make,
+ * each make writes the results of its stat calls to that file, and each
+ * sub-make takes them from there instead of calling stat again.
+ *
+ * Each entry records the modification time of the parent directory of the
+ * file, taken before the file itself was looked at.  An entry is only used
+ * if the directory is unchanged, so files that have been created, removed
+ * or renamed since are looked at again.
+ *
+ * Rewriting a file in place does not change its directory though.  Each
+ * make therefore appends a byte to the jobs file, named like the stat cache
+ * with ".jobs" added, before it runs a command other than a sub-make, and
+ * each entry records the size of the jobs file as known before the file was
+ * looked at.  An entry is only used if no command has been started since,
+ * by any of the makes.  A build that has nothing to do thus only starts
+ * sub-makes and takes all files from the cache, while after the first real
+ * command, the files are looked at again.
+ *
+ * The file is mapped into memory and has the following format:
+ *
+ *	bmake statcache 2
+ *	<jobs> <dir mtime> <mtime> <mode> <absolute path>
+ *	...
+ */
+typedef struct StatCacheEntry {
+	unsigned long long jobs; /* the size of the jobs file */
+	time_t dirMtime;	/* of the parent directory, or 0 */
+	time_t mtime;
+	unsigned short mode;
+} StatCacheEntry;
+
+#define STATCACHE_MAGIC "bmake statcache 2\n"
+
+static char *statCacheFile = NULL; /* NULL if there is no stat cache */
+static bool statCacheOwner = false; /* whether we created the file */
+static bool statCacheDirty = false; /* whether the file needs an update */
+static HashTable statCache;	/* the StatCacheEntry for each file */
+static HashTable statCacheDirs;	/* the time_t of each parent directory */
+static HANDLE statCacheJobsFile = INVALID_HANDLE_VALUE;
+static unsigned long long statCacheJobs; /* the size of the jobs file */
+static int statCacheSaved;	/* stat calls that were saved */
+static int statCacheDirChecks;	/* stat calls for the parent directories */
+static int statCacheExpired;	/* entries not used since jobs have run */
+
 
 static void OpenDirs_Remove(OpenDirs *, const char *);
 
@@ -271,6 +372,7 @@ CachedDir_New(const char *name)
 	dir->name = bmake_strdup(name);
 	dir->refCount = 0;
 	dir->hits = 0;
+	dir->mtime = 0;
 	HashSet_Init(&dir->files);
 
 #ifdef DEBUG_REFCNT
@@ -386,6 +488,336 @@ OpenDirs_Remove(OpenDirs *odirs, const char *name)
 	Lst_Remove(&odirs->list, ln);
 }
 
+static void
+FreeCachedTable(HashTable *tbl)
+{
+	HashIter hi;
+	HashIter_Init(&hi, tbl);
+	while (HashIter_Next(&hi))
+		free(hi.entry->value);
+	HashTable_Done(tbl);
+}
+
+/* Parse a decimal number that is followed by a space. */
+static bool
+ParseCacheNum(const char **pp, const char *end, unsigned long long *out)
+{
+	const char *p = *pp;
+	unsigned long long num = 0;
+
+	if (p == end || !ch_isdigit(*p))
+		return false;
+	while (p < end && ch_isdigit(*p))
+		num = 10 * num + (unsigned)(*p++ - '0');
+	if (p == end || *p != ' ')
+		return false;
+	*pp = p + 1;
+	*out = num;
+	return true;
+}
+
+/* Take the entries from the mapped stat cache file. */
+static bool
+StatCache_Index(const char *p, const char *end)
+{
+	size_t magicLen = sizeof STATCACHE_MAGIC - 1;
+
+	if ((size_t)(end - p) < magicLen ||
+	    memcmp(p, STATCACHE_MAGIC, magicLen) != 0)
+		return false;
+	p += magicLen;
+
+	while (p < end) {
+		unsigned long long jobs, dirMtime, mtime, mode;
+		const char *nl;
+		char *name;
+		HashEntry *he;
+		StatCacheEntry *ent;
+		bool isNew;
+
+		if (!ParseCacheNum(&p, end, &jobs) ||
+		    !ParseCacheNum(&p, end, &dirMtime) ||
+		    !ParseCacheNum(&p, end, &mtime) ||
+		    !ParseCacheNum(&p, end, &mode))
+			return false;
+		nl = memchr(p, '\n', (size_t)(end - p));
+		if (nl == NULL || nl == p)
+			return false;
+
+		name = bmake_strsedup(p, nl);
+		he = HashTable_CreateEntry(&statCache, name, &isNew);
+		free(name);
+		if (isNew)
+			HashEntry_Set(he, bmake_malloc(sizeof *ent));
+		ent = HashEntry_Get(he);
+		ent->jobs = jobs;
+		ent->dirMtime = (time_t)dirMtime;
+		ent->mtime = (time_t)mtime;
+		ent->mode = (unsigned short)mode;
+
+		p = nl + 1;
+	}
+	return true;
+}
+
+/*
+ * Read the stat cache file that was passed on by the parent make.  The
+ * file is only mapped while it is read, since it cannot be replaced by the
+ * other makes while it is mapped.
+ */
+static void
+StatCache_Load(void)
+{
+	HANDLE fh, map = NULL;
+	LARGE_INTEGER size;
+	const char *data = NULL;
+	bool ok;
+
+	fh = CreateFileA(statCacheFile, GENERIC_READ,
+	    FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+	    FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fh == INVALID_HANDLE_VALUE) {
+		DEBUG1(DIR, "Stat cache %s does not exist yet\n",
+		    statCacheFile);
+		return;
+	}
+
+	if (GetFileSizeEx(fh, &size) != 0 && size.QuadPart > 0 &&
+	    size.QuadPart < 1024 * 1024 * 1024 &&
+	    (map = CreateFileMappingA(fh, NULL, PAGE_READONLY,
+		0, 0, NULL)) != NULL)
+		data = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(fh);
+
+	ok = data != NULL && StatCache_Index(data, data + size.QuadPart);
+	if (data != NULL)
+		UnmapViewOfFile(data);
+	if (map != NULL)
+		CloseHandle(map);
+
+	if (!ok) {
+		DEBUG1(DIR, "Ignoring malformed stat cache %s\n",
+		    statCacheFile);
+		FreeCachedTable(&statCache);
+		HashTable_Init(&statCache);
+		return;
+	}
+	DEBUG2(DIR, "Using stat cache %s with %u files\n",
+	    statCacheFile, statCache.numEntries);
+}
+
+/* Take the number of jobs that have been started by all makes so far. */
+static void
+StatCache_UpdateJobs(void)
+{
+	LARGE_INTEGER size;
+
+	if (GetFileSizeEx(statCacheJobsFile, &size) != 0)
+		statCacheJobs = (unsigned long long)size.QuadPart;
+}
+
+/*
+ * Open the jobs file, which is shared by all makes that use the stat cache.
+ * Without it, the stat cache is not used at all.
+ */
+static bool
+StatCache_OpenJobs(void)
+{
+	char *name = str_concat2(statCacheFile, ".jobs");
+
+	statCacheJobsFile = CreateFileA(name, FILE_APPEND_DATA,
+	    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+	    OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	free(name);
+	if (statCacheJobsFile == INVALID_HANDLE_VALUE) {
+		DEBUG2(DIR, "Cannot open the jobs file of stat cache %s: %s\n",
+		    statCacheFile, strerr(GetLastError()));
+		return false;
+	}
+	StatCache_UpdateJobs();
+	return true;
+}
+
+/*
+ * Called before a command is run that may change files, that is, any
+ * command except for a sub-make.  From then on, none of the makes trust
+ * the entries that have been recorded so far.
+ */
+void
+Dir_ExpireStatCache(void)
+{
+	DWORD nWritten;
+
+	if (statCacheJobsFile == INVALID_HANDLE_VALUE)
+		return;
+	if (WriteFile(statCacheJobsFile, "j", 1, &nWritten, NULL) == 0)
+		Punt("cannot write to the jobs file of stat cache %s: %s",
+		    statCacheFile, strerr(GetLastError()));
+	StatCache_UpdateJobs();
+}
+
+/*
+ * Called when .MAKE.STATCACHE is assigned to.  In the top-level make, the
+ * value is a boolean that enables the stat cache; for the sub-makes, it is
+ * replaced with the name of the file.
+ */
+void
+Dir_SetStatCache(const char *value)
+{
+	char tmpdir[MAXPATHLEN + 1];
+	char file[MAXPATHLEN + 1];
+	DWORD len;
+
+	if (statCacheFile != NULL)
+		return;
+
+	if (isAbs(value)) {
+		statCacheFile = bmake_strdup(value);
+		/* The jobs file first, so that no job is missed. */
+		if (!StatCache_OpenJobs()) {
+			free(statCacheFile);
+			statCacheFile = NULL;
+			return;
+		}
+		StatCache_Load();
+		return;
+	}
+	if (!ParseBoolean(value, false))
+		return;
+
+	len = GetTempPathA(sizeof tmpdir, tmpdir);
+	if (len == 0 || len >= sizeof tmpdir)
+		return;
+	snprintf(file, sizeof file, "%sbmake-stat.%lu", tmpdir, myPid);
+	statCacheFile = bmake_strdup(file);
+	if (!StatCache_OpenJobs()) {
+		free(statCacheFile);
+		statCacheFile = NULL;
+		return;
+	}
+	statCacheOwner = true;
+
+	/* Pass the file on to the sub-makes, via .MAKEOVERRIDES. */
+	Var_Set(SCOPE_CMDLINE, ".MAKE.STATCACHE", statCacheFile);
+	DEBUG1(DIR, "Created stat cache %s\n", statCacheFile);
+}
+
+/*
+ * Return the modification time of the directory, or 0 if it is unknown.
+ * Each directory is only looked at once, before any of its files, so
+ * that a change to the directory after that is always noticed.
+ */
+static time_t
+StatCache_DirStamp(const char *dir)
+{
+	time_t *stamp = HashTable_FindValue(&statCacheDirs, dir);
+	struct stat st;
+
+	if (stamp != NULL)
+		return *stamp;
+
+	stamp = bmake_malloc(sizeof *stamp);
+	*stamp = stat(dir, &st) == 0 ? st.st_mtime : 0;
+	HashTable_Set(&statCacheDirs, dir, stamp);
+	statCacheDirChecks++;
+	return *stamp;
+}
+
+/*
+ * Get the absolute name of the file and the stamp of its directory.
+ * Return false if the stat cache cannot be used for this file.
+ */
+static bool
+StatCache_Prepare(const char *pathname, char *abspath, time_t *out_dirMtime)
+{
+	char *slash;
+	char dir[MAXPATHLEN + 1];
+	size_t dirLen;
+
+	if (statCacheFile == NULL ||
+	    _fullpath(abspath, pathname, MAXPATHLEN) == NULL ||
+	    (slash = lastSlash(abspath)) == NULL)
+		return false;
+
+	/* Keep the slash of "C:\", since "C:" is the current directory. */
+	dirLen = slash == abspath + 2 ? 3 : (size_t)(slash - abspath);
+	memcpy(dir, abspath, dirLen);
+	dir[dirLen] = '\0';
+
+	*out_dirMtime = StatCache_DirStamp(dir);
+	return *out_dirMtime != 0;
+}
+
+static void
+StatCache_Record(const char *abspath, time_t dirMtime,
+		 const struct cached_stat *cst)
+{
+	StatCacheEntry *ent = HashTable_FindValue(&statCache, abspath);
+
+	if (ent == NULL) {
+		ent = bmake_malloc(sizeof *ent);
+		HashTable_Set(&statCache, abspath, ent);
+	}
+	ent->jobs = statCacheJobs;
+	ent->dirMtime = dirMtime;
+	ent->mtime = cst->cst_mtime;
+	ent->mode = cst->cst_mode;
+	statCacheDirty = true;
+}
+
+/*
+ * Write the stat cache file for the sub-makes that are about to be
+ * started, if anything has changed since the last time.
+ */
+void
+Dir_SaveStatCache(void)
+{
+	char tmp[MAXPATHLEN + 1];
+	HashIter hi;
+	FILE *f;
+	bool ok;
+
+	if (statCacheFile == NULL)
+		return;
+
+	/*
+	 * The files that are looked at from now on may see the jobs of the
+	 * other makes, up to now.
+	 */
+	StatCache_UpdateJobs();
+	if (!statCacheDirty)
+		return;
+
+	snprintf(tmp, sizeof tmp, "%s.%lu", statCacheFile, myPid);
+	if ((f = fopen(tmp, "wb")) == NULL) {
+		DEBUG2(DIR, "Cannot write stat cache %s: %s\n",
+		    tmp, strerror(errno));
+		return;
+	}
+
+	fputs(STATCACHE_MAGIC, f);
+	HashIter_Init(&hi, &statCache);
+	while (HashIter_Next(&hi)) {
+		StatCacheEntry *ent = hi.entry->value;
+
+		fprintf(f, "%llu %lld %lld %u %s\n", ent->jobs,
+		    (long long)ent->dirMtime, (long long)ent->mtime,
+		    (unsigned)ent->mode, hi.entry->key);
+	}
+
+	ok = fflush(f) == 0 && !ferror(f);
+	ok = fclose(f) == 0 && ok;
+
+	/* This fails while another make is reading the file. */
+	if (!ok || MoveFileExA(tmp, statCacheFile,
+	    MOVEFILE_REPLACE_EXISTING) == 0) {
+		DEBUG1(DIR, "Cannot replace stat cache %s\n", statCacheFile);
+		(void)unlink(tmp);
+		return;
+	}
+	statCacheDirty = false;
+}
+
 /*
  * Returns 0 and the result of stat(2) in *out_cst,
  * or -1 on error.
@@ -397,6 +829,10 @@ cached_stats(const char *pathname, struct cached_stat *out_cst,
 	HashTable *tbl = &mtimes;
 	struct stat sys_st;
 	struct cached_stat *cst;
+	StatCacheEntry *ent;
+	char abspath[MAXPATHLEN + 1];
+	time_t dirMtime;
+	bool useStatCache, fromStatCache = false;
 	int rc;
 
 	if (pathname == NULL || pathname[0] == '\0')
@@ -410,9 +846,25 @@ cached_stats(const char *pathname, struct cached_stat *out_cst,
 		return 0;
 	}
 
-	rc = stat(pathname, &sys_st);
-	if (rc == -1)
-		return -1;	/* don't cache negative lookups */
+	useStatCache = StatCache_Prepare(pathname, abspath, &dirMtime);
+	ent = useStatCache && !forceRefresh
+	    ? HashTable_FindValue(&statCache, abspath) : NULL;
+	if (ent != NULL && ent->jobs != statCacheJobs) {
+		statCacheExpired++;
+		ent = NULL;
+	}
+	if (ent != NULL && ent->dirMtime == dirMtime) {
+		sys_st.st_mtime = ent->mtime;
+		sys_st.st_mode = ent->mode;
+		fromStatCache = true;
+		statCacheSaved++;
+		DEBUG2(DIR, "   Using stat cache %s for %s\n",
+		    Targ_FmtTime(sys_st.st_mtime), pathname);
+	} else {
+		rc = stat(pathname, &sys_st);
+		if (rc == -1)
+			return -1;	/* don't cache negative lookups */
+	}
 
 	if (sys_st.st_mtime == 0)
 		sys_st.st_mtime = 1; /* avoid confusion with missing file */
@@ -424,6 +876,8 @@ cached_stats(const char *pathname, struct cached_stat *out_cst,
 
 	cst->cst_mtime = sys_st.st_mtime;
 	cst->cst_mode = sys_st.st_mode;
+	if (useStatCache && !fromStatCache)
+		StatCache_Record(abspath, dirMtime, cst);
 
 	*out_cst = *cst;
 	DEBUG2(DIR, "   Caching %s for %s\n",
@@ -444,6 +898,11 @@ Dir_Init(void)
 {
 	OpenDirs_Init(&openDirs);
 	HashTable_Init(&mtimes);
+	HashTable_Init(&dirCache);
+	HashTable_Init(&statCache);
+	HashTable_Init(&statCacheDirs);
+	Buf_Init(&dirCacheNew);
+	HashSet_Init(&dirCacheUpdated);
 	CachedDir_Assign(&dotLast, CachedDir_New(".DOTLAST"));
 }
 
@@ -487,22 +946,260 @@ Dir_InitDot(void)
 	Dir_SetPATH();		/* initialize */
 }
 
-#ifdef CLEANUP
+/*
+ * Index the directories of the mapped cache file, without looking at the
+ * files.  Return false if the file is malformed.
+ */
+static bool
+DirCache_Index(const char *p, const char *end)
+{
+	size_t magicLen = sizeof DIRCACHE_MAGIC - 1;
+
+	if ((size_t)(end - p) < magicLen ||
+	    memcmp(p, DIRCACHE_MAGIC, magicLen) != 0)
+		return false;
+	p += magicLen;
+
+	while (p < end) {
+		unsigned long long mtime, count, size;
+		const char *nl;
+		char *name;
+		HashEntry *he;
+		DirCacheEntry *ent;
+		bool isNew;
+
+		if (end - p < 2 || p[0] != 'D' || p[1] != ' ')
+			return false;
+		p += 2;
+		if (!ParseCacheNum(&p, end, &mtime) ||
+		    !ParseCacheNum(&p, end, &count) ||
+		    !ParseCacheNum(&p, end, &size))
+			return false;
+		nl = memchr(p, '\n', (size_t)(end - p));
+		if (nl == NULL || nl == p || size > (size_t)(end - nl - 1) ||
+		    count > size)
+			return false;
+
+		name = bmake_strsedup(p, nl);
+		he = HashTable_CreateEntry(&dirCache, name, &isNew);
+		free(name);
+		if (isNew)
+			HashEntry_Set(he, bmake_malloc(sizeof *ent));
+		ent = HashEntry_Get(he);
+		ent->mtime = (time_t)mtime;
+		ent->numFiles = (unsigned int)count;
+		ent->files = nl + 1;
+		ent->filesLen = (size_t)size;
+
+		p = nl + 1 + size;
+	}
+	return true;
+}
+
 static void
-FreeCachedTable(HashTable *tbl)
+DirCache_Unmap(void)
+{
+	if (dirCacheData != NULL)
+		UnmapViewOfFile(dirCacheData);
+	dirCacheData = NULL;
+	if (dirCacheMap != NULL)
+		CloseHandle(dirCacheMap);
+	dirCacheMap = NULL;
+}
+
+/*
+ * Use the given file as the persistent directory cache.  Called when
+ * .MAKE.DIRCACHE is assigned to; only the first assignment counts, since
+ * some directories may already have been taken from the first file.
+ */
+void
+Dir_LoadCache(const char *file)
 {
+	HANDLE fh;
+	LARGE_INTEGER size;
+
+	if (file[0] == '\0')
+		return;
+	if (dirCacheFile != NULL) {
+		DEBUG2(DIR, "Ignoring directory cache %s, already using %s\n",
+		    file, dirCacheFile);
+		return;
+	}
+
+	dirCacheFile = isAbs(file) ? bmake_strdup(file)
+	    : str_concat3(curdir, "\\", file);
+	/* If the file is missing or malformed, write a new one. */
+	dirCacheDirty = true;
+
+	fh = CreateFileA(dirCacheFile, GENERIC_READ,
+	    FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+	    FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fh == INVALID_HANDLE_VALUE) {
+		DEBUG1(DIR, "Directory cache %s does not exist yet\n",
+		    dirCacheFile);
+		return;
+	}
+
+	/* An empty file cannot be mapped. */
+	if (GetFileSizeEx(fh, &size) != 0 && size.QuadPart > 0 &&
+	    size.QuadPart < 1024 * 1024 * 1024 &&
+	    (dirCacheMap = CreateFileMappingA(fh, NULL, PAGE_READONLY,
+		0, 0, NULL)) != NULL)
+		dirCacheData = MapViewOfFile(dirCacheMap, FILE_MAP_READ,
+		    0, 0, 0);
+	CloseHandle(fh);
+
+	if (dirCacheData == NULL ||
+	    !DirCache_Index(dirCacheData, dirCacheData + size.QuadPart)) {
+		DEBUG1(DIR, "Ignoring malformed directory cache %s\n",
+		    dirCacheFile);
+		DirCache_Unmap();
+		FreeCachedTable(&dirCache);
+		HashTable_Init(&dirCache);
+		return;
+	}
+
+	dirCacheDirty = false;
+	DEBUG2(DIR, "Using directory cache %s with %u directories\n",
+	    dirCacheFile, dirCache.numEntries);
+}
+
+/* Fill in the files of the directory from its entry in the cache file. */
+static bool
+DirCache_Fill(CachedDir *dir, const DirCacheEntry *ent)
+{
+	const char *p, *end, *nl;
+	unsigned int n = 0;
+	char name[MAXPATHLEN + 1];
+
+	end = ent->files + ent->filesLen;
+	for (p = ent->files; p < end; p = nl + 1) {
+		nl = memchr(p, '\n', (size_t)(end - p));
+		if (nl == NULL || nl == p || (size_t)(nl - p) > MAXPATHLEN)
+			break;
+		memcpy(name, p, (size_t)(nl - p));
+		name[nl - p] = '\0';
+		(void)HashSet_Add(&dir->files, name);
+		n++;
+	}
+	if (p != end || n != ent->numFiles) {
+		HashSet_Done(&dir->files);
+		HashSet_Init(&dir->files);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Record the directory that has just been read, for the cache file.
+ * A directory that was modified in the same second as it was read may be
+ * modified again without its time changing, so it is not cached.
+ */
+static void
+DirCache_Add(CachedDir *dir, const char *key, time_t readTime)
+{
+	Buffer files;
 	HashIter hi;
-	HashIter_Init(&hi, tbl);
-	while (HashIter_Next(&hi))
-		free(hi.entry->value);
-	HashTable_Done(tbl);
+	unsigned int n = 0;
+	char header[64];
+
+	if (dirCacheFile == NULL || dir->mtime == 0)
+		return;
+	dirCacheDirty = true;
+	if (!HashSet_Add(&dirCacheUpdated, key) || dir->mtime >= readTime)
+		return;
+
+	Buf_Init(&files);
+	HashIter_InitSet(&hi, &dir->files);
+	while (HashIter_Next(&hi)) {
+		Buf_AddStr(&files, hi.entry->key);
+		Buf_AddByte(&files, '\n');
+		n++;
+	}
+
+	snprintf(header, sizeof header, "D %lld %u %zu ",
+	    (long long)dir->mtime, n, files.len);
+	Buf_AddStr(&dirCacheNew, header);
+	Buf_AddStr(&dirCacheNew, key);
+	Buf_AddByte(&dirCacheNew, '\n');
+	Buf_AddBytes(&dirCacheNew, files.data, files.len);
+	Buf_Done(&files);
+}
+
+/*
+ * Write the cache file if any directory had to be read.  The file is
+ * replaced in a single step, so that sub-makes that share the cache file
+ * never see a partial file; the last one to finish wins.
+ */
+static void
+DirCache_Save(void)
+{
+	char tmp[MAXPATHLEN + 1];
+	HashIter hi;
+	FILE *f;
+	bool ok;
+
+	if (dirCacheFile == NULL || !dirCacheDirty)
+		goto done;
+
+	snprintf(tmp, sizeof tmp, "%s.%lu", dirCacheFile, myPid);
+	if ((f = fopen(tmp, "wb")) == NULL) {
+		DEBUG2(DIR, "Cannot write directory cache %s: %s\n",
+		    tmp, strerror(errno));
+		goto done;
+	}
+
+	fputs(DIRCACHE_MAGIC, f);
+	fwrite(dirCacheNew.data, 1, dirCacheNew.len, f);
+
+	/* Keep the directories that were not needed this time. */
+	HashIter_Init(&hi, &dirCache);
+	while (HashIter_Next(&hi)) {
+		DirCacheEntry *ent = hi.entry->value;
+
+		if (HashSet_Contains(&dirCacheUpdated, hi.entry->key))
+			continue;
+		fprintf(f, "D %lld %u %zu %s\n", (long long)ent->mtime,
+		    ent->numFiles, ent->filesLen, hi.entry->key);
+		fwrite(ent->files, 1, ent->filesLen, f);
+	}
+
+	ok = fflush(f) == 0 && !ferror(f);
+	ok = fclose(f) == 0 && ok;
+
+	/* The old file cannot be replaced while it is still mapped. */
+	DirCache_Unmap();
+	if (!ok || MoveFileExA(tmp, dirCacheFile,
+	    MOVEFILE_REPLACE_EXISTING) == 0) {
+		DEBUG1(DIR, "Cannot replace directory cache %s\n",
+		    dirCacheFile);
+		(void)unlink(tmp);
+	}
+
+done:
+	DirCache_Unmap();
 }
-#endif
 
 /* Clean up the directories module. */
 void
 Dir_End(void)
 {
+	DirCache_Save();
+	if (statCacheFile != NULL) {
+		DEBUG4(DIR, "Stat cache saved %d stat calls, "
+		    "using %d directory checks, "
+		    "%d entries expired by jobs (%s)\n",
+		    statCacheSaved, statCacheDirChecks, statCacheExpired,
+		    statCacheFile);
+		CloseHandle(statCacheJobsFile);
+		if (statCacheOwner) {
+			char *jobs = str_concat2(statCacheFile, ".jobs");
+
+			(void)unlink(statCacheFile);
+			(void)unlink(jobs);
+			free(jobs);
+		}
+	}
 #ifdef CLEANUP
 	CachedDir_Assign(&cur, NULL);
 	CachedDir_Assign(&dot, NULL);
@@ -510,6 +1207,13 @@ Dir_End(void)
 	SearchPath_Clear(&dirSearchPath);
 	OpenDirs_Done(&openDirs);
 	FreeCachedTable(&mtimes);
+	FreeCachedTable(&dirCache);
+	FreeCachedTable(&statCache);
+	FreeCachedTable(&statCacheDirs);
+	Buf_Done(&dirCacheNew);
+	HashSet_Done(&dirCacheUpdated);
+	free(dirCacheFile);
+	free(statCacheFile);
 #endif
 }
 
@@ -524,6 +1228,7 @@ Dir_SetPATH(void)
 	CachedDirListNode *ln;
 	bool seenDotLast = false;	/* true if we should search '.' last */
 
+	Suff_PathsChanged();
 	Global_Delete(".PATH");
 
 	if ((ln = dirSearchPath.dirs.first) != NULL) {
@@ -632,6 +1337,7 @@ DirMatchFiles(const char *pattern, CachedDir *dir, StringList *expansions)
 {
 	const char *dirName = dir->name;
 	bool isDot = dirName[0] == '.' && dirName[1] == '\0';
+	StrPattern sp;
 	HashIter hi;
 
 	/*
@@ -640,10 +1346,11 @@ DirMatchFiles(const char *pattern, CachedDir *dir, StringList *expansions)
 	 * is faster.
 	 */
 
+	StrPattern_Init(&sp, pattern);
 	HashIter_InitSet(&hi, &dir->files);
 	while (HashIter_Next(&hi)) {
 		const char *base = hi.entry->key;
-		StrMatchResult res = Str_Match(base, pattern);
+		StrMatchResult res = StrPattern_Match(&sp, base);
 		/* TODO: handle errors from res.error */
 
 		if (!res.matched)
@@ -669,6 +1376,7 @@ DirMatchFiles(const char *pattern, CachedDir *dir, StringList *expansions)
 			Lst_Append(expansions, fullName);
 		}
 	}
+	StrPattern_Done(&sp);
 }
 
 /* Find the next closing brace in 'p', taking nested braces into account. */
@@ -1372,7 +2080,7 @@ ResolveFullName(GNode *gn)
 		fullName = Dir_FindFile(gn->name, Suff_FindPath(gn));
 
 		if (fullName == NULL && gn->flags.fromDepend &&
-		    !Lst_IsEmpty(&gn->implicitParents))
+		    !GNodeVec_IsEmpty(&gn->implicitParents))
 			fullName = ResolveMovedDepends(gn);
 
 		DEBUG2(DIR, "Found '%s' as '%s'\n",
@@ -1430,53 +2138,270 @@ Dir_UpdateMTime(GNode *gn, bool forceRefresh)
 }
 
 /*
- * Read the directory and add it to the cache in openDirs.
- * If a path is given, add the directory to that path as well.
+ * Reading a directory is split in two.  DirScan_Run only touches the
+ * DirScan, so that Dir_Prefetch can run it in a worker thread; it does
+ * not even allocate from an arena.  DirScan_Finish does everything else
+ * in the main thread, such as filling in the CachedDir, the statistics
+ * and the debug output.
  */
-static CachedDir *
-CacheNewDir(const char *name, SearchPath *path)
+typedef enum DirScanResult {
+	DSR_NOT_FOUND,
+	DSR_READ,
+	DSR_CACHED		/* taken from the cache file */
+} DirScanResult;
+
+typedef struct DirScan {
+	CachedDir *dir;
+	char *key;		/* the absolute name, for the cache file */
+	const DirCacheEntry *cached; /* NULL if not in the cache file */
+	bool statted;		/* whether dir->mtime is known */
+	time_t readTime;
+	DirScanResult result;
+	Buffer names;		/* the files that were read, '\0'-terminated */
+	const char *failed;	/* the step that failed, or NULL */
+	DWORD error;
+} DirScan;
+
+static void
+DirScan_Init(DirScan *scan, const char *name)
+{
+	char abspath[MAXPATHLEN + 1];
+
+	memset(scan, 0, sizeof *scan);
+	scan->dir = CachedDir_New(name);
+	Buf_Init(&scan->names);
+	if (dirCacheFile != NULL) {
+		scan->key = bmake_strdup(
+		    _fullpath(abspath, name, MAXPATHLEN) != NULL
+		    ? abspath : name);
+		scan->cached = HashTable_FindValue(&dirCache, scan->key);
+	}
+}
+
+static void
+DirScan_Read(DirScan *scan)
 {
 	WIN32_FIND_DATAA dp;
-	CachedDir *cdir;
-	DWORD ret;
 	HANDLE d;
 
+	scan->readTime = time(NULL);
+
 	/* Suffix the dir with "\*" */
 	{
-		size_t len = strlen(name);
+		size_t len = strlen(scan->dir->name);
 		char *dir = _alloca(len + 3);
-		memcpy(dir, name, len);
+		memcpy(dir, scan->dir->name, len);
 		memcpy(dir + len, "\\*", 3);
 
 		if ((d = FindFirstFileA(dir, &dp)) == INVALID_HANDLE_VALUE) {
-			DEBUG1(DIR, "Caching %s ... not found\n", name);
-			return NULL;
+			scan->result = DSR_NOT_FOUND;
+			return;
 		}
 	}
 
-	DEBUG1(DIR, "Caching %s ...\n", name);
-
-	cdir = CachedDir_New(name);
-
 	do {
-		(void)HashSet_Add(&cdir->files, dp.cFileName);
+		Buf_AddBytes(&scan->names, dp.cFileName,
+		    strlen(dp.cFileName) + 1);
 	} while (FindNextFileA(d, &dp) != 0);
 
+	if ((scan->error = GetLastError()) != ERROR_NO_MORE_FILES)
+		scan->failed = "failed to find next file in dir";
+	if (FindClose(d) == 0 && scan->failed == NULL) {
+		scan->error = GetLastError();
+		scan->failed = "failed to close file handle";
+	}
+	scan->result = DSR_READ;
+}
+
+/*
+ * See whether the files of the directory can be taken from the cache file,
+ * which is the case if the directory has not been modified since, or else
+ * read the directory.
+ */
+static void
+DirScan_Run(DirScan *scan)
+{
+	CachedDir *cdir = scan->dir;
+	struct stat st;
+
+	if (dirCacheFile != NULL && stat(cdir->name, &st) == 0) {
+		cdir->mtime = st.st_mtime;
+		scan->statted = true;
+		if (scan->cached != NULL &&
+		    scan->cached->mtime == cdir->mtime) {
+			scan->result = DSR_CACHED;
+			return;
+		}
+	}
+	DirScan_Read(scan);
+}
+
+/* Release a directory that never made it into openDirs. */
+static void
+DirScan_Discard(DirScan *scan)
+{
+	free(scan->dir->name);
+	HashSet_Done(&scan->dir->files);
+	free(scan->dir);
+	scan->dir = NULL;
+	Buf_Done(&scan->names);
+	free(scan->key);
+}
+
+/* Fill in the directory that has been scanned, and account for it. */
+static CachedDir *
+DirScan_Finish(DirScan *scan)
+{
+	CachedDir *cdir = scan->dir;
+	const char *p, *end;
+
+	if (scan->result == DSR_CACHED && !DirCache_Fill(cdir, scan->cached)) {
+		DEBUG1(DIR, "Ignoring malformed directory cache entry "
+		    "for %s\n", cdir->name);
+		DirScan_Read(scan);
+	}
+	if (scan->result == DSR_CACHED)
+		dirCacheHits++;
+	else if (scan->statted)
+		dirCacheMisses++;
+
+	if (scan->failed != NULL)
+		Punt("%s: %s", scan->failed, strerr(scan->error));
+
+	switch (scan->result) {
+	case DSR_CACHED:
+		DEBUG1(DIR, "Caching %s ... from the directory cache\n",
+		    cdir->name);
+		break;
+	case DSR_READ:
+		end = scan->names.data + scan->names.len;
+		for (p = scan->names.data; p < end; p += strlen(p) + 1)
+			(void)HashSet_Add(&cdir->files, p);
+		DEBUG1(DIR, "Caching %s ...\n", cdir->name);
+		DirCache_Add(cdir, scan->key, scan->readTime);
+		break;
+	default:
+		DEBUG1(DIR, "Caching %s ... not found\n", cdir->name);
+		DirScan_Discard(scan);
+		return NULL;
+	}
+	Buf_Done(&scan->names);
+	free(scan->key);
+	return cdir;
+}
+
+/*
+ * Read the directory and add it to the cache in openDirs.
+ * If a path is given, add the directory to that path as well.
+ */
+static CachedDir *
+CacheNewDir(const char *name, SearchPath *path)
+{
+	DirScan scan;
+	CachedDir *cdir;
+
+	DirScan_Init(&scan, name);
+	DirScan_Run(&scan);
+	if ((cdir = DirScan_Finish(&scan)) == NULL)
+		return NULL;
+
 	OpenDirs_Add(&openDirs, cdir);
 	if (path != NULL)
 		Lst_Append(&path->dirs, CachedDir_Ref(cdir));
 
-	if ((ret = GetLastError()) != ERROR_NO_MORE_FILES)
-		Punt("failed to find next file in dir: %s",
-			strerr(ret));
-	if (FindClose(d) == 0)
-		Punt("failed to close file handle: %s",
-			strerr(GetLastError()));
-
 	DEBUG1(DIR, "Caching %s done\n", name);
 	return cdir;
 }
 
+#define DIR_PREFETCH_THREADS 8
+
+typedef struct DirPrefetch {
+	DirScan *scans;
+	LONG numScans;
+	volatile LONG next;	/* the next scan to run */
+} DirPrefetch;
+
+static DWORD WINAPI
+DirPrefetch_Worker(LPVOID arg)
+{
+	DirPrefetch *pf = arg;
+	LONG i;
+
+	while ((i = InterlockedIncrement(&pf->next) - 1) < pf->numScans)
+		DirScan_Run(&pf->scans[i]);
+	return 0;
+}
+
+/*
+ * Read the directories that are not cached yet in parallel, so that the
+ * following calls to SearchPath_Add find them in openDirs.  On a network
+ * drive, reading a directory takes several round trips to the server, and
+ * this lets them overlap.
+ *
+ * The directories are added to openDirs in the given order, with the same
+ * debug output as if SearchPath_Add had read them one after another.
+ * Directories that do not exist are left to SearchPath_Add.
+ */
+void
+Dir_Prefetch(StringList *names)
+{
+	DirPrefetch pf;
+	HANDLE threads[DIR_PREFETCH_THREADS];
+	DWORD numThreads = 0;
+	StringListNode *ln;
+	HashSet seen;
+	LONG i, n = 0;
+
+	for (ln = names->first; ln != NULL; ln = ln->next)
+		n++;
+	if (n < 2)
+		return;
+
+	pf.scans = bmake_malloc((size_t)n * sizeof *pf.scans);
+	pf.numScans = 0;
+	pf.next = 0;
+	HashSet_Init(&seen);
+	for (ln = names->first; ln != NULL; ln = ln->next) {
+		const char *name = ln->datum;
+		if (strcmp(name, ".DOTLAST") == 0 ||
+		    OpenDirs_Find(&openDirs, name) != NULL ||
+		    !HashSet_Add(&seen, name))
+			continue;
+		DirScan_Init(&pf.scans[pf.numScans++], name);
+	}
+	HashSet_Done(&seen);
+
+	/* The main thread takes part in the work as well. */
+	while (numThreads + 1 < DIR_PREFETCH_THREADS &&
+	       (LONG)numThreads + 1 < pf.numScans) {
+		HANDLE t = CreateThread(NULL, 0, DirPrefetch_Worker, &pf, 0,
+		    NULL);
+		if (t == NULL)
+			break;
+		threads[numThreads++] = t;
+	}
+	(void)DirPrefetch_Worker(&pf);
+	if (numThreads > 0)
+		(void)WaitForMultipleObjects(numThreads, threads, TRUE,
+		    INFINITE);
+	for (i = 0; i < (LONG)numThreads; i++)
+		CloseHandle(threads[i]);
+
+	for (i = 0; i < pf.numScans; i++) {
+		DirScan *scan = &pf.scans[i];
+		CachedDir *cdir;
+
+		if (scan->result == DSR_NOT_FOUND && scan->failed == NULL) {
+			DirScan_Discard(scan);
+			continue;
+		}
+		cdir = DirScan_Finish(scan);
+		OpenDirs_Add(&openDirs, cdir);
+		DEBUG1(DIR, "Caching %s done\n", cdir->name);
+	}
+	free(pf.scans);
+}
+
 /*
  * Read the list of filenames in the directory 'name' and store the result
  * in 'openDirs'.
@@ -1541,6 +2466,64 @@ Dir_CopyDirSearchPath(void)
 	return path;
 }
 
+/* Write the names of the directories to the snapshot, see snapshot.c. */
+void
+SearchPath_SaveSnapshot(SearchPath *path)
+{
+	CachedDirListNode *ln;
+	size_t n = 0;
+
+	for (ln = path->dirs.first; ln != NULL; ln = ln->next)
+		n++;
+	Snapshot_PutNum(n);
+	for (ln = path->dirs.first; ln != NULL; ln = ln->next) {
+		CachedDir *dir = ln->datum;
+		Snapshot_PutStr(dir->name);
+	}
+}
+
+/*
+ * Replace the directories of the search path with those from the snapshot.
+ * The directories are read again, or taken from the directory cache.
+ */
+void
+SearchPath_RestoreSnapshot(SearchPath *path)
+{
+	unsigned long long n;
+
+	SearchPath_Clear(path);
+	for (n = Snapshot_GetNum(); n > 0; n--) {
+		char *name = Snapshot_GetStr();
+
+		if (strcmp(name, ".DOTLAST") == 0)
+			Lst_Append(&path->dirs, CachedDir_Ref(dotLast));
+		else
+			(void)SearchPath_Add(path, name);
+		free(name);
+	}
+}
+
+/*
+ * Do not use the snapshot of this run once the file appears in one of the
+ * directories of the search path.
+ */
+void
+SearchPath_AddSnapshotDeps(SearchPath *path, const char *file)
+{
+	CachedDirListNode *ln;
+
+	for (ln = path->dirs.first; ln != NULL; ln = ln->next) {
+		CachedDir *dir = ln->datum;
+		char *fullName;
+
+		if (dir == dotLast)
+			continue;
+		fullName = str_concat3(dir->name, "\\", file);
+		Snapshot_AddDep(fullName);
+		free(fullName);
+	}
+}
+
 /*
  * Make a string by taking all the directories in the given search path and
  * preceding them by the given flag. Used by the suffix module to create
@@ -1627,6 +2610,9 @@ Dir_PrintDirectories(void)
 	    "# Stats: %d hits %d misses %d near misses %d losers (%d%%)\n",
 	    hits, misses, nearmisses, bigmisses,
 	    percentage(hits, hits + bigmisses + nearmisses));
+	if (dirCacheFile != NULL)
+		debug_printf("# Directory cache %s: %d hits %d misses\n",
+		    dirCacheFile, dirCacheHits, dirCacheMisses);
 	debug_printf("#  refs  hits  directory\n");
 
 	for (ln = openDirs.list.first; ln != NULL; ln = ln->next) {
@@ -90,12 +90,20 @@ char *Dir_FindInclude(const char *, SearchPath *) MAKE_ATTR_USE;
 char *Dir_FindHereOrAbove(const char *, const char *) MAKE_ATTR_USE;
 void Dir_UpdateMTime(GNode *, bool);
 CachedDir *SearchPath_Add(SearchPath *, const char *);
+void Dir_Prefetch(StringList *);
 char *SearchPath_ToFlags(SearchPath *, const char *) MAKE_ATTR_USE;
 void SearchPath_Clear(SearchPath *);
 void SearchPath_AddAll(SearchPath *, SearchPath *);
+void Dir_LoadCache(const char *);
+void Dir_SetStatCache(const char *);
+void Dir_SaveStatCache(void);
+void Dir_ExpireStatCache(void);
 void Dir_PrintDirectories(void);
 void SearchPath_Print(const SearchPath *);
 SearchPath *Dir_CopyDirSearchPath(void) MAKE_ATTR_USE;
+void SearchPath_SaveSnapshot(SearchPath *);
+void SearchPath_RestoreSnapshot(SearchPath *);
+void SearchPath_AddSnapshotDeps(SearchPath *, const char *);
 
 /* Stripped-down variant of struct stat. */
 struct cached_stat {
@@ -0,0 +1,457 @@
+/* Out-of-date checks by the content of the files, see .MAKE.OODATE_MODE */
+
+/*
+ * Interface:
+ *	FileHash_Init	If .MAKE.OODATE_MODE is "hash", load the database
+ *			named by .MAKE.OODATE_DB and hash the files in it
+ *			that have been modified since the last run.
+ *
+ *	FileHash_End	Hash the files that are new to the database and
+ *			write it back.
+ *
+ *	FileHash_MTime	Replace the modification time of a node with the
+ *			time at which its content last changed.
+ *
+ *	FileHash_Made	Record that a node has just been made.
+ *
+ * With .MAKE.OODATE_MODE=hash, a file whose modification time changed but
+ * whose content did not, for example after a 'git checkout' or after a
+ * restore from a cache, keeps the modification time it had before.  The
+ * rest of make still compares modification times, it just gets to see
+ * those of the content.
+ *
+ * For each file, the database has its modification time, the time at
+ * which its content last changed, and a hash of the content.  A file is
+ * only hashed when its modification time differs from the one in the
+ * database, so an unmodified tree is not read at all.  A file that make
+ * sees for the first time, or that it has just made, is entered with an
+ * unknown hash, which FileHash_End fills in.
+ *
+ * The database is relative to .OBJDIR.  It starts with FILEHASH_MAGIC,
+ * followed by one record per file:
+ *
+ *	8 bytes		the modification time, little-endian
+ *	8 bytes		the time at which the content changed, little-endian
+ *	8 bytes		the hash of the content, 0 if unknown
+ *	2 bytes		the length of the path, little-endian
+ *	<length> bytes	the path, as in GNode.path
+ */
+
+#include <sys/stat.h>
+
+#include "make.h"
+
+#define FILEHASH_MAGIC "bmake hashes 1\n"
+
+/* The number of threads that hash the files in FileHash_Init. */
+#define FILEHASH_THREADS 8
+
+typedef struct FileHashEntry {
+	time_t mtime;		/* when the file was last modified */
+	time_t changed;		/* when its content was last changed */
+	ULONGLONG hash;		/* of the content, 0 if unknown */
+} FileHashEntry;
+
+static bool hashMode = false;	/* .MAKE.OODATE_MODE=hash */
+static char *dbFile = NULL;
+static HashTable db;		/* the FileHashEntry of each path */
+static bool dbDirty = false;
+
+/* Statistics for -dm */
+static unsigned int numHashed;
+static unsigned int numUnchanged;
+
+/*
+ * Hash the content of the file.  This runs in the worker threads as well,
+ * so it must not touch any data of make.  Return 0 if the file cannot be
+ * read.
+ */
+static ULONGLONG
+FileHash_Compute(const char *path)
+{
+	const ULONGLONG prime = 0x9e3779b97f4a7c15ULL;
+	unsigned char buf[0x10000];
+	ULONGLONG h = prime, size = 0;
+	DWORD n, i;
+	HANDLE f;
+	bool ok;
+
+	f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+	    NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (f == INVALID_HANDLE_VALUE)
+		return 0;
+
+	while ((ok = ReadFile(f, buf, sizeof buf, &n, NULL)) && n > 0) {
+		/* Pad the last word with zeros; the size tells them apart. */
+		for (i = n; i % 8 != 0; i++)
+			buf[i] = 0;
+		for (i = 0; i < n; i += 8) {
+			ULONGLONG w;
+			memcpy(&w, buf + i, 8);
+			h = (h ^ w) * prime;
+			h ^= h >> 29;
+		}
+		size += n;
+	}
+	CloseHandle(f);
+	if (!ok)
+		return 0;
+
+	h = (h ^ size) * prime;
+	h ^= h >> 32;
+	return h != 0 ? h : 1;
+}
+
+/*
+ * The file has been modified, and its content now has the given hash.
+ * If the content is the same as before, keep the time at which it
+ * changed.
+ */
+static void
+FileHashEntry_Update(FileHashEntry *ent, time_t mtime, ULONGLONG hash)
+{
+	if (hash == 0 || hash != ent->hash)
+		ent->changed = mtime;
+	else
+		numUnchanged++;
+	ent->mtime = mtime;
+	ent->hash = hash;
+	dbDirty = true;
+}
+
+static void
+FileHash_WriteInt(FILE *f, ULONGLONG x, size_t len)
+{
+	unsigned char b[8];
+	size_t i;
+
+	for (i = 0; i < len; i++, x >>= 8)
+		b[i] = (unsigned char)x;
+	fwrite(b, 1, len, f);
+}
+
+static ULONGLONG
+FileHash_ReadInt(const unsigned char *b, size_t len)
+{
+	ULONGLONG x = 0;
+
+	while (len-- > 0)
+		x = x << 8 | b[len];
+	return x;
+}
+
+/* Return false if the file is not a database. */
+static bool
+FileHash_Read(FILE *f)
+{
+	char magic[sizeof FILEHASH_MAGIC - 1];
+	unsigned char rec[26];
+	char *path;
+
+	if (fread(magic, 1, sizeof magic, f) != sizeof magic ||
+	    memcmp(magic, FILEHASH_MAGIC, sizeof magic) != 0)
+		return false;
+
+	path = bmake_malloc(0x10000);
+	while (fread(rec, 1, sizeof rec, f) == sizeof rec) {
+		size_t len = (size_t)FileHash_ReadInt(rec + 24, 2);
+		FileHashEntry *ent;
+
+		if (fread(path, 1, len, f) != len)
+			break;
+		path[len] = '\0';
+		ent = bmake_malloc(sizeof *ent);
+		ent->mtime = (time_t)FileHash_ReadInt(rec, 8);
+		ent->changed = (time_t)FileHash_ReadInt(rec + 8, 8);
+		ent->hash = FileHash_ReadInt(rec + 16, 8);
+		free(HashTable_FindValue(&db, path));
+		HashTable_Set(&db, path, ent);
+	}
+	free(path);
+	return true;
+}
+
+/*
+ * Replace the database in a single step, like the directory cache, so
+ * that a make that is killed leaves the old one.
+ */
+static void
+FileHash_Write(void)
+{
+	char tmp[MAXPATHLEN + 1];
+	HashIter hi;
+	FILE *f;
+	bool ok;
+
+	snprintf(tmp, sizeof tmp, "%s.%lu", dbFile, myPid);
+	if ((f = fopen(tmp, "wb")) == NULL) {
+		DEBUG2(MAKE, "Cannot write hash database %s: %s\n",
+		    tmp, strerror(errno));
+		return;
+	}
+
+	fputs(FILEHASH_MAGIC, f);
+	HashIter_Init(&hi, &db);
+	while (HashIter_Next(&hi)) {
+		const char *path = hi.entry->key;
+		FileHashEntry *ent = hi.entry->value;
+		size_t len = strlen(path);
+
+		if (len > 0xffff)
+			continue;
+		FileHash_WriteInt(f, (ULONGLONG)ent->mtime, 8);
+		FileHash_WriteInt(f, (ULONGLONG)ent->changed, 8);
+		FileHash_WriteInt(f, ent->hash, 8);
+		FileHash_WriteInt(f, len, 2);
+		fwrite(path, 1, len, f);
+	}
+
+	ok = fflush(f) == 0 && !ferror(f);
+	ok = fclose(f) == 0 && ok;
+	if (!ok || MoveFileExA(tmp, dbFile, MOVEFILE_REPLACE_EXISTING) == 0) {
+		DEBUG1(MAKE, "Cannot replace hash database %s\n", dbFile);
+		(void)unlink(tmp);
+	}
+}
+
+/*
+ * Checking a file is split in two, like reading a directory in dir.c.
+ * FileCheck_Run only touches the FileCheck, so that it can run in a worker
+ * thread.  FileHash_Init does everything else in the main thread.
+ */
+typedef struct FileCheck {
+	HashEntry *he;		/* in db */
+	const char *path;
+	FileHashEntry *ent;
+	bool exists;
+	time_t mtime;
+	ULONGLONG hash;		/* 0 if the file was not hashed */
+} FileCheck;
+
+typedef struct FileCheckQueue {
+	FileCheck *checks;
+	LONG numChecks;
+	volatile LONG next;	/* the next check to run */
+} FileCheckQueue;
+
+static void
+FileCheck_Run(FileCheck *fc)
+{
+	struct stat st;
+
+	if (stat(fc->path, &st) != 0)
+		return;
+	fc->exists = true;
+	fc->mtime = st.st_mtime != 0 ? st.st_mtime : 1;
+	if (fc->mtime != fc->ent->mtime || fc->ent->hash == 0)
+		fc->hash = FileHash_Compute(fc->path);
+}
+
+static DWORD WINAPI
+FileCheck_Worker(LPVOID arg)
+{
+	FileCheckQueue *q = arg;
+	LONG i;
+
+	while ((i = InterlockedIncrement(&q->next) - 1) < q->numChecks)
+		FileCheck_Run(&q->checks[i]);
+	return 0;
+}
+
+/*
+ * Check the files in the database in parallel, either all of them or only
+ * those whose hash is not known yet.  Files that no longer exist are
+ * removed, and those that have been modified are hashed.
+ */
+static void
+FileHash_Check(bool unhashedOnly)
+{
+	FileCheckQueue q;
+	HANDLE threads[FILEHASH_THREADS];
+	DWORD numThreads = 0;
+	HashIter hi;
+	LONG i;
+
+	q.checks = bmake_malloc((db.numEntries + 1) * sizeof *q.checks);
+	q.numChecks = 0;
+	q.next = 0;
+	HashIter_Init(&hi, &db);
+	while (HashIter_Next(&hi)) {
+		FileCheck *fc;
+
+		if (unhashedOnly &&
+		    ((FileHashEntry *)hi.entry->value)->hash != 0)
+			continue;
+		fc = &q.checks[q.numChecks++];
+		fc->he = hi.entry;
+		fc->path = hi.entry->key;
+		fc->ent = hi.entry->value;
+		fc->exists = false;
+		fc->hash = 0;
+	}
+
+	/* The main thread takes part in the work as well. */
+	while (numThreads + 1 < FILEHASH_THREADS &&
+	       (LONG)numThreads + 1 < q.numChecks) {
+		HANDLE t = CreateThread(NULL, 0, FileCheck_Worker, &q, 0, NULL);
+		if (t == NULL)
+			break;
+		threads[numThreads++] = t;
+	}
+	(void)FileCheck_Worker(&q);
+	if (numThreads > 0)
+		(void)WaitForMultipleObjects(numThreads, threads, TRUE,
+		    INFINITE);
+	for (i = 0; i < (LONG)numThreads; i++)
+		CloseHandle(threads[i]);
+
+	for (i = 0; i < q.numChecks; i++) {
+		FileCheck *fc = &q.checks[i];
+
+		if (!fc->exists) {
+			free(fc->ent);
+			HashTable_DeleteEntry(&db, fc->he);
+			dbDirty = true;
+		} else if (fc->mtime != fc->ent->mtime) {
+			numHashed++;
+			FileHashEntry_Update(fc->ent, fc->mtime, fc->hash);
+		} else if (fc->hash != 0) {
+			numHashed++;
+			fc->ent->hash = fc->hash;
+			dbDirty = true;
+		}
+	}
+	free(q.checks);
+}
+
+void
+FileHash_Init(void)
+{
+	char *mode = Var_Subst("${.MAKE.OODATE_MODE:U:tl}",
+	    SCOPE_GLOBAL, VARE_EVAL);
+	/* TODO: handle errors */
+	FILE *f;
+
+	if (mode[0] == '\0' || strcmp(mode, "mtime") == 0)
+		hashMode = false;
+	else if (strcmp(mode, "hash") == 0)
+		hashMode = true;
+	else
+		Punt("illegal value for .MAKE.OODATE_MODE: %s", mode);
+	free(mode);
+
+	HashTable_Init(&db);
+	if (!hashMode)
+		return;
+
+	dbFile = Var_Subst("${.MAKE.OODATE_DB:U.make.hashes}",
+	    SCOPE_GLOBAL, VARE_EVAL);
+	/* TODO: handle errors */
+	if ((f = fopen(dbFile, "rb")) != NULL) {
+		if (!FileHash_Read(f))
+			dbDirty = true;
+		fclose(f);
+	}
+
+	FileHash_Check(false);
+	DEBUG4(MAKE, "Hash database %s has %u files, "
+		     "%u hashed, %u with the same content\n",
+	    dbFile, db.numEntries, numHashed, numUnchanged);
+}
+
+void
+FileHash_End(void)
+{
+#ifdef CLEANUP
+	HashIter hi;
+#endif
+
+	if (dbFile != NULL) {
+		FileHash_Check(true);
+		if (dbDirty)
+			FileHash_Write();
+	}
+	dbDirty = false;
+#ifdef CLEANUP
+	HashIter_Init(&hi, &db);
+	while (HashIter_Next(&hi))
+		free(hi.entry->value);
+	HashTable_Done(&db);
+	free(dbFile);
+	dbFile = NULL;
+#endif
+}
+
+static bool
+FileHash_Applies(const GNode *gn)
+{
+	return hashMode && gn->mtime != 0 && gn->path != NULL &&
+	       !(gn->type & (OP_ARCHV | OP_MEMBER | OP_PHONY));
+}
+
+/*
+ * Replace gn->mtime, which Dir_UpdateMTime has just set, with the time at
+ * which the content of the file last changed.
+ */
+void
+FileHash_MTime(GNode *gn)
+{
+	FileHashEntry *ent;
+	bool isNew;
+	HashEntry *he;
+
+	if (!FileHash_Applies(gn))
+		return;
+
+	he = HashTable_CreateEntry(&db, gn->path, &isNew);
+	if (isNew) {
+		ent = bmake_malloc(sizeof *ent);
+		ent->mtime = gn->mtime;
+		ent->changed = gn->mtime;
+		ent->hash = 0;
+		he->value = ent;
+		dbDirty = true;
+		return;
+	}
+
+	ent = he->value;
+	if (ent->mtime != gn->mtime) {
+		/* Modified since FileHash_Init. */
+		numHashed++;
+		FileHashEntry_Update(ent, gn->mtime,
+		    FileHash_Compute(gn->path));
+	}
+	if (ent->changed != gn->mtime) {
+		DEBUG1(MAKE, "content unchanged since %s...",
+		    Targ_FmtTime(ent->changed));
+		gn->mtime = ent->changed;
+	}
+}
+
+/*
+ * The node has just been made, and Dir_UpdateMTime has set gn->mtime.  If
+ * the file was modified, its content counts as changed even if it is the
+ * same as before, since otherwise the node would look out of date again in
+ * the next run.  It is hashed in FileHash_End.
+ */
+void
+FileHash_Made(GNode *gn)
+{
+	FileHashEntry *ent;
+
+	if (!FileHash_Applies(gn))
+		return;
+
+	ent = HashTable_FindValue(&db, gn->path);
+	if (ent == NULL) {
+		ent = bmake_malloc(sizeof *ent);
+		HashTable_Set(&db, gn->path, ent);
+	} else if (ent->mtime == gn->mtime) {
+		gn->mtime = ent->changed;
+		return;
+	}
+	ent->mtime = gn->mtime;
+	ent->changed = gn->mtime;
+	ent->hash = 0;
+	dbDirty = true;
+}
@@ -0,0 +1,143 @@
+/* Tracing the files that a job accesses, using filemon.dll; see filemon.h */
+
+#include "../make.h"
+#include "../proc.h"
+#include "filemon.h"
+
+struct filemon {
+	char output[MAXPATHLEN];	/* where the DLL writes the records */
+	char env[sizeof FILEMON_ENV + MAXPATHLEN];	/* FILEMON_ENV=output */
+};
+
+/*
+ * The DLL is installed next to bmake.exe.  In the build tree, it is in
+ * the subdirectory that builds it.
+ */
+const char *
+filemon_path(void)
+{
+	static char path[MAXPATHLEN];
+	static const char *const names[] = {
+		"filemon.dll", "filemon\\filemon.dll"
+	};
+	char *dir;
+	size_t i;
+
+	if (path[0] != '\0')
+		return path;
+
+	if (GetModuleFileNameA(NULL, path, sizeof path) == 0 ||
+	    (dir = strrchr(path, '\\')) == NULL)
+		return strcpy(path, names[0]);
+	dir++;
+	for (i = 0; i < sizeof names / sizeof names[0]; i++) {
+		strlcpy(dir, names[i], sizeof path - (size_t)(dir - path));
+		if (GetFileAttributesA(path) != INVALID_FILE_ATTRIBUTES)
+			break;
+	}
+	if (i == sizeof names / sizeof names[0])
+		strlcpy(dir, names[0], sizeof path - (size_t)(dir - path));
+	return path;
+}
+
+/*
+ * Prepare an empty output file.  Return NULL if the DLL or the file is
+ * not available.
+ */
+struct filemon *
+filemon_open(void)
+{
+	struct filemon *fm;
+
+	if (GetFileAttributesA(filemon_path()) == INVALID_FILE_ATTRIBUTES)
+		return NULL;
+
+	fm = bmake_malloc(sizeof *fm);
+	if (GetTempFileNameA(getTmpdir(), "fm", 0, fm->output) == 0) {
+		free(fm);
+		return NULL;
+	}
+	snprintf(fm->env, sizeof fm->env, "%s=%s", FILEMON_ENV, fm->output);
+	return fm;
+}
+
+void
+filemon_close(struct filemon *fm)
+{
+	(void)DeleteFileA(fm->output);
+	free(fm);
+}
+
+const char *
+filemon_output(const struct filemon *fm)
+{
+	return fm->output;
+}
+
+/*
+ * The entry that tells the DLL the name of the output file, for the
+ * environment of the child.
+ */
+const char *
+filemon_env(const struct filemon *fm)
+{
+	return fm->env;
+}
+
+/*
+ * Load the DLL in the process, by running LoadLibraryA in a new thread of
+ * it.  kernel32.dll is mapped at the same address in all processes of the
+ * same architecture, so the address of LoadLibraryA in make is valid in
+ * the child as well.
+ */
+static bool
+filemon_inject(HANDLE process)
+{
+	const char *dll = filemon_path();
+	size_t size = strlen(dll) + 1;
+	FARPROC loadLibrary;
+	BOOL makeWow64, childWow64;
+	HANDLE thread;
+	void *remote;
+	DWORD loaded = 0;
+
+	if (!IsWow64Process(GetCurrentProcess(), &makeWow64) ||
+	    !IsWow64Process(process, &childWow64))
+		return false;
+	if (makeWow64 != childWow64) {
+		SetLastError(ERROR_BAD_EXE_FORMAT);
+		return false;
+	}
+
+	loadLibrary = GetProcAddress(GetModuleHandleA("kernel32.dll"),
+	    "LoadLibraryA");
+	remote = VirtualAllocEx(process, NULL, size, MEM_COMMIT | MEM_RESERVE,
+	    PAGE_READWRITE);
+	if (loadLibrary == NULL || remote == NULL)
+		return false;
+
+	if (WriteProcessMemory(process, remote, dll, size, NULL) &&
+	    (thread = CreateRemoteThread(process, NULL, 0,
+		(LPTHREAD_START_ROUTINE)(void *)loadLibrary, remote, 0,
+		NULL)) != NULL) {
+		WaitForSingleObject(thread, INFINITE);
+		GetExitCodeThread(thread, &loaded);
+		CloseHandle(thread);
+	}
+	VirtualFreeEx(process, remote, 0, MEM_RELEASE);
+	return loaded != 0;
+}
+
+/*
+ * Start tracing the child, which was started with PROC_SUSPENDED, and
+ * let it run.  If the DLL cannot be loaded in the child, it runs without.
+ */
+bool
+filemon_setproc(struct filemon *fm MAKE_ATTR_UNUSED, Proc *proc)
+{
+	bool ok;
+
+	ok = filemon_inject(proc->handle);
+	Proc_Resume(proc);
+	return ok;
+}
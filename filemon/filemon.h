@@ -0,0 +1,48 @@
+/* Tracing the files that the processes of a job access, for meta mode */
+
+/*
+ * This plays the part of filemon(4) on NetBSD and FreeBSD.  make injects
+ * filemon.dll into the child of a job, and the DLL injects itself into
+ * every process that the child starts in turn.  Each process appends a
+ * line to the output file for each file it opens, creates, removes or
+ * runs, in the format that filemon(4) uses:
+ *
+ *	C pid path		changed its working directory
+ *	D pid path		removed a file
+ *	E pid path		runs the program
+ *	F pid child		started a child process
+ *	L pid 'from' 'to'	created a hard link
+ *	M pid 'from' 'to'	renamed a file
+ *	R pid path		opened a file for reading
+ *	W pid path		opened a file for writing
+ *	X pid status		exited
+ *
+ * The paths are absolute.  The DLL finds the output file through the
+ * environment variable FILEMON_ENV.
+ *
+ * Usage:
+ *	fm = filemon_open();
+ *	env = Var_Environment(gn, filemon_env(fm));
+ *	Proc_Spawn(&proc, ..., env, ..., PROC_SUSPENDED);
+ *	filemon_setproc(fm, &proc);	(this lets the child run)
+ *	...
+ *	copy the file filemon_output(fm)
+ *	filemon_close(fm);
+ */
+
+#ifndef MAKE_FILEMON_H
+#define MAKE_FILEMON_H
+
+#define FILEMON_ENV	"BMAKE_FILEMON"
+
+struct filemon;
+struct Proc;
+
+const char *filemon_path(void);
+struct filemon *filemon_open(void);
+void filemon_close(struct filemon *);
+const char *filemon_output(const struct filemon *);
+const char *filemon_env(const struct filemon *);
+bool filemon_setproc(struct filemon *, struct Proc *);
+
+#endif
@@ -0,0 +1,619 @@
+/* The DLL that records the files a process tree accesses; see filemon.h */
+
+/*
+ * When the DLL is loaded, it redirects the file and process functions of
+ * kernel32.dll and kernelbase.dll that the other modules of the process
+ * import, by replacing the entries in their import address tables.  The
+ * modules that are loaded later are patched by the hooks of the
+ * LoadLibrary functions.
+ *
+ * Each call that succeeds appends a record to the file that is named by
+ * FILEMON_ENV.  Each record is written by a single WriteFile to a handle
+ * that only has FILE_APPEND_DATA access, so the records of the threads and
+ * processes do not mix.
+ *
+ * Child processes are created suspended, the DLL is loaded into them the
+ * same way as make does it for the job, and then they are resumed.  A
+ * child that gets an environment without FILEMON_ENV is not traced.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "filemon.h"
+
+/* Paths are converted to the ANSI code page, like the paths in make. */
+#define PATHSZ	(4 * MAX_PATH)
+
+static HMODULE self;
+static HANDLE output = INVALID_HANDLE_VALUE;
+static DWORD pid;
+static CRITICAL_SECTION patchLock;
+
+static HANDLE (WINAPI *Real_CreateFileA)(LPCSTR, DWORD, DWORD,
+    LPSECURITY_ATTRIBUTES, DWORD, DWORD, HANDLE);
+static HANDLE (WINAPI *Real_CreateFileW)(LPCWSTR, DWORD, DWORD,
+    LPSECURITY_ATTRIBUTES, DWORD, DWORD, HANDLE);
+static HANDLE (WINAPI *Real_CreateFile2)(LPCWSTR, DWORD, DWORD, DWORD,
+    LPCREATEFILE2_EXTENDED_PARAMETERS);
+static BOOL (WINAPI *Real_DeleteFileA)(LPCSTR);
+static BOOL (WINAPI *Real_DeleteFileW)(LPCWSTR);
+static BOOL (WINAPI *Real_MoveFileA)(LPCSTR, LPCSTR);
+static BOOL (WINAPI *Real_MoveFileW)(LPCWSTR, LPCWSTR);
+static BOOL (WINAPI *Real_MoveFileExA)(LPCSTR, LPCSTR, DWORD);
+static BOOL (WINAPI *Real_MoveFileExW)(LPCWSTR, LPCWSTR, DWORD);
+static BOOL (WINAPI *Real_CreateHardLinkA)(LPCSTR, LPCSTR,
+    LPSECURITY_ATTRIBUTES);
+static BOOL (WINAPI *Real_CreateHardLinkW)(LPCWSTR, LPCWSTR,
+    LPSECURITY_ATTRIBUTES);
+static BOOL (WINAPI *Real_SetCurrentDirectoryA)(LPCSTR);
+static BOOL (WINAPI *Real_SetCurrentDirectoryW)(LPCWSTR);
+static BOOL (WINAPI *Real_CreateProcessA)(LPCSTR, LPSTR,
+    LPSECURITY_ATTRIBUTES, LPSECURITY_ATTRIBUTES, BOOL, DWORD, LPVOID,
+    LPCSTR, LPSTARTUPINFOA, LPPROCESS_INFORMATION);
+static BOOL (WINAPI *Real_CreateProcessW)(LPCWSTR, LPWSTR,
+    LPSECURITY_ATTRIBUTES, LPSECURITY_ATTRIBUTES, BOOL, DWORD, LPVOID,
+    LPCWSTR, LPSTARTUPINFOW, LPPROCESS_INFORMATION);
+static HMODULE (WINAPI *Real_LoadLibraryA)(LPCSTR);
+static HMODULE (WINAPI *Real_LoadLibraryW)(LPCWSTR);
+static HMODULE (WINAPI *Real_LoadLibraryExA)(LPCSTR, HANDLE, DWORD);
+static HMODULE (WINAPI *Real_LoadLibraryExW)(LPCWSTR, HANDLE, DWORD);
+static VOID (WINAPI *Real_ExitProcess)(UINT);
+
+static void
+Record(const char *fmt, ...)
+{
+	char buf[3 * PATHSZ];
+	va_list ap;
+	DWORD written;
+	int n;
+
+	if (output == INVALID_HANDLE_VALUE)
+		return;
+	va_start(ap, fmt);
+	n = vsnprintf(buf, sizeof buf, fmt, ap);
+	va_end(ap);
+	if (n > 0 && (size_t)n < sizeof buf)
+		WriteFile(output, buf, (DWORD)n, &written, NULL);
+}
+
+/*
+ * Convert a file name to an absolute path in the ANSI code page.  Devices
+ * and pipes are skipped.
+ */
+static bool
+FullPathW(const WCHAR *name, char *path)
+{
+	WCHAR full[PATHSZ];
+	const WCHAR *p = full;
+	DWORD n;
+
+	if (name == NULL)
+		return false;
+	n = GetFullPathNameW(name, PATHSZ, full, NULL);
+	if (n == 0 || n >= PATHSZ)
+		return false;
+	if (wcsncmp(p, L"\\\\?\\", 4) == 0)
+		p += 4;
+	else if (wcsncmp(p, L"\\\\.\\", 4) == 0)
+		return false;
+	return WideCharToMultiByte(CP_ACP, 0, p, -1, path, PATHSZ,
+	    NULL, NULL) != 0;
+}
+
+static bool
+FullPathA(const char *name, char *path)
+{
+	WCHAR wname[PATHSZ];
+
+	if (name == NULL ||
+	    MultiByteToWideChar(CP_ACP, 0, name, -1, wname, PATHSZ) == 0)
+		return false;
+	return FullPathW(wname, path);
+}
+
+static bool
+IsWrite(DWORD access, DWORD disposition)
+{
+	return (access & (GENERIC_WRITE | GENERIC_ALL | FILE_WRITE_DATA |
+			  FILE_APPEND_DATA)) != 0 ||
+	       disposition == CREATE_ALWAYS || disposition == CREATE_NEW ||
+	       disposition == TRUNCATE_EXISTING;
+}
+
+static void
+RecordOpen(const WCHAR *name, DWORD access, DWORD disposition)
+{
+	char path[PATHSZ];
+
+	if (FullPathW(name, path))
+		Record("%c %lu %s\n", IsWrite(access, disposition) ? 'W' : 'R',
+		    pid, path);
+}
+
+static void
+RecordPath(char op, const WCHAR *name)
+{
+	char path[PATHSZ];
+
+	if (FullPathW(name, path))
+		Record("%c %lu %s\n", op, pid, path);
+}
+
+static void
+RecordPaths(char op, const WCHAR *from, const WCHAR *to)
+{
+	char fromPath[PATHSZ], toPath[PATHSZ];
+
+	if (FullPathW(from, fromPath) && FullPathW(to, toPath))
+		Record("%c %lu '%s' '%s'\n", op, pid, fromPath, toPath);
+}
+
+/* Like make does for the job, see filemon_inject in filemon.c. */
+static bool
+Inject(HANDLE process)
+{
+	WCHAR dll[MAX_PATH];
+	DWORD len = GetModuleFileNameW(self, dll, MAX_PATH);
+	size_t size = (len + 1) * sizeof dll[0];
+	FARPROC loadLibrary;
+	BOOL parentWow64, childWow64;
+	HANDLE thread;
+	void *remote;
+	DWORD loaded = 0;
+
+	if (len == 0 || len >= MAX_PATH ||
+	    !IsWow64Process(GetCurrentProcess(), &parentWow64) ||
+	    !IsWow64Process(process, &childWow64) ||
+	    parentWow64 != childWow64)
+		return false;
+
+	loadLibrary = GetProcAddress(GetModuleHandleW(L"kernel32.dll"),
+	    "LoadLibraryW");
+	remote = VirtualAllocEx(process, NULL, size, MEM_COMMIT | MEM_RESERVE,
+	    PAGE_READWRITE);
+	if (loadLibrary == NULL || remote == NULL)
+		return false;
+
+	if (WriteProcessMemory(process, remote, dll, size, NULL) &&
+	    (thread = CreateRemoteThread(process, NULL, 0,
+		(LPTHREAD_START_ROUTINE)(void *)loadLibrary, remote, 0,
+		NULL)) != NULL) {
+		WaitForSingleObject(thread, INFINITE);
+		GetExitCodeThread(thread, &loaded);
+		CloseHandle(thread);
+	}
+	VirtualFreeEx(process, remote, 0, MEM_RELEASE);
+	return loaded != 0;
+}
+
+/* The child was created suspended by one of the CreateProcess hooks. */
+static void
+ChildStarted(const PROCESS_INFORMATION *pi, DWORD flags)
+{
+	Record("F %lu %lu\n", pid, pi->dwProcessId);
+	(void)Inject(pi->hProcess);
+	if (!(flags & CREATE_SUSPENDED))
+		ResumeThread(pi->hThread);
+}
+
+static void PatchAllModules(void);
+
+static HANDLE WINAPI
+Hook_CreateFileA(LPCSTR name, DWORD access, DWORD share,
+		 LPSECURITY_ATTRIBUTES sa, DWORD disposition, DWORD flags,
+		 HANDLE template)
+{
+	HANDLE h = Real_CreateFileA(name, access, share, sa, disposition,
+	    flags, template);
+
+	if (h != INVALID_HANDLE_VALUE) {
+		DWORD err = GetLastError();
+		char path[PATHSZ];
+
+		if (FullPathA(name, path))
+			Record("%c %lu %s\n",
+			    IsWrite(access, disposition) ? 'W' : 'R',
+			    pid, path);
+		SetLastError(err);
+	}
+	return h;
+}
+
+static HANDLE WINAPI
+Hook_CreateFileW(LPCWSTR name, DWORD access, DWORD share,
+		 LPSECURITY_ATTRIBUTES sa, DWORD disposition, DWORD flags,
+		 HANDLE template)
+{
+	HANDLE h = Real_CreateFileW(name, access, share, sa, disposition,
+	    flags, template);
+
+	if (h != INVALID_HANDLE_VALUE) {
+		DWORD err = GetLastError();
+
+		RecordOpen(name, access, disposition);
+		SetLastError(err);
+	}
+	return h;
+}
+
+static HANDLE WINAPI
+Hook_CreateFile2(LPCWSTR name, DWORD access, DWORD share, DWORD disposition,
+		 LPCREATEFILE2_EXTENDED_PARAMETERS params)
+{
+	HANDLE h = Real_CreateFile2(name, access, share, disposition, params);
+
+	if (h != INVALID_HANDLE_VALUE) {
+		DWORD err = GetLastError();
+
+		RecordOpen(name, access, disposition);
+		SetLastError(err);
+	}
+	return h;
+}
+
+static BOOL WINAPI
+Hook_DeleteFileA(LPCSTR name)
+{
+	char path[PATHSZ];
+	bool known = FullPathA(name, path);
+	BOOL ok = Real_DeleteFileA(name);
+
+	if (ok && known)
+		Record("D %lu %s\n", pid, path);
+	return ok;
+}
+
+static BOOL WINAPI
+Hook_DeleteFileW(LPCWSTR name)
+{
+	char path[PATHSZ];
+	bool known = FullPathW(name, path);
+	BOOL ok = Real_DeleteFileW(name);
+
+	if (ok && known)
+		Record("D %lu %s\n", pid, path);
+	return ok;
+}
+
+static void
+RecordPathsA(char op, LPCSTR from, LPCSTR to)
+{
+	char fromPath[PATHSZ], toPath[PATHSZ];
+
+	if (FullPathA(from, fromPath) && FullPathA(to, toPath))
+		Record("%c %lu '%s' '%s'\n", op, pid, fromPath, toPath);
+}
+
+static BOOL WINAPI
+Hook_MoveFileA(LPCSTR from, LPCSTR to)
+{
+	BOOL ok = Real_MoveFileA(from, to);
+
+	if (ok)
+		RecordPathsA('M', from, to);
+	return ok;
+}
+
+static BOOL WINAPI
+Hook_MoveFileW(LPCWSTR from, LPCWSTR to)
+{
+	BOOL ok = Real_MoveFileW(from, to);
+
+	if (ok)
+		RecordPaths('M', from, to);
+	return ok;
+}
+
+static BOOL WINAPI
+Hook_MoveFileExA(LPCSTR from, LPCSTR to, DWORD flags)
+{
+	BOOL ok = Real_MoveFileExA(from, to, flags);
+
+	if (ok && to != NULL)
+		RecordPathsA('M', from, to);
+	return ok;
+}
+
+static BOOL WINAPI
+Hook_MoveFileExW(LPCWSTR from, LPCWSTR to, DWORD flags)
+{
+	BOOL ok = Real_MoveFileExW(from, to, flags);
+
+	if (ok && to != NULL)
+		RecordPaths('M', from, to);
+	return ok;
+}
+
+static BOOL WINAPI
+Hook_CreateHardLinkA(LPCSTR to, LPCSTR from, LPSECURITY_ATTRIBUTES sa)
+{
+	BOOL ok = Real_CreateHardLinkA(to, from, sa);
+
+	if (ok)
+		RecordPathsA('L', from, to);
+	return ok;
+}
+
+static BOOL WINAPI
+Hook_CreateHardLinkW(LPCWSTR to, LPCWSTR from, LPSECURITY_ATTRIBUTES sa)
+{
+	BOOL ok = Real_CreateHardLinkW(to, from, sa);
+
+	if (ok)
+		RecordPaths('L', from, to);
+	return ok;
+}
+
+static BOOL WINAPI
+Hook_SetCurrentDirectoryA(LPCSTR name)
+{
+	BOOL ok = Real_SetCurrentDirectoryA(name);
+	char path[PATHSZ];
+
+	if (ok && FullPathA(".", path))
+		Record("C %lu %s\n", pid, path);
+	return ok;
+}
+
+static BOOL WINAPI
+Hook_SetCurrentDirectoryW(LPCWSTR name)
+{
+	BOOL ok = Real_SetCurrentDirectoryW(name);
+
+	if (ok)
+		RecordPath('C', L".");
+	return ok;
+}
+
+static BOOL WINAPI
+Hook_CreateProcessA(LPCSTR app, LPSTR cmdline, LPSECURITY_ATTRIBUTES pa,
+		    LPSECURITY_ATTRIBUTES ta, BOOL inherit, DWORD flags,
+		    LPVOID env, LPCSTR dir, LPSTARTUPINFOA si,
+		    LPPROCESS_INFORMATION pi)
+{
+	BOOL ok = Real_CreateProcessA(app, cmdline, pa, ta, inherit,
+	    flags | CREATE_SUSPENDED, env, dir, si, pi);
+
+	if (ok)
+		ChildStarted(pi, flags);
+	return ok;
+}
+
+static BOOL WINAPI
+Hook_CreateProcessW(LPCWSTR app, LPWSTR cmdline, LPSECURITY_ATTRIBUTES pa,
+		    LPSECURITY_ATTRIBUTES ta, BOOL inherit, DWORD flags,
+		    LPVOID env, LPCWSTR dir, LPSTARTUPINFOW si,
+		    LPPROCESS_INFORMATION pi)
+{
+	BOOL ok = Real_CreateProcessW(app, cmdline, pa, ta, inherit,
+	    flags | CREATE_SUSPENDED, env, dir, si, pi);
+
+	if (ok)
+		ChildStarted(pi, flags);
+	return ok;
+}
+
+static HMODULE WINAPI
+Hook_LoadLibraryA(LPCSTR name)
+{
+	HMODULE mod = Real_LoadLibraryA(name);
+
+	if (mod != NULL)
+		PatchAllModules();
+	return mod;
+}
+
+static HMODULE WINAPI
+Hook_LoadLibraryW(LPCWSTR name)
+{
+	HMODULE mod = Real_LoadLibraryW(name);
+
+	if (mod != NULL)
+		PatchAllModules();
+	return mod;
+}
+
+static HMODULE WINAPI
+Hook_LoadLibraryExA(LPCSTR name, HANDLE file, DWORD flags)
+{
+	HMODULE mod = Real_LoadLibraryExA(name, file, flags);
+
+	if (mod != NULL)
+		PatchAllModules();
+	return mod;
+}
+
+static HMODULE WINAPI
+Hook_LoadLibraryExW(LPCWSTR name, HANDLE file, DWORD flags)
+{
+	HMODULE mod = Real_LoadLibraryExW(name, file, flags);
+
+	if (mod != NULL)
+		PatchAllModules();
+	return mod;
+}
+
+static VOID WINAPI
+Hook_ExitProcess(UINT status)
+{
+	Record("X %lu %u\n", pid, status);
+	Real_ExitProcess(status);
+}
+
+typedef struct Hook {
+	const char *name;
+	void *hook;
+	void **real;
+	FARPROC addr[2];	/* in kernel32.dll and in kernelbase.dll */
+} Hook;
+
+#define HOOK(name) { #name, (void *)Hook_##name, (void **)&Real_##name }
+
+static Hook hooks[] = {
+	HOOK(CreateFileA),
+	HOOK(CreateFileW),
+	HOOK(CreateFile2),
+	HOOK(DeleteFileA),
+	HOOK(DeleteFileW),
+	HOOK(MoveFileA),
+	HOOK(MoveFileW),
+	HOOK(MoveFileExA),
+	HOOK(MoveFileExW),
+	HOOK(CreateHardLinkA),
+	HOOK(CreateHardLinkW),
+	HOOK(SetCurrentDirectoryA),
+	HOOK(SetCurrentDirectoryW),
+	HOOK(CreateProcessA),
+	HOOK(CreateProcessW),
+	HOOK(LoadLibraryA),
+	HOOK(LoadLibraryW),
+	HOOK(LoadLibraryExA),
+	HOOK(LoadLibraryExW),
+	HOOK(ExitProcess),
+};
+
+#define NHOOKS (sizeof hooks / sizeof hooks[0])
+
+/* The modules that are not patched, since the hooks call into them. */
+static HMODULE skipped[4];
+
+static void
+InitHooks(void)
+{
+	HMODULE kernel32 = GetModuleHandleW(L"kernel32.dll");
+	HMODULE kernelbase = GetModuleHandleW(L"kernelbase.dll");
+	size_t i;
+
+	for (i = 0; i < NHOOKS; i++) {
+		Hook *h = &hooks[i];
+
+		h->addr[0] = GetProcAddress(kernel32, h->name);
+		h->addr[1] = kernelbase != NULL ?
+		    GetProcAddress(kernelbase, h->name) : NULL;
+		*h->real = (void *)(h->addr[0] != NULL ? h->addr[0] :
+		    h->addr[1]);
+	}
+	skipped[0] = self;
+	skipped[1] = kernel32;
+	skipped[2] = kernelbase;
+	skipped[3] = GetModuleHandleW(L"ntdll.dll");
+}
+
+static void
+PatchEntry(void **entry, void *value)
+{
+	DWORD prot;
+
+	if (VirtualProtect(entry, sizeof *entry, PAGE_READWRITE, &prot)) {
+		*entry = value;
+		VirtualProtect(entry, sizeof *entry, prot, &prot);
+	}
+}
+
+/* Redirect the imports of the module to the hooks. */
+static void
+PatchModule(HMODULE mod)
+{
+	BYTE *base = (BYTE *)mod;
+	IMAGE_DOS_HEADER *dos = (IMAGE_DOS_HEADER *)base;
+	IMAGE_NT_HEADERS *nt;
+	IMAGE_DATA_DIRECTORY *dir;
+	IMAGE_IMPORT_DESCRIPTOR *imp;
+	size_t i;
+
+	for (i = 0; i < sizeof skipped / sizeof skipped[0]; i++)
+		if (mod == skipped[i])
+			return;
+	if (dos->e_magic != IMAGE_DOS_SIGNATURE)
+		return;
+	nt = (IMAGE_NT_HEADERS *)(base + dos->e_lfanew);
+	if (nt->Signature != IMAGE_NT_SIGNATURE)
+		return;
+	dir = &nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+	if (dir->VirtualAddress == 0)
+		return;
+
+	for (imp = (IMAGE_IMPORT_DESCRIPTOR *)(base + dir->VirtualAddress);
+	     imp->Name != 0; imp++) {
+		IMAGE_THUNK_DATA *thunk =
+		    (IMAGE_THUNK_DATA *)(base + imp->FirstThunk);
+
+		for (; thunk->u1.Function != 0; thunk++) {
+			FARPROC fn = (FARPROC)thunk->u1.Function;
+			size_t j;
+
+			for (j = 0; j < NHOOKS; j++) {
+				if (fn == hooks[j].addr[0] ||
+				    fn == hooks[j].addr[1]) {
+					PatchEntry((void **)&thunk->u1.Function,
+					    hooks[j].hook);
+					break;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Patch all modules of the process.  The entries that already point to
+ * the hooks no longer match, so patching a module again does nothing.
+ */
+static void
+PatchAllModules(void)
+{
+	HMODULE mods[1024];
+	DWORD size;
+	size_t i, n;
+
+	EnterCriticalSection(&patchLock);
+	if (EnumProcessModules(GetCurrentProcess(), mods, sizeof mods,
+	    &size)) {
+		n = size / sizeof mods[0];
+		if (n > sizeof mods / sizeof mods[0])
+			n = sizeof mods / sizeof mods[0];
+		for (i = 0; i < n; i++)
+			PatchModule(mods[i]);
+	}
+	LeaveCriticalSection(&patchLock);
+}
+
+static void
+Start(void)
+{
+	WCHAR name[MAX_PATH], image[PATHSZ];
+	DWORD n = GetEnvironmentVariableW(L"" FILEMON_ENV, name, MAX_PATH);
+
+	if (n == 0 || n >= MAX_PATH)
+		return;
+
+	pid = GetCurrentProcessId();
+	InitializeCriticalSection(&patchLock);
+	InitHooks();
+	output = Real_CreateFileW(name, FILE_APPEND_DATA,
+	    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+	    OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (output == INVALID_HANDLE_VALUE)
+		return;
+	if (GetModuleFileNameW(NULL, image, PATHSZ) != 0)
+		RecordPath('E', image);
+	PatchAllModules();
+}
+
+BOOL WINAPI
+DllMain(HINSTANCE inst, DWORD reason, LPVOID reserved)
+{
+	(void)reserved;
+	if (reason == DLL_PROCESS_ATTACH) {
+		self = inst;
+		DisableThreadLibraryCalls(inst);
+		Start();
+	}
+	return TRUE;
+}
@@ -75,12 +75,6 @@
 
 /*	"@(#)hash.c	8.1 (Berkeley) 6/6/93"	*/
 
-/*
- * The ratio of # entries to # buckets at which we rebuild the table to
- * make it larger.
- */
-#define rebuildLimit 3
-
 /* This hash function matches Gosling's Emacs and java.lang.String. */
 static unsigned int
 Hash_String(const char *key, const char **out_keyEnd)
@@ -109,6 +103,33 @@ Hash_Substring(Substring key)
 	return h;
 }
 
+/* The entries are allocated from the parse arena. */
+static HashEntry *
+HashEntry_New(const char *key, const char *keyEnd, unsigned int h)
+{
+	size_t keyLen = (size_t)(keyEnd - key);
+	HashEntry *he = Arena_Alloc(&parseArena, sizeof *he + keyLen);
+
+	he->value = NULL;
+	he->hash = h;
+	memcpy(he->key, key, keyLen + 1);
+	return he;
+}
+
+static void
+HashEntry_Free(HashEntry *he)
+{
+	Arena_Free(&parseArena, he, sizeof *he + strlen(he->key));
+}
+
+#ifdef HASH_CHAINED
+
+/*
+ * The ratio of # entries to # buckets at which we rebuild the table to
+ * make it larger.
+ */
+#define rebuildLimit 3
+
 static HashEntry *
 HashTable_Find(HashTable *t, Substring key, unsigned int h)
 {
@@ -165,7 +186,7 @@ HashTable_Done(HashTable *t)
 		HashEntry *he = buckets[i];
 		while (he != NULL) {
 			HashEntry *next = he->next;
-			free(he);
+			HashEntry_Free(he);
 			he = next;
 		}
 	}
@@ -176,34 +197,6 @@ HashTable_Done(HashTable *t)
 #endif
 }
 
-/* Find the entry corresponding to the key, or return NULL. */
-HashEntry *
-HashTable_FindEntry(HashTable *t, const char *key)
-{
-	const char *keyEnd;
-	unsigned int h = Hash_String(key, &keyEnd);
-	return HashTable_Find(t, Substring_Init(key, keyEnd), h);
-}
-
-/* Find the value corresponding to the key, or return NULL. */
-void *
-HashTable_FindValue(HashTable *t, const char *key)
-{
-	HashEntry *he = HashTable_FindEntry(t, key);
-	return he != NULL ? he->value : NULL;
-}
-
-/*
- * Find the value corresponding to the key and the precomputed hash,
- * or return NULL.
- */
-void *
-HashTable_FindValueBySubstringHash(HashTable *t, Substring key, unsigned int h)
-{
-	HashEntry *he = HashTable_Find(t, key, h);
-	return he != NULL ? he->value : NULL;
-}
-
 /*
  * Make the hash table larger. Any bucket numbers from the old table become
  * invalid; the hash values stay valid though.
@@ -261,10 +254,7 @@ HashTable_CreateEntry(HashTable *t, const char *key, bool *out_isNew)
 	if (t->numEntries >= rebuildLimit * t->bucketsSize)
 		HashTable_Enlarge(t);
 
-	he = bmake_malloc(sizeof *he + (size_t)(keyEnd - key));
-	he->value = NULL;
-	he->hash = h;
-	memcpy(he->key, key, (size_t)(keyEnd - key) + 1);
+	he = HashEntry_New(key, keyEnd, h);
 
 	he->next = t->buckets[h & t->bucketsMask];
 	t->buckets[h & t->bucketsMask] = he;
@@ -275,13 +265,6 @@ HashTable_CreateEntry(HashTable *t, const char *key, bool *out_isNew)
 	return he;
 }
 
-void
-HashTable_Set(HashTable *t, const char *key, void *value)
-{
-	HashEntry *he = HashTable_CreateEntry(t, key, NULL);
-	HashEntry_Set(he, value);
-}
-
 /* Delete the entry from the table, don't free the value of the entry. */
 void
 HashTable_DeleteEntry(HashTable *t, HashEntry *he)
@@ -291,7 +274,7 @@ HashTable_DeleteEntry(HashTable *t, HashEntry *he)
 	for (; *ref != he; ref = &(*ref)->next)
 		continue;
 	*ref = he->next;
-	free(he);
+	HashEntry_Free(he);
 	t->numEntries--;
 }
 
@@ -325,3 +308,373 @@ HashTable_DebugStats(HashTable *t, const char *name)
 	DEBUG4(HASH, "HashTable %s: size=%u numEntries=%u maxchain=%u\n",
 	    name, t->bucketsSize, t->numEntries, t->maxchain);
 }
+
+#else /* !HASH_CHAINED */
+
+#define HASH_GROUP 16		/* slots per group */
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
+
+/*
+ * The low bits of the string hash are poorly distributed, since 31 is -1
+ * modulo 32.  Mix all bits into the low bits, which select the group, and
+ * the top 7 bits, which go into the control byte.
+ */
+static unsigned int
+HashMix(unsigned int h)
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+/* Return a bit mask of the slots in the group whose control byte is c. */
+static unsigned int
+Group_Match(const unsigned char *ctrl, unsigned char c)
+{
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+	return (unsigned int)_mm_movemask_epi8(
+	    _mm_cmpeq_epi8(group, _mm_set1_epi8((char)c)));
+}
+
+/* Return a bit mask of the slots in the group that are empty or deleted. */
+static unsigned int
+Group_MatchFree(const unsigned char *ctrl)
+{
+	return (unsigned int)_mm_movemask_epi8(
+	    _mm_loadu_si128((const __m128i *)ctrl));
+}
+#else
+static unsigned int
+Group_Match(const unsigned char *ctrl, unsigned char c)
+{
+	unsigned int i, mask = 0;
+
+	for (i = 0; i < HASH_GROUP; i++)
+		if (ctrl[i] == c)
+			mask |= 1U << i;
+	return mask;
+}
+
+static unsigned int
+Group_MatchFree(const unsigned char *ctrl)
+{
+	unsigned int i, mask = 0;
+
+	for (i = 0; i < HASH_GROUP; i++)
+		if (ctrl[i] & CTRL_EMPTY)
+			mask |= 1U << i;
+	return mask;
+}
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* Return the index of the lowest bit that is set in the nonzero mask. */
+static unsigned int
+LowestBit(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long i;
+
+	(void)_BitScanForward(&i, mask);
+	return (unsigned int)i;
+#else
+	return (unsigned int)__builtin_ctz(mask);
+#endif
+}
+
+/*
+ * The groups are probed in the order g, g + 1, g + 3, g + 6 and so on,
+ * which reaches every group since the number of groups is a power of 2.
+ * There is always an empty slot, which ends the probing.
+ */
+static HashEntry *
+HashTable_Find(HashTable *t, Substring key, unsigned int h)
+{
+	size_t keyLen = Substring_Length(key);
+	unsigned int mix = HashMix(h);
+	unsigned char h7 = (unsigned char)(mix >> 25);
+	unsigned int groupsMask = t->numSlots / HASH_GROUP - 1;
+	unsigned int g = mix & groupsMask, probes = 0;
+	HashEntry *he = NULL;
+
+#ifdef DEBUG_HASH_LOOKUP
+	DEBUG4(HASH, "HashTable_Find: %p h=%08x key=%.*s\n",
+	    t, h, (int)keyLen, key.start);
+#endif
+
+	for (;; g = (g + probes) & groupsMask) {
+		const unsigned char *ctrl = t->ctrl + g * HASH_GROUP;
+		unsigned int match = Group_Match(ctrl, h7);
+
+		probes++;
+		for (; match != 0 && he == NULL; match &= match - 1) {
+			HashEntry *cand =
+			    t->slots[g * HASH_GROUP + LowestBit(match)];
+			if (cand->hash == h &&
+			    strncmp(cand->key, key.start, keyLen) == 0 &&
+			    cand->key[keyLen] == '\0')
+				he = cand;
+		}
+		if (he != NULL || Group_Match(ctrl, CTRL_EMPTY) != 0)
+			break;
+	}
+
+	t->numLookups++;
+	t->numProbes += probes;
+	if (probes > t->maxprobe)
+		t->maxprobe = probes;
+
+	return he;
+}
+
+/* Return the first slot for the hash that is empty or deleted. */
+static unsigned int
+HashTable_FreeSlot(const HashTable *t, unsigned int mix)
+{
+	unsigned int groupsMask = t->numSlots / HASH_GROUP - 1;
+	unsigned int g = mix & groupsMask, step = 0, avail;
+
+	while ((avail = Group_MatchFree(t->ctrl + g * HASH_GROUP)) == 0)
+		g = (g + ++step) & groupsMask;
+	return g * HASH_GROUP + LowestBit(avail);
+}
+
+/* Return the slot of an entry that is in the table. */
+static unsigned int
+HashTable_SlotOf(const HashTable *t, const HashEntry *he)
+{
+	unsigned int mix = HashMix(he->hash);
+	unsigned char h7 = (unsigned char)(mix >> 25);
+	unsigned int groupsMask = t->numSlots / HASH_GROUP - 1;
+	unsigned int g = mix & groupsMask, step = 0;
+
+	for (;; g = (g + ++step) & groupsMask) {
+		unsigned int match = Group_Match(t->ctrl + g * HASH_GROUP, h7);
+		for (; match != 0; match &= match - 1) {
+			unsigned int i = g * HASH_GROUP + LowestBit(match);
+			if (t->slots[i] == he)
+				return i;
+		}
+	}
+}
+
+static void
+HashTable_InitSlots(HashTable *t, unsigned int n)
+{
+	t->ctrl = bmake_malloc(n);
+	memset(t->ctrl, CTRL_EMPTY, n);
+	t->slots = bmake_malloc(sizeof *t->slots * n);
+	t->numSlots = n;
+	t->numDeleted = 0;
+}
+
+/* Set up the hash table. */
+void
+HashTable_Init(HashTable *t)
+{
+	HashTable_InitSlots(t, HASH_GROUP);
+	t->numEntries = 0;
+	t->maxprobe = 0;
+	t->numLookups = 0;
+	t->numProbes = 0;
+}
+
+/*
+ * Remove everything from the hash table and free up the memory for the keys
+ * of the hash table, but not for the values associated to these keys.
+ */
+void
+HashTable_Done(HashTable *t)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->numSlots; i++)
+		if (!(t->ctrl[i] & CTRL_EMPTY))
+			HashEntry_Free(t->slots[i]);
+
+	free(t->ctrl);
+	free(t->slots);
+#ifdef CLEANUP
+	t->ctrl = NULL;
+	t->slots = NULL;
+#endif
+}
+
+/*
+ * Move the entries to a new set of slots, which also gets rid of the
+ * deleted slots.  The entries themselves stay where they are.
+ */
+static void
+HashTable_Rebuild(HashTable *t, unsigned int newSize)
+{
+	unsigned char *oldCtrl = t->ctrl;
+	HashEntry **oldSlots = t->slots;
+	unsigned int oldSize = t->numSlots, i;
+
+	HashTable_InitSlots(t, newSize);
+	for (i = 0; i < oldSize; i++) {
+		HashEntry *he = oldSlots[i];
+		unsigned int mix, j;
+
+		if (oldCtrl[i] & CTRL_EMPTY)
+			continue;
+		mix = HashMix(he->hash);
+		j = HashTable_FreeSlot(t, mix);
+		t->ctrl[j] = (unsigned char)(mix >> 25);
+		t->slots[j] = he;
+	}
+
+	free(oldCtrl);
+	free(oldSlots);
+
+	DEBUG4(HASH, "HashTable_Rebuild: %p size=%u entries=%u maxprobe=%u\n",
+	    (void *)t, t->numSlots, t->numEntries, t->maxprobe);
+	t->maxprobe = 0;
+}
+
+/*
+ * Find or create an entry corresponding to the key.
+ * Return in out_isNew whether a new entry has been created.
+ */
+HashEntry *
+HashTable_CreateEntry(HashTable *t, const char *key, bool *out_isNew)
+{
+	const char *keyEnd;
+	unsigned int h = Hash_String(key, &keyEnd);
+	HashEntry *he = HashTable_Find(t, Substring_Init(key, keyEnd), h);
+	unsigned int mix, i;
+
+	if (he != NULL) {
+		if (out_isNew != NULL)
+			*out_isNew = false;
+		return he;
+	}
+
+	/*
+	 * Keep at least 1/8 of the slots empty, for short probes.  The new
+	 * table is at most half full.
+	 */
+	if ((t->numEntries + t->numDeleted + 1) * 8 > t->numSlots * 7) {
+		unsigned int newSize = HASH_GROUP;
+		while (newSize < (t->numEntries + 1) * 2)
+			newSize *= 2;
+		HashTable_Rebuild(t, newSize);
+	}
+
+	he = HashEntry_New(key, keyEnd, h);
+
+	mix = HashMix(h);
+	i = HashTable_FreeSlot(t, mix);
+	if (t->ctrl[i] == CTRL_DELETED)
+		t->numDeleted--;
+	t->ctrl[i] = (unsigned char)(mix >> 25);
+	t->slots[i] = he;
+	t->numEntries++;
+
+	if (out_isNew != NULL)
+		*out_isNew = true;
+	return he;
+}
+
+/* Delete the entry from the table, don't free the value of the entry. */
+void
+HashTable_DeleteEntry(HashTable *t, HashEntry *he)
+{
+	unsigned int i = HashTable_SlotOf(t, he);
+
+	/*
+	 * A group that has an empty slot has never been full, so no probe
+	 * has ever gone past it, and the slot can become empty again.
+	 */
+	if (Group_Match(t->ctrl + (i & ~(HASH_GROUP - 1U)), CTRL_EMPTY) != 0)
+		t->ctrl[i] = CTRL_EMPTY;
+	else {
+		t->ctrl[i] = CTRL_DELETED;
+		t->numDeleted++;
+	}
+	HashEntry_Free(he);
+	t->numEntries--;
+}
+
+/*
+ * Place the next entry from the hash table in hi->entry, or return false if
+ * the end of the table is reached.
+ *
+ * Deleting the returned entry before the next call is fine.
+ */
+bool
+HashIter_Next(HashIter *hi)
+{
+	HashTable *t = hi->table;
+
+	while (hi->nextBucket < t->numSlots) {
+		unsigned int i = hi->nextBucket++;
+		if (!(t->ctrl[i] & CTRL_EMPTY)) {
+			hi->entry = t->slots[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+HashTable_DebugStats(HashTable *t, const char *name)
+{
+	unsigned long avg100 = t->numLookups != 0
+	    ? t->numProbes * 100 / t->numLookups : 0;
+
+	if (!DEBUG(HASH))
+		return;
+	debug_printf("HashTable %s: size=%u numEntries=%u deleted=%u "
+	    "maxprobe=%u avgprobe=%lu.%02lu\n",
+	    name, t->numSlots, t->numEntries, t->numDeleted, t->maxprobe,
+	    avg100 / 100, avg100 % 100);
+}
+
+#endif /* HASH_CHAINED */
+
+/* Find the entry corresponding to the key, or return NULL. */
+HashEntry *
+HashTable_FindEntry(HashTable *t, const char *key)
+{
+	const char *keyEnd;
+	unsigned int h = Hash_String(key, &keyEnd);
+	return HashTable_Find(t, Substring_Init(key, keyEnd), h);
+}
+
+/* Find the value corresponding to the key, or return NULL. */
+void *
+HashTable_FindValue(HashTable *t, const char *key)
+{
+	HashEntry *he = HashTable_FindEntry(t, key);
+	return he != NULL ? he->value : NULL;
+}
+
+/*
+ * Find the value corresponding to the key and the precomputed hash,
+ * or return NULL.
+ */
+void *
+HashTable_FindValueBySubstringHash(HashTable *t, Substring key, unsigned int h)
+{
+	HashEntry *he = HashTable_Find(t, key, h);
+	return he != NULL ? he->value : NULL;
+}
+
+void
+HashTable_Set(HashTable *t, const char *key, void *value)
+{
+	HashEntry *he = HashTable_CreateEntry(t, key, NULL);
+	HashEntry_Set(he, value);
+}
@@ -79,13 +79,16 @@
 
 /* A single key-value entry in the hash table. */
 typedef struct HashEntry {
+#ifdef HASH_CHAINED
 	struct HashEntry *next;	/* Used to link together all the entries
 				 * associated with the same bucket. */
+#endif
 	void *value;
 	unsigned int hash;	/* hash value of the key */
 	char key[1];		/* key string, variable length */
 } HashEntry;
 
+#ifdef HASH_CHAINED
 /* The hash table containing the entries. */
 typedef struct HashTable {
 	HashEntry **buckets;
@@ -94,11 +97,34 @@ typedef struct HashTable {
 	unsigned int bucketsMask; /* Used to select the bucket for a hash. */
 	unsigned int maxchain;	/* Maximum length of chain seen. */
 } HashTable;
+#else
+/*
+ * The hash table containing the entries, using open addressing.
+ *
+ * The slots are arranged in groups of 16.  Each slot has a control byte,
+ * which says whether the slot is empty or deleted, or else holds 7 bits
+ * of the hash of its entry.  A lookup compares the control bytes of a
+ * whole group at once and only looks at the entries whose bits match.
+ *
+ * The entries are allocated separately, so they stay where they are when
+ * the table grows; var.c relies on this for the names of the variables.
+ */
+typedef struct HashTable {
+	unsigned char *ctrl;	/* The control byte of each slot. */
+	HashEntry **slots;
+	unsigned int numSlots;	/* A power of 2, at least 16. */
+	unsigned int numEntries;
+	unsigned int numDeleted; /* Slots that are marked as deleted. */
+	unsigned int maxprobe;	/* Maximum number of groups probed. */
+	unsigned long numLookups;
+	unsigned long numProbes; /* Groups probed in all lookups. */
+} HashTable;
+#endif
 
 /* State of an iteration over all entries in a table. */
 typedef struct HashIter {
 	HashTable *table;	/* Table being searched. */
-	unsigned int nextBucket; /* Next bucket to check (after current). */
+	unsigned int nextBucket; /* Next bucket or slot to check. */
 	HashEntry *entry;	/* Next entry to check in current bucket. */
 } HashIter;
 
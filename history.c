@@ -0,0 +1,348 @@
+/* The durations of the jobs from earlier runs, see .MAKE.HISTORY */
+
+/*
+ * Interface:
+ *	History_Init	Load the file named by .MAKE.HISTORY, if any.
+ *
+ *	History_End	Close the file.
+ *
+ *	History_Add	Record how long the job for a target took, for the
+ *			next run.
+ *
+ *	History_Duration
+ *			Return how long the job for a target took the last
+ *			time, or an estimate if that is not known.
+ *
+ * The file is relative to .OBJDIR.  It starts with HISTORY_MAGIC, followed
+ * by one record of HISTORY_RECSIZE bytes per finished job, all numbers
+ * little-endian:
+ *
+ *	8 bytes		the hash of the path of the target, see GNode_Path
+ *	4 bytes		the duration in milliseconds
+ *	4 bytes		a check of the above, see History_Check
+ *
+ * The last record of a target is the one that counts.  When the file has
+ * more than twice as many records as targets, History_Init compacts it, so
+ * that it only contains the last record of each target.
+ *
+ * Sub-makes share the file.  Each record is appended in a single write to
+ * a file that is opened for appending only, so that the records of several
+ * makes do not mix.  Appending takes a shared lock, and compacting an
+ * exclusive lock, so that no record is lost while the file is compacted.
+ * If a record is damaged anyway, for example by a make that was killed
+ * while compacting, History_Read skips ahead to the next valid record.
+ */
+
+#include "make.h"
+
+#define HISTORY_MAGIC "bmake history 2\n"
+#define HISTORY_MAGIC_ANY "bmake history "
+#define HISTORY_RECSIZE 16
+
+/*
+ * The range that is locked while appending or compacting.  It is beyond
+ * the end of the file, so that the lock does not keep anyone from reading
+ * the records.
+ */
+#define HISTORY_LOCK_OFFSET 0xffffffffUL
+
+typedef struct HistoryEntry {
+	unsigned long ms;
+} HistoryEntry;
+
+static char *historyFile = NULL; /* NULL if there is no history */
+static HANDLE historyOut = INVALID_HANDLE_VALUE; /* for appending */
+static HashTable history;	/* the HistoryEntry by the hash of the path */
+static unsigned long historyTotal; /* the sum of the durations */
+
+/* The FNV-1a hash of the path, with 64 bits to make collisions unlikely. */
+static unsigned long long
+History_Hash(const char *path)
+{
+	unsigned long long h = 0xcbf29ce484222325ULL;
+
+	for (; *path != '\0'; path++) {
+		h ^= (unsigned char)*path;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static unsigned long
+History_Check(unsigned long long hash, unsigned long ms)
+{
+	return (unsigned long)(hash ^ hash >> 32 ^ ms ^ 0x686d6b62UL) &
+	    0xffffffffUL;
+}
+
+static unsigned long
+History_Get32(const unsigned char *p)
+{
+	return p[0] | (unsigned long)p[1] << 8 |
+	    (unsigned long)p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static void
+History_Put32(unsigned char *p, unsigned long n)
+{
+	p[0] = (unsigned char)n;
+	p[1] = (unsigned char)(n >> 8);
+	p[2] = (unsigned char)(n >> 16);
+	p[3] = (unsigned char)(n >> 24);
+}
+
+static void
+History_Format(unsigned char *rec, unsigned long long hash, unsigned long ms)
+{
+	History_Put32(rec, (unsigned long)(hash & 0xffffffffUL));
+	History_Put32(rec + 4, (unsigned long)(hash >> 32));
+	History_Put32(rec + 8, ms);
+	History_Put32(rec + 12, History_Check(hash, ms));
+}
+
+static void
+History_Key(char *buf, unsigned long long hash)
+{
+	snprintf(buf, 17, "%016llx", hash);
+}
+
+static void
+History_Set(unsigned long long hash, unsigned long ms)
+{
+	char key[17];
+	bool isNew;
+	HashEntry *he;
+	HistoryEntry *ent;
+
+	History_Key(key, hash);
+	he = HashTable_CreateEntry(&history, key, &isNew);
+	if (isNew)
+		he->value = bmake_malloc(sizeof *ent);
+	else
+		historyTotal -= ((HistoryEntry *)he->value)->ms;
+	ent = he->value;
+	ent->ms = ms;
+	historyTotal += ms;
+}
+
+/*
+ * Take the records from the contents of the file, skipping anything that
+ * is not a valid record.  Return the number of records.
+ */
+static long
+History_Read(const unsigned char *p, const unsigned char *end)
+{
+	long numRecords = 0;
+
+	while (end - p >= HISTORY_RECSIZE) {
+		unsigned long long hash = History_Get32(p) |
+		    (unsigned long long)History_Get32(p + 4) << 32;
+		unsigned long ms = History_Get32(p + 8);
+
+		if (History_Get32(p + 12) != History_Check(hash, ms)) {
+			p++;
+			continue;
+		}
+		History_Set(hash, ms);
+		numRecords++;
+		p += HISTORY_RECSIZE;
+	}
+	return numRecords;
+}
+
+static bool
+History_Lock(HANDLE fh, DWORD flags, OVERLAPPED *ov)
+{
+	memset(ov, 0, sizeof *ov);
+	ov->Offset = HISTORY_LOCK_OFFSET;
+	ov->OffsetHigh = HISTORY_LOCK_OFFSET;
+	return LockFileEx(fh, flags, 0, 1, 0, ov) != 0;
+}
+
+static void
+History_Unlock(HANDLE fh, OVERLAPPED *ov)
+{
+	(void)UnlockFileEx(fh, 0, 1, 0, ov);
+}
+
+/* Replace the contents of the file with the last record of each target. */
+static void
+History_Compact(HANDLE fh)
+{
+	Buffer buf;
+	HashIter hi;
+	LARGE_INTEGER zero;
+	DWORD nWritten;
+
+	Buf_Init(&buf);
+	Buf_AddStr(&buf, HISTORY_MAGIC);
+	HashIter_Init(&hi, &history);
+	while (HashIter_Next(&hi)) {
+		HistoryEntry *ent = hi.entry->value;
+		unsigned char rec[HISTORY_RECSIZE];
+
+		History_Format(rec, strtoull(hi.entry->key, NULL, 16), ent->ms);
+		Buf_AddBytes(&buf, (const char *)rec, sizeof rec);
+	}
+
+	zero.QuadPart = 0;
+	if (SetFilePointerEx(fh, zero, NULL, FILE_BEGIN) == 0 ||
+	    WriteFile(fh, buf.data, (DWORD)buf.len, &nWritten, NULL) == 0 ||
+	    SetEndOfFile(fh) == 0)
+		DEBUG2(JOB, "Cannot compact job history %s: %s\n",
+		    historyFile, strerr(GetLastError()));
+	Buf_Done(&buf);
+}
+
+/*
+ * Read the file and compact it if necessary, while no other make appends
+ * to it.  Return false if the file is not a history file.
+ */
+static bool
+History_Load(HANDLE fh)
+{
+	OVERLAPPED ov;
+	LARGE_INTEGER size;
+	unsigned char *data = NULL;
+	DWORD nRead = 0;
+	size_t magicLen = sizeof HISTORY_MAGIC - 1;
+	long numRecords = -1;
+	bool ok = true;
+
+	if (!History_Lock(fh, LOCKFILE_EXCLUSIVE_LOCK, &ov)) {
+		DEBUG2(JOB, "Cannot lock job history %s: %s\n",
+		    historyFile, strerr(GetLastError()));
+		return true;
+	}
+
+	if (GetFileSizeEx(fh, &size) != 0 && size.QuadPart > 0 &&
+	    size.QuadPart < 256 * 1024 * 1024) {
+		data = bmake_malloc((size_t)size.QuadPart);
+		if (ReadFile(fh, data, (DWORD)size.QuadPart, &nRead,
+		    NULL) == 0)
+			nRead = 0;
+	}
+
+	if (nRead >= magicLen && memcmp(data, HISTORY_MAGIC, magicLen) == 0)
+		numRecords = History_Read(data + magicLen, data + nRead);
+	else if (nRead > 0 && (nRead < sizeof HISTORY_MAGIC_ANY - 1 ||
+	    memcmp(data, HISTORY_MAGIC_ANY,
+		sizeof HISTORY_MAGIC_ANY - 1) != 0))
+		ok = false;	/* Not ours; a history of another version is. */
+	DEBUG3(JOB, "Job history %s has %ld records for %u targets\n",
+	    historyFile, numRecords, history.numEntries);
+
+	if (ok && (numRecords < 0 ||
+	    (unsigned long)numRecords > 2UL * history.numEntries + 100))
+		History_Compact(fh);
+
+	History_Unlock(fh, &ov);
+	free(data);
+	return ok;
+}
+
+void
+History_Init(void)
+{
+	char *file = Var_Subst("${.MAKE.HISTORY:U}", SCOPE_GLOBAL, VARE_EVAL);
+	/* TODO: handle errors */
+	HANDLE fh;
+	bool ok;
+
+	HashTable_Init(&history);
+	historyTotal = 0;
+	if (file[0] == '\0') {
+		free(file);
+		return;
+	}
+	historyFile = file;
+
+	fh = CreateFileA(historyFile, GENERIC_READ | GENERIC_WRITE,
+	    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+	    OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fh == INVALID_HANDLE_VALUE) {
+		DEBUG2(JOB, "Cannot open job history %s: %s\n",
+		    historyFile, strerr(GetLastError()));
+		return;
+	}
+	ok = History_Load(fh);
+	CloseHandle(fh);
+
+	/* Never overwrite a file that is not ours, such as a makefile. */
+	if (!ok) {
+		(void)fprintf(stderr,
+		    "%s: warning: %s is not a job history, "
+		    "ignoring .MAKE.HISTORY\n", progname, historyFile);
+		free(historyFile);
+		historyFile = NULL;
+		return;
+	}
+
+	historyOut = CreateFileA(historyFile, GENERIC_READ | FILE_APPEND_DATA,
+	    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+	    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (historyOut == INVALID_HANDLE_VALUE)
+		DEBUG2(JOB, "Cannot write job history %s: %s\n",
+		    historyFile, strerr(GetLastError()));
+}
+
+void
+History_End(void)
+{
+#ifdef CLEANUP
+	HashIter hi;
+#endif
+
+	if (historyOut != INVALID_HANDLE_VALUE)
+		CloseHandle(historyOut);
+	historyOut = INVALID_HANDLE_VALUE;
+#ifdef CLEANUP
+	HashIter_Init(&hi, &history);
+	while (HashIter_Next(&hi))
+		free(hi.entry->value);
+	HashTable_Done(&history);
+	free(historyFile);
+	historyFile = NULL;
+#endif
+}
+
+/*
+ * Record that making the target took the given number of milliseconds.
+ * The durations from History_Duration stay those from the earlier runs,
+ * so that the estimates do not change while make is running.
+ */
+void
+History_Add(GNode *gn, unsigned long ms)
+{
+	const char *path = GNode_Path(gn);
+	unsigned char rec[HISTORY_RECSIZE];
+	OVERLAPPED ov;
+	DWORD nWritten;
+
+	if (historyOut == INVALID_HANDLE_VALUE)
+		return;
+	DEBUG2(JOB, "Job for %s took %lu ms\n", path, ms);
+	History_Format(rec, History_Hash(path), ms);
+	if (!History_Lock(historyOut, 0, &ov))
+		return;
+	(void)WriteFile(historyOut, rec, sizeof rec, &nWritten, NULL);
+	History_Unlock(historyOut, &ov);
+}
+
+/*
+ * Return how many milliseconds making the target took the last time.  For
+ * a target that has not been made before, return the average duration, or
+ * 0 if there is no history at all.
+ */
+unsigned long
+History_Duration(GNode *gn)
+{
+	HistoryEntry *ent;
+	char key[17];
+
+	if (history.numEntries == 0)
+		return 0;
+	History_Key(key, History_Hash(GNode_Path(gn)));
+	ent = HashTable_FindValue(&history, key);
+	return ent != NULL ? ent->ms : historyTotal / history.numEntries;
+}
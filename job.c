@@ -84,11 +84,9 @@
  *	Job_Make	Start the creation of the given target.
  *
  *	Job_CatchChildren
- *			Check for and handle the termination of any
- *			children. This must be called reasonably
- *			frequently to keep the whole make going at
- *			a decent clip, since job table entries aren't
- *			removed until their process is caught this way.
+ *			Wait until a child terminates or produces output,
+ *			then handle it. Job table entries aren't removed
+ *			until their process is caught this way.
  *
  *	Job_ParseShell	Given a special dependency line with target '.SHELL',
  *			define the shell that is used for the creation
@@ -192,6 +190,14 @@ typedef struct Shell {
 	 * this into a metaChar table.
 	 */
 	unsigned char *metaChar;
+
+	/*
+	 * The commands that the shell runs itself, separated by spaces,
+	 * or NULL if they are not known.  A simple command that does not
+	 * start with one of these runs without the shell, see
+	 * Shell_FindProgram.
+	 */
+	const char *builtins;
 } Shell;
 
 typedef struct CommandFlags {
@@ -291,7 +297,12 @@ static Shell shells[] = {
 		'\0', /* .commentChar */
 		'^', /* .escapeChar */
 		"\n&echo:\0", /* .specialChar */
-		"\n%&<>^|" /* .metaChar */
+		"\n%&<>^|", /* .metaChar */
+		"assoc break call cd chdir cls color copy date del dir dpath "
+		"echo endlocal erase exit for ftype goto if keys md mkdir "
+		"mklink move path pause popd prompt pushd rd rem ren rename "
+		"rmdir set setlocal shift start time title type ver verify "
+		"vol" /* .builtins */
 	},
 	/* Powershell description. */
 	{
@@ -318,7 +329,8 @@ static Shell shells[] = {
 		'#', /* .commentChar */
 		'`', /* .escapeChar */
 		"\"`\\\"\0\n`n\0", /* .specialChar */
-		"\n\"#$&'*();<>@`{|} " /* .metaChar */
+		"\n\"#$&'*();<>@`{|} ", /* .metaChar */
+		NULL /* .builtins: the aliases and cmdlets of PowerShell */
 	}
 };
 
@@ -335,11 +347,16 @@ static Job *job_table;		/* The structures that describe them */
 static Job *job_table_end;	/* job_table + maxJobs */
 
 static char *targPrefix = NULL;	/* To identify a job change in the output. */
-static Job tokenWaitJob;	/* token wait pseudo-job */
+static ProcPipe tokenPipe;	/* The pipe for the job tokens */
 
 static HANDLE job_mutex = NULL;
 
-static void CollectOutput(Job *, bool);
+/* The number of times Job_CatchChildren woke up, for -dj */
+static unsigned int jobWakeups = 0;
+/* Whether Job_TokenWithdraw found the token pool empty */
+static bool tokenBlocked = false;
+
+static bool CollectOutput(Job *, bool);
 static void MAKE_ATTR_DEAD JobInterrupt(bool);
 
 static void
@@ -375,7 +392,8 @@ DumpJobs(const char *where)
 	for (job = job_table; job < job_table_end; job++) {
 		Job_FlagsToString(job, flags, sizeof flags);
 		debug_printf("job %d, status %d, flags %s, pid %lu\n",
-			(int)(job - job_table), job->status, flags, job->pid);
+			(int)(job - job_table), job->status, flags,
+			job->proc.pid);
 	}
 }
 
@@ -387,6 +405,11 @@ static void
 JobDeleteTarget(GNode *gn)
 {
 	const char *file;
+	size_t i;
+
+	/* The job may have created any of the targets of its batch. */
+	for (i = 0; i < gn->batch.len; i++)
+		JobDeleteTarget(GNodeVec_Get(&gn->batch, i));
 
 	if (gn->type & OP_JOIN)
 		return;
@@ -402,21 +425,24 @@ JobDeleteTarget(GNode *gn)
 		Error("*** %s removed", file);
 }
 
+/* Create the pipe through which the output of a job is collected. */
 static void
 JobCreatePipe(Job *job)
 {
-	if (CreatePipe(&job->inPipe, &job->outPipe, NULL, PIPESZ) == 0)
-		Punt("failed to create pipe: %s", strerr(GetLastError()));
-	/*
-	 * We mark the input side of the pipe non-blocking; we might lose the
-	 * race for the token when a new one becomes available, so the read
-	 * from the pipe should not block.
-	 */
-	if (SetNamedPipeHandleState(job->inPipe, &(DWORD){PIPE_NOWAIT}, NULL, NULL) == 0)
-		Punt("failed to set pipe handle state: %s", strerr(GetLastError()));
-	if (SetHandleInformation(job->outPipe, HANDLE_FLAG_INHERIT,
-			HANDLE_FLAG_INHERIT) == 0)
-		Punt("failed to set pipe attributes: %s", strerr(GetLastError()));
+	if (!ProcPipe_Open(&job->pipe))
+		Punt("failed to create pipe: %s", Proc_Error());
+}
+
+/*
+ * Start reading the next chunk of output from the job, directly into the
+ * free part of outBuf.
+ */
+static void
+JobStartRead(Job *job)
+{
+	if (!ProcPipe_StartRead(&job->pipe, &job->outBuf[job->curPos],
+		JOB_BUFSIZE - job->curPos))
+		Punt("failed to read from job pipe: %s", Proc_Error());
 }
 
 /*
@@ -439,16 +465,16 @@ JobPassSig_term(void)
 }
 
 static Job *
-JobFindHandle(HANDLE handle, JobStatus status, bool isJobs)
+JobFindPid(unsigned long pid, JobStatus status, bool isJobs)
 {
 	Job *job;
 
 	for (job = job_table; job < job_table_end; job++) {
-		if (job->status == status && job->handle == handle)
+		if (job->status == status && job->proc.pid == pid)
 			return job;
 	}
 	if (DEBUG(JOB) && isJobs)
-		DumpJobs("no handle");
+		DumpJobs("no pid");
 	return NULL;
 }
 
@@ -629,6 +655,15 @@ JobWriteCommand(Job *job, ShellWriter *wr, StringListNode *ln, const char *ucmd)
 		return;
 	}
 
+	/*
+	 * Remember the command in case it is the only one, see JobExec.
+	 * Its errors are only ignored by the shell.
+	 */
+	free(job->directCmd);
+	job->directCmd = job->cmdBuffer->len == 0 && !cmdFlags.ignerr
+	    ? bmake_strdup(xcmd) : NULL;
+	job->directEcho = job->echo && cmdFlags.echo;
+
 	escCmd = EscapeShell(xcmd);
 	if (cmdFlags.ignerr) {
 		JobWriteSpecials(job, wr, escCmd, run, &cmdFlags, &cmdTemplate);
@@ -664,6 +699,46 @@ JobWriteCommand(Job *job, ShellWriter *wr, StringListNode *ln, const char *ucmd)
 	free(xcmdStart);
 }
 
+static const char *const batchVars[] = { TARGET, IMPSRC, PREFIX };
+
+/*
+ * In the commands for a batch of nodes, see MakeBatch, the local variables
+ * .TARGET, .IMPSRC and .PREFIX list the values of all nodes in the batch.
+ * Remember the values of the first node, for JobRestoreBatchVars.
+ */
+static void
+JobSetBatchVars(GNode *gn, char **saved)
+{
+	size_t i, j;
+
+	for (i = 0; i < sizeof batchVars / sizeof batchVars[0]; i++) {
+		const char *value = GNode_ValueDirect(gn, batchVars[i]);
+
+		saved[i] = value != NULL ? bmake_strdup(value) : NULL;
+		for (j = 0; j < gn->batch.len; j++) {
+			GNode *bgn = GNodeVec_Get(&gn->batch, j);
+
+			value = GNode_ValueDirect(bgn, batchVars[i]);
+			if (value != NULL)
+				Var_Append(gn, batchVars[i], value);
+		}
+	}
+}
+
+static void
+JobRestoreBatchVars(GNode *gn, char **saved)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof batchVars / sizeof batchVars[0]; i++) {
+		if (saved[i] != NULL)
+			Var_Set(gn, batchVars[i], saved[i]);
+		else
+			Var_Delete(gn, batchVars[i]);
+		free(saved[i]);
+	}
+}
+
 /*
  * Write all commands to the shell file that is later executed.
  *
@@ -678,9 +753,13 @@ JobWriteCommands(Job *job)
 	StringListNode *ln;
 	bool seen = false;
 	ShellWriter wr;
+	char *batchSaved[sizeof batchVars / sizeof batchVars[0]];
 
 	wr.b = job->cmdBuffer;
 
+	if (!GNodeVec_IsEmpty(&job->node->batch))
+		JobSetBatchVars(job->node, batchSaved);
+
 	for (ln = job->node->commands.first; ln != NULL; ln = ln->next) {
 		const char *cmd = ln->datum;
 
@@ -694,6 +773,9 @@ JobWriteCommands(Job *job)
 		seen = true;
 	}
 
+	if (!GNodeVec_IsEmpty(&job->node->batch))
+		JobRestoreBatchVars(job->node, batchSaved);
+
 	/* Remove trailing separator. */
 	if (job->cmdBuffer->len > 0)
 		job->cmdBuffer->data[--job->cmdBuffer->len] = '\0';
@@ -732,12 +814,7 @@ static void
 JobClosePipes(Job *job)
 {
 	CollectOutput(job, true);
-
-	CloseHandle(job->outPipe);
-	job->outPipe = NULL;
-
-	CloseHandle(job->inPipe);
-	job->inPipe = NULL;
+	ProcPipe_Close(&job->pipe);
 }
 
 static void
@@ -793,7 +870,8 @@ JobFinishDoneExitedError(Job *job, DWORD *inout_status)
 static void
 JobFinishDoneExited(Job *job, DWORD *inout_status)
 {
-	DEBUG2(JOB, "Process %lu [%s] exited.\n", job->pid, job->node->name);
+	DEBUG2(JOB, "Process %lu [%s] exited.\n",
+		job->proc.pid, job->node->name);
 
 	if (*inout_status != 0)
 		JobFinishDoneExitedError(job, inout_status);
@@ -806,6 +884,24 @@ JobFinishDoneExited(Job *job, DWORD *inout_status)
 	(void)fflush(stdout);
 }
 
+/*
+ * Record how long the job took.  The commands of a batch make all of its
+ * targets at once, so each of them gets an equal share of the duration,
+ * which adds up again when they are batched in the next run.
+ */
+static void
+JobAddHistory(Job *job)
+{
+	GNode *gn = job->node;
+	unsigned long ms = (unsigned long)(GetTickCount64() - job->started);
+	size_t i;
+
+	ms /= (unsigned long)gn->batch.len + 1;
+	History_Add(gn, ms);
+	for (i = 0; i < gn->batch.len; i++)
+		History_Add(GNodeVec_Get(&gn->batch, i), ms);
+}
+
 /*
  * Do final processing for the given job including updating parent nodes and
  * starting new jobs as available/necessary.
@@ -825,15 +921,20 @@ JobFinish(Job *job, DWORD status)
 	bool return_job_token;
 
 	DEBUG3(JOB, "JobFinish: %lu [%s], status %lu\n",
-		job->pid, job->node->name, status);
+		job->proc.pid, job->node->name, status);
+
+	DEBUG3(JOB, "Process %lu [%s] woke us up %u times\n",
+		job->proc.pid, job->node->name, job->wakeups);
 
 	JobClosePipes(job);
-	CloseHandle(job->handle);
+	Proc_Close(&job->proc);
 	if (job->cmdBuffer != NULL) {
 		Buf_Done(job->cmdBuffer);
 
 		free(job->cmdBuffer);
 		job->cmdBuffer = NULL;
+		free(job->directCmd);
+		job->directCmd = NULL;
 	}
 
 	JobFinishDoneExited(job, &status);
@@ -864,9 +965,12 @@ JobFinish(Job *job, DWORD status)
 		 */
 		JobSaveCommands(job);
 		job->node->made = MADE;
-		if (!job->special)
+		if (!job->special) {
+			JobAddHistory(job);
 			return_job_token = true;
+		}
 		Make_Update(job->node);
+		Make_UpdateBatch(job->node);
 		job->status = JOB_ST_FREE;
 	} else if (status != 0) {
 		job_errors++;
@@ -964,7 +1068,7 @@ Job_CheckCommands(GNode *gn, void (*abortProc)(const char *, ...))
 		return true;
 	if (!Lst_IsEmpty(&gn->commands))
 		return true;
-	if ((gn->type & OP_LIB) && !Lst_IsEmpty(&gn->children))
+	if ((gn->type & OP_LIB) && !GNodeVec_IsEmpty(&gn->children))
 		return true;
 
 	/*
@@ -1026,17 +1130,55 @@ Job_CheckCommands(GNode *gn, void (*abortProc)(const char *, ...))
 	return false;
 }
 
-/* Execute the shell for the given job. */
+/*
+ * Print the command like the shell would have echoed it, as if it were
+ * the first line of output of the job.
+ */
+static void
+JobEchoCommand(Job *job, const char *cmd)
+{
+	if (!opts.silent)
+		SwitchOutputTo(job->node);
+#ifdef USE_META
+	if (useMeta)
+		meta_job_output(job, UNCONST(cmd), "\n");
+#endif
+	(void)fprintf(stdout, "%s\n", cmd);
+	(void)fflush(stdout);
+}
+
+/*
+ * Execute the shell for the given job, or the program directly if the job
+ * consists of a single simple command.
+ */
 static void
-JobExec(Job *job, char *args)
+JobExec(Job *job)
 {
-	STARTUPINFOA si = {sizeof si, 0};
-	PROCESS_INFORMATION pi;
+	const char *cmd = job->cmdBuffer->data;
+	ProcRedirect redirect = PROC_STDOUT | PROC_STDERR;
+	const char *filemonEnv = NULL;
+	const char *env;
+	char *program = NULL;
+	bool started = false;
+
+#ifdef USE_META
+	if (useMeta && (filemonEnv = meta_job_child(job)) != NULL)
+		redirect |= PROC_SUSPENDED;
+#endif
+	env = Var_Environment(job->node, filemonEnv);
+	if (job->directCmd != NULL)
+		program = Shell_FindProgram(job->directCmd, env);
 
 	if (DEBUG(JOB)) {
 		debug_printf("Running %s\n", job->node->name);
-		debug_printf("\tCommand: ");
-		debug_printf("%s\n", args);
+		if (program != NULL)
+			debug_printf("\tCommand without the shell: %s\n",
+			    job->directCmd);
+		else {
+			debug_printf("\tCommand: ");
+			debug_printf(cmdFmt "\n",
+			    shellPath, Shell_GetArgs(), cmd);
+		}
 	}
 
 	/*
@@ -1054,57 +1196,58 @@ JobExec(Job *job, char *args)
 	/* Pre-emptively mark job running, pid still zero though */
 	job->status = JOB_ST_RUNNING;
 
-	Var_ReexportVars(job->node);
-
-	si.dwFlags = STARTF_USESTDHANDLES;
-	si.hStdOutput = si.hStdError = job->outPipe;
-	si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
-	
-	if (CreateProcessA(shellPath, args, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi) == 0)
-		Punt("could not create process: %s", strerr(GetLastError()));
-	CloseHandle(pi.hThread);
+	if (job->node->type & (OP_MAKE | OP_SUBMAKE))
+		Dir_SaveStatCache();
+	else
+		Dir_ExpireStatCache();
+
+	if (program != NULL) {
+		started = Proc_SpawnDirect(&job->proc, program,
+		    job->directCmd, env, &job->pipe, redirect);
+		if (started && job->directEcho)
+			JobEchoCommand(job, job->directCmd);
+		else if (!started)
+			DEBUG2(JOB, "Cannot run %s without the shell: %s\n",
+			    program, Proc_Error());
+	}
+	free(program);
+	if (!started && !Proc_Spawn(&job->proc, shellPath, Shell_GetArgs(),
+	    cmd, env, &job->pipe, redirect))
+		Punt("could not create process: %s", Proc_Error());
 
-	job->handle = pi.hProcess;
-	job->pid = pi.dwProcessId;
+#ifdef USE_META
+	if (useMeta)
+		meta_job_parent(job, &job->proc);
+#endif
 
+	job->started = GetTickCount64();
 	Trace_Log(JOBSTART, job);
 
 	/*
 	 * Set the current position in the buffer to the beginning
-	 * and mark another stream to watch in the outputs mask
+	 * and start watching the output of the job.
 	 */
 	job->curPos = 0;
+	JobStartRead(job);
 
-	free(args);
 	if (job->cmdBuffer != NULL) {
 		Buf_Done(job->cmdBuffer);
 
 		free(job->cmdBuffer);
 		job->cmdBuffer = NULL;
+		free(job->directCmd);
+		job->directCmd = NULL;
 	}
 
 	/* Now that the job is actually running, add it to the table. */
 	if (DEBUG(JOB)) {
-		debug_printf("JobExec(%s): handle %p added to jobs table\n",
-			job->node->name, job->handle);
+		debug_printf("JobExec(%s): pid %lu added to jobs table\n",
+			job->node->name, job->proc.pid);
 		DumpJobs("job started");
 	}
 	Job_ReleaseMutex();
 }
 
-/* Create the argv needed to execute the shell for a given job. */
-static char *
-JobMakeArgs(Job *job)
-{
-	char *args;
-
-	args = bmake_malloc((size_t)snprintf(NULL, 0, cmdFmt, shellPath, shell->args,
-		job->cmdBuffer->data) + 1);
-	sprintf(args, cmdFmt, shellPath, shell->args, job->cmdBuffer->data);
-
-	return args;
-}
-
 static void
 JobWriteShellCommands(Job *job, GNode *gn, bool *out_run)
 {
@@ -1170,7 +1313,6 @@ static JobStartResult
 JobStart(GNode *gn, bool special)
 {
 	Job *job;		/* new job descriptor */
-	char *args;
 	bool cmdsOK;		/* true if the nodes commands were all right */
 	bool run;
 
@@ -1258,6 +1400,8 @@ JobStart(GNode *gn, bool special)
 
 			free(job->cmdBuffer);
 			job->cmdBuffer = NULL;
+			free(job->directCmd);
+			job->directCmd = NULL;
 		}
 
 		/*
@@ -1268,21 +1412,16 @@ JobStart(GNode *gn, bool special)
 			JobSaveCommands(job);
 			job->node->made = MADE;
 			Make_Update(job->node);
+			Make_UpdateBatch(job->node);
 		}
 		job->status = JOB_ST_FREE;
 		return cmdsOK ? JOB_FINISHED : JOB_ERROR;
 	}
 
-	/*
-	 * Set up the control arguments to the shell. This is based on the
-	 * flags set earlier for this job.
-	 */
-	args = JobMakeArgs(job);
-
 	/* Create the pipe by which we'll get the shell's output. */
 	JobCreatePipe(job);
 
-	JobExec(job, args);
+	JobExec(job);
 	return JOB_RUNNING;
 }
 
@@ -1301,31 +1440,34 @@ JobStart(GNode *gn, bool special)
  *	finish		true if this is the last time we'll be called
  *			for this job
  */
-static void
+static bool
 CollectOutput(Job *job, bool finish)
 {
+	bool gotOutput = false;	/* true if anything was read */
 	bool gotNL;		/* true if got a newline */
 	bool fbuf;		/* true if our buffer filled up */
 	size_t nr;		/* number of bytes read */
 	size_t i;		/* auxiliary index into outBuf */
 	size_t max;		/* limit for i (end of current data) */
-	DWORD nRead;		/* (Temporary) number of bytes read */
+	bool eof;		/* true if the pipe has no more output */
 
 	/* Read as many bytes as will fit in the buffer. */
 again:
 	gotNL = false;
 	fbuf = false;
 
-	if (PeekNamedPipe(job->inPipe, NULL, 0, NULL, &nRead, NULL) == 0)
-		Punt("failed to peek pipe: %s", strerr(GetLastError()));
-	if (nRead == 0)
-		return;
-	if (ReadFile(job->inPipe, &job->outBuf[job->curPos],
-		(DWORD)(JOB_BUFSIZE - job->curPos), &nRead, NULL) == 0)
-		Punt("failed to read from job pipe: %s", strerr(GetLastError()));
-	nr = (size_t)nRead;
+	switch (ProcPipe_ReadResult(&job->pipe, finish, &nr)) {
+	case PROC_AGAIN:
+		return gotOutput;
+	case PROC_ERROR:
+		Punt("failed to read from job pipe: %s", Proc_Error());
+	case PROC_DONE:
+		break;
+	}
 
-	if (nr == 0)
+	gotOutput = true;
+	eof = nr == 0;
+	if (eof)
 		finish = false;	/* stop looping */
 
 	/*
@@ -1419,6 +1561,8 @@ again:
 			job->curPos = 0;
 		}
 	}
+	if (!eof)
+		JobStartRead(job);
 	if (finish) {
 		/*
 		 * If the finish flag is true, we must loop until we hit
@@ -1430,6 +1574,7 @@ again:
 		 */
 		goto again;
 	}
+	return gotOutput;
 }
 
 static void
@@ -1444,52 +1589,94 @@ JobRun(GNode *targ)
 }
 
 /*
- * Handle the exit of a child. Called from Make_Make.
+ * Sleep until one of the running jobs exits or produces output.
  *
- * The job descriptor is removed from the list of children.
+ * Job tokens that are returned by other make processes don't wake us up,
+ * so if we are waiting for one of these, we look again after a short time.
+ */
+static void
+JobWaitForEvent(void)
+{
+	switch (Proc_WaitForEvent(tokenBlocked ? PROCESSWAIT : -1)) {
+	case PROC_DONE:
+		jobWakeups++;
+		break;
+	case PROC_AGAIN:
+		break;
+	case PROC_ERROR:
+		Punt("failed to wait for jobs: %s", Proc_Error());
+	}
+}
+
+/*
+ * Handle the jobs that have exited or produced output, without waiting.
+ * For each job that has exited, call JobFinish to finish things off.
  *
- * Notes:
- *	We do waits, blocking or not, according to the wisdom of our
- *	caller, until there are no more children to report. For each
- *	job, call JobFinish to finish things off.
+ * Return whether there are running jobs and none of them needed attention.
  */
-void
-Job_CatchChildren(void)
+static bool
+JobPollChildren(void)
 {
 	Job *job;
-
-	/* Don't even bother if we know there's no one around. */
-	if (jobTokensRunning == 0)
-		return;
+	ProcStatus status;	/* Exit/termination status */
+	bool running = false;
+	bool ready = false;
 
 	for (job = job_table; job < job_table_end; job++) {
 		if (job->status != JOB_ST_RUNNING)
 			continue;
+		running = true;
 
-		switch (WaitForSingleObject(job->handle, 0)) {
-		case WAIT_OBJECT_0:
-			DWORD status; /* Exit/termination status */
-
-			if (GetExitCodeProcess(job->handle, &status) == 0)
-				Punt("failed to get exit code for process: %s",
-					strerr(GetLastError()));
-
-			DEBUG2(JOB, "Process %d exited/stopped status %lx.\n",
-				job->pid, status);
+		switch (Proc_Wait(&job->proc, false, &status)) {
+		case PROC_DONE:
+			DEBUG2(JOB, "Process %lu exited/stopped status %lx.\n",
+				job->proc.pid, status);
 
+			job->wakeups++;
 			job->status = JOB_ST_FINISHED;
 			job->exit_status = status;
 			job->node->exit_status = status;
 
 			JobFinish(job, status);
+			ready = true;
 			break;
-		case WAIT_TIMEOUT:
-			CollectOutput(job, false);
+		case PROC_AGAIN:
+			if (CollectOutput(job, false)) {
+				job->wakeups++;
+				ready = true;
+			}
 			break;
-		case WAIT_FAILED:
-			Punt("failed to wait for process: %s", strerr(GetLastError()));
+		case PROC_ERROR:
+			Punt("failed to wait for process: %s", Proc_Error());
 		}
 	}
+	return running && !ready;
+}
+
+/*
+ * Handle the exit of a child. Called from Make_Make.
+ *
+ * The job descriptor is removed from the list of children.
+ *
+ * Notes:
+ *	We block until at least one of the running jobs needs attention,
+ *	then handle all jobs that have exited or produced output.
+ *
+ *	The jobs are looked at before blocking, since another wait, such as
+ *	the one in Cmd_Finish for a '!=' assignment during JobStart, may
+ *	already have consumed their wakeup.
+ */
+void
+Job_CatchChildren(void)
+{
+	/* Don't even bother if we know there's no one around. */
+	if (jobTokensRunning == 0)
+		return;
+
+	if (JobPollChildren()) {
+		JobWaitForEvent();
+		(void)JobPollChildren();
+	}
 }
 
 /*
@@ -1610,6 +1797,185 @@ Shell_GetArgs(void)
 	return shell->args;
 }
 
+/* Whether the first word of the command is one of the shell's builtins. */
+static bool
+IsShellBuiltin(const char *word, size_t len)
+{
+	const char *b = shell->builtins;
+
+	while (*b != '\0') {
+		size_t blen = strcspn(b, " ");
+
+		/* The shell also runs "echo." or "cd\\" itself. */
+		if (blen <= len && _strnicmp(word, b, blen) == 0 &&
+		    (blen == len || !ch_isalnum(word[blen])))
+			return true;
+		b += blen;
+		if (*b == ' ')
+			b++;
+	}
+	return false;
+}
+
+/* Find the value of the variable in the environment block. */
+static const char *
+EnvBlockValue(const char *env, const char *name)
+{
+	size_t len = strlen(name);
+
+	if (env == NULL)
+		return getenv(name);
+	for (; *env != '\0'; env += strlen(env) + 1)
+		if (_strnicmp(env, name, len) == 0 && env[len] == '=')
+			return env + len + 1;
+	return NULL;
+}
+
+static bool
+IsFile(const char *path)
+{
+	DWORD attrs = GetFileAttributesA(path);
+
+	return attrs != INVALID_FILE_ATTRIBUTES &&
+	       !(attrs & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+/*
+ * Look for the program in the directory like the shell does, by its name
+ * if that has an extension, then with each of the extensions in PATHEXT.
+ * Return the path of the program that the shell would start, or NULL.
+ */
+static char *
+FindProgramIn(const char *dir, size_t dirLen, const char *word, size_t len,
+	      const char *pathext)
+{
+	Buffer buf;
+	size_t baseLen;
+	const char *ext;
+
+	Buf_Init(&buf);
+	if (dirLen > 0) {
+		Buf_AddBytes(&buf, dir, dirLen);
+		if (dir[dirLen - 1] != '\\')
+			Buf_AddByte(&buf, '\\');
+	}
+	Buf_AddBytes(&buf, word, len);
+	baseLen = buf.len;
+
+	ext = strrchr(buf.data, '.');
+	if (ext != NULL && strchr(ext, '\\') == NULL && IsFile(buf.data))
+		return Buf_DoneData(&buf);
+
+	while (*pathext != '\0') {
+		size_t extLen = strcspn(pathext, ";");
+
+		Buf_AddBytes(&buf, pathext, extLen);
+		if (extLen > 0 && IsFile(buf.data))
+			return Buf_DoneData(&buf);
+		buf.len = baseLen;
+		buf.data[baseLen] = '\0';
+		pathext += extLen;
+		if (*pathext == ';')
+			pathext++;
+	}
+	Buf_Done(&buf);
+	return NULL;
+}
+
+/*
+ * Return the path of the program if the command can be run without the
+ * shell, or NULL if it needs the shell: because it uses one of the
+ * shell's special characters or builtins, or because the program is not
+ * an executable file that the shell would find in the current directory
+ * or in the PATH of the environment block 'env'.  The caller frees the
+ * path.
+ *
+ * Only the programs that are not found are cached, by the name of the
+ * program and the search paths.  The shell is always right for them,
+ * even if the program is created later.  A program that is found is
+ * looked up again each time, since a command may create another program
+ * of the same name that comes first in the search, or remove it.
+ */
+char *
+Shell_FindProgram(const char *cmd, const char *env)
+{
+	static HashTable cache;
+	static bool cacheInit = false;
+	const char *path, *pathext, *p, *ext;
+	size_t len, i;
+	char *program = NULL;
+	Buffer key;
+
+	if (shell->builtins == NULL || shell->metaChar == NULL)
+		return NULL;
+	for (i = 0; cmd[i] != '\0'; i++)
+		if (ch_is_shell_meta(cmd[i], shell->metaChar))
+			return NULL;
+
+	/*
+	 * A command in quotes, or with a name that the shell would split
+	 * differently from the program, is left to the shell.
+	 */
+	len = strcspn(cmd, " \t");
+	if (len == 0)
+		return NULL;
+	for (i = 0; i < len; i++)
+		if (strchr("\"/,;=()+[]", cmd[i]) != NULL ||
+		    (cmd[i] == ':' && i != 1))
+			return NULL;
+	if (IsShellBuiltin(cmd, len))
+		return NULL;
+
+	if ((path = EnvBlockValue(env, "PATH")) == NULL)
+		path = "";
+	if ((pathext = EnvBlockValue(env, "PATHEXT")) == NULL)
+		pathext = ".COM;.EXE;.BAT;.CMD";
+	if (strchr(path, '"') != NULL)
+		return NULL;
+
+	if (!cacheInit) {
+		HashTable_Init(&cache);
+		cacheInit = true;
+	}
+	Buf_Init(&key);
+	Buf_AddBytes(&key, cmd, len);
+	Buf_AddByte(&key, '\n');
+	Buf_AddStr(&key, path);
+	Buf_AddByte(&key, '\n');
+	Buf_AddStr(&key, pathext);
+	if (HashTable_FindEntry(&cache, key.data) != NULL) {
+		Buf_Done(&key);
+		return NULL;
+	}
+
+	if (memchr(cmd, '\\', len) != NULL || memchr(cmd, ':', len) != NULL)
+		program = FindProgramIn("", 0, cmd, len, pathext);
+	else if ((program = FindProgramIn(".", 1, cmd, len, pathext))
+		 == NULL) {
+		for (p = path; program == NULL && *p != '\0';) {
+			size_t dirLen = strcspn(p, ";");
+
+			if (dirLen > 0)
+				program = FindProgramIn(p, dirLen, cmd, len,
+				    pathext);
+			p += dirLen;
+			if (*p == ';')
+				p++;
+		}
+	}
+
+	/* Batch files and documents are started by the shell. */
+	if (program != NULL && ((ext = strrchr(program, '.')) == NULL ||
+	    (_stricmp(ext, ".exe") != 0 && _stricmp(ext, ".com") != 0))) {
+		free(program);
+		program = NULL;
+	}
+	if (program == NULL)
+		HashTable_Set(&cache, key.data, NULL);
+	Buf_Done(&key);
+	return program;
+}
+
 void
 Job_SetPrefix(void)
 {
@@ -1916,11 +2282,11 @@ JobInterrupt(bool runINTERRUPT)
 		gn = job->node;
 
 		JobDeleteTarget(gn);
-		if (job->handle != NULL) {
+		if (job->proc.pid != 0) {
 			DEBUG1(JOB,
-				"JobInterrupt terminating child %p.\n",
-				job->handle);
-			TerminateProcess(job->handle, 0);
+				"JobInterrupt terminating child %lu.\n",
+				job->proc.pid);
+			Proc_Kill(&job->proc);
 			CollectOutput(job, true);
 		}
 	}
@@ -1945,8 +2311,10 @@ int
 Job_Finish(void)
 {
 	GNode *endNode = Targ_GetEndNode();
+
+	DEBUG1(JOB, "Waited for jobs %u times\n", jobWakeups);
 	if (!Lst_IsEmpty(&endNode->commands) ||
-		!Lst_IsEmpty(&endNode->children)) {
+		!GNodeVec_IsEmpty(&endNode->children)) {
 		if (job_errors != 0)
 			Error("Errors reported so .END ignored");
 		else
@@ -2000,11 +2368,31 @@ Job_AbortAll(void)
 			/*
 			 * kill the child process
 			 */
-			TerminateProcess(job->handle, 0);
+			Proc_Kill(&job->proc);
 		}
 	}
 }
 
+/* Remove all tokens from the job pipe. */
+static void
+JobTokenFlush(void)
+{
+	char tok;
+	ProcResult res;
+
+	while ((res = ProcPipe_TryReadToken(&tokenPipe, &tok)) == PROC_DONE)
+		continue;
+	if (res == PROC_ERROR)
+		Fatal("Failed to read from pipe: %s", Proc_Error());
+}
+
+static void
+JobTokenPut(char tok)
+{
+	if (!ProcPipe_WriteToken(&tokenPipe, tok))
+		Fatal("Failed to write to pipe: %s", Proc_Error());
+}
+
 /*
  * Put a token (back) into the job pipe.
  * This allows a make process to start a build job.
@@ -2012,47 +2400,38 @@ Job_AbortAll(void)
 static void
 JobTokenAdd(void)
 {
-	DWORD ret;
-	char tok = JOB_TOKENS[aborting], tok1;
+	char tok = JOB_TOKENS[aborting];
 
 	/* If we are depositing an error token flush everything else */
-	if (tok != '+') {
-		while (ReadFile(tokenWaitJob.inPipe, &tok1, 1, NULL, NULL) != 0);
-
-		if ((ret = GetLastError()) != ERROR_NO_DATA)
-			Fatal("Failed to read from pipe: %s", strerr(ret));
-	}
+	if (tok != '+')
+		JobTokenFlush();
 
 	DEBUG3(JOB, "(%lu) aborting %d, deposit token %c\n",
 		myPid, aborting, tok);
 
-	if (WriteFile(tokenWaitJob.outPipe, &tok, 1, NULL, NULL) == 0)
-		Fatal("Failed to write to pipe: %s", strerr(GetLastError()));
+	JobTokenPut(tok);
 }
 
-/* Prep the job token pipe in the root make process. */
+/*
+ * Prep the job token pipe in the root make process, or use the one passed
+ * in from the parent.
+ */
 void
-Job_ServerStart(int max_tokens, HANDLE jp_0, HANDLE jp_1)
+Job_ServerStart(int max_tokens, ProcPipe *parent)
 {
 	int i;
 	char jobarg[64];
 
-	if (jp_0 != NULL && jp_1 != NULL) {
+	if (parent != NULL) {
 		/* Pipe passed in from parent */
-		tokenWaitJob.inPipe = jp_0;
-		tokenWaitJob.outPipe = jp_1;
+		tokenPipe = *parent;
 		return;
 	}
 
-	JobCreatePipe(&tokenWaitJob);
-
-	/* make the read pipe inheritable */
-	if (SetHandleInformation(tokenWaitJob.inPipe, HANDLE_FLAG_INHERIT,
-		HANDLE_FLAG_INHERIT) == 0)
-		Punt("failed to set pipe attributes: %s", strerr(GetLastError()));
+	if (!ProcPipe_OpenTokens(&tokenPipe))
+		Punt("failed to create token pipe: %s", Proc_Error());
 
-	snprintf(jobarg, sizeof jobarg, "%p,%p",
-		tokenWaitJob.inPipe, tokenWaitJob.outPipe);
+	ProcPipe_Format(&tokenPipe, jobarg, sizeof jobarg);
 
 	Global_Append(MAKEFLAGS, "-J");
 	Global_Append(MAKEFLAGS, jobarg);
@@ -2089,45 +2468,43 @@ Job_TokenReturn(void)
 bool
 Job_TokenWithdraw(void)
 {
-	char tok, tok1;
-	DWORD ret = 0;
+	char tok;
+	ProcResult res;
 
 	DEBUG3(JOB, "Job_TokenWithdraw(%lu): aborting %d, running %d\n",
 		myPid, aborting, jobTokensRunning);
 
+	tokenBlocked = false;
 	if (aborting != ABORT_NONE || (jobTokensRunning >= opts.maxJobs))
 		return false;
 
-	if (ReadFile(tokenWaitJob.inPipe, &tok, 1, NULL, NULL) == 0 &&
-			(ret = GetLastError()) != ERROR_NO_DATA)
-		Fatal("Failed to read from pipe: %s", strerr(ret));
+	res = ProcPipe_TryReadToken(&tokenPipe, &tok);
+	if (res == PROC_ERROR)
+		Fatal("Failed to read from pipe: %s", Proc_Error());
 
-	if (ret == ERROR_NO_DATA && jobTokensRunning != 0) {
+	if (res == PROC_AGAIN && jobTokensRunning != 0) {
 		DEBUG1(JOB, "(%lu) blocked for token\n", myPid);
+		tokenBlocked = true;
 		return false;
 	}
 
-	if (ret != ERROR_NO_DATA && tok != '+') {
+	if (res == PROC_DONE && tok != '+') {
 		/* make being aborted - remove any other job tokens */
 		DEBUG2(JOB, "(%lu) aborted by token %c\n", myPid, tok);
 
-		while (ReadFile(tokenWaitJob.inPipe, &tok1, 1, NULL, NULL) != 0);
-		if ((ret = GetLastError()) != ERROR_NO_DATA)
-			Fatal("Failed to read from pipe: %s", strerr(ret));
+		JobTokenFlush();
 
 		/* And put the stopper back */
-		if (WriteFile(tokenWaitJob.outPipe, &tok, 1, NULL, NULL) == 0)
-			Fatal("Failed to write to pipe: %s", strerr(GetLastError()));
+		JobTokenPut(tok);
 		if (shouldDieQuietly(NULL, 1))
 			exit(6);	/* we aborted */
 		Fatal("A failure has been detected "
 			  "in another branch of the parallel make");
 	}
 
-	if (ret != ERROR_NO_DATA && jobTokensRunning == 0)
+	if (res == PROC_DONE && jobTokensRunning == 0)
 		/* We didn't want the token really */
-		if (WriteFile(tokenWaitJob.outPipe, &tok, 1, NULL, NULL) == 0)
-			Fatal("Failed to write to pipe: %s", strerr(GetLastError()));
+		JobTokenPut(tok);
 
 	jobTokensRunning++;
 	DEBUG1(JOB, "(%lu) withdrew token\n", myPid);
@@ -78,21 +78,12 @@
 #ifndef MAKE_JOB_H
 #define MAKE_JOB_H
 
-#include <winsock2.h>
-#undef SP_ERROR
-#undef SearchPath
-#undef ERROR
+#include "proc.h"
 
 #ifdef USE_META
 # include "meta.h"
 #endif
 
-/*
- * Format for executing shells.
- * "shellPath" args cmd
- */
-#define cmdFmt "\"%s\" %s %s"
-
 typedef enum JobStatus {
 	JOB_ST_FREE	= 0,	/* Job is available */
 	JOB_ST_SET_UP	= 1,	/* Job is allocated but otherwise invalid */
@@ -115,11 +106,8 @@ typedef enum JobStatus {
  * other dependencies are finished as well.
  */
 typedef struct Job {
-	/* The process ID of the shell running the commands */
-	DWORD pid;
-
-	/* The process handle of the shell running the commands */
-	HANDLE handle;
+	/* The shell running the commands */
+	Proc proc;
 
 	/* The target the child is making */
 	GNode *node;
@@ -134,6 +122,13 @@ typedef struct Job {
 	/* This is where the shell commands go. */
 	Buffer *cmdBuffer;
 
+	/*
+	 * The command if it is the only one, so that it may run without
+	 * the shell, and whether make has to echo it then.
+	 */
+	char *directCmd;
+	bool directEcho;
+
 	DWORD exit_status;
 
 	JobStatus status;
@@ -145,8 +140,13 @@ typedef struct Job {
 	/* Target is a special one. */
 	bool special;
 
-	HANDLE inPipe;		/* Pipe for reading output from job */
-	HANDLE outPipe;		/* Pipe for writing control commands */
+	ProcPipe pipe;		/* Pipe for reading output from job */
+
+	/* How often Job_CatchChildren woke up for this job, for -dj */
+	unsigned int wakeups;
+
+	/* When the child was started, from GetTickCount64, for .MAKE.HISTORY */
+	ULONGLONG started;
 
 #define JOB_BUFSIZE	1024
 	/* Buffer for storing the output of the job, line by line. */
@@ -202,6 +202,7 @@ ch_is_shell_special(char c, const char *specialChar)
 void Shell_Init(void);
 ShellInfo *Shell_GetInfo(void);
 const char *Shell_GetArgs(void);
+char *MAKE_ATTR_USE Shell_FindProgram(const char *, const char *);
 void Job_Touch(GNode *, bool);
 bool Job_CheckCommands(GNode *, void (*abortProc)(const char *, ...))
 	MAKE_ATTR_USE;
@@ -215,7 +216,7 @@ void Job_Wait(void);
 void Job_AbortAll(void);
 void Job_TokenReturn(void);
 bool Job_TokenWithdraw(void) MAKE_ATTR_USE;
-void Job_ServerStart(int, HANDLE, HANDLE);
+void Job_ServerStart(int, ProcPipe *);
 void Job_SetPrefix(void);
 bool Job_RunTarget(const char *, const char *);
 void Job_FlagsToString(const Job *, char *, size_t);
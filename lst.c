@@ -37,7 +37,7 @@
 static ListNode *
 LstNodeNew(ListNode *prev, ListNode *next, void *datum)
 {
-	ListNode *ln = bmake_malloc(sizeof *ln);
+	ListNode *ln = Arena_Alloc(&parseArena, sizeof *ln);
 
 	ln->prev = prev;
 	ln->next = next;
@@ -53,7 +53,7 @@ Lst_Done(List *list)
 
 	for (ln = list->first; ln != NULL; ln = next) {
 		next = ln->next;
-		free(ln);
+		Arena_Free(&parseArena, ln, sizeof *ln);
 	}
 }
 
@@ -65,7 +65,7 @@ Lst_DoneFree(List *list)
 	for (ln = list->first; ln != NULL; ln = next) {
 		next = ln->next;
 		free(ln->datum);
-		free(ln);
+		Arena_Free(&parseArena, ln, sizeof *ln);
 	}
 }
 
@@ -144,7 +144,7 @@ Lst_Remove(List *list, ListNode *ln)
 	if (list->last == ln)
 		list->last = ln->prev;
 
-	free(ln);
+	Arena_Free(&parseArena, ln, sizeof *ln);
 }
 
 /* Replace the datum in the given node with the new datum. */
@@ -241,9 +241,16 @@ void
 Vector_Init(Vector *v, size_t itemSize)
 {
 	v->len = 0;
-	v->cap = 10;
+	v->cap = 0;
 	v->itemSize = itemSize;
-	v->items = bmake_malloc(v->cap * v->itemSize);
+	v->items = NULL;
+}
+
+static void
+Vector_Grow(Vector *v)
+{
+	v->cap = v->cap == 0 ? 4 : 2 * v->cap;
+	v->items = bmake_realloc(v->items, v->cap * v->itemSize);
 }
 
 /*
@@ -253,10 +260,8 @@ Vector_Init(Vector *v, size_t itemSize)
 void *
 Vector_Push(Vector *v)
 {
-	if (v->len >= v->cap) {
-		v->cap *= 2;
-		v->items = bmake_realloc(v->items, v->cap * v->itemSize);
-	}
+	if (v->len >= v->cap)
+		Vector_Grow(v);
 	v->len++;
 	return Vector_Get(v, v->len - 1);
 }
@@ -272,3 +277,35 @@ Vector_Pop(Vector *v)
 	v->len--;
 	return Vector_Get(v, v->len);
 }
+
+/*
+ * Add space for a new item at index i, moving the items from there on one
+ * place up, and return a pointer to that space.
+ * The returned data is valid until the next modifying operation.
+ */
+void *
+Vector_Insert(Vector *v, size_t i)
+{
+	unsigned char *items;
+
+	assert(i <= v->len);
+	if (v->len >= v->cap)
+		Vector_Grow(v);
+	items = v->items;
+	memmove(items + (i + 1) * v->itemSize, items + i * v->itemSize,
+	    (v->len - i) * v->itemSize);
+	v->len++;
+	return items + i * v->itemSize;
+}
+
+/* Remove the item at index i, moving the items after it one place down. */
+void
+Vector_Remove(Vector *v, size_t i)
+{
+	unsigned char *items = v->items;
+
+	assert(i < v->len);
+	v->len--;
+	memmove(items + i * v->itemSize, items + (i + 1) * v->itemSize,
+	    (v->len - i) * v->itemSize);
+}
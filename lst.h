@@ -158,7 +158,9 @@ void *Lst_Dequeue(List *) MAKE_ATTR_USE;
 
 /*
  * A vector is an ordered collection of items, allowing for fast indexed
- * access.
+ * access.  An empty vector does not allocate any memory, its items are
+ * NULL, so they must not be passed to qsort or used for pointer arithmetic
+ * unless the vector has items.
  */
 typedef struct Vector {
 	void *items;		/* memory holding the items */
@@ -182,6 +184,8 @@ Vector_Get(Vector *v, size_t i)
 
 void *Vector_Push(Vector *);
 void *Vector_Pop(Vector *);
+void *Vector_Insert(Vector *, size_t);
+void Vector_Remove(Vector *, size_t);
 
 MAKE_INLINE void
 Vector_Done(Vector *v)
@@ -112,7 +112,8 @@ bool deleteOnError;		/* .DELETE_ON_ERROR: set */
 static int maxJobTokens;	/* -j argument */
 static bool enterFlagObj;	/* -w and objdir != srcdir */
 
-static HANDLE jp_0 = NULL, jp_1 = NULL; /* ends of parent job pipe */
+static ProcPipe parentJobPipe;	/* the job pipe passed in from the parent */
+static bool haveParentJobPipe = false;
 bool doing_depend;		/* Set while reading .depend */
 static bool jobsRunning;	/* true if the jobs might be running */
 static const char *tracefile;
@@ -287,6 +288,9 @@ MainParseArgDebug(const char *argvalue)
 		case 't':
 			debug.DEBUG_TARG = true;
 			break;
+		case 'u':
+			debug.DEBUG_ALLOC = true;
+			break;
 		case 'V':
 			opts.debugVflag = true;
 			break;
@@ -366,13 +370,13 @@ MainParseArgChdir(const char *argvalue)
 static void
 MainParseArgJobsInternal(const char *argvalue)
 {
-	char end;
-	if (sscanf(argvalue, "%p,%p%c", &jp_0, &jp_1, &end) != 2) {
+	if (!ProcPipe_Parse(&parentJobPipe, argvalue)) {
 		(void)fprintf(stderr,
 		    "%s: internal error -- J option malformed (%s)\n",
 		    progname, argvalue);
 		usage();
 	}
+	haveParentJobPipe = true;
 	
 	Global_Append(MAKEFLAGS, "-J");
 	Global_Append(MAKEFLAGS, argvalue);
@@ -888,6 +892,8 @@ runTargets(void)
 	else
 		Targ_FindList(&targs, &opts.create);
 
+	FileHash_Init();
+
 	if (!opts.compatMake) {
 		/*
 		 * Initialize job module before traversing the graph
@@ -1140,6 +1146,9 @@ static void
 InitVpath(void)
 {
 	char *vpath, savec, *path;
+	StringList dirs = LST_INIT;
+	StringListNode *ln;
+
 	if (!Var_Exists(SCOPE_CMDLINE, "VPATH"))
 		return;
 
@@ -1154,11 +1163,15 @@ InitVpath(void)
 		/* Save terminator character so know when to stop */
 		savec = *p;
 		*p = '\0';
-		/* Add directory to search path */
-		(void)SearchPath_Add(&dirSearchPath, path);
-		*p = savec;
+		Lst_Append(&dirs, path);
 		path = p + 1;
 	} while (savec == ';');
+
+	/* Read the directories in parallel, then add them in order. */
+	Dir_Prefetch(&dirs);
+	for (ln = dirs.first; ln != NULL; ln = ln->next)
+		(void)SearchPath_Add(&dirSearchPath, ln->datum);
+	Lst_Done(&dirs);
 	free(vpath);
 }
 
@@ -1221,6 +1234,9 @@ main_Init(int argc, char **argv)
 
 	myPid = GetCurrentProcessId();
 
+	if (!Proc_Init())
+		Punt("failed to set up process handling: %s", Proc_Error());
+
 	/* Just in case MAKEOBJDIR wants us to do something tricky. */
 	Targ_Init();
 	Var_Init();
@@ -1394,9 +1410,19 @@ main_PrepareMaking(void)
 		opts.compatMake = true;
 
 	if (!opts.compatMake)
-		Job_ServerStart(maxJobTokens, jp_0, jp_1);
-	DEBUG5(JOB, "job_pipe %d %d, maxjobs %d, tokens %d, compat %d\n",
-	    jp_0, jp_1, opts.maxJobs, maxJobTokens, opts.compatMake ? 1 : 0);
+		Job_ServerStart(maxJobTokens,
+		    haveParentJobPipe ? &parentJobPipe : NULL);
+	if (DEBUG(JOB)) {
+		char jobarg[64];
+
+		if (haveParentJobPipe)
+			ProcPipe_Format(&parentJobPipe, jobarg, sizeof jobarg);
+		else
+			snprintf(jobarg, sizeof jobarg, "none");
+		debug_printf("job_pipe %s, maxjobs %d, tokens %d, compat %d\n",
+		    jobarg, opts.maxJobs, maxJobTokens,
+		    opts.compatMake ? 1 : 0);
+	}
 
 	if (opts.printVars == PVM_NONE)
 		Main_ExportMAKEFLAGS(true);	/* initial export */
@@ -1465,10 +1491,20 @@ main_CleanUp(void)
 	Arch_End();
 	Parse_End();
 	Dir_End();
+	History_End();
+	FileHash_End();
+	CmdCache_End();
 	Job_End();
+	Proc_End();
 	Msg_End();
 	Trace_End();
 	Str_Intern_End();
+
+	if (DEBUG(ALLOC))
+		Malloc_Stats();
+#ifdef CLEANUP
+	Arena_Done(&parseArena);
+#endif
 }
 
 /* Determine the exit code. */
@@ -1486,7 +1522,10 @@ main(int argc, char **argv)
 	bool outOfDate;
 
 	main_Init(argc, argv);
-	main_ReadFiles();
+	if (!Snapshot_Load(argc, argv)) {
+		main_ReadFiles();
+		Snapshot_Save();
+	}
 	main_PrepareMaking();
 	outOfDate = main_Run();
 	main_CleanUp();
@@ -1504,6 +1543,7 @@ ReadMakefile(const char *fname)
 	char *name, *path = NULL;
 
 	if (strcmp(fname, "-") == 0) {
+		Snapshot_Skip("the makefile is read from standard input");
 		Parse_File("(stdin)", -1);
 		Var_Set(SCOPE_INTERNAL, "MAKEFILE", "");
 	} else {
@@ -1557,94 +1597,162 @@ found:
 }
 
 /*
- * Execute the command in cmd, and return its output (only stdout, not
- * stderr, possibly empty).  In the output, replace newlines with spaces.
+ * Add the output that has arrived so far to buf, and start the next read.
+ *
+ * Return PROC_AGAIN if more output may follow, PROC_DONE at end-of-file.
  */
-char *
-Cmd_Exec(const char *cmd, char **error)
+static ProcResult
+CmdExecRead(ProcPipe *pp, Buffer *buf, char *chunk, size_t chunksize,
+	    bool finish)
 {
-	DWORD status;		/* command exit status */
-	Buffer buf = {0};		/* buffer to store the result */
-	DWORD bytes_read;
-	char *output;
-	char *p;
-	DWORD saved_errno;
-	char result[BUFSIZ];
+	size_t nr;
+	ProcResult res;
+
+	while ((res = ProcPipe_ReadResult(pp, finish, &nr)) == PROC_DONE) {
+		if (nr == 0)
+			return PROC_DONE;
+		Buf_AddBytes(buf, chunk, nr);
+		if (!ProcPipe_StartRead(pp, chunk, chunksize))
+			return PROC_ERROR;
+	}
+	return res;
+}
+
+/* A command from Cmd_Start whose output is being collected. */
+struct CmdExec {
+	char *cmd;
+	char *cached;		/* the output from the command cache */
+	CmdCacheKey *cacheKey;	/* for CmdCache_Add, if not cached */
+	Proc proc;
+	ProcPipe pp;
+	bool exited;
+	ProcStatus status;	/* once it has exited */
+	Buffer buf;		/* the output so far */
+	ProcResult readRes;
+	CmdExec *next;		/* in runningCmds */
+	/* Large enough that big outputs need few round trips. */
+	char chunk[0x10000];
+};
+
+/* The commands that have been started but not finished. */
+static CmdExec *runningCmds = NULL;
 
-	STARTUPINFOA si = {sizeof si, 0};
-	PROCESS_INFORMATION pi;
-	HANDLE read, write;
+/*
+ * Start the command in cmd, without waiting for it.  Several commands may
+ * be running at the same time; Cmd_Finish collects the output of each.
+ */
+CmdExec *
+Cmd_Start(const char *cmd)
+{
+	CmdExec *ce = bmake_malloc(sizeof *ce);
 
 	if (shellPath == NULL)
 		Shell_Init();
 
-	p = (char *)Shell_GetArgs();
-	output = _alloca((size_t)snprintf(NULL, 0, cmdFmt, shellPath, p, cmd) + 1);
-	sprintf(output, cmdFmt, shellPath, p, cmd);
+	ce->cmd = bmake_strdup(cmd);
+	ce->exited = true;
+	ce->status = 0;
+	ce->readRes = PROC_DONE;
+	Buf_Init(&ce->buf);
+	ce->next = NULL;
 
-	DEBUG1(VAR, "Capturing the output of command \"%s\"\n", cmd);
+	if ((ce->cached = CmdCache_Find(cmd, &ce->cacheKey)) != NULL)
+		return ce;
 
-	if (CreatePipe(&read, &write, NULL, PIPESZ) == 0)
-		Punt("failed to create pipe: %s", strerr(GetLastError()));
-	if (SetNamedPipeHandleState(read, &(DWORD){PIPE_NOWAIT}, NULL, NULL) == 0)
-		Punt("failed to set pipe handle state: %s", strerr(GetLastError()));
-	if (SetHandleInformation(write, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT) == 0)
-		Punt("failed to set pipe attributes: %s", strerr(GetLastError()));
+	DEBUG1(VAR, "Capturing the output of command \"%s\"\n", cmd);
 
-	Var_ReexportVars(SCOPE_GLOBAL);
+	if (!ProcPipe_Open(&ce->pp))
+		Punt("failed to create pipe: %s", Proc_Error());
 
-	si.dwFlags = STARTF_USESTDHANDLES;
-	si.hStdOutput = write;
-	si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
-	si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+	if (!Proc_Spawn(&ce->proc, shellPath, Shell_GetArgs(), cmd,
+		Var_Environment(SCOPE_GLOBAL, NULL), &ce->pp, PROC_STDOUT))
+		Punt("could not create process: %s", Proc_Error());
 
-	if (CreateProcessA(shellPath, output, NULL, NULL, TRUE, 0, NULL, NULL,
-			&si, &pi) == 0)
-		Punt("could not create process: %s", strerr(GetLastError()));
+	ce->exited = false;
+	ce->readRes = PROC_AGAIN;
+	if (!ProcPipe_StartRead(&ce->pp, ce->chunk, sizeof ce->chunk))
+		ce->readRes = PROC_ERROR;
+	ce->next = runningCmds;
+	runningCmds = ce;
+	return ce;
+}
 
-	Buf_Init(&buf);
-	while ((status = WaitForSingleObject(pi.hProcess, PROCESSWAIT)) == WAIT_TIMEOUT) {
-		DWORD avail;
+/*
+ * Collect the output that has arrived so far.  Return whether the command
+ * has exited and all of its output has been read.
+ */
+static bool
+CmdExec_Poll(CmdExec *ce)
+{
+	ProcResult res;
 
-		if (PeekNamedPipe(read, NULL, 0, NULL, &avail, NULL) == 0)
-			Punt("failed to peek pipe: %s", strerr(GetLastError()));
+	if (ce->exited)
+		return true;
 
-		if (avail >= PIPESZ) {
-			while (ReadFile(read, result, sizeof result, &bytes_read, NULL) != 0)
-				Buf_AddBytes(&buf, result, (size_t)bytes_read);
+	if (ce->readRes == PROC_AGAIN)
+		ce->readRes = CmdExecRead(&ce->pp, &ce->buf, ce->chunk,
+		    sizeof ce->chunk, false);
+	res = Proc_Wait(&ce->proc, false, &ce->status);
+	if (res == PROC_ERROR)
+		Punt("failed to wait for process: %s", Proc_Error());
+	if (res == PROC_AGAIN)
+		return false;
 
-			if ((status = GetLastError()) != ERROR_NO_DATA)
-				Punt("failed to read from pipe: %s", strerr(status));
-		}
-	}
+	ce->exited = true;
+	Proc_Close(&ce->proc);
+	if (ce->readRes == PROC_AGAIN)
+		ce->readRes = CmdExecRead(&ce->pp, &ce->buf, ce->chunk,
+		    sizeof ce->chunk, true);
+	ProcPipe_Close(&ce->pp);
+	return true;
+}
 
-	if (status == WAIT_FAILED)
-		Punt("failed to wait for process: %s", strerr(GetLastError()));
-	if (GetExitCodeProcess(pi.hProcess, &status) == 0)
-		Punt("failed to get exit code for process: %s", strerr(GetLastError()));
+/*
+ * Wait for the command from Cmd_Start to exit, and return its output (only
+ * stdout, not stderr, possibly empty).  In the output, replace newlines
+ * with spaces.  While waiting, keep reading the output of the other
+ * running commands as well, so that they do not block on a full pipe.
+ */
+char *
+Cmd_Finish(CmdExec *ce, char **error)
+{
+	Buffer *buf = &ce->buf;
+	CmdExec **pp;
+	char *output;
+	char *p;
 
-	CloseHandle(pi.hProcess);
-	CloseHandle(pi.hThread);
+	while (!CmdExec_Poll(ce)) {
+		CmdExec *other;
 
-	if (buf.cap == 0)
-		Buf_Init(&buf);
+		for (other = runningCmds; other != NULL; other = other->next)
+			if (other != ce)
+				(void)CmdExec_Poll(other);
+		if (Proc_WaitForEvent(-1) == PROC_ERROR)
+			Punt("failed to wait for process: %s", Proc_Error());
+	}
+	for (pp = &runningCmds; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == ce) {
+			*pp = ce->next;
+			break;
+		}
+	}
 
-	while (ReadFile(read, result, sizeof result, &bytes_read, NULL) != 0)
-		Buf_AddBytes(&buf, result, (size_t)bytes_read);
-	saved_errno = GetLastError();
+	if (ce->cached != NULL) {
+		*error = NULL;
+		output = ce->cached;
+		Buf_Done(buf);
+		goto done;
+	}
 
-	CloseHandle(write);
-	CloseHandle(read);
-	
-	if (Buf_EndsWith(&buf, '\n')) {
-		if (buf.data[buf.len - 2] == '\r')
-			buf.data[buf.len - 2] = '\0';
+	if (Buf_EndsWith(buf, '\n')) {
+		if (buf->len >= 2 && buf->data[buf->len - 2] == '\r')
+			buf->data[buf->len - 2] = '\0';
 		else
-			buf.data[buf.len - 1] = '\0';
+			buf->data[buf->len - 1] = '\0';
 	}
 
-	output = Buf_DoneData(&buf);
-	
+	output = Buf_DoneData(buf);
+
 	/*
 	 * XXX: This makes it so that there are
 	 * two spaces in the case of \r\n.
@@ -1653,18 +1761,32 @@ Cmd_Exec(const char *cmd, char **error)
 		if (*p == '\n' || *p == '\r')
 			*p = ' ';
 
-	if (status != 0)
+	if (ce->status != 0)
 		*error = str_concat3(
-			"\"", cmd, "\" returned non-zero status");
-	else if (saved_errno != ERROR_NO_DATA)
+			"\"", ce->cmd, "\" returned non-zero status");
+	else if (ce->readRes == PROC_ERROR)
 		*error = str_concat3(
-			"Couldn't read shell's output for \"", cmd, "\"");
+			"Couldn't read shell's output for \"", ce->cmd, "\"");
 	else
 		*error = NULL;
+	CmdCache_Add(ce->cacheKey, *error == NULL ? output : NULL);
 
+done:
+	free(ce->cmd);
+	free(ce);
 	return output;
 }
 
+/*
+ * Execute the command in cmd, and return its output (only stdout, not
+ * stderr, possibly empty).  In the output, replace newlines with spaces.
+ */
+char *
+Cmd_Exec(const char *cmd, char **error)
+{
+	return Cmd_Finish(Cmd_Start(cmd), error);
+}
+
 /*
  * Print a printf-style error message.
  *
@@ -1678,6 +1800,7 @@ Error(MAKE_ATTR_PRINTFLIKE const char *fmt, ...)
 	va_list ap;
 	FILE *f;
 
+	Snapshot_Skip("a warning or message was printed");
 	f = opts.debug_file;
 	if (f == stdout)
 		f = stderr;
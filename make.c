@@ -115,6 +115,45 @@ static unsigned int checked_seqno = 1;
  */
 static GNodeList toBeMade = LST_INIT;
 
+/*
+ * With .MAKE.SCHEDULER=critpath, all nodes to be made are marked DEFERRED
+ * at the start, and a node is only added to readyQueue once all its
+ * children are made and it has been reached from the main targets, see
+ * CritPath_Release.  The queue is a heap that yields the node with the
+ * longest critical path first, see CritPath_Init.
+ */
+static bool critPath = false;
+
+typedef struct ReadyNode {
+	GNode *gn;
+	unsigned long seq;	/* for FIFO order among equal nodes */
+} ReadyNode;
+
+static Vector readyQueue;	/* of ReadyNode */
+static unsigned long readySeq;
+
+/*
+ * With the .BATCH attribute on a transformation rule, the job for a target
+ * made by the rule also makes up to .MAKE.BATCH_MAX - 1 other targets that
+ * are ready to be made by the same rule, see MakeBatch.  The names of the
+ * targets and their sources are limited in length so that the command
+ * still fits on the command line of the shell.
+ */
+static unsigned long batchMax;
+#define BATCH_MAX_CHARS 4096
+
+/*
+ * With .MAKE.PROGRESS, the number of targets with commands that are to be
+ * made, and how long making the remaining ones will take, estimated from
+ * .MAKE.HISTORY.
+ */
+static bool progress = false;
+static unsigned int progressDone;
+static unsigned int progressTotal;
+static unsigned long progressRemaining; /* in milliseconds */
+static bool progressEstimated;	/* whether progressRemaining is known */
+static ULONGLONG progressStarted;
+
 
 void
 debug_printf(MAKE_ATTR_PRINTFLIKE const char *fmt, ...)
@@ -185,6 +224,9 @@ GNodeFlags_ToString(GNodeFlags flags)
 	Buf_AddFlag(&buf, flags.doneAllsrc, "DONE_ALLSRC");
 	Buf_AddFlag(&buf, flags.cycle, "CYCLE");
 	Buf_AddFlag(&buf, flags.doneCycle, "DONECYCLE");
+	Buf_AddFlag(&buf, flags.progress, "PROGRESS");
+	Buf_AddFlag(&buf, flags.batch, "BATCH");
+	Buf_AddFlag(&buf, flags.reached, "REACHED");
 	if (buf.len == 0)
 		Buf_AddStr(&buf, "none");
 	return Buf_DoneData(&buf);
@@ -269,6 +311,7 @@ GNode_IsOODate(GNode *gn)
 	 */
 	if (!(gn->type & (OP_JOIN | OP_USE | OP_USEBEFORE | OP_EXEC))) {
 		Dir_UpdateMTime(gn, true);
+		FileHash_MTime(gn);
 		if (DEBUG(MAKE)) {
 			if (gn->mtime != 0)
 				debug_printf("modified %s...",
@@ -367,9 +410,10 @@ GNode_IsOODate(GNode *gn)
 	 * from thinking they're out-of-date.
 	 */
 	if (!oodate) {
-		GNodeListNode *ln;
-		for (ln = gn->parents.first; ln != NULL; ln = ln->next)
-			GNode_UpdateYoungestChild(ln->datum, gn);
+		size_t i;
+		for (i = 0; i < gn->parents.len; i++)
+			GNode_UpdateYoungestChild(
+			    GNodeVec_Get(&gn->parents, i), gn);
 	}
 
 	return oodate;
@@ -378,13 +422,14 @@ GNode_IsOODate(GNode *gn)
 static void
 PretendAllChildrenAreMade(GNode *pgn)
 {
-	GNodeListNode *ln;
+	size_t i;
 
-	for (ln = pgn->children.first; ln != NULL; ln = ln->next) {
-		GNode *cgn = ln->datum;
+	for (i = 0; i < pgn->children.len; i++) {
+		GNode *cgn = GNodeVec_Get(&pgn->children, i);
 
 		/* This may also update cgn->path. */
 		Dir_UpdateMTime(cgn, false);
+		FileHash_MTime(cgn);
 		GNode_UpdateYoungestChild(pgn, cgn);
 		pgn->unmade--;
 	}
@@ -407,7 +452,7 @@ PretendAllChildrenAreMade(GNode *pgn)
 void
 Make_HandleUse(GNode *cgn, GNode *pgn)
 {
-	GNodeListNode *ln;	/* An element in the children list */
+	size_t i;
 
 #ifdef DEBUG_SRC
 	if (!(cgn->type & (OP_USE | OP_USEBEFORE | OP_TRANSFORM))) {
@@ -429,8 +474,8 @@ Make_HandleUse(GNode *cgn, GNode *pgn)
 		}
 	}
 
-	for (ln = cgn->children.first; ln != NULL; ln = ln->next) {
-		GNode *gn = ln->datum;
+	for (i = 0; i < cgn->children.len; i++) {
+		GNode *gn = GNodeVec_Get(&cgn->children, i);
 
 		/*
 		 * Expand variables in the .USE node's name
@@ -451,8 +496,8 @@ Make_HandleUse(GNode *cgn, GNode *pgn)
 				gn = tgn;
 		}
 
-		Lst_Append(&pgn->children, gn);
-		Lst_Append(&gn->parents, pgn);
+		GNodeVec_Append(&pgn->children, gn);
+		GNodeVec_Append(&gn->parents, pgn);
 		pgn->unmade++;
 	}
 
@@ -471,9 +516,13 @@ Make_HandleUse(GNode *cgn, GNode *pgn)
  * Input:
  *	cgn		the child, which may be a .USE node
  *	pgn		the current parent
+ *	i		the index of the child in the parent's children
+ *
+ * Results:
+ *	Whether the child has been removed from the parent's children.
  */
-static void
-MakeHandleUse(GNode *cgn, GNode *pgn, GNodeListNode *ln)
+static bool
+MakeHandleUse(GNode *cgn, GNode *pgn, size_t i)
 {
 	bool unmarked;
 
@@ -481,7 +530,7 @@ MakeHandleUse(GNode *cgn, GNode *pgn, GNodeListNode *ln)
 	cgn->type |= OP_MARK;
 
 	if (!(cgn->type & (OP_USE | OP_USEBEFORE)))
-		return;
+		return false;
 
 	if (unmarked)
 		Make_HandleUse(cgn, pgn);
@@ -493,17 +542,26 @@ MakeHandleUse(GNode *cgn, GNode *pgn, GNodeListNode *ln)
 	 * children the parent has. This is used by Make_Run to decide
 	 * whether to queue the parent or examine its children...
 	 */
-	Lst_Remove(&pgn->children, ln);
+	GNodeVec_Remove(&pgn->children, i);
 	pgn->unmade--;
+	return true;
 }
 
+/*
+ * The children that a .USE node adds to the end are handled as well, unless
+ * the .USE node was the last child.
+ */
 static void
 HandleUseNodes(GNode *gn)
 {
-	GNodeListNode *ln, *nln;
-	for (ln = gn->children.first; ln != NULL; ln = nln) {
-		nln = ln->next;
-		MakeHandleUse(ln->datum, gn, ln);
+	size_t i = 0;
+
+	while (i < gn->children.len) {
+		bool last = i + 1 == gn->children.len;
+		if (!MakeHandleUse(GNodeVec_Get(&gn->children, i), gn, i))
+			i++;
+		if (last)
+			break;
 	}
 }
 
@@ -518,6 +576,7 @@ Make_Recheck(GNode *gn)
 	time_t mtime;
 
 	Dir_UpdateMTime(gn, true);
+	FileHash_Made(gn);
 	mtime = gn->mtime;
 
 #ifndef RECHECK
@@ -543,7 +602,7 @@ Make_Recheck(GNode *gn)
 	 * depend on FRC to be made, so we have to check for gn->children
 	 * being empty as well.
 	 */
-	if (!Lst_IsEmpty(gn->commands) || Lst_IsEmpty(gn->children))
+	if (!Lst_IsEmpty(gn->commands) || GNodeVec_IsEmpty(&gn->children))
 		gn->mtime = now;
 #else
 	/*
@@ -594,11 +653,11 @@ Make_Recheck(GNode *gn)
 static void
 UpdateImplicitParentsVars(GNode *cgn, const char *cname)
 {
-	GNodeListNode *ln;
+	size_t i;
 	const char *cpref = GNode_VarPrefix(cgn);
 
-	for (ln = cgn->implicitParents.first; ln != NULL; ln = ln->next) {
-		GNode *pgn = ln->datum;
+	for (i = 0; i < cgn->implicitParents.len; i++) {
+		GNode *pgn = GNodeVec_Get(&cgn->implicitParents, i);
 		if (pgn->flags.remake) {
 			Var_Set(pgn, IMPSRC, cname);
 			if (cpref != NULL)
@@ -611,10 +670,10 @@ UpdateImplicitParentsVars(GNode *cgn, const char *cname)
 static bool
 IsWaitingForOrder(GNode *gn)
 {
-	GNodeListNode *ln;
+	size_t i;
 
-	for (ln = gn->order_pred.first; ln != NULL; ln = ln->next) {
-		GNode *ogn = ln->datum;
+	for (i = 0; i < gn->order_pred.len; i++) {
+		GNode *ogn = GNodeVec_Get(&gn->order_pred, i);
 
 		if (GNode_IsDone(ogn) || !ogn->flags.remake)
 			continue;
@@ -627,23 +686,275 @@ IsWaitingForOrder(GNode *gn)
 	return false;
 }
 
+static bool
+ReadyNode_Before(const ReadyNode *a, const ReadyNode *b)
+{
+	if (a->gn->critPath != b->gn->critPath)
+		return a->gn->critPath > b->gn->critPath;
+	return a->seq < b->seq;
+}
+
+/* Store the node at index i of the heap, then restore the heap order. */
+static void
+ReadyQueue_SiftUp(size_t i, ReadyNode node)
+{
+	ReadyNode *nodes = readyQueue.items;
+
+	for (; i > 0; i = (i - 1) / 2) {
+		if (!ReadyNode_Before(&node, nodes + (i - 1) / 2))
+			break;
+		nodes[i] = nodes[(i - 1) / 2];
+	}
+	nodes[i] = node;
+}
+
+static void
+ReadyQueue_Add(GNode *gn)
+{
+	ReadyNode node;
+
+	(void)Vector_Push(&readyQueue);
+	node.gn = gn;
+	node.seq = readySeq++;
+	ReadyQueue_SiftUp(readyQueue.len - 1, node);
+}
+
+/* Remove the nodes that are no longer requested, see MakeBatch. */
+static void
+ReadyQueue_Purge(void)
+{
+	ReadyNode *nodes = readyQueue.items;
+	size_t i, n = 0;
+
+	for (i = 0; i < readyQueue.len; i++)
+		if (nodes[i].gn->made == REQUESTED)
+			ReadyQueue_SiftUp(n++, nodes[i]);
+	readyQueue.len = n;
+}
+
+static GNode *
+ReadyQueue_Next(void)
+{
+	ReadyNode *nodes = readyQueue.items;
+	GNode *gn = nodes[0].gn;
+	ReadyNode last = *(ReadyNode *)Vector_Pop(&readyQueue);
+	size_t n = readyQueue.len, i = 0, child;
+
+	if (n == 0)
+		return gn;
+	for (; (child = 2 * i + 1) < n; i = child) {
+		if (child + 1 < n && ReadyNode_Before(nodes + child + 1,
+		    nodes + child))
+			child++;
+		if (!ReadyNode_Before(nodes + child, &last))
+			break;
+		nodes[i] = nodes[child];
+	}
+	nodes[i] = last;
+	return gn;
+}
+
+/* Add the node to the nodes that are ready to be examined. */
+static void
+MakeSchedule(GNode *gn)
+{
+	gn->made = REQUESTED;
+	if (critPath)
+		ReadyQueue_Add(gn);
+	else
+		Lst_Enqueue(&toBeMade, gn);
+}
+
+static bool
+MakeQueueIsEmpty(void)
+{
+	return critPath ? readyQueue.len == 0 : Lst_IsEmpty(&toBeMade);
+}
+
 static bool MakeBuildChild(GNode *, GNodeListNode *);
+static void CritPath_Release(GNode *);
 
 static void
 ScheduleOrderSuccessors(GNode *gn)
 {
 	GNodeListNode *toBeMadeNext = toBeMade.first;
-	GNodeListNode *ln;
+	size_t i;
 
-	for (ln = gn->order_succ.first; ln != NULL; ln = ln->next) {
-		GNode *succ = ln->datum;
+	for (i = 0; i < gn->order_succ.len; i++) {
+		GNode *succ = GNodeVec_Get(&gn->order_succ, i);
 
-		if (succ->made == DEFERRED &&
-		    !MakeBuildChild(succ, toBeMadeNext))
+		if (succ->made != DEFERRED)
+			continue;
+		if (critPath) {
+			if (succ->flags.reached)
+				CritPath_Release(succ);
+		} else if (!MakeBuildChild(succ, toBeMadeNext))
 			succ->flags.doneOrder = true;
 	}
 }
 
+/* Read .MAKE.BATCH_MAX, see MakeBatch. */
+static void
+MakeBatch_Init(void)
+{
+	char *value = Var_Subst("${.MAKE.BATCH_MAX:U16}",
+	    SCOPE_GLOBAL, VARE_EVAL);
+	char *end;
+	/* TODO: handle errors */
+
+	batchMax = strtoul(value, &end, 10);
+	if (end == value || *end != '\0')
+		Punt("illegal value for .MAKE.BATCH_MAX: %s", value);
+	free(value);
+}
+
+/* The length that the node adds to the command of a batch. */
+static size_t
+MakeBatch_Chars(GNode *gn)
+{
+	const char *impsrc = GNode_VarImpsrc(gn);
+
+	return strlen(GNode_VarTarget(gn)) + 1 +
+	       (impsrc != NULL ? strlen(impsrc) + 1 : 0);
+}
+
+/*
+ * Add the node to the batch of the node gn if it is ready and out-of-date,
+ * and if it is made by the same rule in the same way.
+ */
+static bool
+MakeBatch_Add(GNode *gn, GNode *cand, size_t *inout_chars)
+{
+	GNodeType sameType = OP_SILENT | OP_IGNORE | OP_MAKE | OP_SPECIAL |
+	    OP_JOIN | OP_PHONY;
+	size_t chars;
+
+	if (cand == gn || cand->made != REQUESTED || cand->unmade != 0 ||
+	    cand->batchRule != gn->batchRule ||
+	    (cand->type & sameType) != (gn->type & sameType))
+		return false;
+	chars = MakeBatch_Chars(cand);
+	if (*inout_chars + chars > BATCH_MAX_CHARS)
+		return false;
+
+	cand->made = BEINGMADE;
+	if (!GNode_IsOODate(cand)) {
+		cand->made = REQUESTED;
+		return false;
+	}
+	DEBUG2(MAKE, "Making %s in the batch of %s\n", cand->name, gn->name);
+	GNode_SetLocalVars(cand);
+	GNodeVec_Append(&gn->batch, cand);
+	*inout_chars += chars;
+	return true;
+}
+
+/*
+ * If the node is made by a transformation rule with the .BATCH attribute,
+ * take the other nodes that are ready to be made by the same rule from the
+ * queue, so that a single job makes them all.  In the commands of the job,
+ * the variables .TARGET, .IMPSRC and .PREFIX list the values of all these
+ * nodes, see Job_Make.
+ */
+static void
+MakeBatch(GNode *gn)
+{
+	size_t chars, i;
+	GNodeListNode *ln, *next;
+
+	if (gn->batchRule == NULL || batchMax < 2 || opts.touch)
+		return;
+
+	chars = MakeBatch_Chars(gn);
+	if (critPath) {
+		ReadyNode *nodes = readyQueue.items;
+
+		for (i = 0; i < readyQueue.len &&
+		    gn->batch.len + 1 < batchMax; i++)
+			(void)MakeBatch_Add(gn, nodes[i].gn, &chars);
+		if (!GNodeVec_IsEmpty(&gn->batch))
+			ReadyQueue_Purge();
+	} else {
+		for (ln = toBeMade.first; ln != NULL &&
+		    gn->batch.len + 1 < batchMax; ln = next) {
+			next = ln->next;
+			if (MakeBatch_Add(gn, ln->datum, &chars))
+				Lst_Remove(&toBeMade, ln);
+		}
+	}
+}
+
+/* The job that made the node also made the other nodes of its batch. */
+void
+Make_UpdateBatch(GNode *gn)
+{
+	size_t i;
+
+	for (i = 0; i < gn->batch.len; i++) {
+		GNode *bgn = GNodeVec_Get(&gn->batch, i);
+
+		bgn->made = MADE;
+		Make_Update(bgn);
+	}
+}
+
+/* Count the targets to be made, for .MAKE.PROGRESS. */
+static void
+MakeProgress_Init(void)
+{
+	GNodeListNode *ln;
+
+	progress = GetBooleanExpr("${.MAKE.PROGRESS}", false);
+	if (!progress)
+		return;
+
+	progressDone = 0;
+	progressTotal = 0;
+	progressRemaining = 0;
+	for (ln = Targ_List()->first; ln != NULL; ln = ln->next) {
+		GNode *gn = ln->datum;
+
+		if (!gn->flags.remake || Lst_IsEmpty(&gn->commands) ||
+		    (gn->type & (OP_MADE | OP_SPECIAL)))
+			continue;
+		gn->flags.progress = true;
+		progressTotal++;
+		progressRemaining += History_Duration(gn);
+	}
+	progressEstimated = progressRemaining > 0;
+	progressStarted = GetTickCount64();
+}
+
+/*
+ * Account for a target that is done.  If a job was run for it, print how
+ * many are done and when the remaining ones will be done.  Without a
+ * history, the estimate assumes the remaining jobs take as long as the
+ * ones so far.
+ */
+static void
+MakeProgress_Update(GNode *gn)
+{
+	unsigned long eta;
+
+	if (!gn->flags.progress)
+		return;
+	gn->flags.progress = false;
+	progressDone++;
+	progressRemaining -= History_Duration(gn);
+	if (gn->made != MADE)
+		return;
+
+	if (progressEstimated)
+		eta = progressRemaining / (unsigned long)opts.maxJobs;
+	else
+		eta = (unsigned long)(GetTickCount64() - progressStarted) /
+		    progressDone * (progressTotal - progressDone);
+	eta /= 1000;
+	printf("--- %u/%u jobs, ETA %02lu:%02lu ---\n",
+	    progressDone, progressTotal, eta / 60, eta % 60);
+	(void)fflush(stdout);
+}
+
 /*
  * Perform update on the parents of a node. Used by JobFinish once
  * a node has been dealt with and by MakeStartJobs if it finds an
@@ -669,8 +980,8 @@ Make_Update(GNode *cgn)
 {
 	const char *cname;	/* the child's name */
 	time_t mtime = -1;
-	GNodeList *parents;
-	GNodeListNode *ln;
+	GNodeVec *parents;
+	size_t i;
 	GNode *centurion;
 
 	/* It is save to re-examine any nodes again */
@@ -688,12 +999,15 @@ Make_Update(GNode *cgn)
 	if (cgn->made != UPTODATE)
 		mtime = Make_Recheck(cgn);
 
+	if (progress)
+		MakeProgress_Update(cgn);
+
 	/*
 	 * If this is a `::' node, we must consult its first instance
 	 * which is where all parents are linked.
 	 */
 	if ((centurion = cgn->centurion) != NULL) {
-		if (!Lst_IsEmpty(&cgn->parents))
+		if (!GNodeVec_IsEmpty(&cgn->parents))
 			Punt("%s%s: cohort has parents", cgn->name,
 			    cgn->cohort_num);
 		centurion->unmade_cohorts--;
@@ -709,8 +1023,8 @@ Make_Update(GNode *cgn)
 	ScheduleOrderSuccessors(centurion);
 
 	/* Now mark all the parents as having one less unmade child */
-	for (ln = parents->first; ln != NULL; ln = ln->next) {
-		GNode *pgn = ln->datum;
+	for (i = 0; i < parents->len; i++) {
+		GNode *pgn = GNodeVec_Get(parents, i);
 
 		if (DEBUG(MAKE)) {
 			debug_printf("inspect parent %s%s: ", pgn->name,
@@ -772,10 +1086,12 @@ Make_Update(GNode *cgn)
 
 		/*
 		 * We must always rescan the parents of .WAIT and .ORDER
-		 * nodes.
+		 * nodes, except for the critpath scheduler, which only
+		 * takes nodes whose children are all made.
 		 */
-		if (pgn->unmade != 0 && !(centurion->type & OP_WAIT)
-		    && !centurion->flags.doneOrder) {
+		if (pgn->unmade != 0 && (critPath ||
+		    (!(centurion->type & OP_WAIT) &&
+		     !centurion->flags.doneOrder))) {
 			DEBUG0(MAKE, "- unmade children\n");
 			continue;
 		}
@@ -788,6 +1104,10 @@ Make_Update(GNode *cgn)
 			DEBUG0(MAKE, "- not deferred\n");
 			continue;
 		}
+		if (critPath && !pgn->flags.reached) {
+			DEBUG0(MAKE, "- not reached\n");
+			continue;
+		}
 
 		if (IsWaitingForOrder(pgn))
 			continue;
@@ -799,8 +1119,7 @@ Make_Update(GNode *cgn)
 			Targ_PrintNode(pgn, 2);
 		}
 		/* Ok, we can schedule the parent again */
-		pgn->made = REQUESTED;
-		Lst_Enqueue(&toBeMade, pgn);
+		MakeSchedule(pgn);
 	}
 
 	UpdateImplicitParentsVars(cgn, cname);
@@ -809,10 +1128,10 @@ Make_Update(GNode *cgn)
 static void
 UnmarkChildren(GNode *gn)
 {
-	GNodeListNode *ln;
+	size_t i;
 
-	for (ln = gn->children.first; ln != NULL; ln = ln->next) {
-		GNode *child = ln->datum;
+	for (i = 0; i < gn->children.len; i++) {
+		GNode *child = GNodeVec_Get(&gn->children, i);
 		child->type &= (unsigned)~OP_MARK;
 	}
 }
@@ -907,14 +1226,14 @@ MakeAddAllSrc(GNode *cgn, GNode *pgn)
 void
 GNode_SetLocalVars(GNode *gn)
 {
-	GNodeListNode *ln;
+	size_t i;
 
 	if (gn->flags.doneAllsrc)
 		return;
 
 	UnmarkChildren(gn);
-	for (ln = gn->children.first; ln != NULL; ln = ln->next)
-		MakeAddAllSrc(ln->datum, gn);
+	for (i = 0; i < gn->children.len; i++)
+		MakeAddAllSrc(GNodeVec_Get(&gn->children, i), gn);
 
 	if (!Var_Exists(gn, OODATE))
 		Var_Set(gn, OODATE, "");
@@ -981,10 +1300,11 @@ MakeBuildChild(GNode *cn, GNodeListNode *toBeMadeNext)
 		Lst_InsertBefore(&toBeMade, toBeMadeNext, cn);
 
 	if (cn->unmade_cohorts != 0) {
-		ListNode *ln;
+		size_t i;
 
-		for (ln = cn->cohorts.first; ln != NULL; ln = ln->next)
-			if (MakeBuildChild(ln->datum, toBeMadeNext))
+		for (i = 0; i < cn->cohorts.len; i++)
+			if (MakeBuildChild(GNodeVec_Get(&cn->cohorts, i),
+			    toBeMadeNext))
 				break;
 	}
 
@@ -999,10 +1319,11 @@ static void
 MakeChildren(GNode *gn)
 {
 	GNodeListNode *toBeMadeNext = toBeMade.first;
-	GNodeListNode *ln;
+	size_t i;
 
-	for (ln = gn->children.first; ln != NULL; ln = ln->next)
-		if (MakeBuildChild(ln->datum, toBeMadeNext))
+	for (i = 0; i < gn->children.len; i++)
+		if (MakeBuildChild(GNodeVec_Get(&gn->children, i),
+		    toBeMadeNext))
 			break;
 }
 
@@ -1019,7 +1340,7 @@ MakeStartJobs(void)
 	GNode *gn;
 	bool have_token = false;
 
-	while (!Lst_IsEmpty(&toBeMade)) {
+	while (!MakeQueueIsEmpty()) {
 		/*
 		 * Get token now to avoid cycling job-list when we only
 		 * have 1 token
@@ -1028,7 +1349,7 @@ MakeStartJobs(void)
 			break;
 		have_token = true;
 
-		gn = Lst_Dequeue(&toBeMade);
+		gn = critPath ? ReadyQueue_Next() : Lst_Dequeue(&toBeMade);
 		DEBUG2(MAKE, "Examining %s%s...\n", gn->name, gn->cohort_num);
 
 		if (gn->made != REQUESTED) {
@@ -1040,7 +1361,7 @@ MakeStartJobs(void)
 			abort();
 		}
 
-		if (gn->checked_seqno == checked_seqno) {
+		if (!critPath && gn->checked_seqno == checked_seqno) {
 			/*
 			 * We've already looked at this node since a job
 			 * finished...
@@ -1052,6 +1373,11 @@ MakeStartJobs(void)
 		}
 		gn->checked_seqno = checked_seqno;
 
+		if (gn->unmade != 0 && critPath) {
+			/* Make_Update schedules it again. */
+			gn->made = DEFERRED;
+			continue;
+		}
 		if (gn->unmade != 0) {
 			/*
 			 * We can't build this yet, add all unmade children
@@ -1073,6 +1399,7 @@ MakeStartJobs(void)
 			if (opts.query)
 				return strcmp(gn->name, ".MAIN") != 0;
 			GNode_SetLocalVars(gn);
+			MakeBatch(gn);
 			Job_Make(gn);
 			have_token = false;
 		} else {
@@ -1119,12 +1446,12 @@ MakePrintStatusOrderNode(GNode *ogn, GNode *gn)
 static void
 MakePrintStatusOrder(GNode *gn)
 {
-	GNodeListNode *ln;
-	for (ln = gn->order_pred.first; ln != NULL; ln = ln->next)
-		MakePrintStatusOrderNode(ln->datum, gn);
+	size_t i;
+	for (i = 0; i < gn->order_pred.len; i++)
+		MakePrintStatusOrderNode(GNodeVec_Get(&gn->order_pred, i), gn);
 }
 
-static void MakePrintStatusList(GNodeList *, int *);
+static void MakePrintStatusChildren(GNode *, int *);
 
 /*
  * Print the status of a top-level node, viz. it being up-to-date already
@@ -1189,7 +1516,7 @@ MakePrintStatus(GNode *gn, int *errors)
 	if (!gn->flags.cycle) {
 		/* First time we've seen this node, check all children */
 		gn->flags.cycle = true;
-		MakePrintStatusList(&gn->children, errors);
+		MakePrintStatusChildren(gn, errors);
 		/* Mark that this node needn't be processed again */
 		gn->flags.doneCycle = true;
 		return false;
@@ -1203,10 +1530,20 @@ MakePrintStatus(GNode *gn, int *errors)
 		return true;
 
 	/* Reporting for our children will give the rest of the loop */
-	MakePrintStatusList(&gn->children, errors);
+	MakePrintStatusChildren(gn, errors);
 	return false;
 }
 
+static void
+MakePrintStatusChildren(GNode *gn, int *errors)
+{
+	size_t i;
+
+	for (i = 0; i < gn->children.len; i++)
+		if (MakePrintStatus(GNodeVec_Get(&gn->children, i), errors))
+			break;
+}
+
 static void
 MakePrintStatusList(GNodeList *gnodes, int *errors)
 {
@@ -1217,13 +1554,23 @@ MakePrintStatusList(GNodeList *gnodes, int *errors)
 			break;
 }
 
+/* Add the nodes to the head of the list, keeping their order. */
 static void
-ExamineLater(GNodeList *examine, GNodeList *toBeExamined)
+PrependNodes(GNodeList *list, GNodeVec *gnodes)
 {
-	GNodeListNode *ln;
+	size_t i;
 
-	for (ln = toBeExamined->first; ln != NULL; ln = ln->next) {
-		GNode *gn = ln->datum;
+	for (i = gnodes->len; i > 0; i--)
+		Lst_Prepend(list, GNodeVec_Get(gnodes, i - 1));
+}
+
+static void
+ExamineLater(GNodeList *examine, GNodeVec *toBeExamined)
+{
+	size_t i;
+
+	for (i = 0; i < toBeExamined->len; i++) {
+		GNode *gn = GNodeVec_Get(toBeExamined, i);
 
 		if (gn->flags.remake)
 			continue;
@@ -1269,7 +1616,7 @@ Make_ExpandUse(GNodeList *targs)
 		    gn->name, gn->cohort_num);
 
 		if (gn->type & OP_DOUBLEDEP)
-			Lst_PrependAll(&examine, &gn->cohorts);
+			PrependNodes(&examine, &gn->cohorts);
 
 		/*
 		 * Apply any .USE rules before looking for implicit
@@ -1316,32 +1663,53 @@ Make_ExpandUse(GNodeList *targs)
 	Lst_Done(&examine);
 }
 
-/* Make the .WAIT node depend on the previous children */
+/*
+ * Make the .WAIT node depend on the previous children, starting at the
+ * index of the previous .WAIT node.
+ */
 static void
-add_wait_dependency(GNodeListNode *owln, GNode *wn)
+add_wait_dependency(GNodeVec *children, size_t owi, GNode *wn)
 {
-	GNodeListNode *cln;
+	size_t i;
 	GNode *cn;
 
-	for (cln = owln; (cn = cln->datum) != wn; cln = cln->next) {
+	for (i = owi; (cn = GNodeVec_Get(children, i)) != wn; i++) {
 		DEBUG3(MAKE, ".WAIT: add dependency %s%s -> %s\n",
 		    cn->name, cn->cohort_num, wn->name);
 
 		/*
 		 * XXX: This pattern should be factored out, it repeats often
 		 */
-		Lst_Append(&wn->children, cn);
+		GNodeVec_Append(&wn->children, cn);
 		wn->unmade++;
-		Lst_Append(&cn->parents, wn);
+		GNodeVec_Append(&cn->parents, wn);
 	}
 }
 
-/* Convert .WAIT nodes into dependencies. */
+/*
+ * The critpath scheduler doesn't make the children from left to right, so
+ * the children after a .WAIT node are ordered after it, as with .ORDER.
+ */
 static void
+add_wait_order(GNode *wn, GNode *cn)
+{
+	DEBUG3(MAKE, ".WAIT: add order %s -> %s%s\n",
+	    wn->name, cn->name, cn->cohort_num);
+	GNodeVec_Append(&wn->order_succ, cn);
+	GNodeVec_Append(&cn->order_pred, wn);
+}
+
+/*
+ * Convert .WAIT nodes into dependencies.  Return the '.MAIN' node that
+ * depends on the targets.
+ */
+static GNode *
 Make_ProcessWait(GNodeList *targs)
 {
+	GNode *root;		/* The 'dummy' .MAIN node */
 	GNode *pgn;		/* 'parent' node we are examining */
-	GNodeListNode *owln;	/* Previous .WAIT node */
+	size_t owi;		/* Index of the previous .WAIT node */
+	GNode *wn;		/* The previous .WAIT node */
 	GNodeList examine;	/* List of targets to examine */
 
 	/*
@@ -1350,7 +1718,7 @@ Make_ProcessWait(GNodeList *targs)
 	 * Perhaps this should be done earlier...
 	 */
 
-	pgn = GNode_New(".MAIN");
+	root = pgn = GNode_New(".MAIN");
 	pgn->flags.remake = true;
 	pgn->type = OP_PHONY | OP_DEPENDS;
 	/* Get it displayed in the diag dumps */
@@ -1361,20 +1729,21 @@ Make_ProcessWait(GNodeList *targs)
 		for (ln = targs->first; ln != NULL; ln = ln->next) {
 			GNode *cgn = ln->datum;
 
-			Lst_Append(&pgn->children, cgn);
-			Lst_Append(&cgn->parents, pgn);
+			GNodeVec_Append(&pgn->children, cgn);
+			GNodeVec_Append(&cgn->parents, pgn);
 			pgn->unmade++;
 		}
 	}
 
 	/* Start building with the 'dummy' .MAIN' node */
-	MakeBuildChild(pgn, NULL);
+	if (!critPath)
+		MakeBuildChild(pgn, NULL);
 
 	Lst_Init(&examine);
 	Lst_Append(&examine, pgn);
 
 	while (!Lst_IsEmpty(&examine)) {
-		GNodeListNode *ln;
+		size_t i;
 
 		pgn = Lst_Dequeue(&examine);
 
@@ -1385,21 +1754,192 @@ Make_ProcessWait(GNodeList *targs)
 		DEBUG1(MAKE, "Make_ProcessWait: examine %s\n", pgn->name);
 
 		if (pgn->type & OP_DOUBLEDEP)
-			Lst_PrependAll(&examine, &pgn->cohorts);
+			PrependNodes(&examine, &pgn->cohorts);
 
-		owln = pgn->children.first;
-		for (ln = pgn->children.first; ln != NULL; ln = ln->next) {
-			GNode *cgn = ln->datum;
+		owi = 0;
+		wn = NULL;
+		for (i = 0; i < pgn->children.len; i++) {
+			GNode *cgn = GNodeVec_Get(&pgn->children, i);
 			if (cgn->type & OP_WAIT) {
-				add_wait_dependency(owln, cgn);
-				owln = ln;
+				add_wait_dependency(&pgn->children, owi, cgn);
+				owi = i;
+				wn = cgn;
 			} else {
+				if (critPath && wn != NULL)
+					add_wait_order(wn, cgn);
 				Lst_Append(&examine, cgn);
 			}
 		}
 	}
 
 	Lst_Done(&examine);
+	return root;
+}
+
+/*
+ * The nodes that have to be made before the given node, the same as those
+ * that MakeBuildChild requests.  Return NULL after the last one.
+ */
+static GNode *
+CritPath_Prerequisite(GNode *gn, size_t i)
+{
+	size_t numChildren = gn->unmade != 0 ? gn->children.len : 0;
+
+	if (i < numChildren)
+		return GNodeVec_Get(&gn->children, i);
+	i -= numChildren;
+	if (gn->unmade_cohorts != 0 && i < gn->cohorts.len)
+		return GNodeVec_Get(&gn->cohorts, i);
+	return NULL;
+}
+
+/*
+ * The estimated time it takes to make the node itself, in milliseconds
+ * from .MAKE.HISTORY, or 1 if unknown.
+ */
+static unsigned long
+CritPath_Weight(GNode *gn)
+{
+	unsigned long ms;
+
+	if (Lst_IsEmpty(&gn->commands))
+		return 0;
+	ms = History_Duration(gn);
+	return ms != 0 ? ms : 1;
+}
+
+typedef struct CritPathFrame {
+	GNode *gn;
+	size_t next;		/* the next prerequisite to visit */
+} CritPathFrame;
+
+/*
+ * Walk down from the node, which has been reached from the main targets,
+ * and schedule the nodes that can be made right away.  Like in
+ * MakeBuildChild, a node that waits for .ORDER or .WAIT stops the walk, so
+ * that its prerequisites are not made before the nodes it waits for either.
+ * ScheduleOrderSuccessors continues the walk from there, and Make_Update
+ * schedules the reached nodes whose prerequisites have been made.
+ */
+static void
+CritPath_Release(GNode *start)
+{
+	Vector stack;		/* of CritPathFrame, for the depth-first walk */
+	CritPathFrame *frame;
+
+	if (start->made != DEFERRED || IsWaitingForOrder(start))
+		return;
+
+	Vector_Init(&stack, sizeof(CritPathFrame));
+	frame = Vector_Push(&stack);
+	frame->gn = start;
+	frame->next = 0;
+	while (stack.len > 0) {
+		GNode *gn, *cgn;
+
+		frame = Vector_Get(&stack, stack.len - 1);
+		gn = frame->gn;
+		if (gn->unmade == 0) {
+			MakeSchedule(gn);
+			(void)Vector_Pop(&stack);
+			continue;
+		}
+		cgn = CritPath_Prerequisite(gn, frame->next++);
+		if (cgn == NULL) {
+			(void)Vector_Pop(&stack);
+			continue;
+		}
+		if (cgn->flags.reached)
+			continue;
+		cgn->flags.reached = true;
+		if (cgn->made != DEFERRED || IsWaitingForOrder(cgn))
+			continue;
+		frame = Vector_Push(&stack);
+		frame->gn = cgn;
+		frame->next = 0;
+	}
+	Vector_Done(&stack);
+}
+
+/*
+ * Mark all nodes to be made as DEFERRED, compute their critical path and
+ * schedule those that can be made right away, see CritPath_Release.
+ *
+ * The critical path of a node is its own weight plus the longest critical
+ * path of the nodes that wait for it.  Starting the nodes with the longest
+ * critical path first keeps long chains of dependencies from being started
+ * last.
+ */
+static void
+CritPath_Init(GNode *root)
+{
+	Vector stack;		/* of CritPathFrame, for the depth-first walk */
+	Vector order;		/* of GNode *, each after its prerequisites */
+	CritPathFrame *frame;
+	GNode **nodes;
+	size_t i, j;
+
+	Vector_Init(&stack, sizeof(CritPathFrame));
+	Vector_Init(&order, sizeof(GNode *));
+	Vector_Init(&readyQueue, sizeof(ReadyNode));
+
+	root->made = DEFERRED;
+	frame = Vector_Push(&stack);
+	frame->gn = root;
+	frame->next = 0;
+	while (stack.len > 0) {
+		GNode *gn, *cgn;
+
+		frame = Vector_Get(&stack, stack.len - 1);
+		gn = frame->gn;
+		cgn = CritPath_Prerequisite(gn, frame->next++);
+		if (cgn == NULL) {
+			*(GNode **)Vector_Push(&order) = gn;
+			(void)Vector_Pop(&stack);
+		} else if (cgn->made == UNMADE) {
+			cgn->made = DEFERRED;
+			frame = Vector_Push(&stack);
+			frame->gn = cgn;
+			frame->next = 0;
+		}
+	}
+
+	/* In reverse, each node comes before its prerequisites. */
+	nodes = order.items;
+	for (i = order.len; i > 0; i--) {
+		GNode *gn = nodes[i - 1], *cgn;
+
+		gn->critPath += CritPath_Weight(gn);
+		for (j = 0; (cgn = CritPath_Prerequisite(gn, j)) != NULL; j++)
+			if (cgn->made == DEFERRED &&
+			    cgn->critPath < gn->critPath)
+				cgn->critPath = gn->critPath;
+		DEBUG3(MAKE, "CritPath_Init: %s%s has critical path %lu\n",
+		    gn->name, gn->cohort_num, gn->critPath);
+	}
+
+	root->flags.reached = true;
+	CritPath_Release(root);
+
+	Vector_Done(&order);
+	Vector_Done(&stack);
+}
+
+/* Select the scheduler from .MAKE.SCHEDULER. */
+static void
+MakeSetScheduler(void)
+{
+	char *scheduler = Var_Subst("${.MAKE.SCHEDULER:U:tl}",
+	    SCOPE_GLOBAL, VARE_EVAL);
+	/* TODO: handle errors */
+
+	if (scheduler[0] == '\0' || strcmp(scheduler, "fifo") == 0)
+		critPath = false;
+	else if (strcmp(scheduler, "critpath") == 0)
+		critPath = true;
+	else
+		Punt("illegal value for .MAKE.SCHEDULER: %s", scheduler);
+	free(scheduler);
 }
 
 /*
@@ -1426,12 +1966,19 @@ bool
 Make_Run(GNodeList *targs)
 {
 	int errors;		/* Number of errors the Job module reports */
+	GNode *root;
 
 	/* Start trying to make the current targets... */
 	Lst_Init(&toBeMade);
+	MakeSetScheduler();
 
 	Make_ExpandUse(targs);
-	Make_ProcessWait(targs);
+	root = Make_ProcessWait(targs);
+	History_Init();
+	MakeProgress_Init();
+	MakeBatch_Init();
+	if (critPath)
+		CritPath_Init(root);
 
 	if (DEBUG(MAKE)) {
 		debug_printf("#***# full graph\n");
@@ -1466,10 +2013,12 @@ Make_Run(GNodeList *targs)
 	 * condition of this loop. Note that the Job module will exit if
 	 * there were any errors unless the keepgoing flag was given.
 	 */
-	while (!Lst_IsEmpty(&toBeMade) || jobTokensRunning > 0) {
+	while (!MakeQueueIsEmpty() || jobTokensRunning > 0) {
 		Job_CatchChildren();
 		(void)MakeStartJobs();
 	}
+	if (critPath)
+		Vector_Done(&readyQueue);
 
 	errors = Job_Finish();
 
@@ -146,7 +146,7 @@ typedef enum GNodeMade {
 	 */
 	DEFERRED,
 
-	/* The node is on the toBeMade list. */
+	/* The node is on the toBeMade list, or in the ready queue. */
 	REQUESTED,
 
 	/*
@@ -325,6 +325,12 @@ typedef struct GNodeFlags {
 	bool cycle:1;
 	/* Used by MakePrintStatus */
 	bool doneCycle:1;
+	/* Counted by .MAKE.PROGRESS, but not done yet */
+	bool progress:1;
+	/* A transformation rule with the .BATCH attribute */
+	bool batch:1;
+	/* Reached by the critpath scheduler, see CritPath_Release */
+	bool reached:1;
 } GNodeFlags;
 
 typedef struct List StringList;
@@ -333,6 +339,12 @@ typedef struct ListNode StringListNode;
 typedef struct List GNodeList;
 typedef struct ListNode GNodeListNode;
 
+/*
+ * The edges of the dependency graph.  The nodes are kept in the order in
+ * which they were added, in a single array, see GNodeVec_Append.
+ */
+typedef struct Vector GNodeVec;
+
 typedef struct SearchPath {
 	List /* of CachedDir */ dirs;
 } SearchPath;
@@ -367,6 +379,11 @@ typedef struct GNode {
 	GNodeMade made;
 	/* The number of unmade children */
 	int unmade;
+	/*
+	 * The estimated time it takes to make this node and then the nodes
+	 * that depend on it, for .MAKE.SCHEDULER=critpath.
+	 */
+	unsigned long critPath;
 
 	/*
 	 * The modification time; 0 means the node does not have a
@@ -375,39 +392,47 @@ typedef struct GNode {
 	time_t mtime;
 	struct GNode *youngestChild;
 
+	/*
+	 * The transformation rule with the .BATCH attribute whose commands
+	 * make this node, or NULL.  The other nodes that are made by the
+	 * same job as this one, see MakeBatch.
+	 */
+	struct GNode *batchRule;
+	GNodeVec batch;
+
 	/*
 	 * The GNodes for which this node is an implied source. May be empty.
 	 * For example, when there is an inference rule for .c.o, the node
 	 * for file.c has the node for file.o in this list.
 	 */
-	GNodeList implicitParents;
+	GNodeVec implicitParents;
 
 	/*
 	 * The nodes that depend on this one, or in other words, the nodes
 	 * for which this is a source.
 	 */
-	GNodeList parents;
+	GNodeVec parents;
 	/* The nodes on which this one depends. */
-	GNodeList children;
+	GNodeVec children;
 
 	/*
 	 * .ORDER nodes we need made. The nodes that must be made (if they're
 	 * made) before this node can be made, but that do not enter into the
 	 * datedness of this node.
 	 */
-	GNodeList order_pred;
+	GNodeVec order_pred;
 	/*
 	 * .ORDER nodes who need us. The nodes that must be made (if they're
 	 * made at all) after this node is made, but that do not depend on
 	 * this node, in the normal sense.
 	 */
-	GNodeList order_succ;
+	GNodeVec order_succ;
 
 	/*
 	 * Other nodes of the same name, for targets that were defined using
 	 * the '::' dependency operator (OP_DOUBLEDEP).
 	 */
-	GNodeList cohorts;
+	GNodeVec cohorts;
 	/* The "#n" suffix for this cohort, or "" for other nodes */
 	char cohort_num[8];
 	/* The number of unmade instances on the cohorts list */
@@ -562,6 +587,7 @@ extern DWORD myPid;
 #endif
 
 typedef struct DebugFlags {
+	bool DEBUG_ALLOC:1;
 	bool DEBUG_ARCH:1;
 	bool DEBUG_COND:1;
 	bool DEBUG_CWD:1;
@@ -731,6 +757,15 @@ void Arch_FindLib(GNode *, SearchPath *);
 bool MAKE_ATTR_USE Arch_LibOODate(GNode *);
 bool MAKE_ATTR_USE Arch_IsLib(GNode *);
 
+/* cmdcache.c */
+/* The key of a command that is not in the cache, see CmdCache_Find. */
+typedef struct CmdCacheKey CmdCacheKey;
+
+void CmdCache_Load(void);
+void CmdCache_End(void);
+char *MAKE_ATTR_USE CmdCache_Find(const char *, CmdCacheKey **);
+void CmdCache_Add(CmdCacheKey *, const char *);
+
 /* compat.c */
 bool Compat_RunCommand(const char *, GNode *, StringListNode *);
 void Compat_MakeAll(GNodeList *);
@@ -787,6 +822,12 @@ SearchPath_New(void)
 
 void SearchPath_Free(SearchPath *);
 
+/* filehash.c */
+void FileHash_Init(void);
+void FileHash_End(void);
+void FileHash_MTime(GNode *);
+void FileHash_Made(GNode *);
+
 /* for.c */
 struct ForLoop;
 int MAKE_ATTR_USE For_Eval(const char *);
@@ -797,20 +838,30 @@ char *ForLoop_Details(const struct ForLoop *);
 void ForLoop_Free(struct ForLoop *);
 void For_Break(struct ForLoop *);
 
+/* history.c */
+void History_Init(void);
+void History_End(void);
+void History_Add(GNode *, unsigned long);
+unsigned long MAKE_ATTR_USE History_Duration(GNode *);
+
 /* main.c */
 
 /*
- * If a process's output pipe is full, any writes to it block.
- * While the process is running, we check if the pipe is full
- * every PROCESSWAIT ms.
+ * Job tokens returned by other make processes don't wake us up.
+ * While we are blocked for a token, we look for one every PROCESSWAIT ms.
  */
 #define PROCESSWAIT 100
 
 /* pipe size */
 #define PIPESZ 4096
 
+/* A command whose output is being collected, see Cmd_Start. */
+typedef struct CmdExec CmdExec;
+
 void Main_ParseArgLine(const char *);
 char * MAKE_ATTR_USE Cmd_Exec(const char *, char **);
+CmdExec * MAKE_ATTR_USE Cmd_Start(const char *);
+char * MAKE_ATTR_USE Cmd_Finish(CmdExec *, char **);
 void Error(MAKE_ATTR_PRINTFLIKE const char *, ...);
 void MAKE_ATTR_DEAD Fatal(MAKE_ATTR_PRINTFLIKE const char *, ...);
 void MAKE_ATTR_DEAD Punt(MAKE_ATTR_PRINTFLIKE const char *, ...);
@@ -838,7 +889,18 @@ int MAKE_ATTR_USE Parse_NumErrors(void);
 unsigned int MAKE_ATTR_USE CurFile_CondMinDepth(void);
 void Parse_GuardElse(void);
 void Parse_GuardEndif(void);
-
+void Parse_RedoSpecials(void);
+
+/* snapshot.c */
+bool Snapshot_Load(int, char **);
+void Snapshot_Save(void);
+void Snapshot_Skip(const char *);
+void Snapshot_AddDep(const char *);
+void Snapshot_PutNum(unsigned long long);
+void Snapshot_PutStr(const char *);
+unsigned long long MAKE_ATTR_USE Snapshot_GetNum(void);
+size_t MAKE_ATTR_USE Snapshot_GetIndex(size_t);
+char * MAKE_ATTR_USE Snapshot_GetStr(void);
 
 /* suff.c */
 void Suff_Init(void);
@@ -851,6 +913,7 @@ void Suff_EndTransform(GNode *);
 void Suff_AddSuffix(const char *);
 SearchPath * MAKE_ATTR_USE Suff_GetPath(const char *);
 void Suff_ExtendPaths(void);
+void Suff_PathsChanged(void);
 void Suff_AddInclude(const char *);
 void Suff_AddLib(const char *);
 void Suff_FindDeps(GNode *);
@@ -858,6 +921,9 @@ SearchPath * MAKE_ATTR_USE Suff_FindPath(GNode *);
 void Suff_SetNull(const char *);
 void Suff_PrintAll(void);
 char * MAKE_ATTR_USE Suff_NamesStr(void);
+GNodeList * MAKE_ATTR_USE Suff_Transforms(void);
+void Suff_SaveSnapshot(void);
+void Suff_RestoreSnapshot(void);
 
 /* targ.c */
 void Targ_Init(void);
@@ -879,6 +945,11 @@ void Targ_PrintType(GNodeType);
 void Targ_PrintGraph(int);
 void Targ_Propagate(void);
 const char * MAKE_ATTR_USE GNodeMade_Name(GNodeMade);
+void Targ_SaveSnapshot(void);
+void Targ_RestoreSnapshot(void);
+void Targ_SaveNodeRef(GNode *);
+GNode * MAKE_ATTR_USE Targ_RestoreNodeRef(void);
+void Targ_SnapshotDone(void);
 #ifdef CLEANUP
 void Parse_RegisterCommand(char *);
 #else
@@ -976,6 +1047,8 @@ void Var_SetExpand(GNode *, const char *, const char *);
 void Var_SetWithFlags(GNode *, const char *, const char *, VarSetFlags);
 void Var_Append(GNode *, const char *, const char *);
 void Var_AppendExpand(GNode *, const char *, const char *);
+void Var_Watch(HashTable *);
+bool Var_Unwatch(void);
 bool MAKE_ATTR_USE Var_Exists(GNode *, const char *);
 bool MAKE_ATTR_USE Var_ExistsExpand(GNode *, const char *);
 FStr MAKE_ATTR_USE Var_Value(GNode *, const char *);
@@ -986,11 +1059,16 @@ char *Var_SubstInTarget(const char *, GNode *);
 void Var_Expand(FStr *, GNode *, VarEvalMode);
 void Var_Stats(void);
 void Var_Dump(GNode *);
-void Var_ReexportVars(GNode *);
+const char *MAKE_ATTR_USE Var_Environment(GNode *, const char *);
+void Var_EnvironmentChanged(void);
 void Var_Export(VarExportMode, const char *);
 void Var_ExportVars(const char *);
 void Var_UnExport(bool, const char *);
 void Var_ReadOnly(const char *, bool);
+void Var_SaveScope(GNode *);
+void Var_RestoreScope(GNode *);
+void Var_SaveSnapshot(void);
+void Var_RestoreSnapshot(void);
 
 void Global_Set(const char *, const char *);
 void Global_Append(const char *, const char *);
@@ -1015,6 +1093,7 @@ void Make_ExpandUse(GNodeList *);
 time_t MAKE_ATTR_USE Make_Recheck(GNode *);
 void Make_HandleUse(GNode *, GNode *);
 void Make_Update(GNode *);
+void Make_UpdateBatch(GNode *);
 void GNode_SetLocalVars(GNode *);
 bool Make_Run(GNodeList *);
 bool MAKE_ATTR_USE shouldDieQuietly(GNode *, int);
@@ -1099,6 +1178,62 @@ GNode_VarArchive(GNode *gn) { return GNode_ValueDirect(gn, ARCHIVE); }
 MAKE_INLINE const char * MAKE_ATTR_USE
 GNode_VarMember(GNode *gn) { return GNode_ValueDirect(gn, MEMBER); }
 
+MAKE_INLINE void
+GNodeVec_Init(GNodeVec *v) { Vector_Init(v, sizeof(GNode *)); }
+MAKE_INLINE void
+GNodeVec_Done(GNodeVec *v) { Vector_Done(v); }
+MAKE_INLINE bool MAKE_ATTR_USE
+GNodeVec_IsEmpty(const GNodeVec *v) { return v->len == 0; }
+
+MAKE_INLINE GNode * MAKE_ATTR_USE
+GNodeVec_Get(GNodeVec *v, size_t i)
+{
+	return ((GNode **)v->items)[i];
+}
+
+MAKE_INLINE GNode * MAKE_ATTR_USE
+GNodeVec_Last(GNodeVec *v)
+{
+	return GNodeVec_Get(v, v->len - 1);
+}
+
+MAKE_INLINE void
+GNodeVec_Append(GNodeVec *v, GNode *gn)
+{
+	*(GNode **)Vector_Push(v) = gn;
+}
+
+/* Insert the node before the one at index i. */
+MAKE_INLINE void
+GNodeVec_Insert(GNodeVec *v, size_t i, GNode *gn)
+{
+	*(GNode **)Vector_Insert(v, i) = gn;
+}
+
+MAKE_INLINE void
+GNodeVec_Remove(GNodeVec *v, size_t i)
+{
+	Vector_Remove(v, i);
+}
+
+/* Return the index of the node, or v->len if it is not in the vector. */
+MAKE_INLINE size_t MAKE_ATTR_USE
+GNodeVec_Find(GNodeVec *v, const GNode *gn)
+{
+	size_t i;
+
+	for (i = 0; i < v->len; i++)
+		if (GNodeVec_Get(v, i) == gn)
+			break;
+	return i;
+}
+
+MAKE_INLINE bool MAKE_ATTR_USE
+GNodeVec_Contains(GNodeVec *v, const GNode *gn)
+{
+	return GNodeVec_Find(v, gn) < v->len;
+}
+
 MAKE_INLINE void * MAKE_ATTR_USE
 UNCONST(const void *ptr)
 {
@@ -28,6 +28,8 @@
 
 #include "make.h"
 
+#include <psapi.h>
+
 /* die when out of memory. */
 static MAKE_ATTR_DEAD void
 enomem(void)
@@ -84,3 +86,126 @@ bmake_strsedup(const char *start, const char *end)
 {
 	return bmake_strldup(start, (size_t)(end - start));
 }
+
+#define ARENA_CHUNK (64 * 1024)
+
+struct ArenaChunk {
+	struct ArenaChunk *next;
+	/* followed by the objects, aligned to ARENA_ALIGN */
+};
+
+/* The header of a chunk, rounded up so that the objects stay aligned. */
+#define ARENA_HEADER \
+	((sizeof(struct ArenaChunk) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+Arena parseArena = ARENA_INIT("parse");
+
+/* Round the size up to the size class of the object. */
+static size_t
+ArenaSize(size_t size)
+{
+	if (size == 0)
+		size = 1;
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static void
+Arena_AddChunk(Arena *a)
+{
+	struct ArenaChunk *chunk = bmake_malloc(ARENA_CHUNK);
+
+	chunk->next = a->chunks;
+	a->chunks = chunk;
+	a->next = (char *)chunk + ARENA_HEADER;
+	a->end = (char *)chunk + ARENA_CHUNK;
+	a->reserved += ARENA_CHUNK;
+}
+
+/* Allocate an object from the arena, but die on error. */
+void *
+Arena_Alloc(Arena *a, size_t size)
+{
+	void *p;
+
+	size = ArenaSize(size);
+	a->numAllocs++;
+	a->inUse += size;
+	if (a->inUse > a->peak)
+		a->peak = a->inUse;
+
+	if (size > ARENA_SMALL) {
+		a->numLarge++;
+		return bmake_malloc(size);
+	}
+
+	if ((p = a->freeList[size / ARENA_ALIGN - 1]) != NULL) {
+		a->freeList[size / ARENA_ALIGN - 1] = *(void **)p;
+		a->numReused++;
+		return p;
+	}
+
+	if ((size_t)(a->end - a->next) < size)
+		Arena_AddChunk(a);
+	p = a->next;
+	a->next += size;
+	return p;
+}
+
+/*
+ * Give back an object that was allocated from the arena with the same
+ * size, so that it can be reused.
+ */
+void
+Arena_Free(Arena *a, void *p, size_t size)
+{
+	size = ArenaSize(size);
+	a->inUse -= size;
+
+	if (size > ARENA_SMALL) {
+		free(p);
+		return;
+	}
+
+	*(void **)p = a->freeList[size / ARENA_ALIGN - 1];
+	a->freeList[size / ARENA_ALIGN - 1] = p;
+}
+
+/*
+ * Free all chunks of the arena at once.  The large objects must have been
+ * freed before.
+ */
+void
+Arena_Done(Arena *a)
+{
+	struct ArenaChunk *chunk, *next;
+
+	for (chunk = a->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	a->chunks = NULL;
+	a->next = a->end = NULL;
+	memset(a->freeList, 0, sizeof a->freeList);
+	a->reserved = a->inUse = 0;
+}
+
+void
+Arena_Stats(const Arena *a)
+{
+	debug_printf("Arena %s: %lu allocations, %lu reused, %lu large, "
+	    "%zu KiB in chunks, %zu KiB in use, %zu KiB at peak\n",
+	    a->name, a->numAllocs, a->numReused, a->numLarge,
+	    a->reserved / 1024, a->inUse / 1024, a->peak / 1024);
+}
+
+/* Print the allocation statistics, for -du. */
+void
+Malloc_Stats(void)
+{
+	PROCESS_MEMORY_COUNTERS pmc;
+
+	Arena_Stats(&parseArena);
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof pmc) != 0)
+		debug_printf("Peak working set: %zu KiB\n",
+		    (size_t)pmc.PeakWorkingSetSize / 1024);
+}
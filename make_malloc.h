@@ -32,3 +32,44 @@ char * MAKE_ATTR_USE bmake_strdup(const char *);
 char * MAKE_ATTR_USE bmake_strldup(const char *, size_t);
 
 char * MAKE_ATTR_USE bmake_strsedup(const char *, const char *);
+
+/*
+ * An arena hands out small objects from large chunks of memory, which
+ * saves the per-object overhead of malloc.  A freed object goes to a free
+ * list for its size and is reused for the next object of that size; the
+ * chunks themselves are only returned in Arena_Done.  Large objects are
+ * passed on to malloc.
+ *
+ * Arenas are not thread-safe.
+ */
+#define ARENA_ALIGN 8
+#define ARENA_SMALL 512		/* larger objects come from malloc */
+
+typedef struct Arena {
+	const char *name;
+	struct ArenaChunk *chunks;
+	char *next;		/* The unused part of the current chunk. */
+	char *end;
+	void *freeList[ARENA_SMALL / ARENA_ALIGN];
+	size_t reserved;	/* Bytes in the chunks */
+	size_t inUse;		/* Bytes in live objects */
+	size_t peak;		/* Maximum of inUse */
+	unsigned long numAllocs;
+	unsigned long numReused; /* Allocations served from a free list */
+	unsigned long numLarge;	/* Allocations passed on to malloc */
+} Arena;
+
+#define ARENA_INIT(name) { name, NULL, NULL, NULL, { NULL }, 0, 0, 0, 0, 0, 0 }
+
+/*
+ * The objects that usually live until make exits: the nodes of the graph,
+ * the variables, the nodes of the lists and the entries of the hash
+ * tables.
+ */
+extern Arena parseArena;
+
+void * MAKE_ATTR_USE Arena_Alloc(Arena *, size_t);
+void Arena_Free(Arena *, void *, size_t);
+void Arena_Done(Arena *);
+void Arena_Stats(const Arena *);
+void Malloc_Stats(void);
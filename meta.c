@@ -39,6 +39,10 @@
 #include "dir.h"
 #include "job.h"
 
+#ifdef USE_FILEMON
+#include "filemon/filemon.h"
+#endif
+
 static BuildMon Mybm;			/* for compat */
 static StringList metaBailiwick = LST_INIT; /* our scope of control */
 static char *metaBailiwickStr;		/* string storage for the list */
@@ -71,6 +75,10 @@ static bool metaIgnoreFilter = false;	/* do we have more complex filtering? */
 static bool metaCmpFilter = false;	/* do we have CMP_FILTER ? */
 static bool metaCurdirOk = false;	/* write .meta in .CURDIR Ok? */
 static bool metaSilent = false;		/* if we have a .meta be SILENT */
+static bool filemonMissing = false;	/* oodate if missing */
+#ifdef USE_FILEMON
+static bool useFilemon = false;
+#endif
 
 
 #define MAKE_META_PREFIX	".MAKE.META.PREFIX"
@@ -343,7 +351,6 @@ meta_create(BuildMon *pbm, GNode *gn)
 	FILE *fp;
 	char buf[MAXPATHLEN];
 	char objdir_realpath[MAXPATHLEN];
-	char **ptr;
 	FStr dname;
 	const char *tname;
 	char *fname;
@@ -397,8 +404,10 @@ meta_create(BuildMon *pbm, GNode *gn)
 		fprintf(fp, "OODATE %s\n", cp);
 	}
 	if (metaEnv) {
-		for (ptr = environ; *ptr != NULL; ptr++)
-			fprintf(fp, "ENV %s\n", *ptr);
+		const char *env = Var_Environment(gn, NULL);
+
+		for (; *env != '\0'; env += strlen(env) + 1)
+			fprintf(fp, "ENV %s\n", env);
 	}
 
 	fprintf(fp, "-- command output --\n");
@@ -449,6 +458,9 @@ meta_mode_init(const char *make_mode)
 
 	useMeta = true;
 	writeMeta = true;
+#ifdef USE_FILEMON
+	useFilemon = true;
+#endif
 
 	if (make_mode != NULL) {
 		if (strstr(make_mode, "env") != NULL)
@@ -459,8 +471,13 @@ meta_mode_init(const char *make_mode)
 			writeMeta = false;
 		if (strstr(make_mode, "ignore-cmd") != NULL)
 			metaIgnoreCMDs = true;
+#ifdef USE_FILEMON
+		if (strstr(make_mode, "nofilemon") != NULL)
+			useFilemon = false;
+#endif
 		get_mode_bf(metaCurdirOk, "curdirok=");
 		get_mode_bf(metaMissing, "missing-meta=");
+		get_mode_bf(filemonMissing, "missing-filemon=");
 		get_mode_bf(metaSilent, "silent=");
 	}
 	if (metaVerbose && !Var_Exists(SCOPE_GLOBAL, MAKE_META_PREFIX)) {
@@ -477,6 +494,9 @@ meta_mode_init(const char *make_mode)
 		return;
 	once = true;
 	memset(&Mybm, 0, sizeof Mybm);
+#ifdef USE_FILEMON
+	Global_Set(".MAKE.PATH_FILEMON", filemon_path());
+#endif
 	/*
 	 * We consider ourselves master of all within ${.MAKE.META.BAILIWICK}
 	 */
@@ -517,6 +537,47 @@ meta_job_start(Job *job, GNode *gn)
 
 	pbm = BM(job);
 	pbm->mfp = meta_create(pbm, gn);
+#ifdef USE_FILEMON
+	/* If we're not writing to a meta data file, don't use filemon. */
+	if (pbm->mfp != NULL && useFilemon) {
+		pbm->filemon = filemon_open();
+		if (pbm->filemon == NULL) {
+			useFilemon = false;
+			warnx("Could not open filemon %s", filemon_path());
+		}
+	}
+#endif
+}
+
+/*
+ * The child of the job is about to be started.  If filemon traces it,
+ * return the entry for its environment that filemon needs; the child then
+ * has to be started with PROC_SUSPENDED, so that meta_job_parent can
+ * attach filemon to it before it runs.
+ */
+const char *
+meta_job_child(Job *job MAKE_ATTR_UNUSED)
+{
+#ifdef USE_FILEMON
+	BuildMon *pbm = BM(job);
+
+	if (pbm->filemon != NULL)
+		return filemon_env(pbm->filemon);
+#endif
+	return NULL;
+}
+
+/* The child of the job has been started, see meta_job_child. */
+void
+meta_job_parent(Job *job MAKE_ATTR_UNUSED, Proc *proc MAKE_ATTR_UNUSED)
+{
+#ifdef USE_FILEMON
+	BuildMon *pbm = BM(job);
+
+	if (pbm->filemon != NULL && !filemon_setproc(pbm->filemon, proc))
+		DEBUG2(META, "Could not attach filemon to process %lu: %s\n",
+		    proc->pid, strerr(GetLastError()));
+#endif
 }
 
 void
@@ -577,6 +638,34 @@ meta_job_output(Job *job, char *cp, const char *nl)
 	}
 }
 
+#ifdef USE_FILEMON
+/* Copy the records of filemon to the meta data file. */
+static int
+filemon_read(FILE *mfp, struct filemon *filemon)
+{
+	char buf[BUFSIZ];
+	size_t n;
+	FILE *fp;
+	int error = 0;
+
+	if ((fp = fopen(filemon_output(filemon), "rb")) == NULL) {
+		error = errno;
+		warn("Could not read filemon output %s",
+		    filemon_output(filemon));
+		fprintf(mfp, "\n");
+		return error;
+	}
+
+	fprintf(mfp, "\n-- filemon acquired metadata --\n");
+	while ((n = fread(buf, 1, sizeof buf, fp)) > 0) {
+		if (fwrite(buf, 1, n, mfp) < n)
+			error = EIO;
+	}
+	fclose(fp);
+	return error;
+}
+#endif
+
 int
 meta_cmd_finish(void *pbmp)
 {
@@ -586,6 +675,15 @@ meta_cmd_finish(void *pbmp)
 	if (pbm == NULL)
 		pbm = &Mybm;
 
+#ifdef USE_FILEMON
+	if (pbm->filemon != NULL) {
+		error = filemon_read(pbm->mfp, pbm->filemon);
+		filemon_close(pbm->filemon);
+		pbm->filemon = NULL;
+		return error;
+	}
+#endif
+
 	fprintf(pbm->mfp, "\n");	/* ensure end with newline */
 	return error;
 }
@@ -789,6 +887,26 @@ meta_ignore(GNode *gn, const char *p)
 	*ep = '\0'; \
 	}
 
+/*
+ * Split the arguments of an 'L' or 'M' record, "'from' 'to'".  The paths
+ * may contain spaces, so they are split at the "' '" between them.
+ */
+static bool
+meta_split_paths(char *p, char **from, char **to)
+{
+	char *sep, *end;
+
+	if (*p != '\'' || (sep = strstr(p, "' '")) == NULL)
+		return false;
+	*sep = '\0';
+	*from = p + 1;
+	*to = sep + 3;
+	if ((end = strrchr(*to, '\'')) == NULL)
+		return false;
+	*end = '\0';
+	return true;
+}
+
 static void
 append_if_new(StringList *list, const char *str)
 {
@@ -849,7 +967,9 @@ meta_oodate(GNode *gn, bool oodate)
 	FILE *fp;
 	bool needOODATE = false;
 	StringList missingFiles;
+	bool have_filemon = false;
 	bool cmp_filter;
+	struct cached_stat cst;
 
 	if (oodate)
 		return oodate;		/* we're done */
@@ -921,13 +1041,166 @@ meta_oodate(GNode *gn, bool oodate)
 			link_src = NULL;
 			move_target = NULL;
 
+			/* Find the start of the build monitor section. */
+			if (!have_filemon &&
+			    strncmp(buf, "-- filemon", 10) == 0) {
+				have_filemon = true;
+				continue;
+			}
+
 			/* Delimit the record type. */
 			p = buf;
 #ifdef DEBUG_META_MODE
 			DEBUG3(META, "%s: %u: %s\n", fname, lineno, buf);
 #endif
 			strsep(&p, " ");
-			if (strcmp(buf, "CMD") == 0) {
+			if (have_filemon) {
+				/*
+				 * We are in the 'filemon' output section.
+				 * Each record from filemon follows the general form:
+				 *
+				 * <key> <pid> <data>
+				 *
+				 * Where:
+				 * <key> is a single letter, denoting the call.
+				 * <pid> is the process that made the call.
+				 * <data> is the arguments (of interest).
+				 *
+				 * The paths are absolute, see filemon.h, so the
+				 * working directory of each process need not be
+				 * tracked.
+				 */
+				if (buf[0] == '#' || buf[0] == 'V')
+					continue;	/* comment or version */
+				CHECK_VALID_META(p);
+				/* Skip past the pid. */
+				if (strsep(&p, " ") == NULL)
+					continue;
+				CHECK_VALID_META(p);
+
+				/* Process according to record type. */
+				switch (buf[0]) {
+				case 'M':		/* renaMe */
+					/*
+					 * For 'M'oves the source is gone,
+					 * and the target is checked as for
+					 * 'W'rite.
+					 */
+					if (!meta_split_paths(p, &p, &move_target))
+						p = NULL;
+					CHECK_VALID_META(p);
+					/* FALLTHROUGH */
+				case 'D':		/* unlink */
+					if (isAbs(p)) {
+						/* remove any missingFiles entries that match p */
+						StringListNode *ln = missingFiles.first;
+						while (ln != NULL) {
+							StringListNode *next = ln->next;
+							if (path_starts_with(ln->datum, p)) {
+								free(ln->datum);
+								Lst_Remove(&missingFiles, ln);
+							}
+							ln = next;
+						}
+					}
+					if (buf[0] == 'M') {
+						/* the target of the mv is a file 'W'ritten */
+#ifdef DEBUG_META_MODE
+						DEBUG2(META, "meta_oodate: M %s -> %s\n",
+							p, move_target);
+#endif
+						p = move_target;
+						goto check_write;
+					}
+					break;
+				case 'L':		/* Link */
+					/*
+					 * For 'L'inks check
+					 * the src as for 'R'ead
+					 * and the target as for 'W'rite.
+					 */
+					if (!meta_split_paths(p, &link_src, &p))
+						p = NULL;
+					CHECK_VALID_META(p);
+#ifdef DEBUG_META_MODE
+					DEBUG2(META, "meta_oodate: L %s -> %s\n",
+						link_src, p);
+#endif
+					/* FALLTHROUGH */
+				case 'W':		/* Write */
+				check_write:
+					/*
+					 * If a file we generated within our bailiwick
+					 * but outside of .OBJDIR is missing,
+					 * we need to do it again.
+					 */
+					/* ignore non-absolute paths */
+					if (!isAbs(p))
+						break;
+
+					if (Lst_IsEmpty(&metaBailiwick))
+						break;
+
+					/* ignore cwd - normal dependencies handle those */
+					if (strncmp(p, cwd, cwdlen) == 0)
+						break;
+
+					if (!has_any_prefix(p, &metaBailiwick))
+						break;
+
+					/* tmpdir might be within */
+					if (strncmp(p, tmpdir, tmplen) == 0)
+						break;
+
+					if (cached_stat(p, &cst) < 0 &&
+						!meta_ignore(gn, p))
+						append_if_new(&missingFiles, p);
+					break;
+				check_link_src:
+					p = link_src;
+					link_src = NULL;
+#ifdef DEBUG_META_MODE
+					DEBUG1(META, "meta_oodate: L src %s\n", p);
+#endif
+					/* FALLTHROUGH */
+				case 'R':		/* Read */
+				case 'E':		/* Exec */
+					/*
+					 * Check for runtime files that can't
+					 * be part of the dependencies because
+					 * they are _expected_ to change.
+					 */
+					if (!isAbs(p) || meta_ignore(gn, p))
+						break;
+
+					/*
+					 * The temporary files of the job, e.g.
+					 * response files, are not sources.
+					 */
+					if (strncmp(p, tmpdir, tmplen) == 0)
+						break;
+
+					if (cached_stat(p, &cst) == 0) {
+						if (!S_ISDIR(cst.cst_mode) &&
+							cst.cst_mtime > gn->mtime) {
+							DEBUG3(META, "%s: %u: file '%s' is newer than the target...\n",
+								fname, lineno, p);
+							oodate = true;
+						}
+					} else if (strncmp(p, cwd, cwdlen) != 0) {
+						/*
+						 * A referenced file outside of CWD is missing.
+						 * We cannot catch every eventuality here...
+						 */
+						append_if_new(&missingFiles, p);
+					}
+					break;
+				default:		/* C, F, X */
+					break;
+				}
+				if (!oodate && buf[0] == 'L' && link_src != NULL)
+					goto check_link_src;
+			} else if (strcmp(buf, "CMD") == 0) {
 				/*
 				 * Compare the current command with the one in the
 				 * meta data file.
@@ -1013,6 +1286,10 @@ meta_oodate(GNode *gn, bool oodate)
 		}
 
 		fclose(fp);
+		if (!oodate && !have_filemon && filemonMissing) {
+			DEBUG1(META, "%s: missing filemon data\n", fname);
+			oodate = true;
+		}
 		if (!Lst_IsEmpty(&missingFiles)) {
 			DEBUG2(META, "%s: missing files: %s...\n",
 				fname, (char *)missingFiles.first->datum);
@@ -1055,52 +1332,59 @@ oodate_out:
 
 /* support for compat mode */
 
-static HANDLE childPipe[2];
+static ProcPipe childPipe;
+static char childBuf[PIPESZ + 1];
 
 void
 meta_compat_start(void)
 {
-	if (CreatePipe(&childPipe[0], &childPipe[1], NULL, PIPESZ) == 0)
-		Punt("failed to create pipe: %s", strerr(GetLastError()));
-	if (SetNamedPipeHandleState(childPipe[0], &(DWORD){PIPE_NOWAIT},
-		NULL, NULL) == 0)
-		Punt("failed to set pipe handle state: %s", strerr(GetLastError()));
-	if (SetHandleInformation(childPipe[1], HANDLE_FLAG_INHERIT,
-		HANDLE_FLAG_INHERIT) == 0)
-		Punt("failed to set pipe attributes: %s", strerr(GetLastError()));
+	if (!ProcPipe_Open(&childPipe))
+		Punt("failed to create pipe: %s", Proc_Error());
+	if (!ProcPipe_StartRead(&childPipe, childBuf, sizeof childBuf - 1))
+		Punt("failed to read from pipe: %s", Proc_Error());
 }
 
-HANDLE *
+ProcPipe *
 meta_compat_pipe(void)
 {
-	return childPipe;
+	return &childPipe;
 }
 
+/*
+ * Pass on the output of the child that has arrived so far.  If 'done' is
+ * set, the child has exited, so take everything that is left and close
+ * the pipe.
+ */
 void
 meta_compat_catch(char *cmd, bool done)
 {
-	char *buf;
-	DWORD sz;
+	size_t nr;
 
-	if (PeekNamedPipe(childPipe[0], NULL, 0, NULL, &sz, NULL) == 0)
-		Punt("failed to peek pipe: %s", strerr(GetLastError()));
-	if (sz == 0)
-		return;
-
-	buf = _alloca(sz + 1);
-	if (ReadFile(childPipe[0], buf, sz, NULL, NULL) == 0)
-		Punt("failed to read from pipe: %s", strerr(GetLastError()));
+	for (;;) {
+		switch (ProcPipe_ReadResult(&childPipe, done, &nr)) {
+		case PROC_AGAIN:
+			return;
+		case PROC_ERROR:
+			Punt("failed to read from pipe: %s", Proc_Error());
+		case PROC_DONE:
+			break;
+		}
+		if (nr == 0)
+			break;
 
-	fwrite(buf, 1, sz, stdout);
-	fflush(stdout);
+		fwrite(childBuf, 1, nr, stdout);
+		fflush(stdout);
 
-	buf[sz] = '\0';
-	meta_job_output(NULL, buf, "");
+		childBuf[nr] = '\0';
+		meta_job_output(NULL, childBuf, "");
 
-	if (done) {
-		CloseHandle(childPipe[0]);
-		CloseHandle(childPipe[1]);
+		if (!ProcPipe_StartRead(&childPipe, childBuf,
+			sizeof childBuf - 1))
+			Punt("failed to read from pipe: %s", Proc_Error());
 	}
+
+	if (done)
+		ProcPipe_Close(&childPipe);
 }
 
 #endif /* USE_META */
@@ -33,6 +33,7 @@
 
 typedef struct BuildMon {
 	char	meta_fname[MAXPATHLEN];
+	struct filemon *filemon;
 	FILE	*mfp;
 } BuildMon;
 
@@ -41,13 +42,15 @@ struct Job;
 void meta_finish(void);
 void meta_mode_init(const char *);
 void meta_job_start(struct Job *, GNode *);
+const char *meta_job_child(struct Job *);
+void meta_job_parent(struct Job *, Proc *);
 void meta_job_error(struct Job *, GNode *, bool, int);
 void meta_job_output(struct Job *, char *, const char *);
 int  meta_cmd_finish(void *);
 int  meta_job_finish(struct Job *);
 bool meta_oodate(GNode *, bool) MAKE_ATTR_USE;
 void meta_compat_start(void);
-HANDLE *meta_compat_pipe(void);
+ProcPipe *meta_compat_pipe(void);
 void meta_compat_catch(char *, bool);
 
 extern bool useMeta;
@@ -104,6 +104,9 @@
 
 #define S_ISREG(m) (((m) & S_IFMT) == S_IFREG)
 
+/* Makefiles of at least this size are mapped instead of read. */
+#define LOADFILE_MAP_MIN (64 * 1024)
+
 /*	"@(#)parse.c	8.3 (Berkeley) 3/19/94"	*/
 
 /* Detects a multiple-inclusion guard in a makefile. */
@@ -117,6 +120,7 @@ typedef enum {
 /* A file being parsed. */
 typedef struct IncludedFile {
 	FStr name;		/* absolute or relative to the cwd */
+	const char *internedName; /* the name for GNode.fname, or NULL */
 	unsigned lineno;	/* 1-based */
 	unsigned readLines;	/* the number of physical lines that have
 				 * been read from the file */
@@ -129,8 +133,10 @@ typedef struct IncludedFile {
 	bool depending;		/* state of doing_depend on EOF */
 
 	Buffer buf;		/* the file's content or the body of the .for
-				 * loop; either empty or ends with '\n' */
-	char *buf_ptr;		/* next char to be read from buf */
+				 * loop; either empty or ends with '\n';
+				 * for a mapped file, the current line */
+	char *map;		/* the read-only mapped file, or NULL */
+	char *buf_ptr;		/* next char to be read from buf or map */
 	char *buf_end;		/* buf_end[-1] == '\n' */
 
 	GuardState guardState;
@@ -142,6 +148,7 @@ typedef struct IncludedFile {
 /* Special attributes for target nodes. */
 typedef enum ParseSpecial {
 	SP_ATTRIBUTE,	/* Generic attribute */
+	SP_BATCH,	/* .BATCH */
 	SP_BEGIN,	/* .BEGIN */
 	SP_DEFAULT,	/* .DEFAULT */
 	SP_DELETE_ON_ERROR, /* .DELETE_ON_ERROR */
@@ -254,6 +261,7 @@ static const struct {
 	ParseSpecial special;	/* when used as a target */
 	GNodeType targetAttr;	/* when used as a source */
 } parseKeywords[] = {
+	{ ".BATCH",		SP_BATCH,	OP_NONE },
 	{ ".BEGIN",		SP_BEGIN,	OP_NONE },
 	{ ".DEFAULT",	SP_DEFAULT,	OP_NONE },
 	{ ".DELETE_ON_ERROR", SP_DELETE_ON_ERROR, OP_NONE },
@@ -305,6 +313,21 @@ enum PosixState posix_state = PS_NOT_YET;
 
 static HashTable /* full file name -> Guard */ guards;
 
+/*
+ * With .MAKE.PARALLEL_SHELL_ASSIGN, the commands of consecutive '!='
+ * assignments run at the same time.  The assignments are done in order
+ * once the run ends, see FinishShellAssigns.
+ */
+typedef struct PendingShellAssign {
+	char *name;		/* as written, not expanded */
+	CmdExec *cmd;
+	unsigned lineno;
+} PendingShellAssign;
+
+static Vector /* of PendingShellAssign */ pendingShellAssigns;
+/* The expanded name of each pending assignment -> its CmdExec */
+static HashTable pendingShellNames;
+
 
 static List *
 Lst_New(void)
@@ -382,6 +405,70 @@ LoadFile(const char *path, int fd)
 	return buf;		/* may not be null-terminated */
 }
 
+/*
+ * Map a large makefile, such as a generated dependency file, instead of
+ * copying it to a buffer.  Return NULL if the file is small, is not a
+ * regular file, cannot be mapped or does not end with a newline.
+ *
+ * Reading the file in text mode turns CRLF into LF and stops at a CTRL-Z,
+ * which the mapping does not, so such files are read as well.
+ */
+static char *
+MapFile(int fd, size_t *out_size)
+{
+	HANDLE fh = (HANDLE)_get_osfhandle(fd);
+	HANDLE map;
+	LARGE_INTEGER size;
+	char *data;
+
+	if (fh == INVALID_HANDLE_VALUE || GetFileType(fh) != FILE_TYPE_DISK ||
+	    GetFileSizeEx(fh, &size) == 0 ||
+	    size.QuadPart < LOADFILE_MAP_MIN ||
+	    (ULONGLONG)size.QuadPart > SIZE_MAX)
+		return NULL;
+
+	if ((map = CreateFileMappingA(fh, NULL, PAGE_READONLY,
+	    0, 0, NULL)) == NULL)
+		return NULL;
+	data = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(map);	/* the view keeps the mapping */
+	if (data == NULL)
+		return NULL;
+
+	if (data[size.QuadPart - 1] != '\n' ||
+	    memchr(data, '\r', (size_t)size.QuadPart) != NULL ||
+	    memchr(data, '\x1a', (size_t)size.QuadPart) != NULL) {
+		UnmapViewOfFile(data);
+		return NULL;
+	}
+	*out_size = (size_t)size.QuadPart;
+	return data;
+}
+
+/* Parse the file from the descriptor, later return to the current file. */
+static void
+PushFile(const char *name, int fd)
+{
+	IncludedFile *curFile;
+	Buffer buf;
+	char *map;
+	size_t mapSize;
+
+	if ((map = MapFile(fd, &mapSize)) == NULL) {
+		Parse_PushInput(name, 1, 0, LoadFile(name, fd), NULL);
+		return;
+	}
+
+	DEBUG2(PARSE, "PushFile: mapped %s, %lu bytes\n",
+	    name, (unsigned long)mapSize);
+	Buf_Init(&buf);
+	Parse_PushInput(name, 1, 0, buf, NULL);
+	curFile = CurFile();
+	curFile->map = map;
+	curFile->buf_ptr = map;
+	curFile->buf_end = map + mapSize;
+}
+
 /*
  * Print the current chain of .include and .for directives.  In Parse_Fatal
  * or other functions that already print the location, includingInnermost
@@ -443,7 +530,9 @@ static void
 RememberLocation(GNode *gn)
 {
 	IncludedFile *curFile = CurFile();
-	gn->fname = Str_Intern(curFile->name.str);
+	if (curFile->internedName == NULL)
+		curFile->internedName = Str_Intern(curFile->name.str);
+	gn->fname = curFile->internedName;
 	gn->lineno = curFile->lineno;
 }
 
@@ -518,6 +607,7 @@ ParseVErrorInternal(FILE *f, bool useVars, const GNode *gn,
 {
 	static bool fatal_warning_error_printed = false;
 
+	Snapshot_Skip("a warning or message was printed");
 	(void)fprintf(f, "%s: ", progname);
 
 	PrintLocation(f, useVars, gn);
@@ -622,10 +712,10 @@ HandleMessage(ParseErrorLevel level, const char *levelName, const char *umsg)
 static void
 LinkSource(GNode *pgn, GNode *cgn, bool isSpecial)
 {
-	if ((pgn->type & OP_DOUBLEDEP) && !Lst_IsEmpty(&pgn->cohorts))
-		pgn = pgn->cohorts.last->datum;
+	if ((pgn->type & OP_DOUBLEDEP) && !GNodeVec_IsEmpty(&pgn->cohorts))
+		pgn = GNodeVec_Last(&pgn->cohorts);
 
-	Lst_Append(&pgn->children, cgn);
+	GNodeVec_Append(&pgn->children, cgn);
 	pgn->unmade++;
 
 	/*
@@ -633,7 +723,7 @@ LinkSource(GNode *pgn, GNode *cgn, bool isSpecial)
 	 * target has been made.
 	 */
 	if (!isSpecial)
-		Lst_Append(&cgn->parents, pgn);
+		GNodeVec_Append(&cgn->parents, pgn);
 
 	if (DEBUG(PARSE)) {
 		debug_printf("Target \"%s\" depends on \"%s\"\n",
@@ -700,7 +790,7 @@ TryApplyDependencyOperator(GNode *gn, GNodeType op)
 		 * traversals will no longer see this node anyway. -mycroft)
 		 */
 		cohort->type = op | OP_INVISIBLE;
-		Lst_Append(&gn->cohorts, cohort);
+		GNodeVec_Append(&gn->cohorts, cohort);
 		cohort->centurion = gn;
 		gn->unmade_cohorts++;
 		snprintf(cohort->cohort_num, sizeof cohort->cohort_num, "#%d",
@@ -745,6 +835,29 @@ ApplyDependencySourceWait(bool isSpecial)
 	LinkToTargets(gn, isSpecial);
 }
 
+/*
+ * In a line like ".c.obj: .BATCH", allow the job that makes a target using
+ * this transformation rule to make other targets using the same rule as
+ * well, see MakeBatch.
+ */
+static void
+ApplyDependencySourceBatch(void)
+{
+	GNodeListNode *ln;
+
+	for (ln = targets->first; ln != NULL; ln = ln->next) {
+		GNode *gn = ln->datum;
+
+		if (gn->type & OP_TRANSFORM)
+			gn->flags.batch = true;
+		else
+			Parse_Error(PARSE_WARNING,
+			    "The attribute .BATCH only applies to "
+			    "transformation rules, not to \"%s\"",
+			    gn->name);
+	}
+}
+
 static bool
 ApplyDependencySourceKeyword(const char *src, ParseSpecial special)
 {
@@ -767,6 +880,10 @@ ApplyDependencySourceKeyword(const char *src, ParseSpecial special)
 		ApplyDependencySourceWait(special != SP_NOT);
 		return true;
 	}
+	if (parseKeywords[keywd].special == SP_BATCH) {
+		ApplyDependencySourceBatch();
+		return true;
+	}
 	return false;
 }
 
@@ -802,8 +919,8 @@ ApplyDependencySourceOrder(const char *src)
 	if (doing_depend)
 		RememberLocation(gn);
 	if (order_pred != NULL) {
-		Lst_Append(&order_pred->order_succ, gn);
-		Lst_Append(&gn->order_pred, order_pred);
+		GNodeVec_Append(&order_pred->order_succ, gn);
+		GNodeVec_Append(&gn->order_pred, order_pred);
 		if (DEBUG(PARSE)) {
 			debug_printf(
 				"# .ORDER forces '%s' to be made before '%s'\n",
@@ -1229,6 +1346,37 @@ skip:
 	return true;
 }
 
+/*
+ * Remember where the missing makefile would have been found, so that the
+ * snapshot of this run is not used anymore once it exists.
+ */
+static void
+AddMissingIncludeDeps(const char *file, bool isSystem)
+{
+	if (isAbs(file)) {
+		Snapshot_AddDep(file);
+		return;
+	}
+	if (!isSystem) {
+		char *incdir = bmake_strdup(CurFile()->name.str);
+		char *slash = lastSlash(incdir);
+
+		if (slash != NULL) {
+			char *fullname;
+
+			*slash = '\0';
+			fullname = str_concat3(incdir, "\\", file);
+			Snapshot_AddDep(fullname);
+			free(fullname);
+		}
+		free(incdir);
+		SearchPath_AddSnapshotDeps(parseIncPath, file);
+		SearchPath_AddSnapshotDeps(&dirSearchPath, file);
+	}
+	SearchPath_AddSnapshotDeps(Lst_IsEmpty(&sysIncPath->dirs)
+	    ? defSysIncPath : sysIncPath, file);
+}
+
 /*
  * Handle one of the .[-ds]include directives by remembering the current file
  * and pushing the included file on the stack.  After the included file has
@@ -1242,7 +1390,6 @@ skip:
 static void
 IncludeFile(const char *file, bool isSystem, bool depinc, bool silent)
 {
-	Buffer buf;
 	char *fullname;		/* full pathname of file */
 	int fd;
 
@@ -1260,6 +1407,8 @@ IncludeFile(const char *file, bool isSystem, bool depinc, bool silent)
 	if (fullname == NULL) {
 		if (!silent)
 			Parse_Error(PARSE_FATAL, "Could not find %s", file);
+		else
+			AddMissingIncludeDeps(file, isSystem);
 		return;
 	}
 
@@ -1272,10 +1421,9 @@ IncludeFile(const char *file, bool isSystem, bool depinc, bool silent)
 		goto done;
 	}
 
-	buf = LoadFile(fullname, fd);
+	PushFile(fullname, fd);
 	(void)close(fd);
 
-	Parse_PushInput(fullname, 1, 0, buf, NULL);
 	if (depinc)
 		doing_depend = depinc;	/* only turn it on */
 done:
@@ -1359,6 +1507,7 @@ ParseDependencySourceSpecial(ParseSpecial special, const char *word,
 		Suff_SetNull(word);
 		break;
 	case SP_OBJDIR:
+		Snapshot_Skip("the makefiles use .OBJDIR");
 		Main_SetObjdir(false, "%s", word);
 		break;
 	case SP_READONLY:
@@ -1444,10 +1593,34 @@ ParseDependencyTargets(char **pp,
 	return true;
 }
 
+/*
+ * Read the directories of a '.PATH' line in parallel, before they are
+ * added to the search paths one by one.
+ */
+static void
+PrefetchPaths(const char *start)
+{
+	StringList dirs = LST_INIT;
+
+	while (*start != '\0') {
+		const char *end = start;
+		while (*end != '\0' && !ch_isspace(*end))
+			end++;
+		Lst_Append(&dirs, bmake_strsedup(start, end));
+		cpp_skip_whitespace(&end);
+		start = end;
+	}
+	Dir_Prefetch(&dirs);
+	Lst_DoneFree(&dirs);
+}
+
 static void
 ParseDependencySourcesSpecial(char *start,
 				  ParseSpecial special, SearchPathList *paths)
 {
+	if ((special == SP_PATH || special == SP_SYSPATH) && paths != NULL)
+		PrefetchPaths(start);
+
 	while (*start != '\0') {
 		char savedEnd;
 		char *end = start;
@@ -1557,9 +1730,11 @@ ParseDependencySources(char *p, GNodeType targetAttr,
 	if (*p == '\0') {
 		HandleDependencySourcesEmpty(special, *inout_paths);
 	} else if (special == SP_MFLAGS) {
+		Snapshot_Skip("the makefiles use .MAKEFLAGS or .MFLAGS");
 		Main_ParseArgLine(p);
 		return;
 	} else if (special == SP_SHELL) {
+		Snapshot_Skip("the makefiles use .SHELL");
 		if (!Job_ParseShell(p)) {
 			Parse_Error(PARSE_FATAL,
 				"improper shell specification");
@@ -1905,6 +2080,119 @@ VarAssignSpecial(const char *name, const char *avalue)
 		Job_SetPrefix();
 	else if (strcmp(name, ".MAKE.EXPORTED") == 0)
 		Var_ExportVars(avalue);
+	else if (strcmp(name, ".MAKE.DIRCACHE") == 0)
+		Dir_LoadCache(avalue);
+	else if (strcmp(name, ".MAKE.STATCACHE") == 0)
+		Dir_SetStatCache(avalue);
+	else if (strcmp(name, ".MAKE.CMDCACHE") == 0)
+		CmdCache_Load();
+}
+
+/*
+ * After restoring the variables from a snapshot, redo the effects of the
+ * special variables that the makefiles assigned to, see snapshot.c.
+ */
+void
+Parse_RedoSpecials(void)
+{
+	static const char specials[][20] = {
+		".MAKE.DIRCACHE", ".MAKE.STATCACHE", ".MAKE.CMDCACHE",
+		".MAKE.JOB.PREFIX", ".MAKE.EXPORTED"
+	};
+	const char *value;
+	size_t i;
+
+	value = GNode_ValueDirect(SCOPE_GLOBAL, ".CURDIR");
+	if (value != NULL && strcmp(value, curdir) != 0)
+		VarAssignSpecial(".CURDIR", value);
+	for (i = 0; i < sizeof specials / sizeof specials[0]; i++) {
+		value = GNode_ValueDirect(SCOPE_GLOBAL, specials[i]);
+		if (value != NULL)
+			VarAssignSpecial(specials[i], value);
+	}
+}
+
+/*
+ * Wait for the commands of the pending '!=' assignments, and assign their
+ * output in the order in which they appear in the makefile.
+ */
+static void
+FinishShellAssigns(void)
+{
+	IncludedFile *curFile = includes.len > 0 ? CurFile() : NULL;
+	unsigned lineno = curFile != NULL ? curFile->lineno : 0;
+	size_t i;
+
+	if (pendingShellAssigns.len == 0)
+		return;
+
+	for (i = 0; i < pendingShellAssigns.len; i++) {
+		PendingShellAssign *psa = Vector_Get(&pendingShellAssigns, i);
+		char *output, *error;
+
+		output = Cmd_Finish(psa->cmd, &error);
+		/* Report errors at the line of the assignment. */
+		if (curFile != NULL)
+			curFile->lineno = psa->lineno;
+		Var_SetExpand(SCOPE_GLOBAL, psa->name, output);
+		if (error != NULL) {
+			Parse_Error(PARSE_WARNING, "%s", error);
+			free(error);
+		}
+		VarAssignSpecial(psa->name, output);
+		free(output);
+		free(psa->name);
+	}
+	if (curFile != NULL)
+		curFile->lineno = lineno;
+
+	pendingShellAssigns.len = 0;
+	HashTable_Done(&pendingShellNames);
+	HashTable_Init(&pendingShellNames);
+}
+
+/*
+ * Start the command of a '!=' assignment, leaving the assignment to
+ * FinishShellAssigns.  If the command or the variable name depends on an
+ * assignment that is still pending, finish those first.
+ */
+static void
+StartShellAssign(const char *name, const char *uvalue)
+{
+	PendingShellAssign *psa;
+	FStr cmd;
+	char *xname;
+	bool dependent;
+
+	Var_Watch(&pendingShellNames);
+	xname = Var_Subst(name, SCOPE_GLOBAL, VARE_EVAL);
+	/* TODO: handle errors */
+	cmd = FStr_InitRefer(uvalue);
+	Var_Expand(&cmd, SCOPE_CMDLINE, VARE_EVAL_DEFINED);
+	/* The command gets the exported variables in its environment. */
+	(void)Var_Environment(SCOPE_GLOBAL, NULL);
+	dependent = Var_Unwatch() ||
+	    HashTable_FindValue(&pendingShellNames, xname) != NULL;
+
+	if (dependent) {
+		DEBUG1(PARSE, "Waiting for the pending '!=' assignments "
+		    "before assigning %s\n", xname);
+		FinishShellAssigns();
+		free(xname);
+		xname = Var_Subst(name, SCOPE_GLOBAL, VARE_EVAL);
+		/* TODO: handle errors */
+		FStr_Done(&cmd);
+		cmd = FStr_InitRefer(uvalue);
+		Var_Expand(&cmd, SCOPE_CMDLINE, VARE_EVAL_DEFINED);
+	}
+
+	psa = Vector_Push(&pendingShellAssigns);
+	psa->name = bmake_strdup(name);
+	psa->lineno = CurFile()->lineno;
+	psa->cmd = Cmd_Start(cmd.str);
+	HashTable_Set(&pendingShellNames, xname, psa->cmd);
+	free(xname);
+	FStr_Done(&cmd);
 }
 
 /* Perform the variable assignment in the given scope. */
@@ -1914,6 +2202,13 @@ Parse_Var(VarAssign *var, GNode *scope)
 	FStr avalue;		/* actual value (maybe expanded) */
 
 	VarCheckSyntax(var->op, var->value, scope);
+	if (var->op == VAR_SHELL && scope == SCOPE_GLOBAL &&
+	    includes.len > 0 &&
+	    GetBooleanExpr("${.MAKE.PARALLEL_SHELL_ASSIGN}", false)) {
+		StartShellAssign(var->varname, var->value);
+		return;
+	}
+	FinishShellAssigns();
 	if (VarAssign_Eval(var->varname, var->op, var->value, scope, &avalue)) {
 		VarAssignSpecial(var->varname, avalue.str);
 		FStr_Done(&avalue);
@@ -1965,8 +2260,8 @@ MaybeSubMake(const char *cmd)
 static void
 GNode_AddCommand(GNode *gn, char *cmd)
 {
-	if ((gn->type & OP_DOUBLEDEP) && gn->cohorts.last != NULL)
-		gn = gn->cohorts.last->datum;
+	if ((gn->type & OP_DOUBLEDEP) && !GNodeVec_IsEmpty(&gn->cohorts))
+		gn = GNodeVec_Last(&gn->cohorts);
 
 	/* if target already supplied, ignore commands */
 	if (!(gn->type & OP_HAS_COMMANDS)) {
@@ -2159,11 +2454,13 @@ Parse_PushInput(const char *name, unsigned lineno, unsigned readLines,
 
 	curFile = Vector_Push(&includes);
 	curFile->name = FStr_InitOwn(bmake_strdup(name));
+	curFile->internedName = NULL;
 	curFile->lineno = lineno;
 	curFile->readLines = readLines;
 	curFile->forHeadLineno = lineno;
 	curFile->forBodyReadLines = readLines;
 	curFile->buf = buf;
+	curFile->map = NULL;
 	curFile->depending = doing_depend;	/* restore this on EOF */
 	curFile->guardState = forLoop == NULL ? GS_START : GS_NO;
 	curFile->guard = NULL;
@@ -2302,6 +2599,9 @@ ParseEOF(void)
 		return true;
 	}
 
+	/* The lines of the assignments refer to this file. */
+	FinishShellAssigns();
+
 	Cond_EndFile();
 
 	if (curFile->guardState == GS_DONE) {
@@ -2319,6 +2619,8 @@ ParseEOF(void)
 
 	FStr_Done(&curFile->name);
 	Buf_Done(&curFile->buf);
+	if (curFile->map != NULL)
+		UnmapViewOfFile(curFile->map);
 	if (curFile->forLoop != NULL)
 		ForLoop_Free(curFile->forLoop);
 	Vector_Pop(&includes);
@@ -2386,8 +2688,8 @@ ParseRawLine(IncludedFile *curFile, char **out_line, char **out_line_end,
 			if (p[1] == '\n') {
 				curFile->readLines++;
 				if (p + 2 == buf_end) {
+					/* Omit the '\\' at the end. */
 					line_end = p;
-					*line_end = '\n';
 					p += 2;
 					continue;
 				}
@@ -2501,7 +2803,8 @@ typedef enum LineKind {
 
 /*
  * Return the next "interesting" logical line from the current file.  The
- * returned string will be freed at the end of including the file.
+ * returned string will be freed at the end of including the file; for a
+ * mapped file, it is overwritten by the next line.
  */
 static char *
 ReadLowLevelLine(LineKind kind)
@@ -2528,7 +2831,23 @@ ReadLowLevelLine(LineKind kind)
 		}
 
 		/* We now have a line of data */
-		assert(ch_isspace(*line_end));
+		if (curFile->map != NULL) {
+			/* The mapping is read-only, edit a copy of the line. */
+			size_t len = (size_t)(line_end - line);
+			char *copy;
+
+			Buf_Clear(&curFile->buf);
+			Buf_AddBytes(&curFile->buf, line, len);
+			copy = curFile->buf.data;
+			if (firstBackslash != NULL)
+				firstBackslash = copy + (firstBackslash - line);
+			if (commentLineEnd != NULL)
+				commentLineEnd = copy + (commentLineEnd - line);
+			line = copy;
+			line_end = copy + len;
+		}
+		assert(ch_isspace(*line_end) || *line_end == '\\' ||
+		    *line_end == '\0');
 		*line_end = '\0';
 
 		if (kind == LK_FOR_BODY)
@@ -2623,6 +2942,8 @@ ReadHighLevelLine(void)
 		if (line[0] != '.')
 			return line;
 
+		/* Conditions and directives see the pending assignments. */
+		FinishShellAssigns();
 		condResult = Cond_EvalLine(line);
 		if (curFile->guardState == GS_START) {
 			Guard *guard;
@@ -2898,6 +3219,80 @@ ParseDependencyLine(char *line)
 		ParseLine_ShellCommand(shellcmd);
 }
 
+/* See ApplyDependencySourceKeyword and HandleDependencyTarget. */
+static bool
+IsSpecialWord(const char *word)
+{
+	return word[0] == '.' && ch_isupper(word[1]);
+}
+
+/*
+ * Parse a line like "target...: source..." from a generated dependency file,
+ * such as the .depend file.  Most of these lines consist of plain file
+ * names, which don't need to be expanded or checked for wildcards, archive
+ * members or special targets, so the nodes are linked directly.
+ *
+ * Return false if the line needs the full treatment by ParseDependencyLine.
+ */
+static bool
+ParseDependencyLinePlain(char *line)
+{
+	char *colon, *p;
+	bool hasTarget = false;
+
+	if (strpbrk(line, "$*?[{(;=") != NULL)
+		return false;
+	colon = strchr(line, ':');
+	if (colon == NULL || colon[1] == ':')
+		return false;
+
+	for (p = line; *p != '\0';) {
+		if (ch_isspace(*p) || p == colon) {
+			p++;
+			continue;
+		}
+		if (IsSpecialWord(p))
+			return false;
+		for (; *p != '\0' && !ch_isspace(*p) && p != colon; p++)
+			if (p < colon && (*p == '\\' || *p == '!'))
+				return false;
+		if (p <= colon)
+			hasTarget = true;
+	}
+	if (!hasTarget)
+		return false;
+
+	FinishShellAssigns();
+	FinishDependencyGroup();
+	DEBUG1(PARSE, "ParseDependencyLinePlain(%s)\n", line);
+	targets = Lst_New();
+
+	*colon = '\0';
+	for (p = line; *p != '\0';) {
+		char *word = p;
+		for (; *p != '\0' && !ch_isspace(*p); p++)
+			continue;
+		if (*p != '\0')
+			*p++ = '\0';
+		if (*word != '\0')
+			HandleSingleDependencyTargetMundane(word);
+	}
+	ApplyDependencyOperator(OP_DEPENDS);
+
+	for (p = colon + 1; *p != '\0';) {
+		char *word = p;
+		for (; *p != '\0' && !ch_isspace(*p); p++)
+			continue;
+		if (*p != '\0')
+			*p++ = '\0';
+		if (*word != '\0')
+			ApplyDependencySourceOther(word, OP_NONE, SP_NOT);
+	}
+
+	MaybeUpdateMainTarget();
+	return true;
+}
+
 static void
 ParseLine(char *line)
 {
@@ -2910,19 +3305,25 @@ ParseLine(char *line)
 	}
 
 	if (IsSysVInclude(line)) {
+		FinishShellAssigns();
 		ParseTraditionalInclude(line);
 		return;
 	}
 
 	if (strncmp(line, "export", 6) == 0 && ch_isspace(line[6]) &&
 		strchr(line, ':') == NULL) {
+		FinishShellAssigns();
 		ParseGmakeExport(line);
 		return;
 	}
 
+	if (doing_depend && ParseDependencyLinePlain(line))
+		return;
+
 	if (Parse_VarAssign(line, true, SCOPE_GLOBAL))
 		return;
 
+	FinishShellAssigns();
 	FinishDependencyGroup();
 
 	ParseDependencyLine(line);
@@ -2933,15 +3334,12 @@ void
 Parse_File(const char *name, int fd)
 {
 	char *line;
-	Buffer buf;
-
-	buf = LoadFile(name, fd != -1 ? fd : _fileno(stdin));
-	if (fd != -1)
-		(void)close(fd);
 
 	assert(targets == NULL);
 
-	Parse_PushInput(name, 1, 0, buf, NULL);
+	PushFile(name, fd != -1 ? fd : _fileno(stdin));
+	if (fd != -1)
+		(void)close(fd);
 
 	do {
 		while ((line = ReadHighLevelLine()) != NULL) {
@@ -2949,6 +3347,7 @@ Parse_File(const char *name, int fd)
 		}
 	} while (ParseEOF());
 
+	FinishShellAssigns();
 	FinishDependencyGroup();
 
 	if (parseErrors != 0) {
@@ -2971,6 +3370,8 @@ Parse_Init(void)
 	defSysIncPath = SearchPath_New();
 	Vector_Init(&includes, sizeof(IncludedFile));
 	HashTable_Init(&guards);
+	Vector_Init(&pendingShellAssigns, sizeof(PendingShellAssign));
+	HashTable_Init(&pendingShellNames);
 }
 
 /* Clean up the parsing module. */
@@ -2994,6 +3395,9 @@ Parse_End(void)
 		free(guard);
 	}
 	HashTable_Done(&guards);
+	assert(pendingShellAssigns.len == 0);
+	Vector_Done(&pendingShellAssigns);
+	HashTable_Done(&pendingShellNames);
 #endif
 }
 
@@ -3006,8 +3410,13 @@ Parse_MainName(GNodeList *mainList)
 		Punt("no target to make.");
 
 	Lst_Append(mainList, mainNode);
-	if (mainNode->type & OP_DOUBLEDEP)
-		Lst_AppendAll(mainList, &mainNode->cohorts);
+	if (mainNode->type & OP_DOUBLEDEP) {
+		size_t i;
+
+		for (i = 0; i < mainNode->cohorts.len; i++)
+			Lst_Append(mainList,
+			    GNodeVec_Get(&mainNode->cohorts, i));
+	}
 
 	Global_Append(".TARGETS", mainNode->name);
 }
@@ -0,0 +1,395 @@
+/* Child processes and pipes, using the Windows API; see proc.h */
+
+#include "make.h"
+#include "proc.h"
+
+/* Signaled when a child process exits. */
+static HANDLE wakeEvent = NULL;
+
+/* Called by the thread pool when a child process has exited. */
+static VOID CALLBACK
+ProcExited(PVOID arg MAKE_ATTR_UNUSED, BOOLEAN timedOut MAKE_ATTR_UNUSED)
+{
+	SetEvent(wakeEvent);
+}
+
+/*
+ * Completion routine for the reads on the pipes.  It runs during the
+ * alertable wait in Proc_WaitForEvent, and its only purpose is to end that
+ * wait; the result is picked up by ProcPipe_ReadResult.  It must not touch
+ * the pipe, since the routine of a canceled read may run after the pipe
+ * has already been reused.
+ */
+static VOID CALLBACK
+ProcPipeReadDone(DWORD err MAKE_ATTR_UNUSED, DWORD nread MAKE_ATTR_UNUSED,
+		 LPOVERLAPPED ov MAKE_ATTR_UNUSED)
+{
+}
+
+bool
+Proc_Init(void)
+{
+	wakeEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+	return wakeEvent != NULL;
+}
+
+void
+Proc_End(void)
+{
+#ifdef CLEANUP
+	if (wakeEvent != NULL)
+		CloseHandle(wakeEvent);
+#endif
+}
+
+const char *
+Proc_Error(void)
+{
+	return strerr(GetLastError());
+}
+
+/*
+ * Start the program with the command line.  The child gets the environment
+ * block 'env' or, if it is NULL, the environment of make.  The streams
+ * selected by 'redirect' go to the write end of the pipe, the others are
+ * shared with make.  With PROC_SUSPENDED, the child does not run before
+ * Proc_Resume.
+ */
+static bool
+ProcCreate(Proc *proc, const char *program, char *cmdline, const char *env,
+	   ProcPipe *pp, ProcRedirect redirect)
+{
+	STARTUPINFOA si = {sizeof si, 0};
+	PROCESS_INFORMATION pi;
+
+	if (redirect & (PROC_STDOUT | PROC_STDERR)) {
+		si.dwFlags = STARTF_USESTDHANDLES;
+		si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+		si.hStdOutput = redirect & PROC_STDOUT ? pp->wr :
+			GetStdHandle(STD_OUTPUT_HANDLE);
+		si.hStdError = redirect & PROC_STDERR ? pp->wr :
+			GetStdHandle(STD_ERROR_HANDLE);
+	}
+
+	if (CreateProcessA(program, cmdline, NULL, NULL,
+		(redirect & (PROC_STDOUT | PROC_STDERR)) != 0,
+		redirect & PROC_SUSPENDED ? CREATE_SUSPENDED : 0,
+		(LPVOID)env, NULL, &si, &pi) == 0)
+		return false;
+
+	proc->handle = pi.hProcess;
+	proc->pid = pi.dwProcessId;
+	proc->thread = NULL;
+	if (redirect & PROC_SUSPENDED)
+		proc->thread = pi.hThread;
+	else
+		CloseHandle(pi.hThread);
+
+	if (RegisterWaitForSingleObject(&proc->exitWait, proc->handle,
+		ProcExited, NULL, INFINITE, WT_EXECUTEONLYONCE) == 0) {
+		DWORD err = GetLastError();
+
+		TerminateProcess(proc->handle, 1);
+		if (proc->thread != NULL)
+			CloseHandle(proc->thread);
+		CloseHandle(proc->handle);
+		SetLastError(err);
+		return false;
+	}
+	return true;
+}
+
+/* Run cmd in the given shell, see ProcCreate. */
+bool
+Proc_Spawn(Proc *proc, const char *shell, const char *args, const char *cmd,
+	   const char *env, ProcPipe *pp, ProcRedirect redirect)
+{
+	char *cmdline;
+	bool ok;
+
+	cmdline = bmake_malloc((size_t)
+		snprintf(NULL, 0, cmdFmt, shell, args, cmd) + 1);
+	sprintf(cmdline, cmdFmt, shell, args, cmd);
+	ok = ProcCreate(proc, shell, cmdline, env, pp, redirect);
+	free(cmdline);
+	return ok;
+}
+
+/*
+ * Run the program without a shell, see ProcCreate.  cmd is the command
+ * line for the program, including its name.
+ */
+bool
+Proc_SpawnDirect(Proc *proc, const char *program, const char *cmd,
+		 const char *env, ProcPipe *pp, ProcRedirect redirect)
+{
+	char *cmdline = bmake_strdup(cmd);
+	bool ok = ProcCreate(proc, program, cmdline, env, pp, redirect);
+
+	free(cmdline);
+	return ok;
+}
+
+/* Let a child that was started with PROC_SUSPENDED run. */
+void
+Proc_Resume(Proc *proc)
+{
+	if (proc->thread == NULL)
+		return;
+	ResumeThread(proc->thread);
+	CloseHandle(proc->thread);
+	proc->thread = NULL;
+}
+
+/*
+ * See whether the process has exited, waiting for it if 'block' is set.
+ * Return PROC_DONE and its exit status if it has.
+ */
+ProcResult
+Proc_Wait(Proc *proc, bool block, ProcStatus *out_status)
+{
+	DWORD status;
+
+	switch (WaitForSingleObject(proc->handle, block ? INFINITE : 0)) {
+	case WAIT_OBJECT_0:
+		if (GetExitCodeProcess(proc->handle, &status) == 0)
+			return PROC_ERROR;
+		*out_status = status;
+		return PROC_DONE;
+	case WAIT_TIMEOUT:
+		return PROC_AGAIN;
+	default:
+		return PROC_ERROR;
+	}
+}
+
+void
+Proc_Kill(Proc *proc)
+{
+	(void)TerminateProcess(proc->handle, 0);
+}
+
+/* Release the resources of a process that has exited. */
+void
+Proc_Close(Proc *proc)
+{
+	if (proc->exitWait != NULL)
+		(void)UnregisterWaitEx(proc->exitWait, INVALID_HANDLE_VALUE);
+	proc->exitWait = NULL;
+	CloseHandle(proc->handle);
+	proc->handle = NULL;
+}
+
+/*
+ * Sleep until a child process exits, a pending read completes or the
+ * timeout in milliseconds expires; a negative timeout never expires.
+ *
+ * Exits are signaled through wakeEvent by the thread pool, completed reads
+ * through their completion routine, which only runs during an alertable
+ * wait.  Neither is limited in the number of processes.
+ *
+ * Return PROC_AGAIN on timeout.  Wakeups may be spurious.
+ */
+ProcResult
+Proc_WaitForEvent(long timeout)
+{
+	switch (WaitForSingleObjectEx(wakeEvent,
+		timeout < 0 ? INFINITE : (DWORD)timeout, TRUE)) {
+	case WAIT_OBJECT_0:
+	case WAIT_IO_COMPLETION:
+		return PROC_DONE;
+	case WAIT_TIMEOUT:
+		return PROC_AGAIN;
+	default:
+		return PROC_ERROR;
+	}
+}
+
+/*
+ * Create a pipe for collecting the output of a child process.
+ *
+ * The read end is a named pipe opened for overlapped I/O, which lets
+ * Proc_WaitForEvent sleep until a child produces output, instead of
+ * peeking at every pipe over and over.  Anonymous pipes cannot do that.
+ */
+bool
+ProcPipe_Open(ProcPipe *pp)
+{
+	static unsigned int pipeNum = 0;
+	char name[64];
+	SECURITY_ATTRIBUTES sa = {sizeof sa, NULL, TRUE};
+
+	snprintf(name, sizeof name, "\\\\.\\pipe\\bmake.%lu.%u",
+		myPid, pipeNum++);
+
+	memset(pp, 0, sizeof *pp);
+	pp->rd = CreateNamedPipeA(name, PIPE_ACCESS_INBOUND |
+			FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+		PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+		1, PIPESZ, PIPESZ, 0, NULL);
+	if (pp->rd == INVALID_HANDLE_VALUE)
+		return false;
+
+	/* Only the write end is inherited by the child. */
+	pp->wr = CreateFileA(name, GENERIC_WRITE, 0, &sa, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (pp->wr == INVALID_HANDLE_VALUE) {
+		DWORD err = GetLastError();
+
+		CloseHandle(pp->rd);
+		SetLastError(err);
+		return false;
+	}
+	return true;
+}
+
+void
+ProcPipe_Close(ProcPipe *pp)
+{
+	DWORD nRead;
+
+	if (pp->pending) {
+		CancelIoEx(pp->rd, &pp->ov);
+		(void)GetOverlappedResult(pp->rd, &pp->ov, &nRead, TRUE);
+		pp->pending = false;
+	}
+
+	CloseHandle(pp->wr);
+	pp->wr = NULL;
+
+	CloseHandle(pp->rd);
+	pp->rd = NULL;
+}
+
+/* Start reading the next chunk of output from the pipe into buf. */
+bool
+ProcPipe_StartRead(ProcPipe *pp, char *buf, size_t bufsize)
+{
+	pp->buf = buf;
+	pp->bufsize = bufsize;
+
+	memset(&pp->ov, 0, sizeof pp->ov);
+	if (ReadFileEx(pp->rd, buf, (DWORD)bufsize, &pp->ov,
+		ProcPipeReadDone) != 0) {
+		pp->pending = true;
+		return true;
+	}
+
+	/* End-of-file is reported by ProcPipe_ReadResult. */
+	pp->pending = false;
+	return GetLastError() == ERROR_BROKEN_PIPE;
+}
+
+/*
+ * See whether the pending read has completed.
+ *
+ * If 'finish' is set, the child has exited, so anything it has written is
+ * already in the pipe.  A read that is still pending will therefore never
+ * get any data and is canceled.
+ *
+ * Return PROC_AGAIN if there is no data yet, otherwise store the number of
+ * bytes read in out_nr, where 0 means end-of-file.
+ */
+ProcResult
+ProcPipe_ReadResult(ProcPipe *pp, bool finish, size_t *out_nr)
+{
+	DWORD nRead, err;
+
+	if (!pp->pending) {
+		*out_nr = 0;
+		return PROC_DONE;
+	}
+
+	if (GetOverlappedResult(pp->rd, &pp->ov, &nRead, FALSE) == 0) {
+		if ((err = GetLastError()) == ERROR_IO_INCOMPLETE) {
+			if (!finish)
+				return PROC_AGAIN;
+
+			/*
+			 * The read may still complete between the check and
+			 * the cancellation, so wait for its final result.
+			 */
+			CancelIoEx(pp->rd, &pp->ov);
+			if (GetOverlappedResult(pp->rd, &pp->ov, &nRead,
+				TRUE) == 0)
+				err = GetLastError();
+			else
+				err = ERROR_SUCCESS;
+		}
+		if (err != ERROR_SUCCESS) {
+			pp->pending = false;
+			if (err != ERROR_BROKEN_PIPE &&
+				err != ERROR_OPERATION_ABORTED) {
+				SetLastError(err);
+				return PROC_ERROR;
+			}
+			*out_nr = 0;
+			return PROC_DONE;
+		}
+	}
+
+	pp->pending = false;
+	if (nRead == 0) {
+		/* Someone wrote 0 bytes, which is not end-of-file. */
+		if (!ProcPipe_StartRead(pp, pp->buf, pp->bufsize))
+			return PROC_ERROR;
+		return ProcPipe_ReadResult(pp, finish, out_nr);
+	}
+	*out_nr = (size_t)nRead;
+	return PROC_DONE;
+}
+
+/*
+ * Create the pipe through which the job tokens are passed around.  Both
+ * ends are inherited by the sub-makes, see ProcPipe_Format.
+ *
+ * The read end is non-blocking; we might lose the race for the token when
+ * a new one becomes available, so the read from the pipe should not block.
+ */
+bool
+ProcPipe_OpenTokens(ProcPipe *pp)
+{
+	SECURITY_ATTRIBUTES sa = {sizeof sa, NULL, TRUE};
+
+	memset(pp, 0, sizeof *pp);
+	if (CreatePipe(&pp->rd, &pp->wr, &sa, PIPESZ) == 0)
+		return false;
+	return SetNamedPipeHandleState(pp->rd, &(DWORD){PIPE_NOWAIT},
+		NULL, NULL) != 0;
+}
+
+/* Take a token from the pipe, without waiting for one. */
+ProcResult
+ProcPipe_TryReadToken(ProcPipe *pp, char *out_tok)
+{
+	DWORD nRead;
+
+	if (ReadFile(pp->rd, out_tok, 1, &nRead, NULL) != 0)
+		return PROC_DONE;
+	return GetLastError() == ERROR_NO_DATA ? PROC_AGAIN : PROC_ERROR;
+}
+
+bool
+ProcPipe_WriteToken(ProcPipe *pp, char tok)
+{
+	DWORD nWritten;
+
+	return WriteFile(pp->wr, &tok, 1, &nWritten, NULL) != 0;
+}
+
+/* Describe the token pipe for the -J option of the sub-makes. */
+void
+ProcPipe_Format(const ProcPipe *pp, char *buf, size_t bufsize)
+{
+	snprintf(buf, bufsize, "%p,%p", pp->rd, pp->wr);
+}
+
+/* Parse the argument of the -J option. */
+bool
+ProcPipe_Parse(ProcPipe *pp, const char *str)
+{
+	char end;
+
+	memset(pp, 0, sizeof *pp);
+	return sscanf(str, "%p,%p%c", &pp->rd, &pp->wr, &end) == 2;
+}
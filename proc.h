@@ -0,0 +1,125 @@
+/* Child processes and the pipes used to talk to them */
+
+/*
+ * The job module, compat mode and Cmd_Exec start their processes only
+ * through this interface.  proc.c implements it using the Windows API,
+ * proc_posix.c using posix_spawn, pipe, poll and a SIGCHLD self-pipe.
+ * Only proc.c is part of make; proc_posix.c is only built for the smoke
+ * test in bench/proc-test.c and does not support PROC_SUSPENDED.
+ *
+ * None of the functions print anything; on failure they return false or
+ * PROC_ERROR and Proc_Error describes what went wrong.
+ *
+ * The environment of a child is either that of make or a block of
+ * "name=value" strings, each ending with a null character, followed by
+ * an empty string, as returned by Var_Environment.
+ *
+ * All callers of Proc_WaitForEvent share the same wakeups, so a wakeup may
+ * be consumed by a caller that waits for other processes, for example
+ * Cmd_Finish while jobs are running.  Callers must therefore look at their
+ * processes and pipes before each wait, not only after it.
+ */
+
+#ifndef MAKE_PROC_H
+#define MAKE_PROC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+# include <winsock2.h>
+# undef SP_ERROR
+# undef SearchPath
+# undef ERROR
+#else
+# include <sys/types.h>
+#endif
+
+#ifndef MAKE_ATTR_USE
+# define MAKE_ATTR_USE
+#endif
+
+/*
+ * Format for executing shells.
+ * "shellPath" args cmd
+ */
+#define cmdFmt "\"%s\" %s %s"
+
+/* The exit status of a process. */
+typedef unsigned long ProcStatus;
+
+typedef enum ProcResult {
+	PROC_ERROR = -1,	/* see Proc_Error */
+	PROC_AGAIN,		/* nothing happened yet */
+	PROC_DONE		/* the process exited, or the read completed */
+} ProcResult;
+
+/*
+ * Which of the standard streams of the child go to the pipe, and whether
+ * the child waits for Proc_Resume before it runs.
+ */
+typedef enum ProcRedirect {
+	PROC_INHERIT	= 0,
+	PROC_STDOUT	= 1 << 0,
+	PROC_STDERR	= 1 << 1,
+	PROC_SUSPENDED	= 1 << 2
+} ProcRedirect;
+
+/*
+ * A pipe from a child process to make.  Only the write end is inherited
+ * by the child.  Reads on the read end are asynchronous; a pending read
+ * wakes up Proc_WaitForEvent when it completes.
+ */
+typedef struct ProcPipe {
+#ifdef _WIN32
+	HANDLE rd;
+	HANDLE wr;
+	OVERLAPPED ov;		/* The read that is pending on rd */
+#else
+	int rd;
+	int wr;
+#endif
+	char *buf;		/* Where the pending read goes */
+	size_t bufsize;
+	bool pending;		/* Whether a read is pending */
+} ProcPipe;
+
+typedef struct Proc {
+	unsigned long pid;
+#ifdef _WIN32
+	HANDLE handle;
+	HANDLE thread;		/* Only until Proc_Resume */
+	HANDLE exitWait;	/* Wakes up Proc_WaitForEvent on exit */
+#else
+	bool exited;
+	ProcStatus status;
+#endif
+} Proc;
+
+bool Proc_Init(void);
+void Proc_End(void);
+const char *Proc_Error(void);
+
+bool MAKE_ATTR_USE Proc_Spawn(Proc *, const char *, const char *,
+			      const char *, const char *, ProcPipe *,
+			      ProcRedirect);
+bool MAKE_ATTR_USE Proc_SpawnDirect(Proc *, const char *, const char *,
+				    const char *, ProcPipe *, ProcRedirect);
+void Proc_Resume(Proc *);
+ProcResult MAKE_ATTR_USE Proc_Wait(Proc *, bool, ProcStatus *);
+void Proc_Kill(Proc *);
+void Proc_Close(Proc *);
+ProcResult MAKE_ATTR_USE Proc_WaitForEvent(long);
+
+bool MAKE_ATTR_USE ProcPipe_Open(ProcPipe *);
+void ProcPipe_Close(ProcPipe *);
+bool MAKE_ATTR_USE ProcPipe_StartRead(ProcPipe *, char *, size_t);
+ProcResult MAKE_ATTR_USE ProcPipe_ReadResult(ProcPipe *, bool, size_t *);
+
+bool MAKE_ATTR_USE ProcPipe_OpenTokens(ProcPipe *);
+ProcResult MAKE_ATTR_USE ProcPipe_TryReadToken(ProcPipe *, char *);
+bool MAKE_ATTR_USE ProcPipe_WriteToken(ProcPipe *, char);
+void ProcPipe_Format(const ProcPipe *, char *, size_t);
+bool MAKE_ATTR_USE ProcPipe_Parse(ProcPipe *, const char *);
+
+#endif
@@ -0,0 +1,504 @@
+/* Child processes and pipes, using POSIX interfaces; see proc.h */
+
+/*
+ * This file only depends on proc.h and the C library, so that the process
+ * handling can be built and exercised on POSIX systems, see
+ * bench/proc-test.c.  Make itself does not use it yet: job.c, compat.c and
+ * main.c still use the Windows API directly for other things, so make
+ * only builds on Windows, with proc.c.
+ *
+ * PROC_SUSPENDED is not supported, see ProcSpawnArgv.
+ *
+ * Children are started with posix_spawn.  The SIGCHLD handler writes a
+ * byte to a self-pipe, so Proc_WaitForEvent can poll the self-pipe and
+ * the pipes with pending reads at the same time; the children are reaped
+ * by Proc_Wait.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "proc.h"
+
+extern char **environ;
+
+/* Written to by the SIGCHLD handler. */
+static int sigPipe[2] = { -1, -1 };
+
+/* The pipes that have a read pending, for Proc_WaitForEvent. */
+static ProcPipe **pendingPipes = NULL;
+static size_t numPending = 0;
+static size_t capPending = 0;
+
+static void
+ProcCatchChild(int signo)
+{
+	int saved_errno = errno;
+
+	(void)signo;
+	(void)write(sigPipe[1], "", 1);
+	errno = saved_errno;
+}
+
+static bool
+ProcSetFlags(int fd, int fdflags, int flflags)
+{
+	int fl;
+
+	if (fdflags != 0 &&
+	    ((fl = fcntl(fd, F_GETFD)) == -1 ||
+	     fcntl(fd, F_SETFD, fl | fdflags) == -1))
+		return false;
+	if (flflags != 0 &&
+	    ((fl = fcntl(fd, F_GETFL)) == -1 ||
+	     fcntl(fd, F_SETFL, fl | flflags) == -1))
+		return false;
+	return true;
+}
+
+static bool
+ProcPipe_AddPending(ProcPipe *pp)
+{
+	if (numPending == capPending) {
+		size_t cap = capPending == 0 ? 16 : 2 * capPending;
+		ProcPipe **p = realloc(pendingPipes, cap * sizeof *p);
+
+		if (p == NULL)
+			return false;
+		pendingPipes = p;
+		capPending = cap;
+	}
+	pendingPipes[numPending++] = pp;
+	pp->pending = true;
+	return true;
+}
+
+static void
+ProcPipe_RemovePending(ProcPipe *pp)
+{
+	size_t i;
+
+	pp->pending = false;
+	for (i = 0; i < numPending; i++) {
+		if (pendingPipes[i] == pp) {
+			pendingPipes[i] = pendingPipes[--numPending];
+			return;
+		}
+	}
+}
+
+bool
+Proc_Init(void)
+{
+	struct sigaction sa;
+
+	if (pipe(sigPipe) == -1)
+		return false;
+	if (!ProcSetFlags(sigPipe[0], FD_CLOEXEC, O_NONBLOCK) ||
+	    !ProcSetFlags(sigPipe[1], FD_CLOEXEC, O_NONBLOCK))
+		return false;
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = ProcCatchChild;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	return sigaction(SIGCHLD, &sa, NULL) == 0;
+}
+
+void
+Proc_End(void)
+{
+#ifdef CLEANUP
+	(void)signal(SIGCHLD, SIG_DFL);
+	(void)close(sigPipe[0]);
+	(void)close(sigPipe[1]);
+	free(pendingPipes);
+#endif
+}
+
+const char *
+Proc_Error(void)
+{
+	return strerror(errno);
+}
+
+/*
+ * Start the program with the arguments in argv.  The child gets the
+ * environment block 'env' or, if it is NULL, the environment of make.
+ * The streams selected by 'redirect' go to the write end of the pipe, the
+ * others are shared with make.
+ *
+ * posix_spawn cannot start a child stopped.  Rather than letting the
+ * child run before the caller is ready for it, PROC_SUSPENDED fails with
+ * ENOTSUP.
+ */
+static bool
+ProcSpawnArgv(Proc *proc, const char *program, char **argv, const char *env,
+	      ProcPipe *pp, ProcRedirect redirect)
+{
+	posix_spawn_file_actions_t fa;
+	char **envp = environ;
+	const char *p;
+	size_t envc = 0;
+	pid_t pid;
+	int err;
+
+	if (redirect & PROC_SUSPENDED) {
+		errno = ENOTSUP;
+		return false;
+	}
+
+	if (env != NULL) {
+		for (p = env; *p != '\0'; p += strlen(p) + 1)
+			envc++;
+		if ((envp = malloc((envc + 1) * sizeof *envp)) == NULL)
+			return false;
+		envc = 0;
+		for (p = env; *p != '\0'; p += strlen(p) + 1)
+			envp[envc++] = (char *)p;
+		envp[envc] = NULL;
+	}
+
+	posix_spawn_file_actions_init(&fa);
+	if (redirect & PROC_STDOUT)
+		posix_spawn_file_actions_adddup2(&fa, pp->wr, STDOUT_FILENO);
+	if (redirect & PROC_STDERR)
+		posix_spawn_file_actions_adddup2(&fa, pp->wr, STDERR_FILENO);
+
+	err = posix_spawn(&pid, program, &fa, NULL, argv, envp);
+
+	posix_spawn_file_actions_destroy(&fa);
+	if (envp != environ)
+		free(envp);
+
+	if (err != 0) {
+		errno = err;
+		return false;
+	}
+
+	proc->pid = (unsigned long)pid;
+	proc->exited = false;
+	proc->status = 0;
+	return true;
+}
+
+/*
+ * Run cmd in the given shell, see ProcSpawnArgv.  The shell arguments are
+ * split at spaces, e.g. "-e -c".
+ */
+bool
+Proc_Spawn(Proc *proc, const char *shell, const char *args, const char *cmd,
+	   const char *env, ProcPipe *pp, ProcRedirect redirect)
+{
+	char *argsCopy, *arg, *save;
+	char **argv;
+	size_t argc = 0;
+	bool ok;
+
+	if ((argsCopy = strdup(args)) == NULL)
+		return false;
+	if ((argv = malloc((strlen(args) / 2 + 4) * sizeof *argv)) == NULL) {
+		free(argsCopy);
+		return false;
+	}
+
+	argv[argc++] = (char *)shell;
+	for (arg = strtok_r(argsCopy, " ", &save); arg != NULL;
+	     arg = strtok_r(NULL, " ", &save))
+		argv[argc++] = arg;
+	argv[argc++] = (char *)cmd;
+	argv[argc] = NULL;
+
+	ok = ProcSpawnArgv(proc, shell, argv, env, pp, redirect);
+	free(argv);
+	free(argsCopy);
+	return ok;
+}
+
+/*
+ * Run the program without a shell, see ProcSpawnArgv.  The caller has
+ * made sure that cmd contains no characters that are special to the
+ * shell, so it is split at spaces and tabs.
+ */
+bool
+Proc_SpawnDirect(Proc *proc, const char *program, const char *cmd,
+		 const char *env, ProcPipe *pp, ProcRedirect redirect)
+{
+	char *cmdCopy, *arg, *save;
+	char **argv;
+	size_t argc = 0;
+	bool ok;
+
+	if ((cmdCopy = strdup(cmd)) == NULL)
+		return false;
+	if ((argv = malloc((strlen(cmd) / 2 + 2) * sizeof *argv)) == NULL) {
+		free(cmdCopy);
+		return false;
+	}
+
+	for (arg = strtok_r(cmdCopy, " \t", &save); arg != NULL;
+	     arg = strtok_r(NULL, " \t", &save))
+		argv[argc++] = arg;
+	argv[argc] = NULL;
+
+	ok = ProcSpawnArgv(proc, program, argv, env, pp, redirect);
+	free(argv);
+	free(cmdCopy);
+	return ok;
+}
+
+/* Never called, since no process is started suspended. */
+void
+Proc_Resume(Proc *proc)
+{
+	(void)proc;
+}
+
+/*
+ * See whether the process has exited, waiting for it if 'block' is set.
+ * Return PROC_DONE and its exit status if it has.  A process that was
+ * killed by a signal gets the status that a shell would report.
+ */
+ProcResult
+Proc_Wait(Proc *proc, bool block, ProcStatus *out_status)
+{
+	pid_t pid;
+	int status;
+
+	while (!proc->exited) {
+		pid = waitpid((pid_t)proc->pid, &status, block ? 0 : WNOHANG);
+		if (pid == -1 && errno == EINTR)
+			continue;
+		if (pid == -1)
+			return PROC_ERROR;
+		if (pid == 0)
+			return PROC_AGAIN;
+
+		if (WIFEXITED(status))
+			proc->status = (ProcStatus)WEXITSTATUS(status);
+		else if (WIFSIGNALED(status))
+			proc->status = 128 + (ProcStatus)WTERMSIG(status);
+		else
+			continue;
+		proc->exited = true;
+	}
+
+	*out_status = proc->status;
+	return PROC_DONE;
+}
+
+void
+Proc_Kill(Proc *proc)
+{
+	if (!proc->exited)
+		(void)kill((pid_t)proc->pid, SIGTERM);
+}
+
+void
+Proc_Close(Proc *proc)
+{
+	proc->pid = 0;
+}
+
+/*
+ * Sleep until a child process exits, a pending read has data or the
+ * timeout in milliseconds expires; a negative timeout never expires.
+ *
+ * Return PROC_AGAIN on timeout.  Wakeups may be spurious.
+ */
+ProcResult
+Proc_WaitForEvent(long timeout)
+{
+	struct pollfd stackFds[64];
+	struct pollfd *fds = stackFds;
+	size_t nfds = numPending + 1, i;
+	char drain[64];
+	int n;
+
+	if (nfds > sizeof stackFds / sizeof stackFds[0] &&
+	    (fds = malloc(nfds * sizeof *fds)) == NULL)
+		return PROC_ERROR;
+
+	fds[0].fd = sigPipe[0];
+	fds[0].events = POLLIN;
+	for (i = 0; i < numPending; i++) {
+		fds[i + 1].fd = pendingPipes[i]->rd;
+		fds[i + 1].events = POLLIN;
+	}
+
+	n = poll(fds, (nfds_t)nfds, timeout < 0 ? -1 : (int)timeout);
+
+	if (fds != stackFds)
+		free(fds);
+
+	if (n == -1)
+		return errno == EINTR ? PROC_DONE : PROC_ERROR;
+	if (n == 0)
+		return PROC_AGAIN;
+
+	while (read(sigPipe[0], drain, sizeof drain) > 0)
+		continue;
+	return PROC_DONE;
+}
+
+/*
+ * Create a pipe for collecting the output of a child process.  Neither
+ * end is inherited on its own; Proc_Spawn duplicates the write end to
+ * the standard streams of the child.
+ */
+bool
+ProcPipe_Open(ProcPipe *pp)
+{
+	int fds[2];
+
+	memset(pp, 0, sizeof *pp);
+	if (pipe(fds) == -1)
+		return false;
+	pp->rd = fds[0];
+	pp->wr = fds[1];
+	if (!ProcSetFlags(pp->rd, FD_CLOEXEC, O_NONBLOCK) ||
+	    !ProcSetFlags(pp->wr, FD_CLOEXEC, 0)) {
+		int saved_errno = errno;
+
+		(void)close(pp->rd);
+		(void)close(pp->wr);
+		errno = saved_errno;
+		return false;
+	}
+	return true;
+}
+
+void
+ProcPipe_Close(ProcPipe *pp)
+{
+	if (pp->pending)
+		ProcPipe_RemovePending(pp);
+	(void)close(pp->wr);
+	pp->wr = -1;
+	(void)close(pp->rd);
+	pp->rd = -1;
+}
+
+/*
+ * Start reading the next chunk of output from the pipe into buf.  The
+ * actual read happens in ProcPipe_ReadResult, once poll says there is
+ * something to read.
+ */
+bool
+ProcPipe_StartRead(ProcPipe *pp, char *buf, size_t bufsize)
+{
+	pp->buf = buf;
+	pp->bufsize = bufsize;
+	return pp->pending || ProcPipe_AddPending(pp);
+}
+
+/*
+ * See whether there is data for the pending read.
+ *
+ * If 'finish' is set, the child has exited, so anything it has written is
+ * already in the pipe, and an empty pipe means end-of-file.
+ *
+ * Return PROC_AGAIN if there is no data yet, otherwise store the number of
+ * bytes read in out_nr, where 0 means end-of-file.
+ */
+ProcResult
+ProcPipe_ReadResult(ProcPipe *pp, bool finish, size_t *out_nr)
+{
+	ssize_t n;
+
+	if (!pp->pending) {
+		*out_nr = 0;
+		return PROC_DONE;
+	}
+
+	while ((n = read(pp->rd, pp->buf, pp->bufsize)) == -1 &&
+	       errno == EINTR)
+		continue;
+
+	if (n == -1) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return PROC_ERROR;
+		if (!finish)
+			return PROC_AGAIN;
+		n = 0;
+	}
+
+	ProcPipe_RemovePending(pp);
+	*out_nr = (size_t)n;
+	return PROC_DONE;
+}
+
+/*
+ * Create the pipe through which the job tokens are passed around.  Both
+ * ends are inherited by the sub-makes, see ProcPipe_Format.
+ *
+ * The read end is non-blocking; we might lose the race for the token when
+ * a new one becomes available, so the read from the pipe should not block.
+ */
+bool
+ProcPipe_OpenTokens(ProcPipe *pp)
+{
+	int fds[2];
+
+	memset(pp, 0, sizeof *pp);
+	if (pipe(fds) == -1)
+		return false;
+	pp->rd = fds[0];
+	pp->wr = fds[1];
+	return ProcSetFlags(pp->rd, 0, O_NONBLOCK);
+}
+
+/* Take a token from the pipe, without waiting for one. */
+ProcResult
+ProcPipe_TryReadToken(ProcPipe *pp, char *out_tok)
+{
+	ssize_t n;
+
+	while ((n = read(pp->rd, out_tok, 1)) == -1 && errno == EINTR)
+		continue;
+	if (n == 1)
+		return PROC_DONE;
+	if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return PROC_AGAIN;
+	if (n == 0)
+		errno = EPIPE;
+	return PROC_ERROR;
+}
+
+bool
+ProcPipe_WriteToken(ProcPipe *pp, char tok)
+{
+	ssize_t n;
+
+	while ((n = write(pp->wr, &tok, 1)) == -1 && errno == EINTR)
+		continue;
+	return n == 1;
+}
+
+/* Describe the token pipe for the -J option of the sub-makes. */
+void
+ProcPipe_Format(const ProcPipe *pp, char *buf, size_t bufsize)
+{
+	snprintf(buf, bufsize, "%d,%d", pp->rd, pp->wr);
+}
+
+/* Parse the argument of the -J option. */
+bool
+ProcPipe_Parse(ProcPipe *pp, const char *str)
+{
+	char end;
+
+	memset(pp, 0, sizeof *pp);
+	if (sscanf(str, "%d,%d%c", &pp->rd, &pp->wr, &end) != 2)
+		return false;
+	/* Make sure the descriptors are actually open. */
+	return fcntl(pp->rd, F_GETFD) != -1 && fcntl(pp->wr, F_GETFD) != -1;
+}
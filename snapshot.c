@@ -0,0 +1,621 @@
+/* The state after reading the makefiles, see .MAKE.SNAPSHOT */
+
+/*
+ * Interface:
+ *	Snapshot_Load	If .MAKE.SNAPSHOT names the snapshot of an earlier
+ *			run that is still valid, restore the state from it
+ *			instead of reading the makefiles.
+ *
+ *	Snapshot_Save	Write the state after reading the makefiles to the
+ *			file named by .MAKE.SNAPSHOT.
+ *
+ *	Snapshot_Skip	Do not save the snapshot of this run.
+ *
+ *	Snapshot_AddDep	Do not use the snapshot once the file changes.
+ *
+ *	Snapshot_PutNum, Snapshot_PutStr, Snapshot_GetNum, Snapshot_GetIndex,
+ *	Snapshot_GetStr
+ *			Write and read the parts of the state, for the
+ *			modules that own them.
+ *
+ * Reading sys.mk and a large framework of makefiles can take most of the
+ * time of a run that has little to do.  While .MAKE.SNAPSHOT names a file,
+ * either on the command line or in the environment, the state after
+ * reading the makefiles is saved to that file: the variables, the
+ * environment, the targets with their dependencies and commands, the
+ * suffixes and transformation rules, and the search paths.  The next run
+ * with the same arguments, environment and directories restores the state
+ * from the file instead of reading the makefiles again, as long as none of
+ * the makefiles in .MAKE.MAKEFILES changed, no missing optional makefile
+ * appeared, and none of the files in .MAKE.SNAPSHOT.DEPS changed.  The
+ * .depend file is still read in each run.
+ *
+ * Like with .MAKE.CMDCACHE, the output of '!=' assignments and the results
+ * of exists() and wildcards are taken from the snapshot, so the files they
+ * depend on belong in .MAKE.SNAPSHOT.DEPS:
+ *
+ *	make .MAKE.SNAPSHOT=.snapshot \
+ *	    .MAKE.SNAPSHOT.DEPS='${.CURDIR}/.git/HEAD'
+ *
+ * A run is not saved if reading the makefiles printed any warning or
+ * message, if the makefile came from standard input, or if the makefiles
+ * use .MAKEFLAGS, .MFLAGS, .SHELL or .OBJDIR, whose effects are not part
+ * of the snapshot.
+ *
+ * The file is relative to .OBJDIR.  It has the following format:
+ *
+ *	bmake snapshot 1
+ *	<key>
+ *	<number of dependencies>
+ *	<modification time> <path>	for each dependency
+ *	<state>
+ *	end
+ *
+ * where the key is the hash of the arguments, the environment and the
+ * directories.  Numbers are written in decimal, followed by a space.
+ * Strings are written as their length, a colon, the bytes and a newline.
+ */
+
+#include <sys/stat.h>
+
+#include "make.h"
+#include "dir.h"
+
+#define SNAPSHOT_MAGIC "bmake snapshot 1\n"
+#define SNAPSHOT_END "end\n"
+
+static char *snapshotFile = NULL; /* absolute; NULL if there is none */
+static char *snapshotKey = NULL;
+static const char *skipReason = NULL; /* why not to save the snapshot */
+static HashSet snapshotDeps;	/* from Snapshot_AddDep */
+
+static Buffer out;		/* the snapshot being written */
+static HANDLE snapshotMap = NULL;
+static const char *snapshotData = NULL;
+static const char *in;		/* the position in the mapped snapshot */
+static const char *inEnd;
+
+static time_t
+Snapshot_MTime(const char *path)
+{
+	struct stat st;
+
+	return stat(path, &st) == 0 ? st.st_mtime : (time_t)-1;
+}
+
+static ULONGLONG
+Snapshot_Hash(ULONGLONG h, const char *str, size_t len)
+{
+	while (len-- > 0)
+		h = (h ^ (unsigned char)*str++) * 0x100000001b3ULL;
+	return h;
+}
+
+/*
+ * Hash the arguments, except for the job pipe given by '-J', which is
+ * different in each run.
+ */
+static ULONGLONG
+Snapshot_HashArgs(ULONGLONG h, char **args, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (strcmp(args[i], "-J") == 0) {
+			i++;
+			continue;
+		}
+		if (strncmp(args[i], "-J", 2) == 0)
+			continue;
+		h = Snapshot_Hash(h, args[i], strlen(args[i]) + 1);
+	}
+	return h;
+}
+
+/*
+ * Build the key of the snapshot, from the inputs of reading the makefiles
+ * other than the files: the path of make, the arguments, the environment,
+ * and the current and object directories.  The variables in the environment
+ * are hashed independently of their order.
+ */
+static char *
+Snapshot_Key(int argc, char **argv)
+{
+	const ULONGLONG basis = 0xcbf29ce484222325ULL;
+	ULONGLONG h = basis, envSum = 0;
+	FStr objdir = Var_Value(SCOPE_GLOBAL, ".OBJDIR");
+	FStr make = Var_Value(SCOPE_GLOBAL, ".MAKE");
+	char hex[17];
+	char *env, *p;
+
+	h = Snapshot_Hash(h, SNAPSHOT_MAGIC, sizeof SNAPSHOT_MAGIC);
+	h = Snapshot_Hash(h, MAKE_VERSION, sizeof MAKE_VERSION);
+	h = Snapshot_Hash(h, curdir, strlen(curdir) + 1);
+	if (objdir.str != NULL)
+		h = Snapshot_Hash(h, objdir.str, strlen(objdir.str) + 1);
+	FStr_Done(&objdir);
+	if (make.str != NULL)
+		h = Snapshot_Hash(h, make.str, strlen(make.str) + 1);
+	FStr_Done(&make);
+	h = Snapshot_HashArgs(h, argv + 1, (size_t)(argc - 1));
+
+	if ((env = GetEnvironmentStringsA()) != NULL) {
+		for (p = env; *p != '\0'; p += strlen(p) + 1) {
+			if (p[0] == '=')
+				continue;
+			if (strncmp(p, "MAKEFLAGS=", 10) == 0) {
+				Words words = Str_Words(p + 10, false);
+				envSum += Snapshot_HashArgs(
+				    Snapshot_Hash(basis, p, 10),
+				    words.words, words.len);
+				Words_Free(words);
+			} else
+				envSum += Snapshot_Hash(basis, p, strlen(p));
+		}
+		FreeEnvironmentStringsA(env);
+	}
+	h = Snapshot_Hash(h, (const char *)&envSum, sizeof envSum);
+
+	snprintf(hex, sizeof hex, "%016llx", h);
+	return bmake_strdup(hex);
+}
+
+void
+Snapshot_PutNum(unsigned long long n)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof buf, "%llu ", n);
+	Buf_AddStr(&out, buf);
+}
+
+void
+Snapshot_PutStr(const char *str)
+{
+	size_t len = strlen(str);
+	char buf[32];
+
+	snprintf(buf, sizeof buf, "%zu:", len);
+	Buf_AddStr(&out, buf);
+	Buf_AddBytes(&out, str, len);
+	Buf_AddByte(&out, '\n');
+}
+
+static void MAKE_ATTR_DEAD
+Snapshot_Malformed(void)
+{
+	Punt("Malformed snapshot %s", snapshotFile);
+}
+
+static unsigned long long
+Snapshot_ParseNum(char sep)
+{
+	const char *p = in;
+	unsigned long long n = 0;
+
+	while (p < inEnd && ch_isdigit(*p))
+		n = n * 10 + (unsigned)(*p++ - '0');
+	if (p == in || p == inEnd || *p != sep)
+		Snapshot_Malformed();
+	in = p + 1;
+	return n;
+}
+
+unsigned long long
+Snapshot_GetNum(void)
+{
+	return Snapshot_ParseNum(' ');
+}
+
+/* Read a number that must be less than the given limit. */
+size_t
+Snapshot_GetIndex(size_t limit)
+{
+	unsigned long long n = Snapshot_GetNum();
+
+	if (n >= limit)
+		Snapshot_Malformed();
+	return (size_t)n;
+}
+
+char *
+Snapshot_GetStr(void)
+{
+	unsigned long long len = Snapshot_ParseNum(':');
+	char *str;
+
+	if (len >= (unsigned long long)(inEnd - in) || in[len] != '\n')
+		Snapshot_Malformed();
+	str = bmake_strsedup(in, in + len);
+	in += len + 1;
+	return str;
+}
+
+static void
+Snapshot_Unmap(void)
+{
+	if (snapshotData != NULL)
+		UnmapViewOfFile(snapshotData);
+	snapshotData = NULL;
+	if (snapshotMap != NULL)
+		CloseHandle(snapshotMap);
+	snapshotMap = NULL;
+}
+
+static bool
+Snapshot_Map(void)
+{
+	HANDLE fh;
+	LARGE_INTEGER size;
+
+	fh = CreateFileA(snapshotFile, GENERIC_READ,
+	    FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+	    FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fh == INVALID_HANDLE_VALUE) {
+		DEBUG1(PARSE, "Snapshot %s does not exist yet\n",
+		    snapshotFile);
+		return false;
+	}
+
+	/* An empty file cannot be mapped. */
+	if (GetFileSizeEx(fh, &size) != 0 && size.QuadPart > 0 &&
+	    size.QuadPart < 1024 * 1024 * 1024 &&
+	    (snapshotMap = CreateFileMappingA(fh, NULL, PAGE_READONLY,
+		0, 0, NULL)) != NULL)
+		snapshotData = MapViewOfFile(snapshotMap, FILE_MAP_READ,
+		    0, 0, 0);
+	CloseHandle(fh);
+
+	if (snapshotData == NULL) {
+		DEBUG1(PARSE, "Cannot map snapshot %s\n", snapshotFile);
+		Snapshot_Unmap();
+		return false;
+	}
+	in = snapshotData;
+	inEnd = snapshotData + size.QuadPart;
+	return true;
+}
+
+/*
+ * Check the magic and the end of the snapshot, then whether it was made
+ * from the same inputs and none of its dependencies changed.
+ */
+static bool
+Snapshot_IsValid(void)
+{
+	size_t magicLen = sizeof SNAPSHOT_MAGIC - 1;
+	size_t endLen = sizeof SNAPSHOT_END - 1;
+	unsigned long long n;
+	char *key;
+	bool same;
+
+	if ((size_t)(inEnd - in) < magicLen + endLen ||
+	    memcmp(in, SNAPSHOT_MAGIC, magicLen) != 0 ||
+	    memcmp(inEnd - endLen, SNAPSHOT_END, endLen) != 0) {
+		DEBUG1(PARSE, "Ignoring malformed snapshot %s\n",
+		    snapshotFile);
+		return false;
+	}
+	in += magicLen;
+	inEnd -= endLen;
+
+	key = Snapshot_GetStr();
+	same = strcmp(key, snapshotKey) == 0;
+	free(key);
+	if (!same) {
+		DEBUG1(PARSE, "Snapshot %s is for other arguments, "
+			      "environment or directories\n", snapshotFile);
+		return false;
+	}
+
+	for (n = Snapshot_GetNum(); n > 0; n--) {
+		time_t mtime = (time_t)(long long)Snapshot_GetNum();
+		char *path = Snapshot_GetStr();
+		bool changed = Snapshot_MTime(path) != mtime;
+
+		if (changed)
+			DEBUG2(PARSE,
+			    "Snapshot %s is out of date: %s changed\n",
+			    snapshotFile, path);
+		free(path);
+		if (changed)
+			return false;
+	}
+	return true;
+}
+
+static bool
+IsVolatileEnv(const char *env)
+{
+	return env[0] == '=' || strncmp(env, "MAKEFLAGS=", 10) == 0;
+}
+
+/*
+ * Save the environment, except for MAKEFLAGS, which contains the job pipe
+ * of this run and is exported again before making the targets anyway.
+ */
+static void
+Snapshot_PutEnv(void)
+{
+	char *env, *p;
+	size_t n = 0;
+
+	if ((env = GetEnvironmentStringsA()) == NULL) {
+		Snapshot_PutNum(0);
+		return;
+	}
+	for (p = env; *p != '\0'; p += strlen(p) + 1)
+		if (!IsVolatileEnv(p))
+			n++;
+	Snapshot_PutNum(n);
+	for (p = env; *p != '\0'; p += strlen(p) + 1)
+		if (!IsVolatileEnv(p))
+			Snapshot_PutStr(p);
+	FreeEnvironmentStringsA(env);
+}
+
+static void
+Snapshot_RestoreEnv(void)
+{
+	HashSet names;
+	unsigned long long n;
+	char *env, *p;
+
+	HashSet_Init(&names);
+	for (n = Snapshot_GetNum(); n > 0; n--) {
+		char *var = Snapshot_GetStr();
+		char *eq = strchr(var + 1, '=');
+
+		if (eq == NULL)
+			Snapshot_Malformed();
+		*eq = '\0';
+		(void)HashSet_Add(&names, var);
+		setenv(var, eq + 1, 1);
+		free(var);
+	}
+
+	/* The block is a copy, so the environment can change meanwhile. */
+	if ((env = GetEnvironmentStringsA()) != NULL) {
+		for (p = env; *p != '\0'; p += strlen(p) + 1) {
+			char *name;
+
+			if (IsVolatileEnv(p) || strchr(p, '=') == NULL)
+				continue;
+			name = bmake_strsedup(p, strchr(p, '='));
+			if (!HashSet_Contains(&names, name))
+				unsetenv(name);
+			free(name);
+		}
+		FreeEnvironmentStringsA(env);
+	}
+	HashSet_Done(&names);
+}
+
+static void
+Snapshot_PutState(void)
+{
+	StringListNode *ln;
+	size_t n = 0;
+
+	Snapshot_PutNum(allPrecious);
+	Snapshot_PutNum(deleteOnError);
+	Snapshot_PutNum(opts.ignoreErrors);
+	Snapshot_PutNum(opts.silent);
+	Snapshot_PutNum(opts.compatMake);
+	Snapshot_PutNum((unsigned)opts.maxJobs);
+	Snapshot_PutNum(posix_state);
+	for (ln = opts.create.first; ln != NULL; ln = ln->next)
+		n++;
+	Snapshot_PutNum(n);
+	for (ln = opts.create.first; ln != NULL; ln = ln->next)
+		Snapshot_PutStr(ln->datum);
+
+	Snapshot_PutEnv();
+	Var_SaveSnapshot();
+	SearchPath_SaveSnapshot(&dirSearchPath);
+	SearchPath_SaveSnapshot(sysIncPath);
+	Targ_SaveSnapshot();
+	Suff_SaveSnapshot();
+	Targ_SnapshotDone();
+}
+
+/* Restore the state in the same order as Snapshot_PutState saved it. */
+static void
+Snapshot_Restore(void)
+{
+	unsigned long long n;
+
+	allPrecious = Snapshot_GetNum() != 0;
+	deleteOnError = Snapshot_GetNum() != 0;
+	opts.ignoreErrors = Snapshot_GetNum() != 0;
+	opts.silent = Snapshot_GetNum() != 0;
+	opts.compatMake = Snapshot_GetNum() != 0;
+	opts.maxJobs = (int)Snapshot_GetNum();
+	posix_state = Snapshot_GetIndex(PS_TOO_LATE + 1);
+	Lst_DoneFree(&opts.create);
+	Lst_Init(&opts.create);
+	for (n = Snapshot_GetNum(); n > 0; n--)
+		Lst_Append(&opts.create, Snapshot_GetStr());
+
+	Snapshot_RestoreEnv();
+	Var_RestoreSnapshot();
+	/* Before the search paths, which may use the directory cache. */
+	Parse_RedoSpecials();
+	SearchPath_RestoreSnapshot(&dirSearchPath);
+	Dir_SetPATH();
+	SearchPath_RestoreSnapshot(sysIncPath);
+	Dir_SetSYSPATH();
+	Targ_RestoreSnapshot();
+	Suff_RestoreSnapshot();
+	Targ_SnapshotDone();
+
+	if (in != inEnd)
+		Snapshot_Malformed();
+}
+
+static void
+Snapshot_Done(void)
+{
+	free(snapshotFile);
+	snapshotFile = NULL;
+	free(snapshotKey);
+	snapshotKey = NULL;
+	HashSet_Done(&snapshotDeps);
+}
+
+/*
+ * If .MAKE.SNAPSHOT names a file with a valid snapshot, restore the state
+ * after reading the makefiles from it and return true.  Otherwise, prepare
+ * for saving the snapshot after reading the makefiles.
+ */
+bool
+Snapshot_Load(int argc, char **argv)
+{
+	char *name = Var_Subst("${.MAKE.SNAPSHOT:U}", SCOPE_GLOBAL, VARE_EVAL);
+	/* TODO: handle errors */
+	bool ok;
+
+	if (name[0] == '\0') {
+		free(name);
+		return false;
+	}
+	if (isAbs(name))
+		snapshotFile = name;
+	else {
+		FStr objdir = Var_Value(SCOPE_GLOBAL, ".OBJDIR");
+		snapshotFile = str_concat3(
+		    objdir.str != NULL ? objdir.str : curdir, "\\", name);
+		FStr_Done(&objdir);
+		free(name);
+	}
+	snapshotKey = Snapshot_Key(argc, argv);
+	HashSet_Init(&snapshotDeps);
+
+	if (!Snapshot_Map())
+		return false;
+	ok = Snapshot_IsValid();
+	if (ok)
+		Snapshot_Restore();
+	Snapshot_Unmap();
+
+	if (ok) {
+		DEBUG1(PARSE, "Restored the state from snapshot %s\n",
+		    snapshotFile);
+		Snapshot_Done();
+	}
+	return ok;
+}
+
+void
+Snapshot_Skip(const char *reason)
+{
+	if (skipReason == NULL)
+		skipReason = reason;
+}
+
+void
+Snapshot_AddDep(const char *path)
+{
+	if (snapshotFile != NULL)
+		(void)HashSet_Add(&snapshotDeps, path);
+}
+
+static void
+Snapshot_AddDepWords(const char *expr)
+{
+	char *value = Var_Subst(expr, SCOPE_GLOBAL, VARE_EVAL);
+	/* TODO: handle errors */
+	Words words = Str_Words(value, false);
+	size_t i;
+
+	for (i = 0; i < words.len; i++)
+		Snapshot_AddDep(words.words[i]);
+	Words_Free(words);
+	free(value);
+}
+
+/*
+ * Write the dependencies with their modification times.  Files that were
+ * modified since this run started may be modified again without their
+ * time changing, so the snapshot is not saved then.
+ */
+static bool
+Snapshot_PutDeps(void)
+{
+	char exe[MAXPATHLEN + 1];
+	DWORD len;
+	HashIter hi;
+
+	Snapshot_AddDepWords("${.MAKE.MAKEFILES}");
+	Snapshot_AddDepWords("${.MAKE.SNAPSHOT.DEPS:U}");
+	len = GetModuleFileNameA(NULL, exe, sizeof exe);
+	if (len > 0 && len < sizeof exe)
+		Snapshot_AddDep(exe);
+
+	Snapshot_PutNum(snapshotDeps.tbl.numEntries);
+	HashIter_InitSet(&hi, &snapshotDeps);
+	while (HashIter_Next(&hi)) {
+		time_t mtime = Snapshot_MTime(hi.entry->key);
+
+		if (mtime >= now) {
+			DEBUG2(PARSE, "Not saving snapshot %s: "
+				      "%s was just modified\n",
+			    snapshotFile, hi.entry->key);
+			return false;
+		}
+		Snapshot_PutNum((unsigned long long)(long long)mtime);
+		Snapshot_PutStr(hi.entry->key);
+	}
+	return true;
+}
+
+/*
+ * Save the state after reading the makefiles.  The file is replaced in a
+ * single step, so that other makes never see a partial file; the last one
+ * to finish wins.
+ */
+void
+Snapshot_Save(void)
+{
+	char tmp[MAXPATHLEN + 1];
+	FILE *f;
+	bool ok;
+
+	if (snapshotFile == NULL)
+		return;
+	if (skipReason != NULL) {
+		DEBUG2(PARSE, "Not saving snapshot %s: %s\n",
+		    snapshotFile, skipReason);
+		goto done;
+	}
+
+	Buf_Init(&out);
+	Buf_AddStr(&out, SNAPSHOT_MAGIC);
+	Snapshot_PutStr(snapshotKey);
+	if (!Snapshot_PutDeps())
+		goto done_buf;
+	Snapshot_PutState();
+	Buf_AddStr(&out, SNAPSHOT_END);
+
+	snprintf(tmp, sizeof tmp, "%s.%lu", snapshotFile, myPid);
+	if ((f = fopen(tmp, "wb")) == NULL) {
+		DEBUG2(PARSE, "Cannot write snapshot %s: %s\n",
+		    tmp, strerror(errno));
+		goto done_buf;
+	}
+	fwrite(out.data, 1, out.len, f);
+	ok = fflush(f) == 0 && !ferror(f);
+	ok = fclose(f) == 0 && ok;
+	if (!ok || MoveFileExA(tmp, snapshotFile,
+	    MOVEFILE_REPLACE_EXISTING) == 0) {
+		DEBUG1(PARSE, "Cannot replace snapshot %s\n", snapshotFile);
+		(void)unlink(tmp);
+	} else
+		DEBUG2(PARSE, "Saved snapshot %s with %zu bytes\n",
+		    snapshotFile, out.len);
+
+done_buf:
+	Buf_Done(&out);
+done:
+	Snapshot_Done();
+}
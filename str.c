@@ -298,7 +298,8 @@ Str_Words(const char *str, bool expand)
  * Test if a string matches a pattern like "*.[ch]". The pattern matching
  * characters are '*', '?' and '[]', as in fnmatch(3).
  *
- * See varmod-match.mk for examples and edge cases.
+ * See varmod-match.mk for examples and edge cases.  To match many strings
+ * against the same pattern, use StrPattern_Match instead.
  */
 StrMatchResult
 Str_Match(const char *str, const char *pat)
@@ -398,6 +399,231 @@ no_match:
 	goto match_fixed_length;
 }
 
+/* One of the parts of a StrPattern between the '*'. */
+struct StrPatternSegment {
+	size_t start;		/* the first of the ops */
+	size_t len;		/* the number of ops, one per character */
+	bool literal;		/* whether all ops are plain characters */
+};
+
+/* In StrPattern.ops, the values up to 255 stand for themselves. */
+#define STR_PATTERN_ANY 256	/* '?' */
+#define STR_PATTERN_LIST 257	/* '[...]', plus the index of the list */
+
+/*
+ * Parse the character list at pat, after the '[', into a bitset.  Return
+ * the end of the list, or NULL for the lists that Str_Match reports as
+ * errors or that it treats differently depending on the matched character,
+ * as in "[a-]b]".
+ */
+static const char *
+StrPattern_CompileList(const char *pat, unsigned char *bits)
+{
+	bool neg = pat[0] == '^';
+	unsigned int c, e1, e2;
+
+	memset(bits, 0, 32);
+	if (neg)
+		pat++;
+	for (; *pat != ']'; pat++) {
+		if (*pat == '\0')
+			return NULL;
+		e1 = e2 = (unsigned char)pat[0];
+		if (pat[1] == '-') {
+			if (pat[2] == '\0' || pat[2] == ']')
+				return NULL;
+			e2 = (unsigned char)pat[2];
+			pat += 2;
+		}
+		if (e1 > e2) {
+			c = e1;
+			e1 = e2;
+			e2 = c;
+		}
+		for (c = e1; c <= e2; c++)
+			bits[c >> 3] |= (unsigned char)(1 << (c & 7));
+	}
+	if (neg)
+		for (c = 0; c < 32; c++)
+			bits[c] = (unsigned char)~bits[c];
+	return pat;
+}
+
+/*
+ * Prepare the pattern for matching it against many strings with
+ * StrPattern_Match.  The pattern must stay valid until StrPattern_Done.
+ */
+void
+StrPattern_Init(StrPattern *sp, const char *pat)
+{
+	size_t patLen = strlen(pat);
+	size_t nops = 0, nlists = 0;
+	struct StrPatternSegment *seg = NULL;
+	const char *p;
+
+	sp->pat = pat;
+	sp->compiled = false;
+	sp->anchorStart = pat[0] != '*';
+	sp->anchorEnd = true;
+	sp->ops = bmake_malloc((patLen + 1) * sizeof sp->ops[0]);
+	sp->lit = bmake_malloc(patLen + 1);
+	sp->segs = bmake_malloc((patLen / 2 + 1) * sizeof sp->segs[0]);
+	sp->nsegs = 0;
+	sp->lists = bmake_malloc((patLen / 2 + 1) * sizeof sp->lists[0]);
+
+	for (p = pat; *p != '\0'; p++) {
+		unsigned int op;
+
+		if (*p == '*') {
+			seg = NULL;
+			sp->anchorEnd = false;
+			continue;
+		}
+		if (*p == '?')
+			op = STR_PATTERN_ANY;
+		else if (*p == '[') {
+			p = StrPattern_CompileList(p + 1, sp->lists[nlists]);
+			if (p == NULL)
+				return;
+			op = STR_PATTERN_LIST + (unsigned int)nlists++;
+		} else {
+			if (*p == '\\' && *++p == '\0')
+				return;
+			op = (unsigned char)*p;
+		}
+
+		if (seg == NULL) {
+			seg = sp->segs + sp->nsegs++;
+			seg->start = nops;
+			seg->len = 0;
+			seg->literal = true;
+		}
+		sp->anchorEnd = true;
+		if (op > 255)
+			seg->literal = false;
+		sp->lit[nops] = (char)op;
+		sp->ops[nops++] = (unsigned short)op;
+		seg->len++;
+	}
+	sp->compiled = true;
+}
+
+void
+StrPattern_Done(StrPattern *sp)
+{
+	free(sp->ops);
+	free(sp->lit);
+	free(sp->segs);
+	free(sp->lists);
+}
+
+/*
+ * See whether the segment matches at the beginning of str, which may be
+ * shorter than the segment.
+ */
+static bool
+StrPattern_MatchAt(const StrPattern *sp, const struct StrPatternSegment *seg,
+		   const char *str)
+{
+	const unsigned short *op = sp->ops + seg->start;
+	const unsigned char *s = (const unsigned char *)str;
+	size_t i;
+
+	if (seg->literal)
+		return str[0] == sp->lit[seg->start] &&
+		    strncmp(str, sp->lit + seg->start, seg->len) == 0;
+
+	for (i = 0; i < seg->len; i++, op++, s++) {
+		if (*s == '\0')
+			return false;
+		if (*op == STR_PATTERN_ANY)
+			continue;
+		if (*op >= STR_PATTERN_LIST) {
+			const unsigned char *bits =
+			    sp->lists[*op - STR_PATTERN_LIST];
+			if (!(bits[*s >> 3] & (1 << (*s & 7))))
+				return false;
+		} else if (*op != *s)
+			return false;
+	}
+	return true;
+}
+
+/* Find the first match of the segment in the string from str to end. */
+static const char *
+StrPattern_Find(const StrPattern *sp, const struct StrPatternSegment *seg,
+		const char *str, const char *end)
+{
+	unsigned short first = sp->ops[seg->start];
+
+	while ((size_t)(end - str) >= seg->len) {
+		if (first < 256) {
+			/* Skip to the next candidate, like memmem. */
+			str = memchr(str, first,
+			    (size_t)(end - str) - seg->len + 1);
+			if (str == NULL)
+				return NULL;
+		}
+		if (seg->literal
+		    ? memcmp(str, sp->lit + seg->start, seg->len) == 0
+		    : StrPattern_MatchAt(sp, seg, str))
+			return str;
+		str++;
+	}
+	return NULL;
+}
+
+/*
+ * Test if a string matches the pattern, with the same result as
+ * Str_Match, but without interpreting the pattern again for each string.
+ */
+StrMatchResult
+StrPattern_Match(const StrPattern *sp, const char *str)
+{
+	StrMatchResult res = { NULL, false };
+	const struct StrPatternSegment *seg = sp->segs;
+	const struct StrPatternSegment *last = seg + sp->nsegs;
+	const char *end = NULL;
+
+	if (!sp->compiled)
+		return Str_Match(str, sp->pat);
+
+	if (sp->nsegs == 0) {
+		/* The pattern is either empty or consists of '*'. */
+		res.matched = !sp->anchorStart || str[0] == '\0';
+		return res;
+	}
+
+	if (sp->anchorStart) {
+		if (!StrPattern_MatchAt(sp, seg, str))
+			return res;
+		str += seg->len;
+		if (sp->nsegs == 1 && sp->anchorEnd) {
+			res.matched = str[0] == '\0';
+			return res;
+		}
+		seg++;
+	}
+
+	/* The last segment must match at the end of the string. */
+	if (sp->anchorEnd)
+		last--;
+	if (seg < last || sp->anchorEnd)
+		end = str + strlen(str);
+	for (; seg < last; seg++) {
+		str = StrPattern_Find(sp, seg, str, end);
+		if (str == NULL)
+			return res;
+		str += seg->len;
+	}
+	if (sp->anchorEnd)
+		res.matched = (size_t)(end - str) >= seg->len &&
+		    StrPattern_MatchAt(sp, seg, end - seg->len);
+	else
+		res.matched = true;
+	return res;
+}
+
 void
 Str_Intern_Init(void)
 {
@@ -76,6 +76,19 @@ typedef struct StrMatchResult {
 	bool matched;
 } StrMatchResult;
 
+/* A pattern for Str_Match, prepared for matching many strings. */
+typedef struct StrPattern {
+	const char *pat;
+	bool compiled;		/* false if only Str_Match can handle it */
+	bool anchorStart;	/* whether it does not start with '*' */
+	bool anchorEnd;		/* whether it does not end with '*' */
+	unsigned short *ops;	/* characters, '?' and character lists */
+	char *lit;		/* the same, for the literal segments */
+	struct StrPatternSegment *segs;	/* the parts between the '*' */
+	size_t nsegs;
+	unsigned char (*lists)[32];	/* bitsets of the character lists */
+} StrPattern;
+
 char *dirname(char *);
 
 MAKE_INLINE FStr
@@ -333,6 +346,9 @@ char *str_concat2(const char *, const char *);
 char *str_concat3(const char *, const char *, const char *);
 
 StrMatchResult Str_Match(const char *, const char *);
+void StrPattern_Init(StrPattern *, const char *);
+StrMatchResult StrPattern_Match(const StrPattern *, const char *);
+void StrPattern_Done(StrPattern *);
 
 void Str_Intern_Init(void);
 void Str_Intern_End(void);
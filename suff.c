@@ -109,6 +109,10 @@
  *
  *	Suff_FindPath	Return the appropriate path to search in order to
  *			find the node.
+ *
+ *	Suff_PathsChanged
+ *			Forget the implied sources that have been found
+ *			along the search paths.
  */
 
 #include "make.h"
@@ -124,6 +128,14 @@ typedef ListNode CandidateListNode;
 
 /* The defined suffixes, such as '.c', '.o', '.l'. */
 static SuffixList sufflist = LST_INIT;
+/*
+ * The suffixes from sufflist by their name, so that the suffixes of a name
+ * are found by looking up its tails instead of comparing it with each
+ * suffix, see FindSuffixesOf.
+ */
+static HashTable suffixesByName;
+/* An upper bound for the length of the suffixes in suffixesByName. */
+static size_t suffixesMaxLen;
 #ifdef CLEANUP
 /* The suffixes to be cleaned up at the end. */
 static SuffixList suffClean = LST_INIT;
@@ -141,6 +153,15 @@ static GNodeList transforms = LST_INIT;
  */
 static int sNum = 0;
 
+/*
+ * Incremented whenever the search paths or the suffixes change, which
+ * invalidates the implied sources that have been looked up so far.
+ */
+static unsigned int sourcesGeneration = 0;
+/* Statistics for the lookups of implied sources, for the -ds option. */
+static unsigned int sourcesLookups = 0;
+static unsigned int sourcesHits = 0;
+
 /*
  * A suffix such as ".c" or ".o" that may be used in suffix transformation
  * rules such as ".c.o:".
@@ -172,6 +193,14 @@ typedef struct Suffix {
 	bool isNull:1;
 	/* The path along which files of this suffix may be found */
 	SearchPath *searchPath;
+	/*
+	 * The files of this suffix that have been searched along the search
+	 * path, by their name. The value is the path of the found file, or
+	 * NULL if the file was not found.
+	 */
+	HashTable sources;
+	/* The value of sourcesGeneration when the sources were looked up. */
+	unsigned int sourcesGen;
 
 	/* The suffix number; TODO: document the purpose of this number */
 	int sNum;
@@ -323,15 +352,48 @@ Suffix_IsSuffix(const Suffix *suff, size_t nameLen, const char *nameEnd)
 static Suffix *
 FindSuffixByNameLen(const char *name, size_t nameLen)
 {
-	SuffixListNode *ln;
+	Substring key = Substring_Init(name, name + nameLen);
 
-	for (ln = sufflist.first; ln != NULL; ln = ln->next) {
-		Suffix *suff = ln->datum;
-		if (suff->nameLen == nameLen &&
-		    memcmp(suff->name, name, nameLen) == 0)
-			return suff;
+	return HashTable_FindValueBySubstringHash(&suffixesByName, key,
+	    Hash_Substring(key));
+}
+
+/*
+ * Add the suffixes of the name to the vector, in the order of sufflist.
+ * Since a name has at most one suffix of each length, only its tails up to
+ * the length of the longest suffix need to be looked up.
+ */
+static void
+FindSuffixesOf(const char *name, size_t nameLen, Vector *suffs)
+{
+	const char *nameEnd = name + nameLen;
+	size_t len;
+
+	for (len = 0; len <= nameLen && len <= suffixesMaxLen; len++) {
+		Suffix *suff = FindSuffixByNameLen(nameEnd - len, len);
+		Suffix **items;
+		size_t i;
+
+		if (suff == NULL)
+			continue;
+
+		/* The suffixes in sufflist are ordered by their number. */
+		(void)Vector_Push(suffs);
+		items = suffs->items;
+		for (i = suffs->len - 1;
+		     i > 0 && items[i - 1]->sNum > suff->sNum; i--)
+			items[i] = items[i - 1];
+		items[i] = suff;
 	}
-	return NULL;
+}
+
+/* Make the suffix from sufflist available to FindSuffixByNameLen. */
+static void
+SuffixesByName_Add(Suffix *suff)
+{
+	HashTable_Set(&suffixesByName, suff->name, suff);
+	if (suffixesMaxLen < suff->nameLen)
+		suffixesMaxLen = suff->nameLen;
 }
 
 static Suffix *
@@ -363,9 +425,33 @@ SuffixList_Unref(SuffixList *list, Suffix *suff)
 	}
 }
 
+static void
+FreeSources(HashTable *sources)
+{
+	HashIter hi;
+
+	HashIter_Init(&hi, sources);
+	while (HashIter_Next(&hi))
+		free(hi.entry->value);
+	HashTable_Done(sources);
+}
+
+/* Forget the sources that have been looked up for the suffix. */
+static void
+Suffix_ForgetSources(Suffix *suff)
+{
+	FreeSources(&suff->sources);
+	HashTable_Init(&suff->sources);
+	suff->sourcesGen = sourcesGeneration;
+}
+
 static void
 Suffix_Free(Suffix *suff)
 {
+	HashEntry *he = HashTable_FindEntry(&suffixesByName, suff->name);
+
+	if (he != NULL && HashEntry_Get(he) == suff)
+		HashTable_DeleteEntry(&suffixesByName, he);
 
 	if (suff == nullSuff)
 		nullSuff = NULL;
@@ -383,6 +469,7 @@ Suffix_Free(Suffix *suff)
 	Lst_Done(&suff->children);
 	Lst_Done(&suff->parents);
 	SearchPath_Free(suff->searchPath);
+	FreeSources(&suff->sources);
 
 	free(suff->name);
 	free(suff);
@@ -446,6 +533,8 @@ Suffix_New(const char *name)
 	suff->name = bmake_strdup(name);
 	suff->nameLen = strlen(suff->name);
 	suff->searchPath = SearchPath_New();
+	HashTable_Init(&suff->sources);
+	suff->sourcesGen = sourcesGeneration;
 	Lst_Init(&suff->children);
 	Lst_Init(&suff->parents);
 	suff->sNum = sNum++;
@@ -471,7 +560,11 @@ Suff_ClearSuffixes(void)
 	Lst_MoveAll(&suffClean, &sufflist);
 #endif
 	DEBUG0(SUFF, "Clearing all suffixes\n");
+	sourcesGeneration++;
 	Lst_Init(&sufflist);
+	HashTable_Done(&suffixesByName);
+	HashTable_Init(&suffixesByName);
+	suffixesMaxLen = 0;
 	sNum = 0;
 	if (nullSuff != NULL)
 		Suffix_Free(nullSuff);
@@ -587,11 +680,12 @@ Suff_AddTransform(const char *name)
 		 */
 		Lst_Done(&gn->commands);
 		Lst_Init(&gn->commands);
-		Lst_Done(&gn->children);
-		Lst_Init(&gn->children);
+		GNodeVec_Done(&gn->children);
+		GNodeVec_Init(&gn->children);
 	}
 
 	gn->type = OP_TRANSFORM;
+	gn->flags.batch = false;
 
 	{
 		/* TODO: Avoid the redundant parsing here. */
@@ -625,13 +719,13 @@ Suff_EndTransform(GNode *gn)
 	Suffix *srcSuff, *targSuff;
 	SuffixList *srcSuffParents;
 
-	if ((gn->type & OP_DOUBLEDEP) && !Lst_IsEmpty(&gn->cohorts))
-		gn = gn->cohorts.last->datum;
+	if ((gn->type & OP_DOUBLEDEP) && !GNodeVec_IsEmpty(&gn->cohorts))
+		gn = GNodeVec_Last(&gn->cohorts);
 
 	if (!(gn->type & OP_TRANSFORM))
 		return;
 
-	if (!Lst_IsEmpty(&gn->commands) || !Lst_IsEmpty(&gn->children)) {
+	if (!Lst_IsEmpty(&gn->commands) || !GNodeVec_IsEmpty(&gn->children)) {
 		DEBUG1(SUFF, "transformation %s complete\n", gn->name);
 		return;
 	}
@@ -765,8 +859,8 @@ UpdateTarget(GNode *target, Suffix *suff, bool *inout_removedMain)
 			*inout_removedMain = true;
 			mainNode = NULL;
 		}
-		Lst_Done(&target->children);
-		Lst_Init(&target->children);
+		GNodeVec_Done(&target->children);
+		GNodeVec_Init(&target->children);
 		target->type = OP_TRANSFORM;
 
 		/*
@@ -811,6 +905,8 @@ Suff_AddSuffix(const char *name)
 
 	suff = Suffix_New(name);
 	Lst_Append(&sufflist, suff);
+	SuffixesByName_Add(suff);
+	sourcesGeneration++;
 	DEBUG1(SUFF, "Adding suffix \"%s\"\n", suff->name);
 
 	UpdateTargets(suff);
@@ -823,6 +919,16 @@ Suff_AddSuffix(const char *name)
 		RebuildGraph(ln->datum, suff);
 }
 
+/*
+ * Forget the implied sources that have been looked up so far, since a
+ * search path has changed. Called whenever '.PATH' is set.
+ */
+void
+Suff_PathsChanged(void)
+{
+	sourcesGeneration++;
+}
+
 /* Return the search path for the given suffix, or NULL. */
 SearchPath *
 Suff_GetPath(const char *name)
@@ -852,6 +958,7 @@ Suff_ExtendPaths(void)
 	SearchPath *includesPath = SearchPath_New();
 	SearchPath *libsPath = SearchPath_New();
 
+	sourcesGeneration++;
 	for (ln = sufflist.first; ln != NULL; ln = ln->next) {
 		Suffix *suff = ln->datum;
 		if (!Lst_IsEmpty(&suff->searchPath->dirs)) {
@@ -1076,6 +1183,30 @@ RemoveCandidate(CandidateList *srcs)
 	return false;
 }
 
+/*
+ * Search the file of the candidate along the search path of its suffix.
+ * The result is remembered until the search paths or the suffixes change,
+ * since the same sources are tried for many targets.
+ */
+static bool
+FindSource(const Candidate *src)
+{
+	Suffix *suff = src->suff;
+	HashEntry *he;
+	bool isNew;
+
+	if (suff->sourcesGen != sourcesGeneration)
+		Suffix_ForgetSources(suff);
+
+	sourcesLookups++;
+	he = HashTable_CreateEntry(&suff->sources, src->file, &isNew);
+	if (!isNew)
+		sourcesHits++;
+	else
+		HashEntry_Set(he, Dir_FindFile(src->file, suff->searchPath));
+	return HashEntry_Get(he) != NULL;
+}
+
 /* Find the first existing file/target in srcs. */
 static Candidate *
 FindThem(CandidateList *srcs, CandidateSearcher *cs)
@@ -1097,22 +1228,12 @@ FindThem(CandidateList *srcs, CandidateSearcher *cs)
 		 * A file is considered to exist if either a node exists in the
 		 * graph for it or the file actually exists.
 		 */
-		if (Targ_FindNode(src->file) != NULL) {
-		found:
+		if (Targ_FindNode(src->file) != NULL || FindSource(src)) {
 			HashSet_Done(&seen);
 			DEBUG0(SUFF, "got it\n");
 			return src;
 		}
 
-		{
-			char *file = Dir_FindFile(src->file,
-			    src->suff->searchPath);
-			if (file != NULL) {
-				free(file);
-				goto found;
-			}
-		}
-
 		DEBUG0(SUFF, "not there\n");
 
 		if (HashSet_Add(&seen, src->file))
@@ -1137,7 +1258,7 @@ FindThem(CandidateList *srcs, CandidateSearcher *cs)
 static Candidate *
 FindCmds(Candidate *targ, CandidateSearcher *cs)
 {
-	GNodeListNode *gln;
+	size_t i;
 	GNode *tgn;		/* Target GNode */
 	GNode *sgn;		/* Source GNode */
 	size_t prefLen;		/* The length of the defined prefix */
@@ -1147,10 +1268,10 @@ FindCmds(Candidate *targ, CandidateSearcher *cs)
 	tgn = targ->node;
 	prefLen = strlen(targ->prefix);
 
-	for (gln = tgn->children.first; gln != NULL; gln = gln->next) {
+	for (i = 0; i < tgn->children.len; i++) {
 		const char *base;
 
-		sgn = gln->datum;
+		sgn = GNodeVec_Get(&tgn->children, i);
 
 		if (sgn->type & OP_OPTIONAL && Lst_IsEmpty(&tgn->commands)) {
 			/*
@@ -1184,7 +1305,7 @@ FindCmds(Candidate *targ, CandidateSearcher *cs)
 			break;
 	}
 
-	if (gln == NULL)
+	if (i == tgn->children.len)
 		return NULL;
 
 	ret = Candidate_New(bmake_strdup(sgn->name), targ->prefix, suff, targ,
@@ -1200,14 +1321,18 @@ FindCmds(Candidate *targ, CandidateSearcher *cs)
 	return ret;
 }
 
-static void
-ExpandWildcards(GNodeListNode *cln, GNode *pgn)
+/*
+ * Replace the child at index i with the files that its name expands to.
+ * Return the index of the child after it.
+ */
+static size_t
+ExpandWildcards(GNode *pgn, size_t i)
 {
-	GNode *cgn = cln->datum;
+	GNode *cgn = GNodeVec_Get(&pgn->children, i);
 	StringList expansions;
 
 	if (!Dir_HasWildcards(cgn->name))
-		return;
+		return i + 1;
 
 	/* Expand the word along the chosen path. */
 	Lst_Init(&expansions);
@@ -1225,8 +1350,8 @@ ExpandWildcards(GNodeListNode *cln, GNode *pgn)
 		free(name);
 
 		/* Insert gn before the original child. */
-		Lst_InsertBefore(&pgn->children, cln, gn);
-		Lst_Append(&gn->parents, pgn);
+		GNodeVec_Insert(&pgn->children, i++, gn);
+		GNodeVec_Append(&gn->parents, pgn);
 		pgn->unmade++;
 	}
 
@@ -1239,8 +1364,9 @@ ExpandWildcards(GNodeListNode *cln, GNode *pgn)
 	 * children, to keep it from being processed.
 	 */
 	pgn->unmade--;
-	Lst_Remove(&pgn->children, cln);
-	Lst_Remove(&cgn->parents, Lst_FindDatum(&cgn->parents, pgn));
+	GNodeVec_Remove(&pgn->children, i);
+	GNodeVec_Remove(&cgn->parents, GNodeVec_Find(&cgn->parents, pgn));
+	return i;
 }
 
 /*
@@ -1314,22 +1440,26 @@ ExpandChildrenRegular(char *p, GNode *pgn, GNodeList *members)
  * parent's unmade counter is decremented, but other nodes may be added.
  *
  * Input:
- *	cln		Child to examine
  *	pgn		Parent node being processed
+ *	i		Index of the child to examine
+ *
+ * Results:
+ *	The index of the child after the examined one.
  */
-static void
-ExpandChildren(GNodeListNode *cln, GNode *pgn)
+static size_t
+ExpandChildren(GNode *pgn, size_t i)
 {
-	GNode *cgn = cln->datum;
+	GNode *cgn = GNodeVec_Get(&pgn->children, i);
 	char *expanded;
 
-	if (!Lst_IsEmpty(&cgn->order_pred) || !Lst_IsEmpty(&cgn->order_succ))
+	if (!GNodeVec_IsEmpty(&cgn->order_pred) ||
+	    !GNodeVec_IsEmpty(&cgn->order_succ))
 		/* It is all too hard to process the result of .ORDER */
-		return;
+		return i + 1;
 
 	if (cgn->type & OP_WAIT)
 		/* Ignore these (& OP_PHONY ?) */
-		return;
+		return i + 1;
 
 	/*
 	 * First do variable expansion -- this takes precedence over wildcard
@@ -1337,10 +1467,8 @@ ExpandChildren(GNodeListNode *cln, GNode *pgn)
 	 * later since the resulting words are tacked on to the end of the
 	 * children list.
 	 */
-	if (strchr(cgn->name, '$') == NULL) {
-		ExpandWildcards(cln, pgn);
-		return;
-	}
+	if (strchr(cgn->name, '$') == NULL)
+		return ExpandWildcards(pgn, i);
 
 	DEBUG1(SUFF, "Expanding \"%s\"...", cgn->name);
 	expanded = Var_Subst(cgn->name, pgn, VARE_EVAL_DEFINED);
@@ -1366,10 +1494,10 @@ ExpandChildren(GNodeListNode *cln, GNode *pgn)
 			GNode *gn = Lst_Dequeue(&members);
 
 			DEBUG1(SUFF, "%s...", gn->name);
-			Lst_InsertBefore(&pgn->children, cln, gn);
-			Lst_Append(&gn->parents, pgn);
+			GNodeVec_Insert(&pgn->children, i, gn);
+			GNodeVec_Append(&gn->parents, pgn);
 			pgn->unmade++;
-			ExpandWildcards(cln->prev, pgn);
+			i = ExpandWildcards(pgn, i);
 		}
 		Lst_Done(&members);
 
@@ -1383,19 +1511,18 @@ ExpandChildren(GNodeListNode *cln, GNode *pgn)
 	 * to keep it from being processed.
 	 */
 	pgn->unmade--;
-	Lst_Remove(&pgn->children, cln);
-	Lst_Remove(&cgn->parents, Lst_FindDatum(&cgn->parents, pgn));
+	GNodeVec_Remove(&pgn->children, i);
+	GNodeVec_Remove(&cgn->parents, GNodeVec_Find(&cgn->parents, pgn));
+	return i;
 }
 
 static void
 ExpandAllChildren(GNode *gn)
 {
-	GNodeListNode *ln, *nln;
+	size_t i = 0;
 
-	for (ln = gn->children.first; ln != NULL; ln = nln) {
-		nln = ln->next;
-		ExpandChildren(ln, gn);
-	}
+	while (i < gn->children.len)
+		i = ExpandChildren(gn, i);
 }
 
 /*
@@ -1410,16 +1537,15 @@ Suff_FindPath(GNode *gn)
 	Suffix *suff = gn->suffix;
 
 	if (suff == NULL) {
-		char *name = gn->name;
-		size_t nameLen = strlen(gn->name);
-		SuffixListNode *ln;
-		for (ln = sufflist.first; ln != NULL; ln = ln->next)
-			if (Suffix_IsSuffix(ln->datum, nameLen, name + nameLen))
-				break;
+		Vector suffs;
+
+		Vector_Init(&suffs, sizeof(Suffix *));
+		FindSuffixesOf(gn->name, strlen(gn->name), &suffs);
 
 		DEBUG1(SUFF, "Wildcard expanding \"%s\"...", gn->name);
-		if (ln != NULL)
-			suff = ln->datum;
+		if (suffs.len > 0)
+			suff = *(Suffix **)Vector_Get(&suffs, 0);
+		Vector_Done(&suffs);
 		/*
 		 * XXX: Here we can save the suffix so we don't have to do
 		 * this again.
@@ -1449,13 +1575,13 @@ Suff_FindPath(GNode *gn)
 static bool
 ApplyTransform(GNode *tgn, GNode *sgn, Suffix *tsuff, Suffix *ssuff)
 {
-	GNodeListNode *ln;
+	size_t i;
 	char *tname;		/* Name of transformation rule */
 	GNode *gn;		/* Node for the transformation rule */
 
 	/* Form the proper links between the target and source. */
-	Lst_Append(&tgn->children, sgn);
-	Lst_Append(&sgn->parents, tgn);
+	GNodeVec_Append(&tgn->children, sgn);
+	GNodeVec_Append(&sgn->parents, tgn);
 	tgn->unmade++;
 
 	/* Locate the transformation rule itself. */
@@ -1470,25 +1596,25 @@ ApplyTransform(GNode *tgn, GNode *sgn, Suffix *tsuff, Suffix *ssuff)
 	DEBUG3(SUFF, "\tapplying %s -> %s to \"%s\"\n",
 	    ssuff->name, tsuff->name, tgn->name);
 
-	/* Record last child; Make_HandleUse may add child nodes. */
-	ln = tgn->children.last;
+	/* Record the number of children; Make_HandleUse may add some. */
+	i = tgn->children.len;
+
+	/* Only a target without commands of its own can join a batch. */
+	if (gn->flags.batch && Lst_IsEmpty(&tgn->commands))
+		tgn->batchRule = gn;
 
 	/* Apply the rule. */
 	Make_HandleUse(gn, tgn);
 
 	/* Deal with wildcards and expressions in any acquired sources. */
-	ln = ln != NULL ? ln->next : NULL;
-	while (ln != NULL) {
-		GNodeListNode *nln = ln->next;
-		ExpandChildren(ln, tgn);
-		ln = nln;
-	}
+	while (i < tgn->children.len)
+		i = ExpandChildren(tgn, i);
 
 	/*
 	 * Keep track of another parent to which this node is transformed so
 	 * the .IMPSRC variable can be set correctly for the parent.
 	 */
-	Lst_Append(&sgn->implicitParents, tgn);
+	GNodeVec_Append(&sgn->implicitParents, tgn);
 
 	return true;
 }
@@ -1567,8 +1693,8 @@ FindDepsArchive(GNode *gn, CandidateSearcher *cs)
 	FindDeps(mem, cs);
 
 	/* Create the link between the two nodes right off. */
-	Lst_Append(&gn->children, mem);
-	Lst_Append(&mem->parents, gn);
+	GNodeVec_Append(&gn->children, mem);
+	GNodeVec_Append(&mem->parents, gn);
 	gn->unmade++;
 
 	/* Copy in the variables from the member node to this one. */
@@ -1652,14 +1778,15 @@ static void
 FindDepsRegularKnown(const char *name, size_t nameLen, GNode *gn,
 		     CandidateList *srcs, CandidateList *targs)
 {
-	SuffixListNode *ln;
+	Vector suffs;
+	size_t i;
 	Candidate *targ;
 	char *pref;
 
-	for (ln = sufflist.first; ln != NULL; ln = ln->next) {
-		Suffix *suff = ln->datum;
-		if (!Suffix_IsSuffix(suff, nameLen, name + nameLen))
-			continue;
+	Vector_Init(&suffs, sizeof(Suffix *));
+	FindSuffixesOf(name, nameLen, &suffs);
+	for (i = 0; i < suffs.len; i++) {
+		Suffix *suff = *(Suffix **)Vector_Get(&suffs, i);
 
 		pref = bmake_strldup(name, (size_t)(nameLen - suff->nameLen));
 		targ = Candidate_New(bmake_strdup(gn->name), pref, suff, NULL,
@@ -1670,6 +1797,7 @@ FindDepsRegularKnown(const char *name, size_t nameLen, GNode *gn,
 		/* Record the target so we can nuke it. */
 		Lst_Append(targs, targ);
 	}
+	Vector_Done(&suffs);
 }
 
 static void
@@ -1842,13 +1970,7 @@ FindDepsRegular(GNode *gn, CandidateSearcher *cs)
 	 * Now we've got the important local variables set, expand any sources
 	 * that still contain variables or wildcards in their names.
 	 */
-	{
-		GNodeListNode *ln, *nln;
-		for (ln = gn->children.first; ln != NULL; ln = nln) {
-			nln = ln->next;
-			ExpandChildren(ln, gn);
-		}
-	}
+	ExpandAllChildren(gn);
 
 	if (targ == NULL) {
 		DEBUG1(SUFF, "\tNo valid suffix on %s\n", gn->name);
@@ -1868,7 +1990,7 @@ FindDepsRegular(GNode *gn, CandidateSearcher *cs)
 	/*
 	 * Check for overriding transformation rule implied by sources
 	 */
-	if (!Lst_IsEmpty(&gn->children)) {
+	if (!GNodeVec_IsEmpty(&gn->children)) {
 		src = FindCmds(targ, cs);
 
 		if (src != NULL) {
@@ -2038,6 +2160,7 @@ Suff_Init(void)
 	 * doesn't actually go on the suffix list or everyone will think
 	 * that's its suffix.
 	 */
+	HashTable_Init(&suffixesByName);
 	Suff_ClearSuffixes();
 }
 
@@ -2047,7 +2170,15 @@ Suff_End(void)
 {
 #ifdef CLEANUP
 	SuffixListNode *ln;
+#endif
+
+	if (DEBUG(SUFF) && sourcesLookups > 0) {
+		debug_printf("# implied sources: %u lookups, %u hits (%u%%)\n",
+		    sourcesLookups, sourcesHits,
+		    (unsigned)(100ULL * sourcesHits / sourcesLookups));
+	}
 
+#ifdef CLEANUP
 	for (ln = sufflist.first; ln != NULL; ln = ln->next)
 		Suffix_Free(ln->datum);
 	Lst_Done(&sufflist);
@@ -2057,6 +2188,7 @@ Suff_End(void)
 	if (nullSuff != NULL)
 		Suffix_Free(nullSuff);
 	Lst_Done(&transforms);
+	HashTable_Done(&suffixesByName);
 #endif
 }
 
@@ -2144,3 +2276,160 @@ Suff_NamesStr(void)
 	}
 	return Buf_DoneData(&buf);
 }
+
+GNodeList *
+Suff_Transforms(void)
+{
+	return &transforms;
+}
+
+/* Return the index of the suffix in the vector, adding it if necessary. */
+static size_t
+SnapshotSuffixIndex(Vector *suffs, Suffix *suff)
+{
+	size_t i;
+
+	for (i = 0; i < suffs->len; i++)
+		if (*(Suffix **)Vector_Get(suffs, i) == suff)
+			return i;
+	*(Suffix **)Vector_Push(suffs) = suff;
+	return i;
+}
+
+static void
+SaveSuffixRefs(Vector *suffs, SuffixList *list)
+{
+	SuffixListNode *ln;
+	size_t n = 0;
+
+	for (ln = list->first; ln != NULL; ln = ln->next)
+		n++;
+	Snapshot_PutNum(n);
+	for (ln = list->first; ln != NULL; ln = ln->next)
+		Snapshot_PutNum(SnapshotSuffixIndex(suffs, ln->datum));
+}
+
+static void
+RestoreSuffixRefs(Vector *suffs, SuffixList *list)
+{
+	unsigned long long n;
+
+	for (n = Snapshot_GetNum(); n > 0; n--) {
+		size_t i = Snapshot_GetIndex(suffs->len);
+		Lst_Append(list, *(Suffix **)Vector_Get(suffs, i));
+	}
+}
+
+/*
+ * Write the suffixes and the transformation rules to the snapshot, see
+ * snapshot.c.  The transformation nodes themselves are already part of
+ * the targets, see Targ_SaveSnapshot.
+ */
+void
+Suff_SaveSnapshot(void)
+{
+	Vector suffs;
+	SuffixListNode *ln;
+	GNodeListNode *gln;
+	size_t i, numListed, n = 0;
+
+	Vector_Init(&suffs, sizeof(Suffix *));
+	for (ln = sufflist.first; ln != NULL; ln = ln->next)
+		(void)SnapshotSuffixIndex(&suffs, ln->datum);
+	numListed = suffs.len;
+	if (nullSuff != NULL)
+		(void)SnapshotSuffixIndex(&suffs, nullSuff);
+	if (emptySuff != NULL)
+		(void)SnapshotSuffixIndex(&suffs, emptySuff);
+	for (i = 0; i < suffs.len; i++) {
+		Suffix *suff = *(Suffix **)Vector_Get(&suffs, i);
+
+		for (ln = suff->parents.first; ln != NULL; ln = ln->next)
+			(void)SnapshotSuffixIndex(&suffs, ln->datum);
+		for (ln = suff->children.first; ln != NULL; ln = ln->next)
+			(void)SnapshotSuffixIndex(&suffs, ln->datum);
+	}
+
+	Snapshot_PutNum(suffs.len);
+	Snapshot_PutNum(numListed);
+	for (i = 0; i < suffs.len; i++)
+		Snapshot_PutStr((*(Suffix **)Vector_Get(&suffs, i))->name);
+	for (i = 0; i < suffs.len; i++) {
+		Suffix *suff = *(Suffix **)Vector_Get(&suffs, i);
+
+		Snapshot_PutNum((unsigned)suff->include |
+		    (unsigned)suff->library << 1 |
+		    (unsigned)suff->isNull << 2);
+		Snapshot_PutNum((unsigned)suff->sNum);
+		Snapshot_PutNum((unsigned)suff->refCount);
+		SearchPath_SaveSnapshot(suff->searchPath);
+		SaveSuffixRefs(&suffs, &suff->parents);
+		SaveSuffixRefs(&suffs, &suff->children);
+	}
+	Snapshot_PutNum(nullSuff != NULL
+	    ? SnapshotSuffixIndex(&suffs, nullSuff) + 1 : 0);
+	Snapshot_PutNum(emptySuff != NULL
+	    ? SnapshotSuffixIndex(&suffs, emptySuff) + 1 : 0);
+	Snapshot_PutNum((unsigned)sNum);
+
+	for (gln = transforms.first; gln != NULL; gln = gln->next)
+		n++;
+	Snapshot_PutNum(n);
+	for (gln = transforms.first; gln != NULL; gln = gln->next)
+		Targ_SaveNodeRef(gln->datum);
+	Vector_Done(&suffs);
+}
+
+/* Replace the suffixes and transformations with those from the snapshot. */
+void
+Suff_RestoreSnapshot(void)
+{
+	Vector suffs;
+	unsigned long long n;
+	size_t i, numSuffs, numListed;
+
+	sourcesGeneration++;
+
+	/* Only the null suffix from Suff_Init exists yet. */
+	if (nullSuff != NULL)
+		Suffix_Free(nullSuff);
+
+	Vector_Init(&suffs, sizeof(Suffix *));
+	numSuffs = Snapshot_GetIndex((size_t)-1);
+	numListed = Snapshot_GetIndex(numSuffs + 1);
+	for (i = 0; i < numSuffs; i++) {
+		char *name = Snapshot_GetStr();
+		Suffix *suff = Suffix_New(name);
+
+		free(name);
+		*(Suffix **)Vector_Push(&suffs) = suff;
+		if (i < numListed) {
+			Lst_Append(&sufflist, suff);
+			SuffixesByName_Add(suff);
+		}
+	}
+	for (i = 0; i < numSuffs; i++) {
+		Suffix *suff = *(Suffix **)Vector_Get(&suffs, i);
+		unsigned long long flags = Snapshot_GetNum();
+
+		suff->include = (flags & 1) != 0;
+		suff->library = (flags & 2) != 0;
+		suff->isNull = (flags & 4) != 0;
+		suff->sNum = (int)Snapshot_GetNum();
+		suff->refCount = (int)Snapshot_GetNum();
+		SearchPath_RestoreSnapshot(suff->searchPath);
+		RestoreSuffixRefs(&suffs, &suff->parents);
+		RestoreSuffixRefs(&suffs, &suff->children);
+	}
+	i = Snapshot_GetIndex(numSuffs + 1);
+	nullSuff = i > 0 ? *(Suffix **)Vector_Get(&suffs, i - 1) : NULL;
+	i = Snapshot_GetIndex(numSuffs + 1);
+	emptySuff = i > 0 ? *(Suffix **)Vector_Get(&suffs, i - 1) : NULL;
+	sNum = (int)Snapshot_GetNum();
+
+	Lst_Done(&transforms);
+	Lst_Init(&transforms);
+	for (n = Snapshot_GetNum(); n > 0; n--)
+		Lst_Append(&transforms, Targ_RestoreNodeRef());
+	Vector_Done(&suffs);
+}
@@ -180,7 +180,7 @@ GNode_New(const char *name)
 {
 	GNode *gn;
 
-	gn = bmake_malloc(sizeof *gn);
+	gn = Arena_Alloc(&parseArena, sizeof *gn);
 	gn->name = bmake_strdup(name);
 	gn->uname = NULL;
 	gn->path = NULL;
@@ -188,14 +188,17 @@ GNode_New(const char *name)
 	memset(&gn->flags, 0, sizeof(gn->flags));
 	gn->made = UNMADE;
 	gn->unmade = 0;
+	gn->critPath = 0;
 	gn->mtime = 0;
 	gn->youngestChild = NULL;
-	Lst_Init(&gn->implicitParents);
-	Lst_Init(&gn->parents);
-	Lst_Init(&gn->children);
-	Lst_Init(&gn->order_pred);
-	Lst_Init(&gn->order_succ);
-	Lst_Init(&gn->cohorts);
+	gn->batchRule = NULL;
+	GNodeVec_Init(&gn->batch);
+	GNodeVec_Init(&gn->implicitParents);
+	GNodeVec_Init(&gn->parents);
+	GNodeVec_Init(&gn->children);
+	GNodeVec_Init(&gn->order_pred);
+	GNodeVec_Init(&gn->order_succ);
+	GNodeVec_Init(&gn->cohorts);
 	gn->cohort_num[0] = '\0';
 	gn->unmade_cohorts = 0;
 	gn->centurion = NULL;
@@ -227,15 +230,16 @@ GNode_Free(GNode *gn)
 	/* Don't free gn->youngestChild since it is not owned by this node. */
 
 	/*
-	 * In the following lists, only free the list nodes, but not the
+	 * In the following vectors, only free the arrays, but not the
 	 * GNodes in them since these are not owned by this node.
 	 */
-	Lst_Done(&gn->implicitParents);
-	Lst_Done(&gn->parents);
-	Lst_Done(&gn->children);
-	Lst_Done(&gn->order_pred);
-	Lst_Done(&gn->order_succ);
-	Lst_Done(&gn->cohorts);
+	GNodeVec_Done(&gn->batch);
+	GNodeVec_Done(&gn->implicitParents);
+	GNodeVec_Done(&gn->parents);
+	GNodeVec_Done(&gn->children);
+	GNodeVec_Done(&gn->order_pred);
+	GNodeVec_Done(&gn->order_succ);
+	GNodeVec_Done(&gn->cohorts);
 
 	HashTable_Done(&gn->vars);
 
@@ -253,7 +257,7 @@ GNode_Free(GNode *gn)
 	 * all places, otherwise a suffix might be freed too early.
 	 */
 
-	free(gn);
+	Arena_Free(&parseArena, gn, sizeof *gn);
 }
 #endif
 
@@ -332,20 +336,20 @@ Targ_FindList(GNodeList *gns, StringList *names)
 }
 
 static void
-PrintNodeNames(GNodeList *gnodes)
+PrintNodeNames(GNodeVec *gnodes)
 {
-	GNodeListNode *ln;
+	size_t i;
 
-	for (ln = gnodes->first; ln != NULL; ln = ln->next) {
-		GNode *gn = ln->datum;
+	for (i = 0; i < gnodes->len; i++) {
+		GNode *gn = GNodeVec_Get(gnodes, i);
 		debug_printf(" %s%s", gn->name, gn->cohort_num);
 	}
 }
 
 static void
-PrintNodeNamesLine(const char *label, GNodeList *gnodes)
+PrintNodeNamesLine(const char *label, GNodeVec *gnodes)
 {
-	if (Lst_IsEmpty(gnodes))
+	if (GNodeVec_IsEmpty(gnodes))
 		return;
 	debug_printf("# %s:", label);
 	PrintNodeNames(gnodes);
@@ -457,7 +461,10 @@ GNodeFlags_IsNone(GNodeFlags flags)
 	       && !flags.fromDepend
 	       && !flags.doneAllsrc
 	       && !flags.cycle
-	       && !flags.doneCycle;
+	       && !flags.doneCycle
+	       && !flags.progress
+	       && !flags.batch
+	       && !flags.reached;
 }
 
 /* Print the contents of a node. */
@@ -508,8 +515,12 @@ Targ_PrintNode(GNode *gn, int pass)
 	debug_printf("\n");
 	Targ_PrintCmds(gn);
 	debug_printf("\n\n");
-	if (gn->type & OP_DOUBLEDEP)
-		Targ_PrintNodes(&gn->cohorts, pass);
+	if (gn->type & OP_DOUBLEDEP) {
+		size_t i;
+
+		for (i = 0; i < gn->cohorts.len; i++)
+			Targ_PrintNode(GNodeVec_Get(&gn->cohorts, i), pass);
+	}
 }
 
 void
@@ -578,7 +589,8 @@ Targ_PrintGraph(int pass)
 void
 Targ_Propagate(void)
 {
-	GNodeListNode *ln, *cln;
+	GNodeListNode *ln;
+	size_t i;
 
 	for (ln = allTargets.first; ln != NULL; ln = ln->next) {
 		GNode *gn = ln->datum;
@@ -587,10 +599,256 @@ Targ_Propagate(void)
 		if (!(type & OP_DOUBLEDEP))
 			continue;
 
-		for (cln = gn->cohorts.first; cln != NULL; cln = cln->next) {
-			GNode *cohort = cln->datum;
+		for (i = 0; i < gn->cohorts.len; i++) {
+			GNode *cohort = GNodeVec_Get(&gn->cohorts, i);
 
 			cohort->type |= type & (unsigned)~OP_OPMASK;
 		}
 	}
 }
+
+/* The nodes of the snapshot, by their index in it. */
+static Vector /* of GNode * */ snapshotNodes;
+/* The index of each node in snapshotNodes plus 1, by its address. */
+static HashTable snapshotIndex;
+
+static void
+SnapshotAddNode(GNode *gn)
+{
+	char key[32];
+	HashEntry *he;
+	bool isNew;
+
+	if (gn == NULL)
+		return;
+	snprintf(key, sizeof key, "%p", (void *)gn);
+	he = HashTable_CreateEntry(&snapshotIndex, key, &isNew);
+	if (!isNew)
+		return;
+	*(GNode **)Vector_Push(&snapshotNodes) = gn;
+	HashEntry_Set(he, (void *)(uintptr_t)snapshotNodes.len);
+}
+
+static void
+SnapshotAddNodes(GNodeVec *gnodes)
+{
+	size_t i;
+
+	for (i = 0; i < gnodes->len; i++)
+		SnapshotAddNode(GNodeVec_Get(gnodes, i));
+}
+
+/* Return the index of the node in the snapshot plus 1, or 0 for NULL. */
+static size_t
+SnapshotNodeNumber(GNode *gn)
+{
+	char key[32];
+
+	if (gn == NULL)
+		return 0;
+	snprintf(key, sizeof key, "%p", (void *)gn);
+	return (uintptr_t)HashTable_FindValue(&snapshotIndex, key);
+}
+
+/* Write a reference to a node, which may be NULL, to the snapshot. */
+void
+Targ_SaveNodeRef(GNode *gn)
+{
+	Snapshot_PutNum(SnapshotNodeNumber(gn));
+}
+
+GNode *
+Targ_RestoreNodeRef(void)
+{
+	size_t i = Snapshot_GetIndex(snapshotNodes.len + 1);
+
+	return i > 0 ? *(GNode **)Vector_Get(&snapshotNodes, i - 1) : NULL;
+}
+
+static void
+SaveNodeRefs(GNodeVec *gnodes)
+{
+	size_t i;
+
+	Snapshot_PutNum(gnodes->len);
+	for (i = 0; i < gnodes->len; i++)
+		Snapshot_PutNum(
+		    SnapshotNodeNumber(GNodeVec_Get(gnodes, i)) - 1);
+}
+
+static void
+RestoreNodeRefs(GNodeVec *gnodes)
+{
+	unsigned long long n;
+
+	for (n = Snapshot_GetNum(); n > 0; n--) {
+		size_t i = Snapshot_GetIndex(snapshotNodes.len);
+		GNodeVec_Append(gnodes,
+		    *(GNode **)Vector_Get(&snapshotNodes, i));
+	}
+}
+
+/* Read a string that is empty for NULL. */
+static char *
+RestoreOptStr(void)
+{
+	char *str = Snapshot_GetStr();
+
+	if (str[0] != '\0')
+		return str;
+	free(str);
+	return NULL;
+}
+
+static void
+SaveNode(GNode *gn)
+{
+	unsigned long long flags = 0;
+	StringListNode *ln;
+	size_t n = 0;
+
+	Snapshot_PutStr(gn->uname != NULL ? gn->uname : "");
+	Snapshot_PutStr(gn->path != NULL ? gn->path : "");
+	Snapshot_PutNum(gn->type);
+	/* The snapshot is only read by the same executable. */
+	memcpy(&flags, &gn->flags, sizeof gn->flags);
+	Snapshot_PutNum(flags);
+	Snapshot_PutNum((unsigned)gn->unmade);
+	SaveNodeRefs(&gn->implicitParents);
+	SaveNodeRefs(&gn->parents);
+	SaveNodeRefs(&gn->children);
+	SaveNodeRefs(&gn->order_pred);
+	SaveNodeRefs(&gn->order_succ);
+	SaveNodeRefs(&gn->cohorts);
+	Snapshot_PutStr(gn->cohort_num);
+	Snapshot_PutNum((unsigned)gn->unmade_cohorts);
+	Targ_SaveNodeRef(gn->centurion);
+	Var_SaveScope(gn);
+	for (ln = gn->commands.first; ln != NULL; ln = ln->next)
+		n++;
+	Snapshot_PutNum(n);
+	for (ln = gn->commands.first; ln != NULL; ln = ln->next)
+		Snapshot_PutStr(ln->datum);
+	Snapshot_PutStr(gn->fname != NULL ? gn->fname : "");
+	Snapshot_PutNum(gn->lineno);
+	Snapshot_PutNum(Targ_FindNode(gn->name) == gn);
+}
+
+static void
+RestoreNode(GNode *gn)
+{
+	unsigned long long flags, n;
+	char *str;
+
+	gn->uname = RestoreOptStr();
+	gn->path = RestoreOptStr();
+	gn->type = (GNodeType)Snapshot_GetNum();
+	flags = Snapshot_GetNum();
+	memcpy(&gn->flags, &flags, sizeof gn->flags);
+	gn->unmade = (int)Snapshot_GetNum();
+	RestoreNodeRefs(&gn->implicitParents);
+	RestoreNodeRefs(&gn->parents);
+	RestoreNodeRefs(&gn->children);
+	RestoreNodeRefs(&gn->order_pred);
+	RestoreNodeRefs(&gn->order_succ);
+	RestoreNodeRefs(&gn->cohorts);
+	str = Snapshot_GetStr();
+	snprintf(gn->cohort_num, sizeof gn->cohort_num, "%s", str);
+	free(str);
+	gn->unmade_cohorts = (int)Snapshot_GetNum();
+	gn->centurion = Targ_RestoreNodeRef();
+	Var_RestoreScope(gn);
+	for (n = Snapshot_GetNum(); n > 0; n--) {
+		char *cmd = Snapshot_GetStr();
+		Parse_RegisterCommand(cmd);
+		Lst_Append(&gn->commands, cmd);
+	}
+	str = RestoreOptStr();
+	gn->fname = str != NULL ? Str_Intern(str) : NULL;
+	free(str);
+	gn->lineno = (unsigned)Snapshot_GetNum();
+	if (Snapshot_GetNum() != 0)
+		HashTable_Set(&allTargetsByName, gn->name, gn);
+}
+
+/*
+ * Write all nodes to the snapshot, see snapshot.c: first the targets, then
+ * the nodes that are only reachable from them or from the transformation
+ * rules, such as .DEFAULT.  The index of each node stays available for
+ * Targ_SaveNodeRef until Targ_SnapshotDone.
+ */
+void
+Targ_SaveSnapshot(void)
+{
+	GNodeListNode *ln;
+	size_t i, numTargets;
+
+	Vector_Init(&snapshotNodes, sizeof(GNode *));
+	HashTable_Init(&snapshotIndex);
+	for (ln = allTargets.first; ln != NULL; ln = ln->next)
+		SnapshotAddNode(ln->datum);
+	numTargets = snapshotNodes.len;
+	for (ln = Suff_Transforms()->first; ln != NULL; ln = ln->next)
+		SnapshotAddNode(ln->datum);
+	SnapshotAddNode(defaultNode);
+	SnapshotAddNode(mainNode);
+	for (i = 0; i < snapshotNodes.len; i++) {
+		GNode *gn = *(GNode **)Vector_Get(&snapshotNodes, i);
+
+		SnapshotAddNodes(&gn->implicitParents);
+		SnapshotAddNodes(&gn->parents);
+		SnapshotAddNodes(&gn->children);
+		SnapshotAddNodes(&gn->order_pred);
+		SnapshotAddNodes(&gn->order_succ);
+		SnapshotAddNodes(&gn->cohorts);
+		SnapshotAddNode(gn->centurion);
+	}
+
+	Snapshot_PutNum(snapshotNodes.len);
+	Snapshot_PutNum(numTargets);
+	for (i = 0; i < snapshotNodes.len; i++) {
+		GNode *gn = *(GNode **)Vector_Get(&snapshotNodes, i);
+		Snapshot_PutStr(gn->name);
+	}
+	for (i = 0; i < snapshotNodes.len; i++)
+		SaveNode(*(GNode **)Vector_Get(&snapshotNodes, i));
+	Targ_SaveNodeRef(defaultNode);
+	Targ_SaveNodeRef(mainNode);
+}
+
+/* Replace the targets with those from the snapshot. */
+void
+Targ_RestoreSnapshot(void)
+{
+	size_t i, n, numTargets;
+
+	Lst_Done(&allTargets);
+	Lst_Init(&allTargets);
+	HashTable_Done(&allTargetsByName);
+	HashTable_Init(&allTargetsByName);
+
+	Vector_Init(&snapshotNodes, sizeof(GNode *));
+	HashTable_Init(&snapshotIndex);
+	n = Snapshot_GetIndex((size_t)-1);
+	numTargets = Snapshot_GetIndex(n + 1);
+	for (i = 0; i < n; i++) {
+		char *name = Snapshot_GetStr();
+		GNode *gn = GNode_New(name);
+
+		free(name);
+		*(GNode **)Vector_Push(&snapshotNodes) = gn;
+		if (i < numTargets)
+			Lst_Append(&allTargets, gn);
+	}
+	for (i = 0; i < n; i++)
+		RestoreNode(*(GNode **)Vector_Get(&snapshotNodes, i));
+	defaultNode = Targ_RestoreNodeRef();
+	mainNode = Targ_RestoreNodeRef();
+}
+
+void
+Targ_SnapshotDone(void)
+{
+	Vector_Done(&snapshotNodes);
+	HashTable_Done(&snapshotIndex);
+}
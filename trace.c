@@ -99,7 +99,7 @@ Trace_Log(TrEvent event, Job *job)
 
 		Job_FlagsToString(job, flags, sizeof flags);
 		fprintf(trfile, " %s %lu %s %x", job->node->name,
-		    job->pid, flags, job->node->type);
+		    job->proc.pid, flags, job->node->type);
 	}
 	fputc('\n', trfile);
 	fflush(trfile);
@@ -135,6 +135,32 @@ tre_have_approx(const regex_t *preg)
   return tnfa->have_approx;
 }
 
+/* Returns nonzero if the string may contain the literal that every match
+   of the regexp contains. */
+static int
+tre_may_match(const tre_tnfa_t *tnfa, const char *str, int len)
+{
+  const char *lit = tnfa->must_lit;
+  size_t lit_len = tnfa->must_len;
+  const char *end;
+
+  if (len < 0)
+    return lit_len == 1 ? strchr(str, lit[0]) != NULL
+      : strstr(str, lit) != NULL;
+
+  end = str + len;
+  while ((size_t)(end - str) >= lit_len)
+    {
+      str = memchr(str, lit[0], (size_t)(end - str) - lit_len + 1);
+      if (str == NULL)
+	return 0;
+      if (memcmp(str + 1, lit + 1, lit_len - 1) == 0)
+	return 1;
+      str++;
+    }
+  return 0;
+}
+
 static int
 tre_match(const tre_tnfa_t *tnfa, const void *string, size_t len,
 	  tre_str_type_t type, size_t nmatch, regmatch_t pmatch[],
@@ -142,6 +168,27 @@ tre_match(const tre_tnfa_t *tnfa, const void *string, size_t len,
 {
   reg_errcode_t status;
   int *tags = NULL, eo;
+
+  /* Most strings do not match, find that out cheaply if possible. */
+  if (!tnfa->have_approx && !(eflags & REG_APPROX_MATCHER))
+    {
+      if (tnfa->must_lit != NULL && (type == STR_BYTE || type == STR_MBS)
+	  && !tre_may_match(tnfa, string, (int)len))
+	return REG_NOMATCH;
+      if (type == STR_BYTE && !tnfa->have_backrefs
+	  && !(eflags & REG_BACKTRACKING_MATCHER))
+	switch (tre_dfa_match(tnfa, string, (int)len, eflags))
+	  {
+	  case 0:
+	    return REG_NOMATCH;
+	  case 1:
+	    /* Without submatches to fill, that is all there is to know. */
+	    if (nmatch == 0)
+	      return REG_OK;
+	    break;
+	  }
+    }
+
   if (tnfa->num_tags > 0 && nmatch > 0)
     {
 #ifdef TRE_USE_ALLOCA
@@ -1850,6 +1850,210 @@ tre_ast_to_tnfa(tre_ast_node_t *node, tre_tnfa_transition_t *transitions,
  while (/*CONSTCOND*/(void)0,0)
 
 
+/*
+  Algorithms to find a string that every match contains.
+*/
+
+/* The longest strings that are kept, and the deepest recursion. */
+#define TRE_LIT_MAX 32
+#define TRE_LIT_DEPTH 256
+
+/* What is known about the strings that a subexpression matches.  If
+   `exact' is set, it only matches `pre', and `suf' and `must' are the
+   same string.  Otherwise every match starts with `pre', ends with `suf'
+   and contains `must'.  The strings may be empty. */
+typedef struct {
+  int exact;
+  size_t pre_len, suf_len, must_len;
+  char pre[TRE_LIT_MAX], suf[TRE_LIT_MAX], must[TRE_LIT_MAX];
+} tre_lit_info_t;
+
+static void
+tre_lit_exact(tre_lit_info_t *info, const char *str, size_t len)
+{
+  info->exact = 1;
+  info->pre_len = info->suf_len = info->must_len = len;
+  memcpy(info->pre, str, len);
+  memcpy(info->suf, str, len);
+  memcpy(info->must, str, len);
+}
+
+/* Keep the longer of `must' and the given string, of which at most
+   TRE_LIT_MAX characters are needed. */
+static void
+tre_lit_must(tre_lit_info_t *info, const char *str, size_t len)
+{
+  if (len > TRE_LIT_MAX)
+    len = TRE_LIT_MAX;
+  if (len > info->must_len)
+    {
+      memcpy(info->must, str, len);
+      info->must_len = len;
+    }
+}
+
+static void
+tre_lit_catenate(tre_lit_info_t *info, const tre_lit_info_t *l,
+		 const tre_lit_info_t *r)
+{
+  char join[2 * TRE_LIT_MAX];
+  size_t len;
+
+  if (l->exact && r->exact && l->pre_len + r->pre_len <= TRE_LIT_MAX)
+    {
+      memcpy(join, l->pre, l->pre_len);
+      memcpy(join + l->pre_len, r->pre, r->pre_len);
+      tre_lit_exact(info, join, l->pre_len + r->pre_len);
+      return;
+    }
+
+  info->exact = 0;
+  if (l->exact)
+    {
+      memcpy(join, l->pre, l->pre_len);
+      memcpy(join + l->pre_len, r->pre, r->pre_len);
+      info->pre_len = l->pre_len + r->pre_len;
+      if (info->pre_len > TRE_LIT_MAX)
+	info->pre_len = TRE_LIT_MAX;
+      memcpy(info->pre, join, info->pre_len);
+    }
+  else
+    {
+      info->pre_len = l->pre_len;
+      memcpy(info->pre, l->pre, l->pre_len);
+    }
+  if (r->exact)
+    {
+      memcpy(join, l->suf, l->suf_len);
+      memcpy(join + l->suf_len, r->suf, r->suf_len);
+      len = l->suf_len + r->suf_len;
+      info->suf_len = len > TRE_LIT_MAX ? TRE_LIT_MAX : len;
+      memcpy(info->suf, join + len - info->suf_len, info->suf_len);
+    }
+  else
+    {
+      info->suf_len = r->suf_len;
+      memcpy(info->suf, r->suf, r->suf_len);
+    }
+
+  /* The end of the left side is followed by the start of the right. */
+  info->must_len = 0;
+  tre_lit_must(info, l->must, l->must_len);
+  tre_lit_must(info, r->must, r->must_len);
+  memcpy(join, l->suf, l->suf_len);
+  memcpy(join + l->suf_len, r->pre, r->pre_len);
+  tre_lit_must(info, join, l->suf_len + r->pre_len);
+  tre_lit_must(info, info->pre, info->pre_len);
+  tre_lit_must(info, info->suf, info->suf_len);
+}
+
+static void
+tre_lit_union(tre_lit_info_t *info, const tre_lit_info_t *l,
+	      const tre_lit_info_t *r)
+{
+  size_t n;
+
+  if (l->exact && r->exact && l->pre_len == r->pre_len
+      && memcmp(l->pre, r->pre, l->pre_len) == 0)
+    {
+      *info = *l;
+      return;
+    }
+
+  info->exact = 0;
+  for (n = 0; n < l->pre_len && n < r->pre_len && l->pre[n] == r->pre[n];)
+    n++;
+  info->pre_len = n;
+  memcpy(info->pre, l->pre, n);
+  for (n = 0; n < l->suf_len && n < r->suf_len
+	 && l->suf[l->suf_len - 1 - n] == r->suf[r->suf_len - 1 - n];)
+    n++;
+  info->suf_len = n;
+  memcpy(info->suf, l->suf + l->suf_len - n, n);
+  info->must_len = 0;
+  tre_lit_must(info, info->pre, info->pre_len);
+  tre_lit_must(info, info->suf, info->suf_len);
+}
+
+static void
+tre_lit_analyze(tre_ast_node_t *node, tre_lit_info_t *info, int depth)
+{
+  tre_lit_info_t l, r;
+
+  memset(info, 0, sizeof(*info));
+  if (depth > TRE_LIT_DEPTH)
+    return;
+
+  switch (node->type)
+    {
+    case LITERAL:
+      {
+	tre_literal_t *lit = node->obj;
+	char c = (char)lit->code_min;
+
+	if (IS_EMPTY(lit) || IS_ASSERTION(lit) || IS_TAG(lit))
+	  tre_lit_exact(info, "", 0);
+	/* Only ASCII characters are the same in every encoding, so they
+	   can be searched for in the bytes of a multibyte string. */
+	else if (lit->code_min == lit->code_max
+		 && lit->code_min > 0 && lit->code_min < 0x80
+		 && !lit->u.class && lit->neg_classes == NULL)
+	  tre_lit_exact(info, &c, 1);
+	break;
+      }
+    case CATENATION:
+      {
+	tre_catenation_t *cat = node->obj;
+	tre_lit_analyze(cat->left, &l, depth + 1);
+	tre_lit_analyze(cat->right, &r, depth + 1);
+	tre_lit_catenate(info, &l, &r);
+	break;
+      }
+    case UNION:
+      {
+	tre_union_t *uni = node->obj;
+	tre_lit_analyze(uni->left, &l, depth + 1);
+	tre_lit_analyze(uni->right, &r, depth + 1);
+	tre_lit_union(info, &l, &r);
+	break;
+      }
+    case ITERATION:
+      {
+	tre_iteration_t *iter = node->obj;
+	if (iter->max == 0)
+	  tre_lit_exact(info, "", 0);
+	else if (iter->min > 0)
+	  {
+	    tre_lit_analyze(iter->arg, info, depth + 1);
+	    if (iter->min != 1 || iter->max != 1)
+	      info->exact = 0;
+	  }
+	break;
+      }
+    }
+}
+
+/* Set tnfa->must_lit to the longest string found that every match of the
+   regexp contains, if any.  Matching can then skip strings that do not
+   contain it. */
+static reg_errcode_t
+tre_compute_must(tre_ast_node_t *tree, tre_tnfa_t *tnfa)
+{
+  tre_lit_info_t info;
+
+  tre_lit_analyze(tree, &info, 0);
+  if (info.must_len == 0)
+    return REG_OK;
+  tnfa->must_lit = xmalloc(info.must_len + 1);
+  if (tnfa->must_lit == NULL)
+    return REG_ESPACE;
+  memcpy(tnfa->must_lit, info.must, info.must_len);
+  tnfa->must_lit[info.must_len] = '\0';
+  tnfa->must_len = info.must_len;
+  return REG_OK;
+}
+
+
 int
 tre_compile(regex_t *preg, const tre_char_t *regex, size_t n, int cflags)
 {
@@ -1919,6 +2123,10 @@ tre_compile(regex_t *preg, const tre_char_t *regex, size_t n, int cflags)
   tnfa->have_approx = parse_ctx.have_approx;
   tnfa->num_submatches = parse_ctx.submatch_id;
 
+  errcode = tre_compute_must(tree, tnfa);
+  if (errcode != REG_OK)
+    ERROR_EXIT(errcode);
+
   /* Set up tags for submatch addressing.  If REG_NOSUB is set and the
      regexp does not have back references, this can be skipped. */
   if (tnfa->have_backrefs || !(cflags & REG_NOSUB))
@@ -2150,6 +2358,7 @@ tre_compile(regex_t *preg, const tre_char_t *regex, size_t n, int cflags)
   tnfa->final = transitions + offs[tree->lastpos[0].position];
   tnfa->num_states = parse_ctx.position;
   tnfa->cflags = cflags;
+  tre_dfa_build(tnfa);
 
   DPRINT(("final state %p\n", (void *)tnfa->final));
 
@@ -2228,6 +2437,9 @@ tre_free(regex_t *preg)
     xfree(tnfa->firstpos_chars);
   if (tnfa->minimal_tags)
     xfree(tnfa->minimal_tags);
+  if (tnfa->must_lit)
+    xfree(tnfa->must_lit);
+  tre_dfa_free(tnfa->dfa);
   xfree(tnfa);
 }
 
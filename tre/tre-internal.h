@@ -230,6 +230,9 @@ struct tre_submatch_data {
 typedef struct tre_submatch_data tre_submatch_data_t;
 
 
+/* DFA that decides whether there is a match, see tre-match-dfa.c. */
+typedef struct tre_dfa tre_dfa_t;
+
 /* TNFA definition. */
 typedef struct tnfa tre_tnfa_t;
 
@@ -252,6 +255,11 @@ struct tnfa {
   int have_backrefs;
   int have_approx;
   int params_depth;
+  /* A string that every match contains (or NULL). */
+  char *must_lit;
+  size_t must_len;
+  /* Built by tre_compile, NULL if the TNFA needs the other matchers. */
+  tre_dfa_t *dfa;
 };
 
 int
@@ -279,6 +287,16 @@ tre_tnfa_run_backtrack(const tre_tnfa_t *tnfa, const void *string,
 		       int len, tre_str_type_t type, int *match_tags,
 		       int eflags, int *match_end_ofs);
 
+int
+tre_dfa_match(const tre_tnfa_t *tnfa, const char *string, int len,
+	      int eflags);
+
+void
+tre_dfa_build(tre_tnfa_t *tnfa);
+
+void
+tre_dfa_free(tre_dfa_t *dfa);
+
 #ifdef TRE_APPROX
 reg_errcode_t
 tre_tnfa_run_approx(const tre_tnfa_t *tnfa, const void *string, int len,
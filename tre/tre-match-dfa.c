@@ -0,0 +1,429 @@
+/*
+  tre-match-dfa.c - TRE DFA for deciding whether there is a match
+
+  This software is released under a BSD-style license.
+  See the file LICENSE for details and copyright.
+
+*/
+
+/*
+  The parallel matcher keeps a set of TNFA states and the tags of the
+  path to each of them, for each character of the string.  Most strings
+  that a pattern is applied to do not match at all, and for those the
+  tags are wasted work.
+
+  This matcher only answers whether the string contains a match.  Its
+  states are the sets of TNFA states that the parallel matcher would
+  have, without the tags, so a string is scanned with one table lookup
+  per character.
+
+  tre_compile builds all the states that can be reached, with
+  tre_dfa_build.  After that, the DFA is only read, so that a compiled
+  regex can be shared and used from several threads at once, like with
+  the other matchers.
+
+  Only 8 bit strings are supported, and only TNFAs whose assertions
+  depend on at most the current character and the next one, that is, no
+  back references, word boundaries or approximate matching.  In all
+  other cases, and when the number of states would exceed
+  TRE_DFA_MAX_STATES, no DFA is built, tre_dfa_match returns -1 and the
+  caller falls back to the other matchers.
+*/
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_WCHAR_H
+#include <wchar.h>
+#endif /* HAVE_WCHAR_H */
+#ifdef HAVE_WCTYPE_H
+#include <wctype.h>
+#endif /* HAVE_WCTYPE_H */
+#ifndef TRE_WCHAR
+#include <ctype.h>
+#endif /* !TRE_WCHAR */
+
+#include "tre-internal.h"
+#include "tre-match-utils.h"
+#include "xmalloc.h"
+
+#define TRE_DFA_MAX_STATES 256
+
+/* The assertions that only depend on the current and the next character. */
+#define TRE_DFA_ASSERTIONS \
+  (ASSERT_AT_BOL | ASSERT_AT_EOL | ASSERT_CHAR_CLASS | ASSERT_CHAR_CLASS_NEG)
+
+/* A transition is taken for a character and whether an end of line
+   follows it. */
+#define TRE_DFA_INPUTS 512
+
+typedef struct {
+  int *ids;		/* Sorted ids of the TNFA states. */
+  int num_ids;
+  unsigned int hash;
+  int final;		/* Whether the final TNFA state is in the set. */
+  int dead;		/* Whether no match can follow. */
+  short next[TRE_DFA_INPUTS];	/* Index of the next state, or -1 in
+				   final and dead states. */
+} tre_dfa_state_t;
+
+struct tre_dfa {
+  int reg_newline;
+  /* Whether all initial transitions require the beginning of a line. */
+  int initial_bol;
+  /* The TNFA state with the given id. */
+  tre_tnfa_transition_t **states;
+  tre_dfa_state_t *dstates[TRE_DFA_MAX_STATES];
+  int num_dstates;
+  /* The state at the beginning of the string, by BOL and EOL there. */
+  short start[4];
+  /* Scratch space for building the states, freed when done. */
+  int *work;
+  unsigned char *seen;
+};
+
+
+static void
+tre_dfa_add(tre_dfa_t *dfa, int id, int *num)
+{
+  if (!dfa->seen[id])
+    {
+      dfa->seen[id] = 1;
+      dfa->work[(*num)++] = id;
+    }
+}
+
+/* Add the initial states whose assertions hold at a position where the
+   beginning and end of line are as given. */
+static void
+tre_dfa_add_initial(const tre_tnfa_t *tnfa, tre_dfa_t *dfa, int bol, int eol,
+		    int *num)
+{
+  tre_tnfa_transition_t *trans_i;
+
+  for (trans_i = tnfa->initial; trans_i->state != NULL; trans_i++)
+    {
+      if ((trans_i->assertions & ASSERT_AT_BOL) && !bol)
+	continue;
+      if ((trans_i->assertions & ASSERT_AT_EOL) && !eol)
+	continue;
+      tre_dfa_add(dfa, trans_i->state_id, num);
+    }
+}
+
+static int
+tre_dfa_cmp(const void *a, const void *b)
+{
+  return *(const int *)a - *(const int *)b;
+}
+
+/* Return the index of the state for the set in dfa->work, creating it if
+   necessary, or -1 if there are too many states. */
+static int
+tre_dfa_intern(const tre_tnfa_t *tnfa, tre_dfa_t *dfa, int num)
+{
+  tre_dfa_state_t *ds;
+  unsigned int hash = 0;
+  int i;
+
+  for (i = 0; i < num; i++)
+    dfa->seen[dfa->work[i]] = 0;
+  qsort(dfa->work, (size_t)num, sizeof(*dfa->work), tre_dfa_cmp);
+  for (i = 0; i < num; i++)
+    hash = hash * 31 + (unsigned int)dfa->work[i];
+
+  for (i = 0; i < dfa->num_dstates; i++)
+    {
+      ds = dfa->dstates[i];
+      if (ds->hash == hash && ds->num_ids == num
+	  && memcmp(ds->ids, dfa->work, sizeof(*ds->ids) * num) == 0)
+	return i;
+    }
+
+  if (dfa->num_dstates == TRE_DFA_MAX_STATES)
+    return -1;
+  ds = xmalloc(sizeof(*ds) + sizeof(*ds->ids) * (num + 1));
+  if (ds == NULL)
+    return -1;
+  ds->ids = (int *)(ds + 1);
+  memcpy(ds->ids, dfa->work, sizeof(*ds->ids) * num);
+  ds->num_ids = num;
+  ds->hash = hash;
+  ds->final = 0;
+  for (i = 0; i < num; i++)
+    if (dfa->states[ds->ids[i]] == tnfa->final)
+      ds->final = 1;
+  /* Past the beginning of the string, initial states are only added at
+     the beginning of a line. */
+  ds->dead = num == 0 && dfa->initial_bol && !dfa->reg_newline;
+  for (i = 0; i < TRE_DFA_INPUTS; i++)
+    ds->next[i] = -1;
+  dfa->dstates[dfa->num_dstates] = ds;
+  return dfa->num_dstates++;
+}
+
+/* Compute the state after reading the character `prev_c' in state `from',
+   where `eol' tells whether an end of line follows the character. */
+static int
+tre_dfa_step(const tre_tnfa_t *tnfa, tre_dfa_t *dfa, int from,
+	     tre_cint_t prev_c, int eol)
+{
+  tre_dfa_state_t *ds = dfa->dstates[from];
+  tre_tnfa_transition_t *trans_i;
+  int bol = dfa->reg_newline && prev_c == L'\n';
+  int i, num = 0;
+
+  for (i = 0; i < ds->num_ids; i++)
+    for (trans_i = dfa->states[ds->ids[i]]; trans_i->state; trans_i++)
+      {
+	if (trans_i->code_min > prev_c || trans_i->code_max < prev_c)
+	  continue;
+	if ((trans_i->assertions & ASSERT_AT_BOL) && !bol)
+	  continue;
+	if ((trans_i->assertions & ASSERT_AT_EOL) && !eol)
+	  continue;
+	if (CHECK_CHAR_CLASSES(trans_i, tnfa, 0))
+	  continue;
+	tre_dfa_add(dfa, trans_i->state_id, &num);
+      }
+
+  /* The parallel matcher adds the initial states at each position until
+     it has found a match. */
+  tre_dfa_add_initial(tnfa, dfa, bol, eol, &num);
+  return tre_dfa_intern(tnfa, dfa, num);
+}
+
+/* Return whether the DFA can decide on its own for the TNFA. */
+static int
+tre_dfa_usable(const tre_tnfa_t *tnfa, int *out_initial_bol)
+{
+  tre_tnfa_transition_t *trans_i;
+  unsigned int i;
+
+  if (tnfa->have_backrefs || tnfa->have_approx)
+    return 0;
+  for (i = 0; i < tnfa->num_transitions; i++)
+    {
+      trans_i = &tnfa->transitions[i];
+      if (trans_i->state != NULL
+	  && (trans_i->assertions & ~TRE_DFA_ASSERTIONS
+	      || trans_i->params != NULL))
+	return 0;
+    }
+  *out_initial_bol = 1;
+  for (trans_i = tnfa->initial; trans_i->state != NULL; trans_i++)
+    {
+      if (trans_i->assertions & ~TRE_DFA_ASSERTIONS
+	  || trans_i->params != NULL)
+	return 0;
+      if (!(trans_i->assertions & ASSERT_AT_BOL))
+	*out_initial_bol = 0;
+    }
+  return 1;
+}
+
+/* Set `rep[c]' to the first character that no transition tells apart
+   from `c', so that the states only need to be computed for those. */
+static void
+tre_dfa_classes(const tre_tnfa_t *tnfa, unsigned char *rep)
+{
+  tre_tnfa_transition_t *trans_i;
+  unsigned char split[TRE_DFA_INPUTS / 2 + 1];
+  unsigned int i;
+  int c, prev_c, match;
+
+  memset(split, 0, sizeof(split));
+  split[0] = 1;
+  /* The beginning of a line follows a newline. */
+  split[L'\n'] = split[L'\n' + 1] = 1;
+  for (i = 0; i < tnfa->num_transitions; i++)
+    {
+      trans_i = &tnfa->transitions[i];
+      if (trans_i->state == NULL)
+	continue;
+      if ((unsigned int)trans_i->code_min <= 255)
+	split[trans_i->code_min] = 1;
+      if ((unsigned int)trans_i->code_max < 255)
+	split[trans_i->code_max + 1] = 1;
+      if (!(trans_i->assertions & (ASSERT_CHAR_CLASS | ASSERT_CHAR_CLASS_NEG)))
+	continue;
+      prev_c = 0;
+      match = !CHECK_CHAR_CLASSES(trans_i, tnfa, 0);
+      for (c = 1; c <= 255; c++)
+	{
+	  prev_c = c;
+	  if (match == CHECK_CHAR_CLASSES(trans_i, tnfa, 0))
+	    {
+	      split[c] = 1;
+	      match = !match;
+	    }
+	}
+    }
+
+  for (c = 0; c <= 255; c++)
+    rep[c] = (unsigned char)(split[c] ? c : rep[c - 1]);
+}
+
+/* Create all the states that can be reached, and the transitions between
+   them.  Return 0 if there would be too many states. */
+static int
+tre_dfa_fill(const tre_tnfa_t *tnfa, tre_dfa_t *dfa)
+{
+  tre_dfa_state_t *ds;
+  tre_tnfa_transition_t *trans_i;
+  unsigned char rep[TRE_DFA_INPUTS / 2];
+  unsigned int t;
+  int i, c, eol, next, num, max_eol = 0;
+
+  tre_dfa_classes(tnfa, rep);
+  /* Without end of line assertions, the end of line does not matter. */
+  for (t = 0; t < tnfa->num_transitions; t++)
+    if (tnfa->transitions[t].state != NULL
+	&& tnfa->transitions[t].assertions & ASSERT_AT_EOL)
+      max_eol = 1;
+  for (trans_i = tnfa->initial; trans_i->state != NULL; trans_i++)
+    if (trans_i->assertions & ASSERT_AT_EOL)
+      max_eol = 1;
+
+  for (i = 0; i < 4; i++)
+    {
+      num = 0;
+      tre_dfa_add_initial(tnfa, dfa, i >> 1, i & 1, &num);
+      if ((next = tre_dfa_intern(tnfa, dfa, num)) < 0)
+	return 0;
+      dfa->start[i] = (short)next;
+    }
+
+  /* The states that are created along the way are appended, and are
+     filled in by a later iteration. */
+  for (i = 0; i < dfa->num_dstates; i++)
+    {
+      ds = dfa->dstates[i];
+      /* tre_dfa_match stops before reading from these. */
+      if (ds->final || ds->dead)
+	continue;
+      for (c = 0; c < TRE_DFA_INPUTS / 2; c++)
+	for (eol = 0; eol < 2; eol++)
+	  {
+	    if (eol > max_eol)
+	      next = ds->next[c * 2];
+	    else if (rep[c] != c)
+	      next = ds->next[rep[c] * 2 + eol];
+	    else if ((next = tre_dfa_step(tnfa, dfa, i, c, eol)) < 0)
+	      return 0;
+	    ds->next[c * 2 + eol] = (short)next;
+	  }
+    }
+  return 1;
+}
+
+void
+tre_dfa_build(tre_tnfa_t *tnfa)
+{
+  tre_dfa_t *dfa;
+  tre_tnfa_transition_t *trans_i;
+  unsigned int i;
+  int initial_bol, ok;
+
+  tnfa->dfa = NULL;
+  if (!tre_dfa_usable(tnfa, &initial_bol))
+    return;
+
+  dfa = xcalloc(1, sizeof(*dfa));
+  if (dfa == NULL)
+    return;
+  dfa->reg_newline = tnfa->cflags & REG_NEWLINE;
+  dfa->initial_bol = initial_bol;
+  dfa->states = xcalloc((unsigned)tnfa->num_states, sizeof(*dfa->states));
+  dfa->work = xmalloc(sizeof(*dfa->work) * tnfa->num_states);
+  dfa->seen = xcalloc((unsigned)tnfa->num_states, 1);
+  ok = dfa->states != NULL && dfa->work != NULL && dfa->seen != NULL;
+  if (ok)
+    {
+      for (i = 0; i < tnfa->num_transitions; i++)
+	{
+	  trans_i = &tnfa->transitions[i];
+	  if (trans_i->state != NULL)
+	    dfa->states[trans_i->state_id] = trans_i->state;
+	}
+      for (trans_i = tnfa->initial; trans_i->state != NULL; trans_i++)
+	dfa->states[trans_i->state_id] = trans_i->state;
+      ok = tre_dfa_fill(tnfa, dfa);
+    }
+
+  xfree(dfa->work);
+  dfa->work = NULL;
+  xfree(dfa->seen);
+  dfa->seen = NULL;
+  if (!ok)
+    {
+      tre_dfa_free(dfa);
+      return;
+    }
+  tnfa->dfa = dfa;
+}
+
+void
+tre_dfa_free(tre_dfa_t *dfa)
+{
+  int i;
+
+  if (dfa == NULL)
+    return;
+  for (i = 0; i < dfa->num_dstates; i++)
+    xfree(dfa->dstates[i]);
+  if (dfa->states)
+    xfree(dfa->states);
+  if (dfa->work)
+    xfree(dfa->work);
+  if (dfa->seen)
+    xfree(dfa->seen);
+  xfree(dfa);
+}
+
+/* Return 1 if the 8 bit string contains a match, 0 if it doesn't, or -1
+   if the DFA cannot tell. */
+int
+tre_dfa_match(const tre_tnfa_t *tnfa, const char *string, int len,
+	      int eflags)
+{
+  const unsigned char *str = (const unsigned char *)string;
+  const tre_dfa_t *dfa = tnfa->dfa;
+  int reg_notbol = eflags & REG_NOTBOL;
+  int reg_noteol = eflags & REG_NOTEOL;
+  int pos, cur, eol;
+  tre_cint_t c, next_c;
+
+  if (dfa == NULL)
+    return -1;
+
+  next_c = len == 0 ? 0 : str[0];
+  eol = (next_c == L'\0' && !reg_noteol)
+    || (next_c == L'\n' && dfa->reg_newline);
+  cur = dfa->start[!reg_notbol * 2 + eol];
+
+  for (pos = 0;; pos++)
+    {
+      const tre_dfa_state_t *ds = dfa->dstates[cur];
+
+      if (ds->final)
+	return 1;
+      if (ds->dead)
+	return 0;
+
+      /* Like the parallel matcher, stop at the end of the string. */
+      c = next_c;
+      if (len < 0 ? c == L'\0' : pos >= len)
+	return 0;
+      next_c = (len >= 0 && pos + 1 >= len) ? 0 : str[pos + 1];
+      eol = (next_c == L'\0' && !reg_noteol)
+	|| (next_c == L'\n' && dfa->reg_newline);
+      cur = ds->next[c * 2 + eol];
+    }
+}
+
+/* EOF */
@@ -0,0 +1,39 @@
+# Tests for the special source .BATCH in dependency declarations, which
+# lets a single job make all targets that are ready to be made by the same
+# transformation rule.  This only happens in jobs mode.
+
+all: .PHONY
+	@${MAKE} -r -f ${MAKEFILE} -j1 objs
+	@${MAKE} -r -f ${MAKEFILE} -j1 .MAKE.BATCH_MAX=2 objs
+	@${MAKE} -r -f ${MAKEFILE} -j1 .MAKE.BATCH_MAX=1 objs
+	@${MAKE} -r -f ${MAKEFILE} -j1 .MAKE.SCHEDULER=critpath objs
+	@-${MAKE} -r -f ${MAKEFILE} -j1 -k fails
+	@if not exist ?.fail echo all targets of the batch removed
+
+.SUFFIXES: .c .obj .fail
+
+# In the commands for a batch, the variables .IMPSRC, .TARGET and .PREFIX
+# list the values of all targets in the batch.
+.c.obj: .BATCH
+	@echo compile ${.IMPSRC} to ${.TARGET}
+
+# A target with commands of its own is made by its own job.
+own.obj: own.c
+	@echo own ${.IMPSRC}
+
+objs: .PHONY a.obj b.obj c.obj own.obj
+	@echo link ${.ALLSRC}
+
+a.c b.c c.c own.c: .PHONY
+
+# When the commands of a batch fail, all targets of the batch are deleted,
+# as they may have been created by the commands.
+.if make(fails)
+.DELETE_ON_ERROR:
+.endif
+
+.c.fail: .BATCH
+	@${.TARGET:@t@type nul > $t& @}exit 1
+
+fails: .PHONY a.fail b.fail c.fail
+	@echo link ${.ALLSRC}
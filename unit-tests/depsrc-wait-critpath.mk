@@ -0,0 +1,19 @@
+# Tests for the special source .WAIT with the critpath scheduler, see
+# .MAKE.SCHEDULER.
+#
+# The critpath scheduler does not make the children of a target from left to
+# right but starts with the longest chain of dependencies.  Still, the nodes
+# to the right of a .WAIT, including their own prerequisites, are only made
+# after the nodes to its left.
+
+.MAKEFLAGS: -j1
+.MAKE.SCHEDULER=	critpath
+
+# Without the .WAIT, 'b1' would be made first, since the chain 'b1', 'b',
+# 'x' is the longest.
+x: a .WAIT b
+	@echo x
+b: b1
+	@echo b
+a b1:
+	@echo ${.TARGET}
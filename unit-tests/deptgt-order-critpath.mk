@@ -0,0 +1,21 @@
+# Tests for the special target .ORDER with the critpath scheduler, see
+# .MAKE.SCHEDULER.
+#
+# The critpath scheduler does not make the children of a target from left to
+# right but starts with the longest chain of dependencies.  Still, a node on
+# the right-hand side of .ORDER and its own prerequisites are only made
+# after the nodes on the left-hand side.
+
+.MAKEFLAGS: -j1
+.MAKE.SCHEDULER=	critpath
+
+all: .PHONY first second
+
+.ORDER: first second
+
+# Without the .ORDER, 'second-child' would be made first, since the chain
+# 'second-child', 'second', 'all' is the longest.
+second: second-child
+
+first second second-child: .PHONY
+	@echo ${.TARGET}
@@ -0,0 +1,48 @@
+# Tests for running the command of a job without the shell, which make does
+# for a target with a single simple command, see Shell_FindProgram.  The
+# -dj debug output tells whether the shell runs the command.
+
+FILE:=		${.PARSEFILE:R}.tmp
+BATCH=		${.PARSEFILE:R}-batch
+PROG=		${.PARSEFILE:R}-prog
+
+.MAIN: all
+
+.if make(all)
+all:
+	@echo b> ${FILE}& echo a>> ${FILE}
+	@echo @echo batch> ${BATCH}.bat
+	@${MAKE} -r -f ${MAKEFILE} -j1 -dj -dF${FILE}.log direct
+	@findstr /c:"Running " /c:"Command" ${FILE}.log
+
+.END:
+	@del ${FILE} ${FILE}.log ${BATCH}.bat ${PROG}.exe ${PROG}.bat 2>nul
+.endif
+
+direct: .PHONY plain .WAIT builtin .WAIT meta .WAIT batch .WAIT \
+	copy .WAIT copied .WAIT replace .WAIT replaced
+
+# The program is found in the PATH, so the shell is not needed.
+plain: .PHONY
+	@sort ${FILE}
+
+# The shell runs its builtins itself, and the metacharacters need it.
+builtin: .PHONY
+	@echo builtin
+meta: .PHONY
+	@sort ${FILE} | sort /r
+
+# Batch files are run by the shell as well.
+batch: .PHONY
+	@${BATCH}
+
+# A program that was found is looked up again for each command, since an
+# earlier command may have replaced it, here by a batch file.
+copy: .PHONY
+	@copy /y %SystemRoot%\System32\sort.exe ${PROG}.exe >nul
+copied: .PHONY
+	@${PROG} ${FILE}
+replace: .PHONY
+	@del ${PROG}.exe & copy ${BATCH}.bat ${PROG}.bat >nul
+replaced: .PHONY
+	@${PROG} ${FILE}
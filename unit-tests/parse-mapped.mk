@@ -0,0 +1,62 @@
+# Tests for large makefiles, such as generated dependency files, which are
+# mapped instead of read into a buffer, see MapFile in parse.c.  Only files
+# of at least 64 KiB that end with a newline and have no carriage returns
+# are mapped; the others are read as usual.
+
+DIR:=		${.PARSEFILE:R}.tmp
+PAD=		xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx
+# 1000 lines of about 70 bytes.  There are no spaces in them, since :ts
+# only joins words.
+LINES=		${:U:range=1000:@i@VAR$i=${PAD}@}
+# In these, a '/' at the end of a word becomes a backslash at the end of
+# a line.
+CONT=		${LINES} LAST=one/ two/
+CONTNONL=	${LINES} LAST=one/
+
+FILE.cont=	${CONT:S,/$,\\,:ts\n}
+FILE.nonl=	${LINES:ts\n}
+FILE.contnonl=	${CONTNONL:S,/$,\\,:ts\n}
+
+# Make writes its output in binary mode, so the lines end with LF only.
+# The target "gen" is not made, it only keeps make(all) false.
+GEN=		${MAKE} -r -f ${MAKEFILE} gen -v
+RUN=		${MAKE} -r -dp -dF${DIR}\debug.log -v LAST -f
+MAPPED=		findstr /c:"PushFile: mapped" ${DIR}\debug.log > nul \
+		&& echo mapped || echo read
+# Write without a newline; set /p fails as there is no input.
+NONL=		<nul set /p
+
+# Without a target on the command line, make(all) is true from here on.
+.MAIN: all
+
+.if make(all)
+_!=	md ${DIR}
+
+all:
+# The file ends with a newline, so it is mapped.  The continuation of the
+# last line goes up to the end of the file.
+	@${GEN} FILE.cont > ${DIR}\cont.mk
+	@${RUN} ${DIR}\cont.mk
+	@${MAPPED}
+# The last line has no newline, so the file is read instead.
+	@${GEN} FILE.nonl > ${DIR}\nonl.mk
+	@${NONL} =LAST=no newline>> ${DIR}\nonl.mk & exit 0
+	@${RUN} ${DIR}\nonl.mk
+	@${MAPPED}
+# The continuation of the last line goes up to the end of the file, which
+# has no newline.
+	@${GEN} FILE.contnonl > ${DIR}\contnonl.mk
+	@${NONL} =two\>> ${DIR}\contnonl.mk & exit 0
+	@${RUN} ${DIR}\contnonl.mk
+	@${MAPPED}
+# With CRLF, the file is read, since in text mode, backslash-CRLF is a
+# line continuation as well.
+	@for /l %i in (1,1,1000) do @echo VAR%i=${PAD}>> ${DIR}\crlf.mk
+	@echo LAST=crlf\>> ${DIR}\crlf.mk
+	@echo two>> ${DIR}\crlf.mk
+	@${RUN} ${DIR}\crlf.mk
+	@${MAPPED}
+
+.END:
+	@rmdir /s /q ${DIR}
+.endif
@@ -0,0 +1,53 @@
+# Tests for remembering the implied sources that have been looked up along
+# the search paths of their suffixes.  The remembered sources are forgotten
+# whenever .PATH or .SUFFIXES changes.
+#
+# The search paths and the suffixes only change while the makefiles are
+# read, and the implied sources are only looked up after that.  The looked
+# up sources must come from the final .PATH and .SUFFIXES anyway, not from
+# the earlier ones.
+#
+# See also:
+#	FindSource
+
+DIR:=		${.PARSEFILE:R}
+LOG:=		${.PARSEFILE:R}.tmp
+
+.MAIN: all
+
+.if make(all)
+all:
+	@mkdir ${DIR}.1 ${DIR}.2
+	@echo first> ${DIR}.1\a.in
+	@echo second> ${DIR}.2\a.in
+	@${MAKE} -r -f ${MAKEFILE} -ds -dF${LOG} show
+	@findstr /b /c:"# implied sources:" ${LOG}
+
+.END:
+	@rmdir /s /q ${DIR}.1 ${DIR}.2
+	@del ${LOG}
+.endif
+
+.if make(show)
+# Replace the search path and the suffixes.
+.PATH: ${DIR}.1
+.SUFFIXES: .in .out
+.PATH:
+.PATH: ${DIR}.2
+.SUFFIXES:
+.SUFFIXES: .y .in .out .out2
+
+# For a.out, a.y is not found and a.in is found, 2 lookups.  For a.out2,
+# the lookup of a.y is remembered, and a.in is a node by now, 1 lookup and
+# 1 hit.
+show: .PHONY a.out a.out2
+
+.y.out:
+	@echo ${.TARGET} from ${.IMPSRC}
+.y.out2:
+	@echo ${.TARGET} from ${.IMPSRC}
+.in.out:
+	@for /f %l in (${.IMPSRC}) do @echo ${.TARGET} from %l
+.in.out2:
+	@for /f %l in (${.IMPSRC}) do @echo ${.TARGET} from %l
+.endif
@@ -0,0 +1,28 @@
+# Tests for looking up the suffixes of a target when one suffix is a tail of
+# another, such as '.gz' of '.tar.gz'.  The target has both suffixes, and the
+# implied sources for them are tried in the order in which the suffixes were
+# given to .SUFFIXES, not by their length.
+#
+# See also:
+#	FindSuffixesOf
+
+ORDER?=		.gz .tar.gz
+
+all:
+	@${MAKE} -r -f ${MAKEFILE} ORDER=".gz .tar.gz" x.tar.gz
+	@${MAKE} -r -f ${MAKEFILE} ORDER=".tar.gz .gz" x.tar.gz
+# The suffix '.tar' is not a tail of 'x.tar.gz', and '.tar.gz' is not one
+# of 'y.gz'.
+	@${MAKE} -r -f ${MAKEFILE} ORDER=".tar.gz .gz" x.tar y.gz
+
+.SUFFIXES:
+.SUFFIXES: .src .tar ${ORDER}
+
+.src.gz:
+	@echo ${.TARGET} from ${.IMPSRC} by .src.gz
+.src.tar.gz:
+	@echo ${.TARGET} from ${.IMPSRC} by .src.tar.gz
+.src.tar:
+	@echo ${.TARGET} from ${.IMPSRC} by .src.tar
+
+x.src x.tar.src y.src: .PHONY
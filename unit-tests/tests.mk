@@ -7,6 +7,16 @@ cmd-errors-jobs \
 cmd-errors-lint \
 ternary \
 varmisc \
+varmod-subst-regex \
+varname-dot-make-cmdcache \
+varname-dot-make-dependfile \
+varname-dot-make-dircache \
+varname-dot-make-history \
+varname-dot-make-oodate-mode \
+varname-dot-make-parallel-shell-assign \
+varname-dot-make-scheduler \
+varname-dot-make-snapshot \
+varname-dot-make-statcache \
 archive-suffix \
 compat-error \
 meta-cmd-cmp \
@@ -44,6 +54,7 @@ cond-token-string \
 cond-token-var \
 cond-undef-lint \
 cond-func-make-main \
+job-direct-exec \
 job-flags \
 job-output-long-lines \
 jobs-empty-commands \
@@ -68,6 +79,7 @@ opt-debug-hash \
 opt-debug-lint \
 opt-debug-loud \
 opt-debug-parse \
+parse-mapped \
 opt-debug-var \
 opt-define \
 opt-env \
@@ -102,6 +114,7 @@ dep-none \
 dep-op-missing \
 dep-percent \
 depsrc \
+depsrc-batch \
 depsrc-end \
 depsrc-exec \
 depsrc-ignore \
@@ -117,6 +130,7 @@ depsrc-use \
 depsrc-usebefore \
 depsrc-usebefore-double-colon \
 depsrc-wait \
+depsrc-wait-critpath \
 deptgt \
 deptgt-begin \
 deptgt-begin-fail \
@@ -134,12 +148,15 @@ deptgt-main \
 deptgt-makeflags \
 deptgt-notparallel \
 deptgt-order \
+deptgt-order-critpath \
 deptgt-path-suffix \
 deptgt-phony \
 deptgt-posix \
 deptgt-silent \
 deptgt-silent-jobs \
 deptgt-suffixes \
+suff-lookup-memo \
+suff-lookup-overlap \
 dep-var \
 dep-wildcards \
 opt-debug-jobs
@@ -172,7 +189,10 @@ CHANGE.opt-debug-graph3= \
 ${CHANGE.opt-debug-graph2}
 
 CHANGE.opt-debug-hash= \
-numEntries=[1-9][0-9]*;numEntries=<entries>
+numEntries=[1-9][0-9]*;numEntries=<entries> \
+'size=[0-9]* numEntries=<entries>;size=<size> numEntries=<entries>' \
+'deleted=[0-9]*;deleted=<n>' \
+'probe=[0-9.]*;probe=<n>'
 
 CHANGE.opt-no-action-runflags= \
 'echo hide-from-output.*\n;' \
@@ -196,13 +216,18 @@ ${TEST_MAKE:S,\\,/,g};bmake
 CHANGE.deptgt-suffixes= \
 '(.|\n)*  \.\.\n\n';
 
+CHANGE.job-direct-exec= \
+'${.SHELL:S,\\,\\\\,g};<shell>'
+
 CHANGE.opt-debug-jobs= \
 \([0-9]*\);(<pid>) \
 'pid [0-9]*;pid <pid>' \
 'Process [0-9]*;Process <pid>' \
 'JobFinish: [0-9]*;JobFinish: <pid>' \
 '${.SHELL:S,\\,\\\\,g};<shell>' \
-'handle [0-9A-F]*;handle <handle>'
+'handle [0-9A-F]*;handle <handle>' \
+'woke us up [0-9]* times;woke us up <n> times' \
+'for jobs [0-9]* times;for jobs <n> times'
 
 # Enviroment variables for tests
 ENV.opt-env= \
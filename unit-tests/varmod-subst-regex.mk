@@ -0,0 +1,12 @@
+# Tests for the :C variable modifier, which replaces the words that match a
+# regular expression.
+
+all: .PHONY bounded
+
+# A bounded repetition inside a group that is repeated itself, such as the
+# (a{2}b)+ below, used to match words that lack some of its parts, like
+# 'aac' without the 'b'.  Only the words in brackets match.
+bounded: .PHONY
+	@echo ${:Uaac aabc aabaabc xaacx ac:C/((a{2}b)+c)+/[&]/}
+	@echo ${:Uc ac 1b1bac cac:C/(((1b){2}|c)*ac)+/[&]/}
+	@echo ${:U1b ab yxzxab:C/(((.x){2})*ab)+/[&]/}
@@ -0,0 +1,42 @@
+# Tests for the special .MAKE.CMDCACHE variable, which keeps the output of
+# the commands from '!=' and ':sh' for later runs, and for
+# .MAKE.CMDCACHE.DEPS, which lists the files that the output depends on.
+
+FILE:=		${.PARSEFILE:R}.tmp
+DEP:=		${.PARSEFILE:R}.dep
+LOG:=		${.PARSEFILE:R}.log
+SUBMAKE=	${MAKE} -r -f ${MAKEFILE} show
+
+# The modification time has a resolution of one second.
+WAIT=	ping -n 3 127.0.0.1 > nul
+
+.MAIN: all
+
+.if make(all)
+all:
+	@echo one> ${DEP}
+# The first time, the command runs.
+	@${SUBMAKE}
+# The second time, its output comes from the cache.
+	@${SUBMAKE}
+# The dependency changed, so the command runs again.
+	@${WAIT}
+	@echo two> ${DEP}
+	@${SUBMAKE}
+	@type ${LOG}
+
+.END:
+	@del ${FILE} ${DEP} ${LOG}
+.endif
+
+.if make(show)
+.MAKE.CMDCACHE=		${FILE}
+.MAKE.CMDCACHE.DEPS=	${DEP}
+OUT!=	echo ran>> ${LOG} & type ${DEP}
+# Without a cache file, the command always runs.
+.MAKE.CMDCACHE=
+UNCACHED!=	echo uncached
+.endif
+
+show: .PHONY
+	@echo ${OUT} ${UNCACHED}
@@ -0,0 +1,37 @@
+# Tests for the file named by .MAKE.DEPENDFILE, which make reads after the
+# makefiles.  The lines of a generated dependency file mostly consist of
+# plain file names, and these are linked directly, see
+# ParseDependencyLinePlain in parse.c.  All other lines are parsed like in
+# any other makefile, and the -dp debug output shows which are which.
+#
+# The sources in the dependency file do not exist, so make ignores them
+# and tells where they came from.
+
+DEPFILE:=	${.PARSEFILE:R}.inc
+LOG:=		${.PARSEFILE:R}.tmp
+
+.MAIN: all
+
+.if make(all)
+all:
+	@${MAKE} -r -f ${MAKEFILE} .MAKE.DEPENDFILE=${DEPFILE} \
+	    -dp -dF${LOG} show
+	@findstr /b /c:"ParseDependencyLinePlain(" ${LOG}
+
+.END:
+	@del ${LOG}
+.endif
+
+EXPR_SRC=	expr.c
+
+show: .PHONY plain.o plain2.o expr.o brace1.o brace2.o double.o force.o \
+	obj\file.o quiet1.o quiet2.o
+
+# The commands are here, the sources come from the dependency file.
+plain.o plain2.o expr.o brace1.o brace2.o obj\file.o:
+	@echo ${.TARGET}: ${.ALLSRC}
+force.o!
+	@echo ${.TARGET}! ${.ALLSRC}
+# Both are silent, from a special target and a special source.
+quiet1.o quiet2.o:
+	echo ${.TARGET}: ${.ALLSRC}
@@ -0,0 +1,58 @@
+# Tests for the special .MAKE.DIRCACHE variable, which names a file that
+# keeps the contents of the cached directories across runs.  A directory
+# is only read again when its modification time has changed.
+
+DIR:=		${.PARSEFILE:R}.tmp
+SUBMAKE=	${MAKE} -r -f ${MAKEFILE} .MAKE.DIRCACHE=${DIR}\dircache \
+		-dd -dF${DIR}\debug.log
+
+.MAIN: all
+
+.if make(all)
+_!=	md ${DIR}\src & echo > ${DIR}\src\a.c
+# Two directories with different files, but most likely the same time.
+_!=	md ${DIR}\one ${DIR}\two & echo > ${DIR}\one\x.c & echo > ${DIR}\two\y.c
+
+# The directory modification time has a resolution of one second, and
+# directories that were modified in the same second as they were read
+# are not cached.
+WAIT=	ping -n 3 127.0.0.1 > nul
+
+all:
+	@${WAIT}
+# The cache file does not exist yet, so the directory is read.
+	@${SUBMAKE} found-a
+	@findstr /b Caching ${DIR}\debug.log | findstr src
+# This time, the directory is taken from the cache file.
+	@${SUBMAKE} found-a
+	@findstr /b Caching ${DIR}\debug.log | findstr src
+# Adding a file modifies the directory, so it is read again.
+	@echo > ${DIR}\src\b.c
+	@${SUBMAKE} found-b
+	@findstr /b Caching ${DIR}\debug.log | findstr src
+# Sub-makes in different directories share the cache file.  To each of
+# them, "." is a different directory, so it must not be taken from the
+# cache file for the other one, even if it has the same time.
+	@${SHARED:S,@,one,} found-x
+	@findstr /b /c:"Caching . ..." ${DIR}\debug.log
+	@${SHARED:S,@,two,} found-y
+	@findstr /b /c:"Caching . ..." ${DIR}\debug.log
+
+.END:
+	@rmdir /s /q ${DIR}
+.endif
+
+SHARED=		${MAKE} -r -f ${.CURDIR}\${.PARSEFILE} -C ${DIR}\@ \
+		.MAKE.DIRCACHE=${.CURDIR}\${DIR}\shared \
+		-dd -dF${.CURDIR}\${DIR}\debug.log
+
+.PATH: ${DIR}\src
+
+found-a: a.c
+	@echo ${.ALLSRC}
+found-b: b.c
+	@echo ${.ALLSRC}
+found-x: x.c
+	@echo ${.ALLSRC}
+found-y: y.c
+	@echo ${.ALLSRC}
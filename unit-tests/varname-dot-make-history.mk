@@ -0,0 +1,31 @@
+# Tests for the special .MAKE.HISTORY variable, which names a file that
+# keeps how long the job of each target took, and for .MAKE.PROGRESS, which
+# reports how many jobs are done and when the remaining ones will be done.
+
+FILE:=		${.PARSEFILE:R}.tmp
+SUBMAKE=	${MAKE} -r -f ${MAKEFILE} -j1 .MAKE.HISTORY=${FILE} \
+		-dj -dF${FILE}.log
+
+.MAIN: all
+
+.if make(all)
+all:
+# The history file does not exist yet, so it is created.
+	@${SUBMAKE} jobs
+	@findstr /b /c:"Job history" ${FILE}.log
+# This time, both jobs are known.  They take less than a second, so the
+# estimate is 0.
+	@${SUBMAKE} .MAKE.PROGRESS=yes jobs
+	@findstr /b /c:"Job history" ${FILE}.log
+# A file that is not a job history, such as a makefile, is left alone.
+	@echo not a history> ${FILE}.txt
+	@${MAKE} -r -f ${MAKEFILE} -j1 .MAKE.HISTORY=${FILE}.txt jobs
+	@type ${FILE}.txt
+
+.END:
+	@del ${FILE} ${FILE}.log ${FILE}.txt
+.endif
+
+jobs: .PHONY job1 job2
+job1 job2: .PHONY
+	@echo ${.TARGET}
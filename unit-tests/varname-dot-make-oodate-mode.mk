@@ -0,0 +1,35 @@
+# Tests for the special .MAKE.OODATE_MODE variable.  With "hash", a target
+# is only out of date if the content of a source has changed, not just its
+# modification time.
+
+SRC:=		${.PARSEFILE:R}.src
+OBJ:=		${.PARSEFILE:R}.obj
+DB:=		${.PARSEFILE:R}.tmp
+SUBMAKE=	${MAKE} -r -f ${MAKEFILE} .MAKE.OODATE_MODE=hash \
+		.MAKE.OODATE_DB=${DB}
+
+# The modification time has a resolution of one second.
+WAIT=	ping -n 3 127.0.0.1 > nul
+
+.MAIN: all
+
+.if make(all)
+all:
+	@echo one> ${SRC}
+	@${SUBMAKE} ${OBJ}
+# Only the modification time of the source changes.
+	@${WAIT}
+	@copy /b ${SRC} +,, > nul
+	@${SUBMAKE} ${OBJ}
+# Now the content changes as well.
+	@${WAIT}
+	@echo two> ${SRC}
+	@${SUBMAKE} ${OBJ}
+
+.END:
+	@del ${SRC} ${OBJ} ${DB}
+.endif
+
+${OBJ}: ${SRC}
+	@echo make ${.TARGET}
+	@copy /y ${.ALLSRC} ${.TARGET} > nul
@@ -0,0 +1,31 @@
+# Tests for the special .MAKE.PARALLEL_SHELL_ASSIGN variable, which runs the
+# commands of consecutive '!=' assignments at the same time.
+
+.MAKE.PARALLEL_SHELL_ASSIGN=	yes
+
+# The commands run at the same time, the assignments are done in order.
+ONE!=		echo one
+TWO!=		echo two
+# This command refers to a variable from the same run, so it waits for the
+# commands above.
+BOTH!=		echo ${ONE} ${TWO}
+# Assigning the same variable again also waits.
+ONE!=		echo ${ONE} again
+.if ${ONE} != "one again" || ${BOTH} != "one two"
+.  error
+.endif
+
+# The next line ends the run, so the condition sees the new value.
+LATE!=		echo late
+.if ${LATE} != "late"
+.  error
+.endif
+
+# Errors are reported at the line of the assignment.
+FAIL!=		exit 1
+OK!=		echo ok
+
+.MAKE.PARALLEL_SHELL_ASSIGN=	no
+
+all:
+	@echo ${ONE} ${TWO} ${BOTH} ${LATE} ${FAIL}${OK}
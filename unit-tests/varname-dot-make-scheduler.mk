@@ -0,0 +1,17 @@
+# Tests for the special .MAKE.SCHEDULER variable, which selects the order in
+# which the targets are made in jobs mode.
+
+all: .PHONY
+	@${MAKE} -r -f ${MAKEFILE} -j1 .MAKE.SCHEDULER=fifo chain
+	@${MAKE} -r -f ${MAKEFILE} -j1 .MAKE.SCHEDULER=critpath chain
+
+# By default, the children of a target are made from left to right, so
+# 'short' comes first.  The critpath scheduler starts with the longest
+# chain of dependencies instead, and then takes 'short' before 'long3'
+# since both have the same critical path and 'short' was ready earlier.
+chain: .PHONY short long3
+long3: long2
+long2: long1
+
+short long1 long2 long3: .PHONY
+	@echo ${.TARGET}
@@ -0,0 +1,45 @@
+# Tests for the special .MAKE.SNAPSHOT variable, which keeps the state after
+# reading the makefiles for later runs, and for .MAKE.SNAPSHOT.DEPS, which
+# lists further files that the state depends on.
+
+FILE:=		${.PARSEFILE:R}.tmp
+DEP:=		${.PARSEFILE:R}.dep
+LOG:=		${.PARSEFILE:R}.log
+SUBMAKE=	${MAKE} -r -f ${MAKEFILE} .MAKE.SNAPSHOT=${FILE} \
+		    .MAKE.SNAPSHOT.DEPS=${DEP} show
+
+# The modification time has a resolution of one second, and files that
+# were modified in the same second as the run started are not trusted.
+WAIT=	ping -n 3 127.0.0.1 > nul
+
+.MAIN: all
+
+.if make(all)
+all:
+	@echo one> ${DEP}
+	@${WAIT}
+# The first time, the makefile is read.
+	@${SUBMAKE}
+# The second time, the state comes from the snapshot, except for the
+# variables that are different in each run.
+	@${SUBMAKE}
+# The dependency changed, so the makefile is read again.
+	@echo two> ${DEP}
+	@${WAIT}
+	@${SUBMAKE}
+	@type ${LOG}
+
+.END:
+	@del ${FILE} ${DEP} ${LOG}
+.endif
+
+.if make(show)
+OUT!=	echo read>> ${LOG} & type ${DEP}
+show: dep
+dep: .PHONY
+	@echo ${OUT}
+.endif
+
+show: .PHONY
+	@echo ${.ALLSRC}
+	@echo ppid ${.MAKE.PPID}
@@ -0,0 +1,42 @@
+# Tests for the special .MAKE.STATCACHE variable, which lets the sub-makes
+# take the modification times of the files from their parent make instead
+# of calling stat again.
+
+# In the top-level make, this creates the stat cache file.  The sub-make
+# gets the name of the file via MAKEFLAGS instead.
+.MAKE.STATCACHE=	yes
+
+DIR:=		${.PARSEFILE:R}.tmp
+# The debug logs must not be in ${DIR}, since creating them would modify
+# the directory and thereby invalidate the cached entries for its files.
+LOG=		${.PARSEFILE:R}-${.TARGET}.log
+
+.MAIN: all
+
+.if make(all)
+_!=	md ${DIR} & echo > ${DIR}\file.c
+.endif
+
+all: first rewrite second
+
+# Since these targets start a sub-make, the parent writes the stat cache
+# right before, including the time of file.c.
+first second: .PHONY ${DIR}\file.c
+	@${MAKE} -r -f ${MAKEFILE} -dd -dF${LOG} sub
+	@findstr /c:"Using stat cache" ${LOG} | find /c /v ""
+
+# Rewriting the file in place does not change the time of its directory.
+# Since this command is not a sub-make, the second sub-make no longer
+# trusts the entry from the stat cache and looks at file.c again.
+rewrite: .PHONY first
+	@echo rewritten> ${DIR}\file.c
+second: rewrite
+
+sub: .PHONY ${DIR}\file.c
+	@echo ${.TARGET}
+
+.if make(all)
+.END:
+	@rmdir /s /q ${DIR}
+	@del ${.PARSEFILE:R}-first.log ${.PARSEFILE:R}-second.log
+.endif
@@ -21,6 +21,7 @@ unsetenv(const char *name)
 	envstring[len] = '=';
 	envstring[len + 1] = '\0';
 
+	Var_EnvironmentChanged();
 	return _putenv(envstring);
 }
 
@@ -42,6 +43,7 @@ setenv(const char *name, const char *value, int rewrite)
 		memcpy(envstring + len1 + 1, value, len2 + 1);
 	}
 
+	Var_EnvironmentChanged();
 	return _putenv(envstring);
 }
 
@@ -103,9 +103,9 @@
  *
  *	Var_Delete	Delete a variable.
  *
- *	Var_ReexportVars
- *			Export some or even all variables to the environment
- *			of this process and its child processes.
+ *	Var_Environment
+ *			Return the environment for a child process, with
+ *			some or even all variables exported to it.
  *
  *	Var_Export	Export the variable to the environment of this process
  *			and its child processes.
@@ -331,6 +331,25 @@ GNode *SCOPE_INTERNAL;
 
 static VarExportedMode var_exportedVars = VAR_EXPORTED_NONE;
 
+/*
+ * The environment of the child processes, see Var_Environment.
+ *
+ * envBlock is built from the environment of make, MAKELEVEL and the
+ * exported variables, and only built again after a variable in one of the
+ * global scopes or the environment of make changed.
+ *
+ * An exported variable may have a different value for a target if it is
+ * set in the scope of the target or if its value is an expression; the
+ * environment of such a child differs from envBlock in a few entries.
+ */
+static Buffer envBlock;
+static Buffer jobEnvBlock;
+static bool envStale = true;
+/* The exported variables, with their value in envBlock or NULL. */
+static HashTable envExported;
+/* The names of the exported variables whose value is an expression. */
+static Vector envDynamic;
+
 static const char VarEvalMode_Name[][32] = {
 	"parse",
 	"parse-balanced",
@@ -387,7 +406,7 @@ VarNew(FStr name, const char *value,
 	   bool shortLived, bool fromEnvironment, bool readOnly)
 {
 	size_t value_len = strlen(value);
-	Var *var = bmake_malloc(sizeof *var);
+	Var *var = Arena_Alloc(&parseArena, sizeof *var);
 	var->name = name;
 	Buf_InitSize(&var->val, value_len + 1);
 	Buf_AddBytes(&var->val, value, value_len);
@@ -438,6 +457,13 @@ GNode_FindVar(GNode *scope, Substring varname, unsigned int hash)
 	return HashTable_FindValueBySubstringHash(&scope->vars, varname, hash);
 }
 
+/*
+ * While not NULL, the variables whose lookup is noted in watchedVarUsed,
+ * see Var_Watch.
+ */
+static HashTable *watchedVars = NULL;
+static bool watchedVarUsed = false;
+
 /*
  * Find the variable in the scope, and maybe in other scopes as well.
  *
@@ -461,6 +487,10 @@ VarFindSubstring(Substring name, GNode *scope, bool elsewhere)
 	name = CanonicalVarname(name);
 	nameHash = Hash_Substring(name);
 
+	if (watchedVars != NULL && HashTable_FindValueBySubstringHash(
+	    watchedVars, name, nameHash) != NULL)
+		watchedVarUsed = true;
+
 	var = GNode_FindVar(scope, name, nameHash);
 	if (!elsewhere)
 		return var;
@@ -512,7 +542,7 @@ VarFreeShortLived(Var *v)
 
 	FStr_Done(&v->name);
 	Buf_Done(&v->val);
-	free(v);
+	Arena_Free(&parseArena, v, sizeof *v);
 }
 
 static const char *
@@ -525,6 +555,18 @@ ValueDescription(const char *value)
 	return "";
 }
 
+/*
+ * The exported variables may depend on the variables of the global
+ * scopes, so the environment of the child processes must be built again.
+ */
+static void
+EnvChanged(GNode *scope)
+{
+	if (scope == SCOPE_GLOBAL || scope == SCOPE_CMDLINE ||
+	    scope == SCOPE_INTERNAL)
+		envStale = true;
+}
+
 /* Add a new variable of the given name and value to the given scope. */
 static Var *
 VarAddS(const char *name, const char *value, GNode *scope, VarSetFlags flags)
@@ -535,6 +577,7 @@ VarAddS(const char *name, const char *value, GNode *scope, VarSetFlags flags)
 	HashEntry_Set(he, v);
 	DEBUG4(VAR, "%s: %s = %s%s\n",
 		scope->name, name, value, ValueDescription(value));
+	EnvChanged(scope);
 	return v;
 }
 
@@ -574,6 +617,7 @@ Var_Delete(GNode *scope, const char *varname)
 	}
 
 	DEBUG2(VAR, "%s: delete %s\n", scope->name, varname);
+	EnvChanged(scope);
 	if (v->exported)
 		unsetenv(v->name.str);
 	if (strcmp(v->name.str, ".MAKE.EXPORTED") == 0)
@@ -582,7 +626,7 @@ Var_Delete(GNode *scope, const char *varname)
 	assert(v->name.freeIt == NULL);
 	HashTable_DeleteEntry(&scope->vars, he);
 	Buf_Done(&v->val);
-	free(v);
+	Arena_Free(&parseArena, v, sizeof *v);
 }
 
 #ifdef CLEANUP
@@ -594,7 +638,7 @@ Var_DeleteAll(GNode *scope)
 	while (HashIter_Next(&hi)) {
 		Var *v = hi.entry->value;
 		Buf_Done(&v->val);
-		free(v);
+		Arena_Free(&parseArena, v, sizeof *v);
 	}
 }
 #endif
@@ -684,12 +728,6 @@ ExportVarEnv(Var *v, GNode *scope)
 	/* XXX: name is injected without escaping it */
 	expr = str_concat3("${", name, "}");
 	val = Var_Subst(expr, scope, VARE_EVAL);
-	if (scope != SCOPE_GLOBAL) {
-		/* we will need to re-export the global version */
-		v = VarFind(name, SCOPE_GLOBAL, false);
-		if (v != NULL)
-			v->exported = false;
-	}
 	/* TODO: handle errors */
 	setenv(name, val, 1);
 	free(val);
@@ -758,13 +796,167 @@ ExportVar(const char *name, GNode *scope, VarExportMode mode)
 }
 
 /*
- * Actually export the variables that have been marked as needing to be
- * re-exported.
+ * Return the value of the exported variable in the environment of a child
+ * that is started for the scope, or NULL if the environment of make has
+ * it already.
  */
-void
-Var_ReexportVars(GNode *scope)
+static char *
+ExportedValue(Var *v, GNode *scope)
+{
+	char *expr, *val;
+
+	if (v->exported && !v->reexport)
+		return NULL;
+	if (strchr(v->val.data, '$') == NULL)
+		return bmake_strdup(v->val.data);
+	if (v->inUse)
+		return NULL;	/* see EMPTY_SHELL in directive-export.mk */
+
+	/* XXX: name is injected without escaping it */
+	expr = str_concat3("${", v->name.str, "}");
+	val = Var_Subst(expr, scope, VARE_EVAL);
+	/* TODO: handle errors */
+	free(expr);
+	return val;
+}
+
+static void
+EnvOverride(Vector *overrides, const char *name, const char *value)
+{
+	*(char **)Vector_Push(overrides) = str_concat3(name, "=", value);
+}
+
+/* The length of the name of an entry of an environment block. */
+static size_t
+EnvNameLen(const char *entry)
+{
+	/* The names of the hidden per-drive entries start with '='. */
+	const char *eq = strchr(entry + 1, '=');
+
+	return eq != NULL ? (size_t)(eq - entry) : strlen(entry);
+}
+
+static bool
+EnvNameEq(const char *a, size_t alen, const char *b, size_t blen)
 {
-	char *xvarnames;
+	size_t i;
+
+	if (alen != blen)
+		return false;
+	for (i = 0; i < alen; i++)
+		if (ch_toupper(a[i]) != ch_toupper(b[i]))
+			return false;
+	return true;
+}
+
+typedef struct EnvEntry {
+	const char *str;
+	bool override;
+} EnvEntry;
+
+/*
+ * Windows wants the entries sorted by their uppercase names.  Among
+ * entries of the same name, the overriding one comes first.
+ */
+static int
+EnvEntryCmp(const void *pa, const void *pb)
+{
+	const EnvEntry *a = pa, *b = pb;
+	size_t alen = EnvNameLen(a->str), blen = EnvNameLen(b->str);
+	size_t i;
+
+	for (i = 0; i < alen && i < blen; i++) {
+		char ca = ch_toupper(a->str[i]), cb = ch_toupper(b->str[i]);
+		if (ca != cb)
+			return (unsigned char)ca < (unsigned char)cb ? -1 : 1;
+	}
+	if (alen != blen)
+		return alen < blen ? -1 : 1;
+	return (int)b->override - (int)a->override;
+}
+
+/*
+ * Write the entries of the environment block 'env', replaced or extended
+ * by the "name=value" strings in 'overrides', to the buffer.
+ */
+static void
+EnvWrite(Buffer *buf, const char *env, Vector *overrides)
+{
+	Vector entries;
+	const char *p, *prev = NULL;
+	size_t i, prevLen = 0;
+
+	Vector_Init(&entries, sizeof(EnvEntry));
+	for (p = env; p != NULL && *p != '\0'; p += strlen(p) + 1) {
+		EnvEntry *e = Vector_Push(&entries);
+		e->str = p;
+		e->override = false;
+	}
+	for (i = 0; i < overrides->len; i++) {
+		EnvEntry *e = Vector_Push(&entries);
+		e->str = ((char **)overrides->items)[i];
+		e->override = true;
+	}
+	if (entries.len > 0)
+		qsort(entries.items, entries.len, sizeof(EnvEntry),
+		    EnvEntryCmp);
+
+	Buf_Clear(buf);
+	for (i = 0; i < entries.len; i++) {
+		const char *str = ((EnvEntry *)entries.items)[i].str;
+		size_t len = EnvNameLen(str);
+
+		if (prev != NULL && EnvNameEq(prev, prevLen, str, len))
+			continue;
+		Buf_AddBytes(buf, str, strlen(str) + 1);
+		prev = str;
+		prevLen = len;
+	}
+	if (entries.len == 0)
+		Buf_AddByte(buf, '\0');
+	Buf_AddByte(buf, '\0');
+	Vector_Done(&entries);
+}
+
+static void
+EnvOverridesDone(Vector *overrides)
+{
+	size_t i;
+
+	for (i = 0; i < overrides->len; i++)
+		free(((char **)overrides->items)[i]);
+	Vector_Done(overrides);
+}
+
+static void
+EnvExportVar(Vector *overrides, const char *name, Var *v)
+{
+	HashEntry *he = HashTable_CreateEntry(&envExported, name, NULL);
+	char *val = v != NULL ? ExportedValue(v, SCOPE_GLOBAL) : NULL;
+
+	HashEntry_Set(he, val);
+	if (val != NULL)
+		EnvOverride(overrides, name, val);
+	if (v != NULL && strchr(v->val.data, '$') != NULL)
+		*(const char **)Vector_Push(&envDynamic) = he->key;
+}
+
+static void
+EnvBuild(void)
+{
+	Vector overrides;
+	HashIter hi;
+	char level_buf[21];
+	char *env;
+
+	HashIter_Init(&hi, &envExported);
+	while (HashIter_Next(&hi))
+		free(hi.entry->value);
+	HashTable_Done(&envExported);
+	HashTable_Init(&envExported);
+	Vector_Done(&envDynamic);
+	Vector_Init(&envDynamic, sizeof(const char *));
+	Vector_Init(&overrides, sizeof(char *));
 
 	/*
 	 * Several make implementations support this sort of mechanism for
@@ -772,37 +964,111 @@ Var_ReexportVars(GNode *scope)
 	 * We allow the makefiles to update MAKELEVEL and ensure
 	 * children see a correctly incremented value.
 	 */
-	char level_buf[21];
 	snprintf(level_buf, sizeof level_buf, "%d", makelevel + 1);
-	setenv(MAKE_LEVEL_ENV, level_buf, 1);
-
-	if (var_exportedVars == VAR_EXPORTED_NONE)
-		return;
+	EnvOverride(&overrides, MAKE_LEVEL_ENV, level_buf);
 
 	if (var_exportedVars == VAR_EXPORTED_ALL) {
-		HashIter hi;
-
 		/* Ouch! Exporting all variables at once is crazy. */
 		HashIter_Init(&hi, &SCOPE_GLOBAL->vars);
 		while (HashIter_Next(&hi)) {
 			Var *var = hi.entry->value;
-			ExportVar(var->name.str, scope, VEM_ENV);
+			if (MayExport(var->name.str))
+				EnvExportVar(&overrides, var->name.str, var);
 		}
-		return;
-	}
-
-	xvarnames = Var_Subst("${.MAKE.EXPORTED:O:u}", SCOPE_GLOBAL,
-		VARE_EVAL);
-	/* TODO: handle errors */
-	if (xvarnames[0] != '\0') {
+	} else if (var_exportedVars == VAR_EXPORTED_SOME) {
+		char *xvarnames = Var_Subst("${.MAKE.EXPORTED:O:u}",
+			SCOPE_GLOBAL, VARE_EVAL);
+		/* TODO: handle errors */
 		Words varnames = Str_Words(xvarnames, false);
 		size_t i;
 
-		for (i = 0; i < varnames.len; i++)
-			ExportVar(varnames.words[i], scope, VEM_ENV);
+		for (i = 0; i < varnames.len; i++) {
+			const char *name = varnames.words[i];
+			if (name[0] != '\0' && MayExport(name))
+				EnvExportVar(&overrides, name,
+				    VarFind(name, SCOPE_GLOBAL, false));
+		}
 		Words_Free(varnames);
+		free(xvarnames);
 	}
-	free(xvarnames);
+
+	env = GetEnvironmentStringsA();
+	EnvWrite(&envBlock, env, &overrides);
+	if (env != NULL)
+		FreeEnvironmentStringsA(env);
+	EnvOverridesDone(&overrides);
+}
+
+/*
+ * Add the value that the exported variable has for the scope if it
+ * differs from the one in envBlock.
+ */
+static void
+EnvDiff(Vector *overrides, const char *name, Var *v, GNode *scope)
+{
+	const char *global = HashTable_FindValue(&envExported, name);
+	char *val = ExportedValue(v, scope);
+
+	if (val != NULL && (global == NULL || strcmp(val, global) != 0))
+		EnvOverride(overrides, name, val);
+	free(val);
+}
+
+/*
+ * Return the environment block for a child process that is started for
+ * the scope, which is SCOPE_GLOBAL or a target: the environment of make,
+ * with MAKELEVEL incremented and with the exported variables.  'extra' is
+ * NULL or a further "name=value" entry for this child only.
+ *
+ * The block stays valid until the next call.
+ */
+const char *
+Var_Environment(GNode *scope, const char *extra)
+{
+	Vector overrides;
+	HashIter hi;
+	size_t i;
+
+	/* While watching, every variable that is used must be looked up. */
+	if (envStale || watchedVars != NULL) {
+		envStale = false;
+		EnvBuild();
+	}
+	if (scope == SCOPE_GLOBAL && extra == NULL)
+		return envBlock.data;
+
+	Vector_Init(&overrides, sizeof(char *));
+	if (extra != NULL)
+		*(char **)Vector_Push(&overrides) = bmake_strdup(extra);
+	if (scope != SCOPE_GLOBAL) {
+		for (i = 0; i < envDynamic.len; i++) {
+			const char *name = ((const char **)envDynamic.items)[i];
+			Var *v = VarFind(name, SCOPE_GLOBAL, false);
+			if (v != NULL)
+				EnvDiff(&overrides, name, v, scope);
+		}
+		/* A name that is dynamic as well is added twice, harmlessly. */
+		HashIter_Init(&hi, &scope->vars);
+		while (HashIter_Next(&hi))
+			if (HashTable_FindEntry(&envExported,
+			    hi.entry->key) != NULL)
+				EnvDiff(&overrides, hi.entry->key,
+				    hi.entry->value, scope);
+	}
+	if (overrides.len == 0) {
+		Vector_Done(&overrides);
+		return envBlock.data;
+	}
+	EnvWrite(&jobEnvBlock, envBlock.data, &overrides);
+	EnvOverridesDone(&overrides);
+	return jobEnvBlock.data;
+}
+
+/* The environment of make changed, see Var_Environment. */
+void
+Var_EnvironmentChanged(void)
+{
+	envStale = true;
 }
 
 static void
@@ -819,6 +1085,7 @@ ExportVars(const char *varnames, bool isExport, VarExportMode mode)
 		const char *varname = words.words[i];
 		if (!ExportVar(varname, SCOPE_GLOBAL, mode))
 			continue;
+		envStale = true;
 
 		if (var_exportedVars == VAR_EXPORTED_NONE)
 			var_exportedVars = VAR_EXPORTED_SOME;
@@ -844,6 +1111,7 @@ Var_Export(VarExportMode mode, const char *varnames)
 {
 	if (mode == VEM_ALL) {
 		var_exportedVars = VAR_EXPORTED_ALL; /* use with caution! */
+		envStale = true;
 		return;
 	} else if (mode == VEM_PLAIN && varnames[0] == '\0') {
 		Parse_Error(PARSE_WARNING, ".export requires an argument.");
@@ -933,6 +1201,7 @@ UnexportVar(Substring varname, UnexportWhat what)
 		unsetenv(v->name.str);
 	v->exported = false;
 	v->reexport = false;
+	envStale = true;
 
 	if (what == UNEXPORT_NAMED) {
 		/* Remove the variable names from .MAKE.EXPORTED. */
@@ -1049,6 +1318,7 @@ Var_SetWithFlags(GNode *scope, const char *name, const char *val,
 
 		DEBUG4(VAR, "%s: %s = %s%s\n",
 			scope->name, name, val, ValueDescription(val));
+		EnvChanged(scope);
 		if (v->exported)
 			ExportVar(name, scope, VEM_PLAIN);
 	}
@@ -1161,6 +1431,7 @@ Var_Append(GNode *scope, const char *name, const char *val)
 		Buf_AddStr(&v->val, val);
 
 		DEBUG3(VAR, "%s: %s = %s\n", scope->name, name, v->val.data);
+		EnvChanged(scope);
 
 		if (v->fromEnvironment) {
 			/* See VarAdd. */
@@ -1208,6 +1479,26 @@ Global_Append(const char *name, const char *value)
 	Var_Append(SCOPE_GLOBAL, name, value);
 }
 
+/*
+ * Until Var_Unwatch, note whether any of the variables in the table is
+ * looked up, in any scope.  The values in the table must not be NULL.
+ * This tells whether an expression depends on these variables.
+ */
+void
+Var_Watch(HashTable *vars)
+{
+	watchedVars = vars;
+	watchedVarUsed = false;
+}
+
+/* Return whether any of the watched variables was looked up. */
+bool
+Var_Unwatch(void)
+{
+	watchedVars = NULL;
+	return watchedVarUsed;
+}
+
 bool
 Var_Exists(GNode *scope, const char *name)
 {
@@ -1286,6 +1577,111 @@ Var_ReadOnly(const char *name, bool bf)
 	DEBUG2(VAR, "Var_ReadOnly: %s %s\n", name, bf ? "true" : "false");
 }
 
+/* Write the variables of the scope to the snapshot, see snapshot.c. */
+void
+Var_SaveScope(GNode *scope)
+{
+	HashIter hi;
+
+	Snapshot_PutNum(scope->vars.numEntries);
+	HashIter_Init(&hi, &scope->vars);
+	while (HashIter_Next(&hi)) {
+		const Var *v = hi.entry->value;
+
+		Snapshot_PutStr(hi.entry->key);
+		Snapshot_PutStr(v->val.data);
+		Snapshot_PutNum((unsigned)v->fromCmd |
+		    (unsigned)v->fromEnvironment << 1 |
+		    (unsigned)v->readOnly << 2 |
+		    (unsigned)v->readOnlyLoud << 3 |
+		    (unsigned)v->exported << 4 |
+		    (unsigned)v->reexport << 5);
+	}
+}
+
+/*
+ * Replace the variables of the scope with those from the snapshot.
+ * The variables that are different in each run keep their current value.
+ */
+void
+Var_RestoreScope(GNode *scope)
+{
+	static const char volatileVars[][16] = {
+		MAKEFLAGS, ".MAKE.PID", ".MAKE.PPID"
+	};
+	char *keep[sizeof volatileVars / sizeof volatileVars[0]];
+	unsigned long long n;
+	HashIter hi;
+	size_t i;
+
+	for (i = 0; i < sizeof volatileVars / sizeof volatileVars[0]; i++) {
+		const char *value = GNode_ValueDirect(scope, volatileVars[i]);
+		keep[i] = value != NULL ? bmake_strdup(value) : NULL;
+	}
+
+	HashIter_Init(&hi, &scope->vars);
+	while (HashIter_Next(&hi)) {
+		Var *v = hi.entry->value;
+		Buf_Done(&v->val);
+		Arena_Free(&parseArena, v, sizeof *v);
+	}
+	HashTable_Done(&scope->vars);
+	HashTable_Init(&scope->vars);
+
+	for (n = Snapshot_GetNum(); n > 0; n--) {
+		char *name = Snapshot_GetStr();
+		char *value = Snapshot_GetStr();
+		unsigned long long flags = Snapshot_GetNum();
+		Var *v = VarAddS(name, value, scope, VAR_SET_NONE);
+
+		v->fromCmd = (flags & 1) != 0;
+		v->fromEnvironment = (flags & 2) != 0;
+		v->readOnly = (flags & 4) != 0;
+		v->readOnlyLoud = (flags & 8) != 0;
+		v->exported = (flags & 16) != 0;
+		v->reexport = (flags & 32) != 0;
+		free(name);
+		free(value);
+	}
+
+	for (i = 0; i < sizeof volatileVars / sizeof volatileVars[0]; i++) {
+		Var *v;
+
+		if (keep[i] == NULL)
+			continue;
+		v = VarFind(volatileVars[i], scope, false);
+		if (v == NULL)
+			v = VarAddS(volatileVars[i], "", scope, VAR_SET_NONE);
+		Buf_Clear(&v->val);
+		Buf_AddStr(&v->val, keep[i]);
+		free(keep[i]);
+	}
+}
+
+/*
+ * Write the global scopes to the snapshot, together with the settings
+ * that are made by assigning to special variables.
+ */
+void
+Var_SaveSnapshot(void)
+{
+	Var_SaveScope(SCOPE_INTERNAL);
+	Var_SaveScope(SCOPE_GLOBAL);
+	Var_SaveScope(SCOPE_CMDLINE);
+	Snapshot_PutNum(var_exportedVars);
+	Snapshot_PutNum(save_dollars);
+}
+
+void
+Var_RestoreSnapshot(void)
+{
+	Var_RestoreScope(SCOPE_INTERNAL);
+	Var_RestoreScope(SCOPE_GLOBAL);
+	Var_RestoreScope(SCOPE_CMDLINE);
+	var_exportedVars = Snapshot_GetIndex(VAR_EXPORTED_ALL + 1);
+	save_dollars = Snapshot_GetNum() != 0;
+}
+
 /*
  * Return the unexpanded variable value from this node, without trying to look
  * up the variable in any other scope.
@@ -1603,8 +1999,96 @@ RegexReplace(Substring replace, SepBuf *buf, const char *wp,
 	}
 }
 
-struct ModifyWord_SubstRegexArgs {
+/*
+ * The compiled patterns of the ':C' modifier.  In a .for loop or in a
+ * variable that is expanded for each target, the same pattern would
+ * otherwise be compiled again and again.  The cache is bounded, and when it
+ * is full, the pattern that was used least recently is freed.
+ */
+#define REGEX_CACHE_SIZE 64
+
+typedef struct CachedRegex {
 	regex_t re;
+	HashEntry *he;		/* in regexCache */
+	ListNode *ln;		/* in regexLRU */
+} CachedRegex;
+
+static HashTable regexCache;	/* "cflags:pattern" to CachedRegex */
+static List regexLRU = LST_INIT; /* of CachedRegex, most recent first */
+static unsigned long regexHits, regexMisses;
+
+/*
+ * Return the compiled pattern, or NULL after printing the error.  The
+ * pattern stays valid until the next call.
+ */
+static const regex_t *
+RegexCache_Get(const char *pattern, int cflags)
+{
+	Buffer key;
+	CachedRegex *cre;
+	HashEntry *he;
+	bool isNew;
+	int error;
+
+	Buf_Init(&key);
+	Buf_AddInt(&key, cflags);
+	Buf_AddByte(&key, ':');
+	Buf_AddStr(&key, pattern);
+	he = HashTable_CreateEntry(&regexCache, key.data, &isNew);
+	Buf_Done(&key);
+
+	if (!isNew) {
+		cre = he->value;
+		regexHits++;
+		if (cre->ln != regexLRU.first) {
+			Lst_Remove(&regexLRU, cre->ln);
+			Lst_Prepend(&regexLRU, cre);
+			cre->ln = regexLRU.first;
+		}
+		return &cre->re;
+	}
+
+	regexMisses++;
+	cre = bmake_malloc(sizeof *cre);
+	error = tre_regcomp(&cre->re, pattern, cflags);
+	if (error != 0) {
+		RegexError(error, &cre->re, "Regex compilation error");
+		HashTable_DeleteEntry(&regexCache, he);
+		free(cre);
+		return NULL;
+	}
+	cre->he = he;
+	he->value = cre;
+	Lst_Prepend(&regexLRU, cre);
+	cre->ln = regexLRU.first;
+
+	if (regexCache.numEntries > REGEX_CACHE_SIZE) {
+		CachedRegex *old = regexLRU.last->datum;
+		Lst_Remove(&regexLRU, regexLRU.last);
+		HashTable_DeleteEntry(&regexCache, old->he);
+		tre_regfree(&old->re);
+		free(old);
+	}
+	return &cre->re;
+}
+
+#ifdef CLEANUP
+static void
+RegexCache_Done(void)
+{
+	CachedRegex *cre;
+
+	while (!Lst_IsEmpty(&regexLRU)) {
+		cre = Lst_Dequeue(&regexLRU);
+		tre_regfree(&cre->re);
+		free(cre);
+	}
+	HashTable_Done(&regexCache);
+}
+#endif
+
+struct ModifyWord_SubstRegexArgs {
+	const regex_t *re;
 	size_t nsub;
 	Substring replace;
 	PatternFlags pflags;
@@ -1626,11 +2110,11 @@ ModifyWord_SubstRegex(Substring word, SepBuf *buf, void *data)
 		goto no_match;
 
 again:
-	xrv = tre_regexec(&args->re, wp, args->nsub, m, flags);
+	xrv = tre_regexec(args->re, wp, args->nsub, m, flags);
 	if (xrv == 0)
 		goto ok;
 	if (xrv != REG_NOMATCH)
-		RegexError(xrv, &args->re, "Unexpected regex error");
+		RegexError(xrv, args->re, "Unexpected regex error");
 no_match:
 	SepBuf_AddRange(buf, wp, word.end);
 	return;
@@ -2799,7 +3283,7 @@ ParseModifier_Match(const char **pp, const ModChain *ch)
 }
 
 struct ModifyWord_MatchArgs {
-	const char *pattern;
+	StrPattern pattern;
 	bool neg;
 	bool error_reported;
 };
@@ -2810,12 +3294,12 @@ ModifyWord_Match(Substring word, SepBuf *buf, void *data)
 	struct ModifyWord_MatchArgs *args = data;
 	StrMatchResult res;
 	assert(word.end[0] == '\0');	/* assume null-terminated word */
-	res = Str_Match(word.start, args->pattern);
+	res = StrPattern_Match(&args->pattern, word.start);
 	if (res.error != NULL && !args->error_reported) {
 		args->error_reported = true;
 		Parse_Error(PARSE_WARNING,
 			"%s in pattern '%s' of modifier '%s'",
-			res.error, args->pattern, args->neg ? ":N" : ":M");
+			res.error, args->pattern.pat, args->neg ? ":N" : ":M");
 	}
 	if (res.matched != args->neg)
 		SepBuf_AddSubstring(buf, word);
@@ -2832,10 +3316,11 @@ ApplyModifier_Match(const char **pp, ModChain *ch)
 
 	if (ModChain_ShouldEval(ch)) {
 		struct ModifyWord_MatchArgs args;
-		args.pattern = pattern;
+		StrPattern_Init(&args.pattern, pattern);
 		args.neg = mod == 'N';
 		args.error_reported = false;
 		ModifyWords(ch, ModifyWord_Match, &args, ch->oneBigWord);
+		StrPattern_Done(&args.pattern);
 	}
 
 	free(pattern);
@@ -2990,7 +3475,6 @@ ApplyModifier_Regex(const char **pp, ModChain *ch)
 {
 	struct ModifyWord_SubstRegexArgs args;
 	bool oneBigWord;
-	int error;
 	LazyBuf reBuf, replaceBuf;
 	FStr re;
 
@@ -3023,21 +3507,19 @@ ApplyModifier_Regex(const char **pp, ModChain *ch)
 	if (!ModChain_ShouldEval(ch))
 		goto done;
 
-	error = tre_regcomp(&args.re, re.str, REG_EXTENDED);
-	if (error != 0) {
-		RegexError(error, &args.re, "Regex compilation error");
+	args.re = RegexCache_Get(re.str, REG_EXTENDED);
+	if (args.re == NULL) {
 		LazyBuf_Done(&replaceBuf);
 		FStr_Done(&re);
 		return AMR_CLEANUP;
 	}
 
-	args.nsub = args.re.re_nsub + 1;
+	args.nsub = args.re->re_nsub + 1;
 	if (args.nsub > 10)
 		args.nsub = 10;
 
 	ModifyWords(ch, ModifyWord_SubstRegex, &args, oneBigWord);
 
-	tre_regfree(&args.re);
 done:
 	LazyBuf_Done(&replaceBuf);
 	FStr_Done(&re);
@@ -4809,6 +5291,13 @@ Var_Init(void)
 	SCOPE_INTERNAL = GNode_New("Internal");
 	SCOPE_GLOBAL = GNode_New("Global");
 	SCOPE_CMDLINE = GNode_New("Command");
+	Buf_Init(&envBlock);
+	Buf_Init(&jobEnvBlock);
+	HashTable_Init(&envExported);
+	Vector_Init(&envDynamic, sizeof(const char *));
+#ifdef HAVE_REGEX_H
+	HashTable_Init(&regexCache);
+#endif
 }
 
 /* Clean up the variables module. */
@@ -4816,12 +5305,19 @@ void
 Var_End(void)
 {
 	Var_Stats();
+#if defined(HAVE_REGEX_H) && defined(CLEANUP)
+	RegexCache_Done();
+#endif
 }
 
 void
 Var_Stats(void)
 {
 	HashTable_DebugStats(&SCOPE_GLOBAL->vars, "Global variables");
+#ifdef HAVE_REGEX_H
+	DEBUG3(HASH, "Regex cache: %u patterns, %lu hits, %lu misses\n",
+	    regexCache.numEntries, regexHits, regexMisses);
+#endif
 }
 
 static int
@@ -4848,7 +5344,8 @@ Var_Dump(GNode *scope)
 		*(const char **)Vector_Push(&vec) = hi.entry->key;
 	varnames = vec.items;
 
-	qsort(varnames, vec.len, sizeof varnames[0], StrAsc);
+	if (vec.len > 0)
+		qsort(varnames, vec.len, sizeof varnames[0], StrAsc);
 
 	for (i = 0; i < vec.len; i++) {
 		const char *varname = varnames[i];